@@ -0,0 +1,68 @@
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: aot-compile.cpp
+//
+// Compiles the program of a state file into a C++ translation unit (see
+// aot.h), to be linked against the emulator library and run with
+// Emulator::run_compiled().
+//
+// Usage: aot-compile <state> <output> [name]
+//
+// Text and binary state files are both accepted. Without a name, the name of
+// the state file is used, with anything that can't go in a C identifier
+// replaced by '_'.
+// -----------------------------------------------------------------------------
+
+#include "binary_state.h"
+#include "emulator.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+std::string default_name(const std::string& filename) {
+  std::string name = std::filesystem::path(filename).stem().string();
+  for (char& c : name)
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+      c = '_';
+  if (name.empty() || (name.front() >= '0' && name.front() <= '9'))
+    name.insert(0, "_");
+  return name;
+}
+
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3 && argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " <state> <output> [name]" << std::endl;
+    return 1;
+  }
+
+  const std::string input = argv[1];
+  const std::string name = (argc == 4) ? argv[3] : default_name(input);
+  if (!valid_aot_name(name)) {
+    std::cerr << "Invalid program name " << name << std::endl;
+    return 1;
+  }
+
+  Emulator emulator;
+  if (!(is_binary_state_file(input) ? emulator.load_binary_state(input) : emulator.load_state(input))) {
+    std::cerr << "Could not load state file " << input << std::endl;
+    return 1;
+  }
+
+  std::ofstream output(argv[2]);
+  if (!output) {
+    std::cerr << "Could not create " << argv[2] << std::endl;
+    return 1;
+  }
+
+  if (!emulator.compile(output, name)) {
+    std::cerr << "Could not compile " << input << " into " << argv[2] << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+#include "aot.h"
+#include "disassembler.h"
+#include "emulator.h"
+#include <string_view>
+#include <vector>
+
+// ============= Helpers ==============
+
+int valid_aot_name(const std::string& name) {
+  if (name.empty() || (name.front() >= '0' && name.front() <= '9'))
+    return 0;
+
+  for (char c : name)
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'))
+      return 0;
+  return 1;
+}
+
+namespace {
+
+addr_t next_pc(addr_t pc) {
+  return (pc + INSTRUCTION_SIZE) & ARCH_BITMASK;
+}
+
+/**
+ * The slots reachable from `entry`, by slot index
+ */
+std::bitset<MAX_INSTRUCTIONS> reachable_slots(const std::array<byte_t, MEMORY_SIZE>& memory, addr_t entry) {
+  std::bitset<MAX_INSTRUCTIONS> reached;
+  std::vector<addr_t> pending{entry};
+
+  while (!pending.empty()) {
+    const addr_t pc = pending.back();
+    pending.pop_back();
+
+    // Odd targets are errors at run time, not slots
+    if ((pc % 2) == 1 || reached.test(pc / INSTRUCTION_SIZE))
+      continue;
+    reached.set(pc / INSTRUCTION_SIZE);
+
+    const byte_t opcode = memory.at(pc);
+    const addr_t address = memory.at(pc + 1);
+    if (opcode >= NUM_OPCODES)
+      continue;
+
+    if (opcode == JMP || opcode == JNE)
+      pending.push_back(address);
+    if (opcode != JMP)
+      pending.push_back(next_pc(pc));
+  }
+
+  return reached;
+}
+
+/**
+ * The description of the instruction from its listing line, for the comments
+ */
+std::string_view describe(char* line, addr_t pc, InstructionData data) {
+  const char* end = disassemble_line(line, pc, data);
+  const std::string_view text(line, end - line - 1);
+  const size_t tab = text.rfind('\t');
+  if (text.find(":\t", text.find('\t')) == std::string_view::npos)
+    return "invalid instruction";
+  return text.substr(tab + 1);
+}
+
+/**
+ * Continue at `target` after an instruction: stop there if it has a
+ * breakpoint, otherwise jump to its label
+ */
+void emit_continue(std::ostream& out, const std::bitset<MAX_INSTRUCTIONS>& compiled, addr_t target, const char* indent) {
+  out << indent << "if (breakpoints[" << target << "]) { state.pc = " << target << "; goto done; }\n";
+  if ((target % 2) == 1) {
+    // What run() does with an odd PC, if it has steps left
+    out << indent << "state.pc = " << target << ";\n";
+    out << indent << "status = (left <= 0) ? RUN_STOPPED : RUN_ERROR;\n";
+    out << indent << "goto done;\n";
+  } else if (compiled.test(target / INSTRUCTION_SIZE)) {
+    out << indent << "goto pc_" << target << ";\n";
+  } else {
+    out << indent << "state.pc = " << target << ";\n";
+    out << indent << "status = AOT_FALLBACK;\n";
+    out << indent << "goto done;\n";
+  }
+}
+
+/**
+ * The same as run(), with loop detection disabled like the compiled code.
+ * The journal and the trace get the observers of run_fast() instead
+ */
+struct UndetectedObserver {
+  static constexpr bool stops_at_breakpoints = true;
+  static constexpr bool detects_loops = false;
+
+  void before_step(Emulator&, byte_t, addr_t) {}
+};
+
+}
+
+// ============= Emulator ==============
+
+int Emulator::compile(std::ostream& out, const std::string& name) const {
+  if (!valid_aot_name(name) || (state.pc % 2) == 1)
+    return 0;
+
+  const std::bitset<MAX_INSTRUCTIONS> compiled = reachable_slots(state.memory, state.pc);
+
+  std::array<byte_t, MEMORY_SIZE> code_mask{};
+  std::vector<addr_t> stores;
+  for (addr_t pc = 0; pc < MEMORY_SIZE; pc += INSTRUCTION_SIZE) {
+    if (!compiled.test(pc / INSTRUCTION_SIZE))
+      continue;
+    code_mask.at(pc) = code_mask.at(pc + 1) = 0xff;
+    if (state.memory.at(pc) == STR)
+      stores.push_back(state.memory.at(pc + 1));
+  }
+
+  out << "// -----------------------------------------------------------------------------\n";
+  out << "// Generated by Emulator::compile() from the program " << name << ". Do not edit.\n";
+  out << "//\n";
+  out << "// " << compiled.count() << " instruction slots, compiled from the entry point at " << state.pc << "\n";
+  out << "// -----------------------------------------------------------------------------\n\n";
+  out << "#include \"aot.h\"\n\n";
+  out << "namespace {\n\n";
+
+  if (!stores.empty()) {
+    out << "const addr_t STORES[] = {";
+    for (size_t idx = 0; idx < stores.size(); ++idx)
+      out << (idx == 0 ? "" : ", ") << stores.at(idx);
+    out << "};\n\n";
+  }
+
+  out << "int run(ProcessorState& state, const std::bitset<MEMORY_SIZE>& breakpoints, int& steps) {\n";
+  out << "  data_t acc = state.acc;\n";
+  out << "  int left = steps;\n";
+  out << "  int status = RUN_STOPPED;\n\n";
+  out << "  switch (state.pc) {\n";
+  for (addr_t pc = 0; pc < MEMORY_SIZE; pc += INSTRUCTION_SIZE)
+    if (compiled.test(pc / INSTRUCTION_SIZE))
+      out << "    case " << pc << ": goto pc_" << pc << ";\n";
+  out << "    default: status = AOT_FALLBACK; goto done;\n";
+  out << "  }\n";
+
+  char line[DISASSEMBLY_LINE_MAX];
+  for (addr_t pc = 0; pc < MEMORY_SIZE; pc += INSTRUCTION_SIZE) {
+    if (!compiled.test(pc / INSTRUCTION_SIZE))
+      continue;
+
+    const byte_t opcode = state.memory.at(pc);
+    const addr_t address = state.memory.at(pc + 1);
+    const addr_t next = next_pc(pc);
+
+    out << "\npc_" << pc << ": // " << describe(line, pc, {opcode, static_cast<byte_t>(address)}) << "\n";
+    out << "  if (left <= 0) { state.pc = " << pc << "; goto done; }\n";
+
+    // Same as decode() returning NULL in run(): no cycle is counted
+    if (opcode >= NUM_OPCODES) {
+      out << "  state.pc = " << pc << ";\n";
+      out << "  status = RUN_ERROR;\n";
+      out << "  goto done;\n";
+      continue;
+    }
+
+    out << "  --left;\n";
+    switch (opcode) {
+      case ADD: out << "  acc = (acc + state.memory[" << address << "]) & ARCH_BITMASK;\n"; break;
+      case AND: out << "  acc &= state.memory[" << address << "];\n"; break;
+      case ORR: out << "  acc |= state.memory[" << address << "];\n"; break;
+      case XOR: out << "  acc ^= state.memory[" << address << "];\n"; break;
+      case LDR: out << "  acc = state.memory[" << address << "];\n"; break;
+      case STR: out << "  state.store(" << address << ", acc);\n"; break;
+      case JMP: break;
+      case JNE:
+        out << "  if (acc != 0) {\n";
+        emit_continue(out, compiled, address, "    ");
+        out << "  }\n";
+        break;
+    }
+
+    if (opcode == JMP) {
+      emit_continue(out, compiled, address, "  ");
+    } else if (opcode == STR && code_mask.at(address) != 0) {
+      // The code this was compiled from just changed
+      out << "  state.pc = " << next << ";\n";
+      out << "  if (!breakpoints[" << next << "]) status = AOT_FALLBACK;\n";
+      out << "  goto done;\n";
+    } else {
+      emit_continue(out, compiled, next, "  ");
+    }
+  }
+
+  out << "\ndone:\n";
+  out << "  state.acc = acc;\n";
+  out << "  steps = left;\n";
+  out << "  return status;\n";
+  out << "}\n\n";
+  out << "}\n\n";
+
+  out << "extern const AotProgram aot_" << name << ";\n";
+  out << "const AotProgram aot_" << name << " = {\n";
+  out << "  \"" << name << "\",\n";
+  const std::array<byte_t, MEMORY_SIZE>* arrays[] = {&state.memory, &code_mask};
+  for (const std::array<byte_t, MEMORY_SIZE>* bytes : arrays) {
+    out << "  {{";
+    for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+      out << (address == 0 ? "" : (address % 16 == 0) ? ",\n    " : ", ") << static_cast<int>(bytes->at(address));
+    out << "}},\n";
+  }
+  if (stores.empty())
+    out << "  NULL, 0,\n";
+  else
+    out << "  STORES, " << stores.size() << ",\n";
+  out << "  &run,\n";
+  out << "};\n";
+
+  return static_cast<bool>(out);
+}
+
+int Emulator::run_compiled(int steps, const AotProgram& program) {
+  // No steps to execute
+  if (steps <= 0)
+    return 1;
+
+  if (needs_run_fast(1))
+    return run_fast(steps);
+
+  // The compiled code doesn't check watchpoints, the interpreter does
+  UndetectedObserver observer;
+  if (watches.active())
+    return run_with(steps, observer);
+
+  byte_t changed = 0;
+  for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+    changed |= (state.memory[address] ^ program.image[address]) & program.code_mask[address];
+  if (changed != 0)
+    return run_with(steps, observer);
+
+  int left = steps;
+  const int status = program.entry(state, breakpoint_addresses(), left);
+  if (left != steps) {
+    total_cycles += steps - left;
+
+    // Same bookkeeping as the stores of run(), whether or not they executed
+    for (int idx = 0; idx < program.num_stores; ++idx)
+      invalidate_decoded(program.stores[idx]);
+  }
+
+  if (status != AOT_FALLBACK)
+    return status;
+  return run_with(left, observer);
+}
@@ -0,0 +1,78 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: aot.h
+//
+// Ahead-of-time compilation of a program into C++ (Emulator::compile() and
+// the aot-compile tool), and running the compiled code
+// (Emulator::run_compiled()).
+//
+// The compiler walks the instruction slots reachable from the PC, following
+// fall-throughs and both sides of every jump, and emits a translation unit
+// with one label per slot. Instructions become straight-line C++ on the
+// state, JMP and JNE become gotos, so there is no fetch, no decode and no
+// dispatch left. The translation unit defines one AotProgram, which is
+// linked into the executable like any other source file (see AOT_PROGRAMS
+// in CMakeLists.txt).
+//
+// Compiled code is only valid while the slots it was compiled from are
+// unchanged. run_compiled() checks them against the image before entering it,
+// and the compiled code returns AOT_FALLBACK right after any store into them,
+// so the rest of the run continues in the interpreter. Stores anywhere else
+// are plain stores. Their targets are known at compile time, so the compiler
+// can tell which stores need the guard.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "loops.h"
+#include <array>
+#include <bitset>
+
+/**
+ * What compiled code returns when the interpreter has to take over: the
+ * PC is outside the compiled slots, or a store just modified one of them
+ */
+constexpr int AOT_FALLBACK = -1;
+
+/**
+ * The entry point of a compiled program
+ *
+ * Runs like Emulator::run() without loop detection, from the PC of the state,
+ * until it runs out of steps, stops at a breakpoint, hits an error or needs
+ * the interpreter. The cycles are not counted here, that's what the steps are
+ * for.
+ *
+ * @param state The processor state, updated in place
+ * @param breakpoints The addresses with a breakpoint
+ * @param steps The maximum number of cycles to execute, decremented by the cycles executed
+ * @return a RunStatus, or AOT_FALLBACK
+ */
+typedef int (*AotEntry)(ProcessorState& state, const std::bitset<MEMORY_SIZE>& breakpoints, int& steps);
+
+/**
+ * Everything a compiled translation unit defines, as `aot_<name>`
+ */
+struct AotProgram {
+  // The name given to the compiler
+  const char* name;
+
+  // The memory the program was compiled from, and 0xff for every byte of
+  // the compiled slots (0 for the rest, which the code doesn't depend on)
+  std::array<byte_t, MEMORY_SIZE> image;
+  std::array<byte_t, MEMORY_SIZE> code_mask;
+
+  // The targets of all the compiled stores, whose decoded slots
+  // run_compiled() has to invalidate. NULL if there are none
+  const addr_t* stores;
+  int num_stores;
+
+  AotEntry entry;
+};
+
+/**
+ * Whether a name can be used for a compiled program: a C identifier
+ *
+ * @param name The name
+ * @return 1 if it's valid, 0 otherwise
+ */
+int valid_aot_name(const std::string& name);
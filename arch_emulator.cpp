@@ -0,0 +1,124 @@
+#include "arch_emulator.h"
+
+// ============= ArchEmulator ==============
+
+template <class Arch>
+ArchEmulator<Arch>::ArchEmulator()
+  : state(std::make_unique<State>()), decoded(Arch::INSTRUCTION_SLOTS), breakpoints(Arch::MEMORY_SIZE) {
+
+}
+
+template <class Arch>
+ArchEmulator<Arch>::ArchEmulator(const ArchEmulator& other)
+  : state(std::make_unique<State>(*other.state)), total_cycles(other.total_cycles),
+    decoded(Arch::INSTRUCTION_SLOTS), breakpoints(other.breakpoints) {
+
+}
+
+template <class Arch>
+ArchEmulator<Arch>& ArchEmulator<Arch>::operator=(const ArchEmulator& other) {
+  if (&other != this) {
+    *state = *other.state;
+    total_cycles = other.total_cycles;
+    breakpoints = other.breakpoints;
+    for (typename Instruction::Handle& slot : decoded)
+      slot.reset();
+  }
+  return *this;
+}
+
+template <class Arch>
+int ArchEmulator<Arch>::load_program(const std::vector<cell_t>& cells, addr_t start) {
+  if (start < 0 || cells.size() > static_cast<size_t>(Arch::MEMORY_SIZE - start))
+    return 0;
+
+  for (size_t offset = 0; offset < cells.size(); ++offset)
+    write_mem(start + offset, cells.at(offset));
+  return 1;
+}
+
+template <class Arch>
+int ArchEmulator<Arch>::run(int steps) {
+  // Same loop as Emulator::run()
+  for (; steps > 0; --steps) {
+    if ((state->pc % 2) == 1)
+      return RUN_ERROR;
+
+    Instruction* instr = decode_cached();
+    if (instr == NULL)
+      return RUN_ERROR;
+
+    instr->execute(*state);
+
+    // A store might have overwritten a decoded instruction
+    if (dynamic_cast<const BasicIstr<Arch>*>(instr) != NULL)
+      decoded.at(instr->get_address() / Arch::INSTRUCTION_SIZE).reset();
+
+    ++total_cycles;
+
+    if (breakpoints.at(state->pc))
+      return RUN_STOPPED;
+  }
+
+  return RUN_STOPPED;
+}
+
+template <class Arch>
+typename ArchEmulator<Arch>::Instruction* ArchEmulator<Arch>::decode_cached() {
+  typename Instruction::Handle& slot = decoded.at(state->pc / Arch::INSTRUCTION_SIZE);
+
+  if (slot == NULL)
+    slot = Instruction::generateInstruction({state->cell(state->pc), state->cell(state->pc + 1)});
+  return slot.get();
+}
+
+template <class Arch>
+int ArchEmulator<Arch>::insert_breakpoint(addr_t address) {
+  if (address < 0 || address >= Arch::MEMORY_SIZE || address % 2 == 1 || breakpoints.at(address))
+    return 0;
+
+  breakpoints.at(address) = true;
+  return 1;
+}
+
+template <class Arch>
+int ArchEmulator<Arch>::delete_breakpoint(addr_t address) {
+  if (address < 0 || address >= Arch::MEMORY_SIZE || !breakpoints.at(address))
+    return 0;
+
+  breakpoints.at(address) = false;
+  return 1;
+}
+
+template <class Arch>
+typename ArchEmulator<Arch>::word_t ArchEmulator<Arch>::read_acc() const {
+  return state->acc;
+}
+
+template <class Arch>
+addr_t ArchEmulator<Arch>::read_pc() const {
+  return state->pc;
+}
+
+template <class Arch>
+typename ArchEmulator<Arch>::cell_t ArchEmulator<Arch>::read_mem(addr_t address) const {
+  return state->cell(address & Arch::ADDRESS_MASK);
+}
+
+template <class Arch>
+int ArchEmulator<Arch>::cycles() const {
+  return total_cycles;
+}
+
+template <class Arch>
+void ArchEmulator<Arch>::write_mem(addr_t address, cell_t value) {
+  address &= Arch::ADDRESS_MASK;
+  state->store(address, value);
+  decoded.at(address / Arch::INSTRUCTION_SIZE).reset();
+}
+
+// ========== Instantiations ==========
+
+template class ArchEmulator<Arch8>;
+template class ArchEmulator<Arch16>;
+template class ArchEmulator<Arch32>;
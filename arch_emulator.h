@@ -0,0 +1,112 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: arch_emulator.h
+//
+// The emulation engine of Emulator::run() as a template over the architecture
+// (see ArchTraits in common.h), for modelling machines with wider words and
+// larger memories.
+//
+// ArchEmulator has the same fetch/decode/execute loop, decode cache and run()
+// contract as Emulator, on top of the templated ProcessorState and
+// instruction classes. Everything else Emulator has (named breakpoints, state
+// files, snapshots, the journal, the faster engines) is built for the 8-bit
+// machine, so Emulator stays the full-featured Arch8 machine and ArchEmulator
+// keeps to the core: a program loaded from memory, breakpoints by address,
+// and run().
+//
+// It is instantiated in arch_emulator.cpp for Arch8, Arch16 and Arch32.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "instructions.h"
+#include "loops.h"
+#include <memory>
+#include <vector>
+
+template <class Arch>
+class ArchEmulator {
+  public:
+    typedef typename Arch::word_t word_t;
+    typedef typename Arch::cell_t cell_t;
+    typedef BasicProcessorState<Arch> State;
+    typedef BasicInstructionBase<Arch> Instruction;
+
+    /**
+     * A machine with all memory and registers zero and no breakpoints
+     */
+    ArchEmulator();
+
+    /**
+     * Copy constructor and assignment. The decode cache is not copied
+     */
+    ArchEmulator(const ArchEmulator& other);
+    ArchEmulator& operator=(const ArchEmulator& other);
+
+    ArchEmulator(ArchEmulator&& other) noexcept = default;
+    ArchEmulator& operator=(ArchEmulator&& other) noexcept = default;
+    ~ArchEmulator() = default;
+
+    /**
+     * Copy a program into memory
+     *
+     * @param cells The memory cells (two per instruction: opcode, operand)
+     * @param start The address of the first cell
+     * @return 1 for success, 0 if the program doesn't fit
+     */
+    int load_program(const std::vector<cell_t>& cells, addr_t start = 0);
+
+    /**
+     * The same as Emulator::run(), without loop detection
+     *
+     * @param steps The maximum number of cycles to execute
+     * @return RUN_STOPPED (1) for a breakpoint or after the maximum number of steps, RUN_ERROR (0) on an error
+     */
+    int run(int steps);
+
+    /**
+     * Add/remove a breakpoint at an instruction address
+     *
+     * @param address The address, which has to be even and inside memory
+     * @return 1 for success, 0 if the address is invalid or there is already (for delete: there is no) breakpoint at it
+     */
+    int insert_breakpoint(addr_t address);
+    int delete_breakpoint(addr_t address);
+
+    /**
+     * Getters for the processor state, the same as Emulator's
+     */
+    word_t read_acc() const;
+    addr_t read_pc() const;
+    cell_t read_mem(addr_t address) const;
+    int cycles() const;
+
+    /**
+     * Overwrite a memory cell
+     *
+     * @param address The address, masked to the memory size
+     * @param value The new value
+     */
+    void write_mem(addr_t address, cell_t value);
+
+  private:
+    /**
+     * The decoded instruction at the PC, decoding it if it isn't cached
+     *
+     * @return the instruction, NULL if the opcode is invalid
+     */
+    Instruction* decode_cached();
+
+    // State is on the heap: the memory of the wider machines doesn't fit on the stack
+    std::unique_ptr<State> state;
+    int total_cycles{0};
+
+    // One slot per instruction, reset when its memory changes
+    std::vector<typename Instruction::Handle> decoded;
+
+    // breakpoints.at(address) is set if there is a breakpoint at address
+    std::vector<bool> breakpoints;
+};
+
+typedef ArchEmulator<Arch16> Emulator16;
+typedef ArchEmulator<Arch32> Emulator32;
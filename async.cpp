@@ -0,0 +1,98 @@
+#include "async.h"
+#include "emulator.h"
+#include <algorithm>
+#include <utility>
+
+// ============= RunTask ==============
+
+RunTask::RunTask(RunTask&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+RunTask& RunTask::operator=(RunTask&& other) noexcept {
+  if (this != &other) {
+    if (handle)
+      handle.destroy();
+    handle = std::exchange(other.handle, nullptr);
+  }
+  return *this;
+}
+
+RunTask::~RunTask() {
+  if (handle)
+    handle.destroy();
+}
+
+int RunTask::resume() {
+  if (done())
+    return 0;
+
+  handle.resume();
+  return !handle.done();
+}
+
+int RunTask::done() const {
+  return !handle || handle.done();
+}
+
+const RunResult& RunTask::result() const {
+  if (!handle)
+    return empty;
+  return handle.promise().result;
+}
+
+long run_interleaved(std::vector<RunTask>& tasks) {
+  long slices = 0;
+  for (size_t active = tasks.size(); active > 0;) {
+    active = 0;
+    for (RunTask& task : tasks) {
+      if (task.done())
+        continue;
+      task.resume();
+      ++slices;
+      active += !task.done();
+    }
+  }
+  return slices;
+}
+
+// ============= Emulator ==============
+
+RunTask Emulator::run_async(int steps, int slice) {
+  const int start = total_cycles;
+  if (slice <= 0)
+    slice = steps;
+
+  // Loop detection carries over from one slice to the next, like in a
+  // single run_fast()
+  loops.reset();
+  NullObserver observer;
+
+  int status = RUN_STOPPED;
+  for (int left = steps; left > 0;) {
+    const int chunk = std::min(slice, left);
+    const int before = total_cycles;
+
+    // The journal and the trace never detect loops, so their engines can
+    // start over for every slice
+    if (needs_run_fast(1))
+      status = run_fast(chunk);
+    else if (watches.active())
+      status = run_loop<NullObserver, true>(chunk, observer);
+    else
+      status = run_loop<NullObserver, false>(chunk, observer);
+    left -= total_cycles - before;
+
+    // Wherever the run would have stopped
+    if ((status != RUN_STOPPED && status != RUN_LOOPING) || is_breakpoint() == 1)
+      break;
+
+    // The loop was only skipped to the end of the slice: skip the periods
+    // of the rest of the run too, what's left is less than one period
+    if (status == RUN_LOOPING && left > 0 && loops.period() > 0)
+      left -= skip_loop(loops.period(), left);
+
+    if (left > 0)
+      co_yield total_cycles - start;
+  }
+
+  co_return RunResult{status, total_cycles - start};
+}
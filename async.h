@@ -0,0 +1,106 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: async.h
+//
+// Coroutine runs (Emulator::run_async()), for interleaving many emulators on
+// one thread without blocking in run() and without paying for tiny runs.
+//
+// run_async() returns a RunTask, which hasn't started yet. Every resume()
+// runs the emulator for one slice of cycles and then suspends, so whoever
+// owns the tasks (an event loop, a thread pool, run_interleaved() below)
+// decides what runs next. A task doesn't care which thread resumes it, as
+// long as only one does at a time.
+//
+// The slices are plain calls to the loop of run_fast(), so the only cost of
+// slicing is one suspend and resume per slice. Results, cycle counts,
+// breakpoint stops and loop detection are identical to a single run_fast()
+// with the same number of steps: the task is done as soon as the run would
+// have stopped.
+// -----------------------------------------------------------------------------
+
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+/**
+ * The outcome of a run_async()
+ */
+struct RunResult {
+  // A RunStatus, the same as run() would return
+  int status = 0;
+
+  // The cycles counted by this run, skipped loops included
+  int cycles = 0;
+};
+
+class RunTask {
+  public:
+    struct promise_type {
+      RunTask get_return_object() {
+        return RunTask(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      // Lazy: nothing runs until the first resume()
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      std::suspend_always final_suspend() noexcept { return {}; }
+
+      // The end of a slice, with the cycles counted so far
+      std::suspend_always yield_value(int cycles) noexcept {
+        result.cycles = cycles;
+        return {};
+      }
+
+      void return_value(RunResult value) noexcept {
+        result = value;
+      }
+
+      void unhandled_exception() {
+        std::terminate();
+      }
+
+      RunResult result;
+    };
+
+    RunTask() = default;
+
+    // Tasks own their coroutine: they move, but don't copy
+    RunTask(const RunTask&) = delete;
+    RunTask& operator=(const RunTask&) = delete;
+    RunTask(RunTask&& other) noexcept;
+    RunTask& operator=(RunTask&& other) noexcept;
+    ~RunTask();
+
+    /**
+     * Run the next slice
+     *
+     * @return 1 if the task still has slices to run, 0 if it's done
+     */
+    int resume();
+
+    /**
+     * Whether the run has finished. An empty (default-constructed or moved-from) task is done
+     */
+    int done() const;
+
+    /**
+     * The cycles counted so far, and the status once the task is done
+     *
+     * The status is meaningless until done() returns 1
+     */
+    const RunResult& result() const;
+
+  private:
+    explicit RunTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+    RunResult empty;
+};
+
+/**
+ * Resume the tasks round-robin, one slice each, until all of them are done
+ *
+ * @param tasks The tasks, each on a different emulator
+ * @return the number of slices run
+ */
+long run_interleaved(std::vector<RunTask>& tasks);
@@ -0,0 +1,305 @@
+#include <bitset>
+#include <cstring>
+#include "batch.h"
+#include "instructions.h"
+
+// ============= Lane vectors ==============
+
+// All the per-lane operations below are written once in terms of lane_t.
+// With GCC/Clang lane_t is a vector of bytes and the compiler uses the widest
+// vector instructions enabled at compile time. Otherwise lane_t is a single
+// byte and the loops below process one lane at a time.
+#if defined(__GNUC__) && !defined(EMULATOR_SCALAR_BATCH)
+#if defined(__AVX512BW__)
+constexpr int LANE_VECTOR_BYTES = 64;
+#elif defined(__AVX2__)
+constexpr int LANE_VECTOR_BYTES = 32;
+#else
+constexpr int LANE_VECTOR_BYTES = 16;
+#endif
+typedef byte_t lane_t __attribute__((vector_size(LANE_VECTOR_BYTES)));
+
+static inline lane_t lanes_broadcast(byte_t value) {
+  return lane_t{} + value;
+}
+
+static inline lane_t lanes_ne(lane_t a, lane_t b) {
+  return reinterpret_cast<lane_t>(a != b);
+}
+#else
+constexpr int LANE_VECTOR_BYTES = 1;
+typedef byte_t lane_t;
+
+static inline lane_t lanes_broadcast(byte_t value) {
+  return value;
+}
+
+static inline lane_t lanes_ne(lane_t a, lane_t b) {
+  return (a != b) ? 0xff : 0;
+}
+#endif
+
+// Lane counts are padded to this, so every vector width divides the stride
+constexpr int MAX_LANE_VECTOR_BYTES = 64;
+
+static inline lane_t lanes_load(const byte_t* src) {
+  lane_t value;
+  memcpy(&value, src, sizeof(value));
+  return value;
+}
+
+static inline void lanes_store(byte_t* dst, lane_t value) {
+  memcpy(dst, &value, sizeof(value));
+}
+
+// mask ? a : b, for masks made of 0xff/0 bytes
+static inline lane_t lanes_select(lane_t mask, lane_t a, lane_t b) {
+  return (mask & a) | (~mask & b);
+}
+
+static inline int lanes_any(lane_t value) {
+  byte_t bytes[sizeof(lane_t)];
+  memcpy(bytes, &value, sizeof(value));
+  byte_t any = 0;
+  for (byte_t byte : bytes)
+    any |= byte;
+  return any != 0;
+}
+
+// ============= BatchEmulator ==============
+
+BatchEmulator::BatchEmulator(const std::vector<Emulator>& machines)
+  : num_lanes(machines.size()) {
+  stride = ((num_lanes + MAX_LANE_VECTOR_BYTES - 1) / MAX_LANE_VECTOR_BYTES) * MAX_LANE_VECTOR_BYTES;
+
+  acc.assign(stride, 0);
+  pc.assign(stride, 0);
+  total_cycles.assign(stride, 0);
+  active.assign(stride, 0);
+  errors.assign(stride, 0);
+  stopped_at_breakpoint.assign(stride, 0);
+  memory.assign(MEMORY_SIZE * stride, 0);
+  breakpoints.assign(MEMORY_SIZE * stride, 0);
+  group.assign(stride, 0);
+  pc_before.assign(stride, 0);
+
+  for (int lane = 0; lane < num_lanes; ++lane) {
+    const Emulator& machine = machines.at(lane);
+    acc.at(lane) = machine.read_acc();
+    pc.at(lane) = machine.read_pc();
+    total_cycles.at(lane) = machine.cycles();
+
+    for (int address = 0; address < MEMORY_SIZE; ++address) {
+      memory.at(address * stride + lane) = machine.read_mem(address);
+      if (machine.find_breakpoint(address) != NULL)
+        breakpoints.at(address * stride + lane) = 0xff;
+    }
+  }
+}
+
+int BatchEmulator::lanes() const {
+  return num_lanes;
+}
+
+int BatchEmulator::simd_width() {
+  return LANE_VECTOR_BYTES;
+}
+
+LaneResult BatchEmulator::result(int lane) const {
+  return {acc.at(lane), pc.at(lane), total_cycles.at(lane), errors.at(lane) == 0, stopped_at_breakpoint.at(lane) != 0};
+}
+
+addr_t BatchEmulator::read_mem(int lane, addr_t address) const {
+  return memory.at((address & ARCH_BITMASK) * stride + lane);
+}
+
+int BatchEmulator::run(int steps) {
+  // Every call starts all lanes again, just like calling Emulator::run() on each of them.
+  // Lanes that failed last time will fail again on their first step
+  for (int lane = 0; lane < stride; ++lane) {
+    active[lane] = (lane < num_lanes) ? 0xff : 0;
+    errors[lane] = 0;
+    stopped_at_breakpoint[lane] = 0;
+  }
+  num_active = num_lanes;
+
+  for (; steps > 0 && num_active > 0; --steps)
+    step();
+
+  int normal = 0;
+  for (int lane = 0; lane < num_lanes; ++lane)
+    normal += (errors[lane] == 0);
+  return normal;
+}
+
+void BatchEmulator::step() {
+  // Group the running lanes by PC. The common case is that they all agree,
+  // which we can check with vector compares only. Otherwise find all the
+  // distinct PCs with one pass over the lanes
+  int first = 0;
+  while (active[first] == 0)
+    ++first;
+  const byte_t first_pc = pc[first];
+
+  lane_t divergent{};
+  const lane_t first_pc_lanes = lanes_broadcast(first_pc);
+  for (int base = 0; base < stride; base += LANE_VECTOR_BYTES)
+    divergent |= lanes_load(&active[base]) & lanes_ne(lanes_load(&pc[base]), first_pc_lanes);
+
+  std::bitset<MEMORY_SIZE> pcs;
+  if (lanes_any(divergent)) {
+    for (int lane = 0; lane < num_lanes; ++lane)
+      if (active[lane])
+        pcs.set(pc[lane]);
+  } else {
+    pcs.set(first_pc);
+  }
+
+  // Executing one group moves its lanes to PCs that later groups might be
+  // looking for, so groups are always formed from the PCs before this step
+  pc_before = pc;
+
+  for (int group_pc = 0; group_pc < MEMORY_SIZE; ++group_pc) {
+    if (!pcs.test(group_pc))
+      continue;
+
+    // group = active lanes that started this step at group_pc
+    const lane_t group_pc_lanes = lanes_broadcast(group_pc);
+    int leader = -1;
+    for (int base = 0; base < stride; base += LANE_VECTOR_BYTES) {
+      const lane_t member = lanes_load(&active[base]) & ~lanes_ne(lanes_load(&pc_before[base]), group_pc_lanes);
+      lanes_store(&group[base], member);
+      if (leader < 0 && lanes_any(member))
+        for (int lane = base; leader < 0; ++lane)
+          if (group[lane])
+            leader = lane;
+    }
+
+    // Instructions are supposed to be aligned on two-byte offsets, same as Emulator::run()
+    if ((group_pc % 2) == 1) {
+      fail_group();
+      continue;
+    }
+
+    // Do all the lanes in the group see the same instruction? They normally
+    // do (same program), unless some of them have modified their code
+    const byte_t* opcodes = &memory[group_pc * stride];
+    const byte_t* addresses = &memory[(group_pc + 1) * stride];
+    const byte_t opcode = opcodes[leader];
+    const byte_t address = addresses[leader];
+
+    lane_t disagree{};
+    const lane_t opcode_lanes = lanes_broadcast(opcode);
+    const lane_t address_lanes = lanes_broadcast(address);
+    for (int base = 0; base < stride; base += LANE_VECTOR_BYTES)
+      disagree |= lanes_load(&group[base]) & (lanes_ne(lanes_load(&opcodes[base]), opcode_lanes) | lanes_ne(lanes_load(&addresses[base]), address_lanes));
+
+    if (lanes_any(disagree)) {
+      for (int lane = 0; lane < num_lanes; ++lane)
+        if (group[lane])
+          execute_lane(lane);
+    } else if (opcode >= NUM_OPCODES) {
+      fail_group();
+    } else {
+      execute_group(group_pc, opcode, address);
+    }
+  }
+}
+
+void BatchEmulator::execute_group(byte_t group_pc, byte_t opcode, byte_t address) {
+  // Byte arithmetic wraps around on its own, so the masking done by
+  // InstructionBase::execute() is free here
+  const byte_t next_pc = group_pc + INSTRUCTION_SIZE;
+  const lane_t next_pc_lanes = lanes_broadcast(next_pc);
+  const lane_t target_lanes = lanes_broadcast(address);
+  byte_t* operand = &memory[address * stride];
+
+  // Breakpoints at the two possible destinations
+  const byte_t* next_breakpoints = &breakpoints[next_pc * stride];
+  const byte_t* target_breakpoints = &breakpoints[address * stride];
+
+  for (int base = 0; base < stride; base += LANE_VECTOR_BYTES) {
+    const lane_t member = lanes_load(&group[base]);
+    lane_t lanes_acc = lanes_load(&acc[base]);
+    lane_t lanes_pc = lanes_load(&pc[base]);
+    lane_t hit;
+
+    switch (opcode) {
+      case ADD: lanes_acc = lanes_select(member, lanes_acc + lanes_load(&operand[base]), lanes_acc); break;
+      case AND: lanes_acc = lanes_select(member, lanes_acc & lanes_load(&operand[base]), lanes_acc); break;
+      case ORR: lanes_acc = lanes_select(member, lanes_acc | lanes_load(&operand[base]), lanes_acc); break;
+      case XOR: lanes_acc = lanes_select(member, lanes_acc ^ lanes_load(&operand[base]), lanes_acc); break;
+      case LDR: lanes_acc = lanes_select(member, lanes_load(&operand[base]), lanes_acc); break;
+      case STR: lanes_store(&operand[base], lanes_select(member, lanes_acc, lanes_load(&operand[base]))); break;
+    }
+
+    if (opcode == JMP) {
+      lanes_pc = lanes_select(member, target_lanes, lanes_pc);
+      hit = member & lanes_load(&target_breakpoints[base]);
+    } else if (opcode == JNE) {
+      const lane_t taken = lanes_ne(lanes_acc, lanes_broadcast(0));
+      lanes_pc = lanes_select(member, lanes_select(taken, target_lanes, next_pc_lanes), lanes_pc);
+      hit = member & lanes_select(taken, lanes_load(&target_breakpoints[base]), lanes_load(&next_breakpoints[base]));
+    } else {
+      lanes_pc = lanes_select(member, next_pc_lanes, lanes_pc);
+      hit = member & lanes_load(&next_breakpoints[base]);
+    }
+
+    lanes_store(&acc[base], lanes_acc);
+    lanes_store(&pc[base], lanes_pc);
+    lanes_store(&stopped_at_breakpoint[base], lanes_load(&stopped_at_breakpoint[base]) | hit);
+    lanes_store(&active[base], lanes_load(&active[base]) & ~hit);
+  }
+
+  for (int lane = 0; lane < stride; ++lane) {
+    total_cycles[lane] += group[lane] & 1;
+    num_active -= stopped_at_breakpoint[lane] & group[lane] & 1;
+  }
+}
+
+void BatchEmulator::execute_lane(int lane) {
+  // Same as Emulator::run_fast() for a single step
+  const int lane_pc = pc[lane];
+  const byte_t opcode = memory[lane_pc * stride + lane];
+  const byte_t address = memory[(lane_pc + 1) * stride + lane];
+  byte_t& operand = memory[address * stride + lane];
+
+  switch (opcode) {
+    case ADD: acc[lane] += operand; break;
+    case AND: acc[lane] &= operand; break;
+    case ORR: acc[lane] |= operand; break;
+    case XOR: acc[lane] ^= operand; break;
+    case LDR: acc[lane] = operand; break;
+    case STR: operand = acc[lane]; break;
+    case JMP: break;
+    case JNE: break;
+    default:
+      errors[lane] = 0xff;
+      active[lane] = 0;
+      --num_active;
+      return;
+  }
+
+  if (opcode == JMP || (opcode == JNE && acc[lane] != 0))
+    pc[lane] = address;
+  else
+    pc[lane] = lane_pc + INSTRUCTION_SIZE;
+
+  ++total_cycles[lane];
+
+  if (breakpoints[pc[lane] * stride + lane]) {
+    stopped_at_breakpoint[lane] = 0xff;
+    active[lane] = 0;
+    --num_active;
+  }
+}
+
+void BatchEmulator::fail_group() {
+  for (int lane = 0; lane < num_lanes; ++lane) {
+    if (group[lane]) {
+      errors[lane] = 0xff;
+      active[lane] = 0;
+      --num_active;
+    }
+  }
+}
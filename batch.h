@@ -0,0 +1,119 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: batch.h
+//
+// An emulator for many independent machines at once, e.g. the same program
+// loaded with thousands of different data images.
+//
+// The state of all machines (lanes) is kept as a structure of arrays: acc and
+// pc are one byte per lane, and memory is stored address-major, so the bytes
+// of one address across all lanes are contiguous. Lanes that are at the same
+// PC and see the same instruction are stepped together with vector
+// operations, 16/32/64 lanes per instruction depending on whether SSE2, AVX2
+// or AVX-512BW is enabled at compile time. Lanes that have stopped are masked
+// off. When SIMD is not available (or EMULATOR_SCALAR_BATCH is defined) the
+// same code runs one lane at a time.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "emulator.h"
+#include <vector>
+
+/**
+ * What happened to a lane during the last BatchEmulator::run()
+ */
+struct LaneResult {
+  data_t acc;
+  addr_t pc;
+  int cycles;
+
+  /**
+   * Whether Emulator::run() would have stopped normally for this lane (1 normal stop, 0 error).
+   * Lanes execute every step, so endless loops are not reported as RUN_LOOPING
+   */
+  int success;
+
+  /**
+   * 1 if the lane stopped because it reached a breakpoint
+   */
+  int breakpoint;
+};
+
+class BatchEmulator {
+  public:
+    /**
+     * Creates one lane per emulator, copying its processor state, cycles and breakpoints
+     *
+     * @param machines The initial states, e.g. loaded with Emulator::load_state()
+     */
+    explicit BatchEmulator(const std::vector<Emulator>& machines);
+
+    /**
+     * Runs every lane for up to the given number of steps
+     *
+     * Each lane behaves exactly as if Emulator::run(steps) was called on it:
+     * it stops early on an error or when it reaches one of its breakpoints.
+     *
+     * @param steps The maximum number of cycles each lane executes
+     * @return the number of lanes that stopped normally
+     */
+    int run(int steps);
+
+    /**
+     * The number of lanes
+     */
+    int lanes() const;
+
+    /**
+     * The state of a lane and how its last run ended
+     */
+    LaneResult result(int lane) const;
+
+    /**
+     * Read a memory byte of a lane
+     */
+    addr_t read_mem(int lane, addr_t address) const;
+
+    /**
+     * How many lanes are stepped by one vector operation (1 for the scalar fallback)
+     */
+    static int simd_width();
+
+  private:
+    // Step all running lanes by one instruction
+    void step();
+
+    // Step all lanes in the group mask, which are all at PC `pc` and have the
+    // same instruction bytes
+    void execute_group(byte_t pc, byte_t opcode, byte_t address);
+
+    // Step a single lane the slow way (lanes at the same PC disagreeing on the instruction)
+    void execute_lane(int lane);
+
+    // Stop the lanes in the group mask because of an error
+    void fail_group();
+
+    int num_lanes;
+
+    // Lanes padded to a multiple of the widest vector. Padding lanes are never active
+    int stride;
+    int num_active{0};
+
+    std::vector<byte_t> acc;
+    std::vector<byte_t> pc;
+    std::vector<int> total_cycles;
+
+    // 0xff for lanes that are still running, 0 otherwise
+    std::vector<byte_t> active;
+    std::vector<byte_t> errors;
+    std::vector<byte_t> stopped_at_breakpoint;
+
+    // memory[address * stride + lane], and the same layout for the breakpoints (0xff/0)
+    std::vector<byte_t> memory;
+    std::vector<byte_t> breakpoints;
+
+    // Scratch space for a single step
+    std::vector<byte_t> group;
+    std::vector<byte_t> pc_before;
+};
@@ -0,0 +1,725 @@
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: bench.cpp
+//
+// Performance suite for the emulator, built with Google Benchmark against an
+// optimised (-O3) build of the emulator library.
+//
+// Microbenchmarks time the individual pieces: fetch, decode, execute (with
+// InstructionBase objects and with instruction values), short runs with
+// every engine, with the profiler, with a trace, with watchpoints and
+// memoized, breakpoint lookup, loading/saving states, batches of server
+// requests against the same requests through state files, print_program
+// and the disassembler.
+// Macrobenchmarks run the programs in `data` for at least 10^8 cycles with
+// each engine, and the ones that aot-compile compiled for the build with
+// run_compiled(), and report millions of instructions per second (the "MIPS"
+// counter). The programs run without their breakpoints, and a program that
+// stops on an error or parks in a jump to itself (where state1, state2 and
+// state_selfmod end up after a few hundred cycles) is restarted from its
+// initial state, so every macrobenchmark executes the full number of cycles
+// and nearly all of them are the program itself. state3 and state4 fail
+// within 10 cycles, so they are not macrobenchmarks.
+//
+// BM_MultiCore runs several cores of state2 over one shared memory, with
+// (cores, quantum) as arguments and quantum 0 for round robin. Its MIPS
+// against BM_Program/run/data/state2.txt and its "switches_per_instr"
+// counter show what the interleaving costs per emulated instruction.
+// BM_MultiCoreThreaded runs the cores on host threads.
+//
+// BM_Counters runs the same programs under measure_run() (see
+// perf_counters.h) and reports the host cycles, branch misses and L1 misses
+// per emulated instruction, where the host can count them (the
+// "perf_events" context says which), and the decodes, allocations,
+// breakpoint checks and decode cache hits per instruction of the engine.
+// All counters are part of the JSON output:
+//   ./build/bench --benchmark_filter=Counters --benchmark_format=json
+//
+// bench-checked is the same suite with bounds-checked memory accesses
+// (EMULATOR_CHECKED_MEMORY=1, as in the test builds), reported as the
+// "checked_memory" context. Comparing the MIPS of the two shows what the
+// checks cost in a release build.
+//
+// Run from the project root, so that the `data` folder can be found:
+//   ./build/bench
+//   ./build/bench --benchmark_filter=Program --cycles=1000000000
+//   ./build/bench-checked --benchmark_filter=Program
+// -----------------------------------------------------------------------------
+
+#include <benchmark/benchmark.h>
+#include "corpus.h"
+#include "disassembler.h"
+#include "emulator.h"
+#include "instruction_values.h"
+#include "instructions.h"
+#include "multicore.h"
+#include "perf_counters.h"
+#include "profiler.h"
+#include "runner.h"
+#include "server.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Compiled from the data files by aot-compile at build time (see CMakeLists.txt)
+extern const AotProgram aot_state1;
+extern const AotProgram aot_state2;
+extern const AotProgram aot_state_selfmod;
+
+namespace {
+
+// Cycles per macrobenchmark, see --cycles
+long long program_cycles = 100000000;
+
+typedef int (Emulator::*Engine)(int);
+
+Emulator load(const std::string& filename) {
+  Emulator emulator;
+  if (!emulator.load_state(filename)) {
+    std::cerr << "Can't load " << filename << ", run the benchmarks from the project root" << std::endl;
+    std::exit(1);
+  }
+  // We are timing instructions, not skipping endless loops
+  emulator.set_loop_detection(0);
+  return emulator;
+}
+
+std::string temp_file(const std::string& name) {
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
+/**
+ * Replace the breakpoints of a program with one on every jump to itself, so
+ * that runs stop as soon as the program parks and can be restarted
+ */
+void stop_at_parking(Emulator& emulator) {
+  for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+    emulator.delete_breakpoint(address);
+  for (addr_t address = 0; address < MEMORY_SIZE; address += INSTRUCTION_SIZE) {
+    const byte_t opcode = emulator.read_mem(address);
+    if ((opcode == JMP || opcode == JNE) && emulator.read_mem(address + 1) == address)
+      emulator.insert_breakpoint(address, "PARK");
+  }
+}
+
+// Whether the program is in a jump to itself, which it would take forever
+int parked(const Emulator& emulator) {
+  const addr_t pc = emulator.read_pc();
+  const byte_t opcode = emulator.read_mem(pc);
+  return emulator.read_mem(pc + 1) == pc && (opcode == JMP || (opcode == JNE && emulator.read_acc() != 0));
+}
+
+void report_mips(benchmark::State& state, long long cycles) {
+  state.counters["MIPS"] = benchmark::Counter(cycles / 1e6, benchmark::Counter::kIsRate);
+}
+
+// -------------------------   MICROBENCHMARKS     -------------------------
+
+void BM_Fetch(benchmark::State& state) {
+  Emulator emulator = load("data/state2.txt");
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.fetch());
+}
+BENCHMARK(BM_Fetch);
+
+void BM_Decode(benchmark::State& state) {
+  Emulator emulator = load("data/state2.txt");
+  const InstructionData data = emulator.fetch();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.decode(data));
+}
+BENCHMARK(BM_Decode);
+
+void BM_DecodeAllocated(benchmark::State& state) {
+  // BM_Decode the way every decode used to go: Arch16 has no shared
+  // instructions, so each decode allocates and frees an object
+  const Emulator emulator = load("data/state2.txt");
+  const InstructionData data = emulator.fetch();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(BasicInstructionBase<Arch16>::generateInstruction({data.opcode, data.address}));
+}
+BENCHMARK(BM_DecodeAllocated);
+
+void BM_Execute(benchmark::State& state) {
+  // ADD 64 from state2, executed over and over. Its JMP back is not needed:
+  // the PC just walks through memory and wraps around
+  Emulator emulator = load("data/state2.txt");
+  InstructionHandle instr = emulator.decode({ADD, 64});
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.execute(instr.get()));
+}
+BENCHMARK(BM_Execute);
+
+void BM_DecodeValue(benchmark::State& state) {
+  // BM_Decode with instruction values instead of InstructionBase objects
+  const Emulator emulator = load("data/state2.txt");
+  const InstructionData data = emulator.fetch();
+  InstructionValue value;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(decode_value(data, value));
+    benchmark::DoNotOptimize(value);
+  }
+}
+BENCHMARK(BM_DecodeValue);
+
+void BM_ExecuteValue(benchmark::State& state) {
+  // BM_Execute with an instruction value
+  ProcessorState processor;
+  InstructionValue value;
+  decode_value<Arch8>({ADD, 64}, value);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(value);
+    execute_value(value, processor);
+    benchmark::DoNotOptimize(processor);
+  }
+}
+BENCHMARK(BM_ExecuteValue);
+
+void BM_Run(benchmark::State& state, Engine engine) {
+  // Short runs of the state2 loop, starting again whenever it finishes
+  Emulator start = load("data/state2.txt");
+  const EmulatorSnapshot initial = start.snapshot();
+  const int steps = state.range(0);
+
+  long long cycles = 0;
+  for (auto _ : state) {
+    const int before = start.cycles();
+    if (!(start.*engine)(steps) || start.cycles() - before < steps) {
+      state.PauseTiming();
+      start.restore(initial);
+      state.ResumeTiming();
+    }
+    cycles += start.cycles() - before;
+  }
+  report_mips(state, cycles);
+}
+BENCHMARK_CAPTURE(BM_Run, run, &Emulator::run)->Arg(1)->Arg(64);
+BENCHMARK_CAPTURE(BM_Run, run_fast, &Emulator::run_fast)->Arg(1)->Arg(64);
+BENCHMARK_CAPTURE(BM_Run, run_blocks, &Emulator::run_blocks)->Arg(1)->Arg(64);
+
+void BM_RunProfiled(benchmark::State& state) {
+  // Same as BM_Run with run_fast, plus the profiler
+  Emulator start = load("data/state2.txt");
+  const EmulatorSnapshot initial = start.snapshot();
+  const int steps = state.range(0);
+  Profiler profiler;
+
+  long long cycles = 0;
+  for (auto _ : state) {
+    const int before = start.cycles();
+    if (!start.run_with(steps, profiler) || start.cycles() - before < steps) {
+      state.PauseTiming();
+      start.restore(initial);
+      state.ResumeTiming();
+    }
+    cycles += start.cycles() - before;
+  }
+  report_mips(state, cycles);
+}
+BENCHMARK(BM_RunProfiled)->Arg(1)->Arg(64);
+
+void BM_RunWatched(benchmark::State& state, Engine engine) {
+  // Same as BM_Run, with a watchpoint and an acc condition that never trigger
+  Emulator start = load("data/state2.txt");
+  start.insert_watchpoint(200, WATCH_READ | WATCH_WRITE);
+  start.insert_acc_condition(ACC_EQUAL, 200);
+  const EmulatorSnapshot initial = start.snapshot();
+  const int steps = state.range(0);
+
+  long long cycles = 0;
+  for (auto _ : state) {
+    const int before = start.cycles();
+    if (!(start.*engine)(steps) || start.cycles() - before < steps) {
+      state.PauseTiming();
+      start.restore(initial);
+      state.ResumeTiming();
+    }
+    cycles += start.cycles() - before;
+  }
+  report_mips(state, cycles);
+}
+BENCHMARK_CAPTURE(BM_RunWatched, run, &Emulator::run)->Arg(64);
+BENCHMARK_CAPTURE(BM_RunWatched, run_fast, &Emulator::run_fast)->Arg(64);
+
+void BM_RunTraced(benchmark::State& state) {
+  // Same as BM_Run with run_fast, writing a trace (compressed for Arg 1)
+  Emulator start = load("data/state2.txt");
+  const EmulatorSnapshot initial = start.snapshot();
+  const int steps = 64;
+  const int compress = state.range(0) && TraceWriter::compression_available();
+  TraceWriter writer;
+  if (!writer.open(temp_file("bench_trace.bin"), start.cycles(), compress)) {
+    state.SkipWithError("Can't create the trace file");
+    return;
+  }
+  start.set_trace(&writer);
+
+  long long cycles = 0;
+  for (auto _ : state) {
+    const int before = start.cycles();
+    if (!start.run_fast(steps) || start.cycles() - before < steps) {
+      state.PauseTiming();
+      start.restore(initial);
+      state.ResumeTiming();
+    }
+    cycles += start.cycles() - before;
+  }
+  writer.close();
+  report_mips(state, cycles);
+}
+BENCHMARK(BM_RunTraced)->Arg(0)->Arg(1);
+
+void BM_RunMemoized(benchmark::State& state) {
+  // Exploration coming back to the same state: restore it, then run the same
+  // segment again. Every run after the first one is a memo hit
+  Emulator start = load("data/state2.txt");
+  const EmulatorSnapshot initial = start.snapshot();
+  const int steps = state.range(0);
+  RunMemo memo;
+
+  long long cycles = 0;
+  for (auto _ : state) {
+    start.restore(initial);
+    start.run_memoized(steps, memo);
+    cycles += start.cycles() - initial.cycles();
+  }
+  report_mips(state, cycles);
+}
+BENCHMARK(BM_RunMemoized)->Arg(64)->Arg(1024);
+
+void BM_FindBreakpointByAddress(benchmark::State& state) {
+  Emulator emulator = load("data/state_breakpoints.txt");
+  addr_t address = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(emulator.find_breakpoint(address));
+    address = (address + 1) & ARCH_BITMASK;
+  }
+}
+BENCHMARK(BM_FindBreakpointByAddress);
+
+void BM_FindBreakpointByName(benchmark::State& state) {
+  Emulator emulator = load("data/state_breakpoints.txt");
+  const std::vector<std::string> names = {"START", "END", "MID", "A", "O", "MISSING"};
+  size_t next = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(emulator.find_breakpoint(names[next]));
+    next = (next + 1) % names.size();
+  }
+}
+BENCHMARK(BM_FindBreakpointByName);
+
+void BM_InsertDeleteBreakpoint(benchmark::State& state) {
+  // Names too long for a small string, which a lookup used to copy
+  Emulator emulator;
+  const std::vector<std::string> names = {"BREAKPOINT_NUMBER_ONE", "BREAKPOINT_NUMBER_TWO", "BREAKPOINT_NUMBER_THREE"};
+  size_t next = 0;
+  for (auto _ : state) {
+    const char* name = names[next].c_str();
+    benchmark::DoNotOptimize(emulator.insert_breakpoint(next * 2, name));
+    benchmark::DoNotOptimize(emulator.find_breakpoint(name));
+    benchmark::DoNotOptimize(emulator.delete_breakpoint(name));
+    next = (next + 1) % names.size();
+  }
+}
+BENCHMARK(BM_InsertDeleteBreakpoint);
+
+void BM_IsBreakpoint(benchmark::State& state) {
+  Emulator emulator = load("data/state_breakpoints.txt");
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.is_breakpoint());
+}
+BENCHMARK(BM_IsBreakpoint);
+
+void BM_LoadState(benchmark::State& state) {
+  Emulator emulator;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.load_state("data/state_breakpoints.txt"));
+}
+BENCHMARK(BM_LoadState);
+
+void BM_LoadCorpus(benchmark::State& state) {
+  // The valid and invalid files of `data`, 64 times over
+  std::vector<std::string> listed;
+  list_corpus("data", listed);
+  std::vector<std::string> files;
+  for (int copy = 0; copy < 64; ++copy)
+    files.insert(files.end(), listed.begin(), listed.end());
+
+  const CorpusLoader loader(state.range(0));
+  std::vector<Emulator> emulators(files.size());
+  for (auto _ : state)
+    benchmark::DoNotOptimize(loader.load(files, emulators));
+  state.SetItemsProcessed(state.iterations() * files.size());
+}
+BENCHMARK(BM_LoadCorpus)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_SaveState(benchmark::State& state) {
+  Emulator emulator = load("data/state_breakpoints.txt");
+  const std::string filename = temp_file("emulator-bench-state.txt");
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.save_state(filename));
+  std::filesystem::remove(filename);
+}
+BENCHMARK(BM_SaveState);
+
+void BM_LoadBinaryState(benchmark::State& state) {
+  const std::string filename = temp_file("emulator-bench-state.bin");
+  load("data/state_breakpoints.txt").save_binary_state(filename);
+
+  Emulator emulator;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.load_binary_state(filename));
+  std::filesystem::remove(filename);
+}
+BENCHMARK(BM_LoadBinaryState);
+
+void BM_SaveBinaryState(benchmark::State& state) {
+  Emulator emulator = load("data/state_breakpoints.txt");
+  const std::string filename = temp_file("emulator-bench-state.bin");
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.save_binary_state(filename));
+  std::filesystem::remove(filename);
+}
+BENCHMARK(BM_SaveBinaryState);
+
+void BM_ServerBatch(benchmark::State& state) {
+  // One batch of a run and a state read for each of range(0) resident sessions
+  const int sessions = state.range(0);
+  const std::string text = [] {
+    std::ifstream file("data/state2.txt", std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  }();
+
+  auto command = [](std::string& out, ServerOp op, uint32_t session, const std::string& payload) {
+    ServerCommandHeader header{};
+    header.op = op;
+    header.session = session;
+    header.length = payload.size();
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.append(payload);
+  };
+  auto batch = [](const std::string& commands, uint32_t count) {
+    const ServerBatchHeader header{static_cast<uint32_t>(commands.size()), count};
+    return std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + commands;
+  };
+
+  EmulatorServer server;
+  ServerResponse response;
+  std::string loads;
+  for (int session = 0; session < sessions; ++session)
+    command(loads, SERVER_LOAD_TEXT, session, text);
+  const std::string load_batch = batch(loads, sessions);
+  server.handle(reinterpret_cast<const byte_t*>(load_batch.data()), load_batch.size(), response);
+
+  const int32_t steps = 100;
+  std::string requests;
+  for (int session = 0; session < sessions; ++session) {
+    command(requests, SERVER_RUN, session, std::string(reinterpret_cast<const char*>(&steps), sizeof(steps)));
+    command(requests, SERVER_READ_STATE, session, "");
+  }
+  const std::string request_batch = batch(requests, 2 * sessions);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(server.handle(reinterpret_cast<const byte_t*>(request_batch.data()), request_batch.size(), response));
+    benchmark::DoNotOptimize(response.pieces());
+  }
+  state.SetItemsProcessed(state.iterations() * 2 * sessions);
+}
+BENCHMARK(BM_ServerBatch)->Arg(1)->Arg(64);
+
+void BM_FileRequest(benchmark::State& state) {
+  // The same run and state read through binary state files, as an RPC layer around the library would
+  const std::string filename = temp_file("emulator-bench-request.bin");
+  load("data/state2.txt").save_binary_state(filename);
+
+  Emulator emulator;
+  for (auto _ : state) {
+    emulator.load_binary_state(filename);
+    emulator.run(100);
+    benchmark::DoNotOptimize(emulator.save_binary_state(filename));
+  }
+  state.SetItemsProcessed(state.iterations() * 2);
+  std::filesystem::remove(filename);
+}
+BENCHMARK(BM_FileRequest);
+
+/**
+ * A stream buffer that throws everything away
+ */
+class NullBuffer : public std::streambuf {
+  protected:
+    int overflow(int c) override {
+      return c;
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+      return count;
+    }
+};
+
+void BM_PrintProgram(benchmark::State& state) {
+  Emulator emulator = load("data/state2.txt");
+  NullBuffer discard;
+  std::streambuf* original = std::cout.rdbuf(&discard);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.print_program());
+  std::cout.rdbuf(original);
+}
+BENCHMARK(BM_PrintProgram);
+
+void BM_Disassemble(benchmark::State& state) {
+  // The same listing into a buffer
+  Emulator emulator = load("data/state2.txt");
+  std::vector<char> buffer(DISASSEMBLY_PROGRAM_MAX);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(emulator.disassemble(buffer.data()));
+}
+BENCHMARK(BM_Disassemble);
+
+void BM_DisassemblySink(benchmark::State& state) {
+  // Many listings streamed into one sink
+  Emulator emulator = load("data/state2.txt");
+  NullBuffer discard;
+  std::ostream out(&discard);
+  DisassemblySink sink(out);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(sink.write_program(emulator));
+}
+BENCHMARK(BM_DisassemblySink);
+
+// -------------------------   MACROBENCHMARKS     -------------------------
+
+template <class Runner>
+void BM_Program(benchmark::State& state, const char* filename, Runner runner) {
+  Emulator emulator = load(filename);
+
+  // Run flat out, stopping only where the program parks
+  stop_at_parking(emulator);
+  const EmulatorSnapshot initial = emulator.snapshot();
+
+  long long total = 0;
+  for (auto _ : state) {
+    emulator.restore(initial);
+
+    long long remaining = program_cycles;
+    while (remaining > 0) {
+      const int chunk = remaining < 1000000 ? remaining : 1000000;
+      const int before = emulator.cycles();
+      const int success = std::invoke(runner, emulator, chunk);
+      const int executed = emulator.cycles() - before;
+      remaining -= executed;
+
+      // Program errors and parking end the program, so start it again. Also
+      // start again long before the cycle counter could overflow
+      if (executed == 0 && emulator.cycles() == initial.cycles()) {
+        state.SkipWithError("The program stops before executing any instruction");
+        return;
+      }
+      if (!success || parked(emulator) || emulator.cycles() > (1 << 30))
+        emulator.restore(initial);
+    }
+    total += program_cycles;
+  }
+  report_mips(state, total);
+}
+
+void BM_Counters(benchmark::State& state, const char* filename, Engine engine) {
+  // BM_Program with the host and engine counters around every chunk
+  Emulator emulator = load(filename);
+  stop_at_parking(emulator);
+  const EmulatorSnapshot initial = emulator.snapshot();
+  HostCounters host;
+
+  RunMeasurement total;
+  long long cycles = 0;
+  for (auto _ : state) {
+    emulator.restore(initial);
+
+    for (long long remaining = program_cycles; remaining > 0;) {
+      const int chunk = remaining < 1000000 ? remaining : 1000000;
+      const RunMeasurement measurement = measure_run(emulator, chunk, host, engine);
+      remaining -= measurement.cycles;
+      cycles += measurement.cycles;
+
+      for (int event = 0; event < NUM_HOST_EVENTS; ++event)
+        total.host.at(event) += measurement.host.at(event);
+      total.engine.decodes += measurement.engine.decodes;
+      total.engine.allocations += measurement.engine.allocations;
+      total.engine.breakpoint_checks += measurement.engine.breakpoint_checks;
+      total.engine.cache_hits += measurement.engine.cache_hits;
+
+      if (measurement.cycles == 0 && emulator.cycles() == initial.cycles()) {
+        state.SkipWithError("The program stops before executing any instruction");
+        return;
+      }
+      if (measurement.status == RUN_ERROR || parked(emulator) || emulator.cycles() > (1 << 30))
+        emulator.restore(initial);
+    }
+  }
+
+  report_mips(state, cycles);
+  for (int event = 0; event < NUM_HOST_EVENTS; ++event)
+    if (host.available(static_cast<HostEvent>(event)))
+      state.counters[std::string("host_") + host_event_name(static_cast<HostEvent>(event)) + "_per_instr"] =
+        static_cast<double>(total.host.at(event)) / cycles;
+  state.counters["decodes_per_instr"] = static_cast<double>(total.engine.decodes) / cycles;
+  state.counters["allocations_per_instr"] = static_cast<double>(total.engine.allocations) / cycles;
+  state.counters["breakpoint_checks_per_instr"] = static_cast<double>(total.engine.breakpoint_checks) / cycles;
+  state.counters["cache_hits_per_instr"] = static_cast<double>(total.engine.cache_hits) / cycles;
+}
+
+void register_programs() {
+  static const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state_selfmod.txt"};
+  static const std::pair<const char*, Engine> engines[] = {
+    {"run", &Emulator::run}, {"run_fast", &Emulator::run_fast}, {"run_blocks", &Emulator::run_blocks},
+  };
+
+  for (const char* file : files)
+    for (const auto& engine : engines)
+      benchmark::RegisterBenchmark((std::string("BM_Program/") + engine.first + "/" + file).c_str(), BM_Program<Engine>, file, engine.second)
+        ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+  for (const char* file : files)
+    for (const auto& engine : engines)
+      benchmark::RegisterBenchmark((std::string("BM_Counters/") + engine.first + "/" + file).c_str(), BM_Counters, file, engine.second)
+        ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+  // The programs compiled ahead of time from the same files (see aot.h)
+  static const std::pair<const char*, const AotProgram*> compiled[] = {
+    {"data/state1.txt", &aot_state1}, {"data/state2.txt", &aot_state2}, {"data/state_selfmod.txt", &aot_state_selfmod},
+  };
+
+  for (const auto& [file, program] : compiled) {
+    auto run_compiled = [program = program](Emulator& emulator, int steps) { return emulator.run_compiled(steps, *program); };
+    benchmark::RegisterBenchmark((std::string("BM_Program/run_compiled/") + file).c_str(), BM_Program<decltype(run_compiled)>, file, run_compiled)
+      ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+  }
+
+  // Coroutine runs suspending every 1000 cycles, against run_fast()
+  auto run_async = [](Emulator& emulator, int steps) {
+    RunTask task = emulator.run_async(steps, 1000);
+    while (task.resume()) {}
+    return task.result().status;
+  };
+  for (const char* file : files)
+    benchmark::RegisterBenchmark((std::string("BM_Program/run_async/") + file).c_str(), BM_Program<decltype(run_async)>, file, run_async)
+      ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+}
+
+void BM_RunInterleaved(benchmark::State& state) {
+  // 1000 sessions of the state2 loop sharing one thread, in slices of range(0) cycles
+  const int slice = state.range(0);
+  Emulator prototype = load("data/state2.txt");
+  prototype.set_loop_detection(0);
+  std::vector<Emulator> emulators(1000, prototype);
+
+  long long total = 0;
+  for (auto _ : state) {
+    std::vector<RunTask> tasks;
+    tasks.reserve(emulators.size());
+    for (Emulator& emulator : emulators)
+      tasks.push_back(emulator.run_async(100000, slice));
+    run_interleaved(tasks);
+
+    for (const RunTask& task : tasks)
+      total += task.result().cycles;
+  }
+  report_mips(state, total);
+}
+BENCHMARK(BM_RunInterleaved)->Arg(10)->Arg(100)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+void BM_MultiCore(benchmark::State& state) {
+  // range(0) cores of state2, switching every range(1) instructions (0: round robin)
+  const Emulator image = load("data/state2.txt");
+  const int num_cores = state.range(0);
+  const int quantum = state.range(1);
+  const int steps = 1000000;
+
+  long long cycles = 0;
+  uint64_t switches = 0;
+  for (auto _ : state) {
+    MultiCoreEmulator multicore(image, num_cores);
+    multicore.set_schedule(quantum == 0 ? SCHEDULE_ROUND_ROBIN : SCHEDULE_QUANTUM, std::max<int>(quantum, 1));
+    if (multicore.run(steps) != RUN_STOPPED) {
+      state.SkipWithError("state2 stopped early");
+      return;
+    }
+    cycles += multicore.instructions();
+    switches += multicore.switches();
+  }
+  report_mips(state, cycles);
+  state.counters["switches_per_instr"] = static_cast<double>(switches) / cycles;
+}
+BENCHMARK(BM_MultiCore)->Args({1, 0})->Args({4, 0})->Args({4, 10})->Args({4, 1000})->Args({16, 100})->Unit(benchmark::kMillisecond);
+
+void BM_MultiCoreThreaded(benchmark::State& state) {
+  // range(0) cores of state2 on their own threads
+  const Emulator image = load("data/state2.txt");
+  const int num_cores = state.range(0);
+  const int steps = 1000000;
+
+  long long cycles = 0;
+  for (auto _ : state) {
+    MultiCoreEmulator multicore(image, num_cores);
+    multicore.run_threaded(steps);
+    for (int core = 0; core < num_cores; ++core)
+      cycles += multicore.cycles(core);
+  }
+  report_mips(state, cycles);
+}
+BENCHMARK(BM_MultiCoreThreaded)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_JobRunner(benchmark::State& state) {
+  // Many copies of the state2 loop, each running for a while. Without loop
+  // detection every cycle is executed, so this measures how the workers scale
+  const int threads = state.range(0);
+  std::vector<EmulatorJob> jobs(256, EmulatorJob{"data/state2.txt", 200000, {}});
+  Emulator prototype;
+  prototype.set_loop_detection(0);
+  const JobRunner runner(threads, prototype);
+
+  long long cycles = 0;
+  for (auto _ : state)
+    for (const JobResult& result : runner.run(jobs))
+      cycles += result.cycles;
+  report_mips(state, cycles);
+  state.counters["MIPS_per_thread"] = benchmark::Counter(cycles / 1e6 / threads, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_JobRunner)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+}
+
+int main(int argc, char** argv) {
+  // Our own option, the rest go to Google Benchmark
+  std::vector<char*> args;
+  for (int arg = 0; arg < argc; ++arg) {
+    if (strncmp(argv[arg], "--cycles=", 9) == 0)
+      program_cycles = std::stoll(argv[arg] + 9);
+    else
+      args.push_back(argv[arg]);
+  }
+  int num_args = args.size();
+
+  register_programs();
+  benchmark::AddCustomContext("checked_memory", EMULATOR_CHECKED_MEMORY ? "yes" : "no");
+  std::string events;
+  const HostCounters host;
+  for (int event = 0; event < NUM_HOST_EVENTS; ++event)
+    if (host.available(static_cast<HostEvent>(event)))
+      events += std::string(events.empty() ? "" : ",") + host_event_name(static_cast<HostEvent>(event));
+  benchmark::AddCustomContext("perf_events", events.empty() ? "none" : events);
+  benchmark::Initialize(&num_args, args.data());
+  if (benchmark::ReportUnrecognizedArguments(num_args, args.data()))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
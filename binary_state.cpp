@@ -0,0 +1,158 @@
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "binary_state.h"
+#include "emulator.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// ============= Helpers ==============
+
+int is_binary_state_file(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  char magic[sizeof(BINARY_STATE_MAGIC)];
+
+  if (!file.read(magic, sizeof(magic)))
+    return 0;
+
+  return memcmp(magic, BINARY_STATE_MAGIC, sizeof(magic)) == 0;
+}
+
+// ============= Emulator ==============
+
+int Emulator::load_binary_state(const std::string filename) {
+  // Same as load_state: the old breakpoints and the whole memory go away
+  clear_breakpoints();
+  invalidate_decoded();
+  reset_journal();
+
+#ifndef _WIN32
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(BinaryStateHeader) + MEMORY_SIZE)) {
+    close(fd);
+    return 0;
+  }
+
+  const size_t size = info.st_size;
+  void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return 0;
+
+  const int loaded = load_binary_image(static_cast<const byte_t*>(mapping), size);
+  munmap(mapping, size);
+  return loaded;
+#else
+  std::ifstream file(filename, std::ios::binary);
+  if (!file)
+    return 0;
+
+  std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  return load_binary_image(reinterpret_cast<const byte_t*>(contents.data()), contents.size());
+#endif
+}
+
+int Emulator::load_binary_state_data(const byte_t* data, size_t size) {
+  clear_breakpoints();
+  invalidate_decoded();
+  reset_journal();
+  return load_binary_image(data, size);
+}
+
+int Emulator::load_binary_image(const byte_t* data, size_t size) {
+  if (size < sizeof(BinaryStateHeader) + MEMORY_SIZE)
+    return 0;
+
+  // The mapping is page aligned, but copying the header out keeps this
+  // independent of how we got the bytes
+  BinaryStateHeader header;
+  memcpy(&header, data, sizeof(header));
+
+  if (memcmp(header.magic, BINARY_STATE_MAGIC, sizeof(header.magic)) != 0)
+    return 0;
+  if (header.version != BINARY_STATE_VERSION)
+    return 0;
+  if (header.reserved[0] != 0 || header.reserved[1] != 0)
+    return 0;
+  if (header.total_cycles < 0)
+    return 0;
+
+  // acc and pc are single bytes, so they can't be out of range
+  total_cycles = header.total_cycles;
+  state.acc = header.acc;
+  state.pc = header.pc;
+  memcpy(state.memory.data(), data + sizeof(header), MEMORY_SIZE);
+  state.rehash();
+
+  size_t offset = sizeof(header) + MEMORY_SIZE;
+  for (int idx = 0; idx < header.num_breakpoints; ++idx) {
+    if (size - offset < BINARY_STATE_BREAKPOINT_SIZE)
+      return 0;
+
+    const addr_t address = data[offset];
+    uint16_t length;
+    memcpy(&length, data + offset + 1, sizeof(length));
+    offset += BINARY_STATE_BREAKPOINT_SIZE;
+
+    if (size - offset < length)
+      return 0;
+
+    // Only names the text format can hold, so that every binary state can be converted
+    const std::string_view name(reinterpret_cast<const char*>(data + offset), length);
+    if (!valid_breakpoint_name(name) || !insert_breakpoint(address, name))
+      return 0;
+    offset += length;
+  }
+
+  // Nothing is allowed after the last breakpoint
+  return offset == size;
+}
+
+int Emulator::save_binary_state(const std::string filename) const {
+  BinaryStateHeader header{};
+  memcpy(header.magic, BINARY_STATE_MAGIC, sizeof(header.magic));
+  header.version = BINARY_STATE_VERSION;
+  header.num_breakpoints = num_breakpoints();
+  header.total_cycles = total_cycles;
+  header.acc = state.acc;
+  header.pc = state.pc;
+
+  // Build the whole file in memory and write it with a single call
+  std::string image(reinterpret_cast<const char*>(&header), sizeof(header));
+  image.append(reinterpret_cast<const char*>(state.memory.data()), MEMORY_SIZE);
+
+  for (int idx = 0; idx < num_breakpoints(); ++idx) {
+    const Breakpoint& breakpoint = breakpoints.at(idx);
+    const std::string_view name = breakpoint.get_name();
+
+    // Names must fit in the 16-bit length field
+    if (name.size() > UINT16_MAX)
+      return 0;
+
+    const uint16_t length = name.size();
+    image.push_back(static_cast<char>(breakpoint.get_address()));
+    image.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    image.append(name);
+  }
+
+  std::ofstream file(filename, std::ios::binary);
+  if (!file)
+    return 0;
+
+  file.write(image.data(), image.size());
+  file.close();
+  return !file.fail();
+}
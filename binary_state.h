@@ -0,0 +1,70 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: binary_state.h
+//
+// A compact binary alternative to the text state format of load_state() and
+// save_state(), for checkpointing many machines quickly.
+//
+// A binary state file is laid out exactly as it sits in memory:
+//   1. a fixed-size BinaryStateHeader (16 bytes)
+//   2. the MEMORY_SIZE raw memory bytes
+//   3. `num_breakpoints` packed breakpoint records, each made of
+//      - 1 byte: the address
+//      - 2 bytes: the length of the name
+//      - the name bytes, without a terminator
+//
+// Loading maps the file and only validates it; there is nothing to parse.
+// Multi-byte fields are stored in the byte order of the machine that
+// wrote the file, so binary states are meant for checkpointing, not exchange.
+// The text format stays the default and the one to use between machines.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include <cstddef>
+#include <string>
+
+/**
+ * The first four bytes of every binary state file
+ */
+constexpr char BINARY_STATE_MAGIC[4] = {'E', 'M', 'U', 'S'};
+
+/**
+ * The format version written by save_binary_state()
+ */
+constexpr uint16_t BINARY_STATE_VERSION = 1;
+
+/**
+ * The fixed-size part at the start of every binary state file
+ */
+struct BinaryStateHeader {
+  char magic[4];
+  uint16_t version;
+  uint16_t num_breakpoints;
+  int32_t total_cycles;
+  uint8_t acc;
+  uint8_t pc;
+
+  /**
+   * Must be zero
+   */
+  uint8_t reserved[2];
+};
+
+static_assert(sizeof(BinaryStateHeader) == 16, "BinaryStateHeader must have no padding");
+
+/**
+ * The size of a breakpoint record without its name
+ */
+constexpr size_t BINARY_STATE_BREAKPOINT_SIZE = 3;
+
+/**
+ * Check whether a file starts like a binary state file
+ *
+ * Only the magic bytes are checked, so this is meant for choosing between
+ * load_state() and load_binary_state(), not for validation
+ *
+ * @param filename The file to check
+ * @return 1 if the file starts with BINARY_STATE_MAGIC, 0 otherwise
+ */
+int is_binary_state_file(const std::string& filename);
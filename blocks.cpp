@@ -0,0 +1,210 @@
+#include <utility>
+#include "emulator.h"
+#include "instructions.h"
+
+// ============= BlockCache ==============
+
+const TranslatedBlock* BlockCache::find(addr_t pc) const {
+  const TranslatedBlock& block = blocks.at(pc / INSTRUCTION_SIZE);
+  return block.valid ? &block : NULL;
+}
+
+const TranslatedBlock* BlockCache::translate(const std::array<byte_t, MEMORY_SIZE>& memory, addr_t pc, const std::bitset<MEMORY_SIZE>& stops) {
+  TranslatedBlock& block = blocks.at(pc / INSTRUCTION_SIZE);
+
+  block.ops.clear();
+  block.cycles = 0;
+  block.first_slot = pc / INSTRUCTION_SIZE;
+
+  for (;;) {
+    const byte_t opcode = memory[pc];
+    const byte_t address = memory[pc + 1];
+
+    // Invalid instructions are left for the interpreter to report
+    if (opcode >= NUM_OPCODES)
+      break;
+
+    // Fuse with the previous op if it was a plain LDR. The LDR cannot be the
+    // target of a jump from within the block, so it always runs with this op
+    const bool is_alu = (opcode == ADD || opcode == AND || opcode == ORR || opcode == XOR);
+    if (is_alu && !block.ops.empty() && block.ops.back().kind == BOP_LDR) {
+      BlockOp& prev = block.ops.back();
+      prev.kind = static_cast<BlockOpKind>(BOP_LDR_ADD + opcode);
+      prev.second = address;
+    } else {
+      block.ops.push_back({static_cast<BlockOpKind>(opcode), address, 0, static_cast<byte_t>(pc)});
+    }
+
+    ++block.cycles;
+
+    // Branches always end the block
+    if (opcode == JMP || opcode == JNE)
+      break;
+
+    // Don't wrap around the end of memory and don't fall into a breakpoint,
+    // run_blocks() has to check it once we get there
+    pc += INSTRUCTION_SIZE;
+    if (pc >= MEMORY_SIZE || stops.test(pc))
+      break;
+  }
+
+  // Empty blocks are not kept: the invalid instruction might be overwritten
+  // with a valid one before the next visit
+  block.last_slot = block.first_slot + block.cycles - 1;
+  block.valid = (block.cycles > 0);
+  for (int slot = block.first_slot; slot <= block.last_slot; ++slot)
+    ++coverage.at(slot);
+
+  return &block;
+}
+
+int BlockCache::invalidate(const std::array<byte_t, MEMORY_SIZE>& memory, addr_t address) {
+  address &= ARCH_BITMASK;
+  const int slot = address / INSTRUCTION_SIZE;
+  const bool operand = (address % INSTRUCTION_SIZE == 1);
+
+  // Common case: a store into data
+  int remaining = coverage.at(slot);
+  if (remaining == 0)
+    return 0;
+
+  // Blocks are indexed by their first slot, so the ones covering this slot start at it or before it
+  for (int first = slot; first >= 0 && remaining > 0; --first) {
+    TranslatedBlock& block = blocks.at(first);
+    if (!block.valid || block.last_slot < slot)
+      continue;
+    --remaining;
+
+    if (operand) {
+      // The op of the instruction, or the op it was fused into
+      const addr_t pc = address - 1;
+      for (BlockOp& op : block.ops) {
+        if (op.pc == pc)
+          op.first = memory[address];
+        else if (op.kind >= BOP_LDR_ADD && op.pc + INSTRUCTION_SIZE == pc)
+          op.second = memory[address];
+      }
+      continue;
+    }
+
+    for (int covered = block.first_slot; covered <= block.last_slot; ++covered)
+      --coverage.at(covered);
+    block.valid = false;
+  }
+
+  return !operand;
+}
+
+void BlockCache::clear() {
+  for (TranslatedBlock& block : blocks)
+    block.valid = false;
+  coverage.fill(0);
+}
+
+// ============= Emulator ==============
+
+int Emulator::run_blocks(int steps) {
+  if (needs_run_fast(0))
+    return run_fast(steps);
+
+  loops.reset();
+
+  for (; steps > 0;) {
+    if ((state.pc % 2) == 1)
+      return 0;
+
+    const TranslatedBlock* block = blocks.find(state.pc);
+    if (block == NULL)
+      block = blocks.translate(state.memory, state.pc, breakpoint_addresses());
+
+    // An empty block means an invalid instruction, same as decode() returning NULL in run()
+    if (block->cycles == 0)
+      return 0;
+
+    // Not enough steps left for the whole block: the run ends inside it, so
+    // let the interpreter do the last few instructions one by one
+    if (block->cycles > steps) {
+      NullObserver observer;
+      return run_loop(steps, observer);
+    }
+
+    const addr_t pc = state.pc;
+    const int executed = execute_block(*block);
+    total_cycles += executed;
+    steps -= executed;
+
+    // Blocks never fall through into a breakpoint, so only the PC we ended
+    // at needs to be checked
+    if (is_breakpoint() == 1)
+      return RUN_STOPPED;
+
+    // A jump to itself repeats forever without changing anything, so when
+    // no loop detection needs to see it the rest of the run is spent there
+    if (state.pc == pc && block->cycles == 1 && !loops.searching()) {
+      total_cycles += steps;
+      break;
+    }
+
+    // Loop detection, same as in run(). Only the last instruction of a block
+    // can move the PC backwards
+    const addr_t last_pc = pc + (executed - 1) * INSTRUCTION_SIZE;
+    if (state.pc <= last_pc && loops.searching()) {
+      const int period = loops.visit(state.pc, state.acc, total_cycles);
+      if (period > 0)
+        steps -= skip_loop(period, steps);
+    }
+  }
+
+  return loops.looping() ? RUN_LOOPING : RUN_STOPPED;
+}
+
+int Emulator::execute_block(const TranslatedBlock& block) {
+  // acc lives in a local for the whole block. ADD is the only operation that
+  // can produce bits above ARCH_BITS and none of the later operations depend
+  // on those bits, so masking is only needed before JNE, STR, and at the end
+  data_t acc = state.acc;
+
+  int executed = 0;
+  for (const BlockOp& op : block.ops) {
+    switch (op.kind) {
+      case BOP_ADD: acc += state.cell(op.first); break;
+      case BOP_AND: acc &= state.cell(op.first); break;
+      case BOP_ORR: acc |= state.cell(op.first); break;
+      case BOP_XOR: acc ^= state.cell(op.first); break;
+      case BOP_LDR: acc = state.cell(op.first); break;
+      case BOP_LDR_ADD: acc = state.cell(op.first) + state.cell(op.second); ++executed; break;
+      case BOP_LDR_AND: acc = state.cell(op.first) & state.cell(op.second); ++executed; break;
+      case BOP_LDR_ORR: acc = state.cell(op.first) | state.cell(op.second); ++executed; break;
+      case BOP_LDR_XOR: acc = state.cell(op.first) ^ state.cell(op.second); ++executed; break;
+      case BOP_STR:
+        acc &= ARCH_BITMASK;
+        state.store(op.first, acc);
+        // Self-modifying code: if we wrote an opcode into any translated
+        // block, this one included, the rest of this block might be stale.
+        // Stop here and continue from the next instruction with a fresh
+        // translation. New operands are already patched into the ops
+        if (invalidate_decoded(op.first)) {
+          state.acc = acc;
+          state.pc = (op.pc + INSTRUCTION_SIZE) & ARCH_BITMASK;
+          return executed + 1;
+        }
+        break;
+      case BOP_JMP:
+        state.acc = acc & ARCH_BITMASK;
+        state.pc = op.first;
+        return executed + 1;
+      case BOP_JNE:
+        acc &= ARCH_BITMASK;
+        state.acc = acc;
+        state.pc = (acc != 0) ? op.first : ((op.pc + INSTRUCTION_SIZE) & ARCH_BITMASK);
+        return executed + 1;
+    }
+    ++executed;
+  }
+
+  // Fell off the end of the block without a branch (breakpoint or end of memory ahead)
+  const BlockOp& last = block.ops.back();
+  state.acc = acc & ARCH_BITMASK;
+  state.pc = (last.pc + (last.kind >= BOP_LDR_ADD ? 2 : 1) * INSTRUCTION_SIZE) & ARCH_BITMASK;
+  return executed;
+}
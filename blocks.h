@@ -0,0 +1,131 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: blocks.h
+//
+// Basic-block translation for Emulator::run_blocks().
+//
+// A block is a straight-line run of instructions starting at some slot and
+// ending at the first JMP/JNE, right before an invalid instruction, at the end
+// of memory, or right before a slot with a breakpoint. Every block is
+// translated once into a short list of BlockOps, where common instruction
+// pairs are fused into a single op, and then replayed with acc kept in a local
+// variable and masked once at the end of the block.
+//
+// Translated blocks are only valid as long as the memory they were translated
+// from doesn't change, so the cache keeps track of which slots are covered by
+// blocks and drops the affected blocks when a store lands in one of them. A
+// store into the operand byte of an instruction (self-modifying code that
+// walks through memory, like state2) doesn't change where blocks end or what
+// is fused, so the operand is patched into the blocks instead.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include <array>
+#include <bitset>
+#include <vector>
+
+/**
+ * Kinds of operations in a translated block
+ *
+ * The first eight match InstructionOpcode one to one, the rest are fused
+ * superinstructions that stand for two consecutive instructions
+ */
+enum BlockOpKind : uint8_t {
+  BOP_ADD = 0,
+  BOP_AND,
+  BOP_ORR,
+  BOP_XOR,
+  BOP_LDR,
+  BOP_STR,
+  BOP_JMP,
+  BOP_JNE,
+  // LDR a followed by ADD/AND/ORR/XOR b
+  BOP_LDR_ADD,
+  BOP_LDR_AND,
+  BOP_LDR_ORR,
+  BOP_LDR_XOR,
+};
+
+/**
+ * One operation of a translated block
+ *
+ * `first` is the operand of the (first) instruction, `second` the operand of
+ * the second instruction of a fused pair. `pc` is the address of the first
+ * instruction, needed to compute the fall-through PC of the final JNE and the
+ * PC after an early exit.
+ */
+struct BlockOp {
+  BlockOpKind kind;
+  byte_t first;
+  byte_t second;
+  byte_t pc;
+};
+
+/**
+ * A translated straight-line run of instructions
+ */
+struct TranslatedBlock {
+  std::vector<BlockOp> ops;
+
+  /**
+   * Number of instructions in the block, i.e. the cycles a full run takes
+   */
+  int cycles = 0;
+
+  /**
+   * First and last instruction slot (pc / 2) the block was translated from
+   */
+  int first_slot = 0;
+  int last_slot = 0;
+
+  bool valid = false;
+};
+
+/**
+ * The per-emulator cache of translated blocks, indexed by the slot they start at
+ */
+class BlockCache {
+  public:
+    /**
+     * Find an already translated block starting at the given PC
+     *
+     * @param pc The (even) address where the block starts
+     * @return A non-owning pointer to the block, or NULL if there is no valid translation
+     */
+    const TranslatedBlock* find(addr_t pc) const;
+
+    /**
+     * Translate the block starting at the given PC
+     *
+     * @param memory The memory to translate from
+     * @param pc The (even) address where the block starts
+     * @param stops Addresses with breakpoints. No block falls through into one
+     * @return A non-owning pointer to the block. The block is empty if the instruction at pc is invalid
+     */
+    const TranslatedBlock* translate(const std::array<byte_t, MEMORY_SIZE>& memory, addr_t pc, const std::bitset<MEMORY_SIZE>& stops);
+
+    /**
+     * Update the blocks translated from the slot holding this address, after a write
+     *
+     * Blocks covering an opcode byte are dropped, blocks covering an operand
+     * byte get the new operand.
+     *
+     * @param memory The memory, with the new value
+     * @param address The address that was written
+     * @return 1 if at least one block was dropped, 0 otherwise
+     */
+    int invalidate(const std::array<byte_t, MEMORY_SIZE>& memory, addr_t address);
+
+    /**
+     * Drop all blocks
+     */
+    void clear();
+
+  private:
+    std::array<TranslatedBlock, MAX_INSTRUCTIONS> blocks;
+
+    // How many valid blocks cover each slot. Stores into slots with a zero
+    // count (i.e. almost all stores) don't need to look at the blocks at all
+    std::array<int, MAX_INSTRUCTIONS> coverage{};
+};
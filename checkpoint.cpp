@@ -0,0 +1,288 @@
+#include "checkpoint.h"
+#include "binary_state.h"
+#include "emulator.h"
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+// ============= Helpers ==============
+
+namespace {
+
+constexpr int CHECKPOINT_LINES = MEMORY_SIZE / DIRTY_LINE_SIZE;
+constexpr uint16_t ALL_LINES = (1u << CHECKPOINT_LINES) - 1;
+
+typedef std::vector<std::pair<addr_t, std::string>> BreakpointList;
+
+/**
+ * A whole record, header included
+ *
+ * @param breakpoints The breakpoints to store, NULL for none
+ * @return the record, empty if a breakpoint name doesn't fit in its length field
+ */
+std::string encode_record(int kind, const std::array<byte_t, MEMORY_SIZE>& memory, data_t acc, addr_t pc, int total_cycles,
+                          uint16_t lines, const BreakpointList* breakpoints) {
+  CheckpointRecordHeader header{};
+  header.kind = kind;
+  header.flags = (breakpoints != NULL) ? CHECKPOINT_BREAKPOINTS : 0;
+  header.acc = acc;
+  header.pc = pc;
+  header.total_cycles = total_cycles;
+  header.lines = lines;
+  header.num_breakpoints = (breakpoints != NULL) ? breakpoints->size() : 0;
+
+  std::string record(sizeof(header), '\0');
+  for (int line = 0; line < CHECKPOINT_LINES; ++line)
+    if ((lines >> line) & 1)
+      record.append(reinterpret_cast<const char*>(&memory.at(line * DIRTY_LINE_SIZE)), DIRTY_LINE_SIZE);
+
+  if (breakpoints != NULL) {
+    for (const auto& [address, name] : *breakpoints) {
+      if (name.size() > UINT16_MAX)
+        return std::string();
+
+      const uint16_t length = name.size();
+      record.push_back(static_cast<char>(address));
+      record.append(reinterpret_cast<const char*>(&length), sizeof(length));
+      record.append(name);
+    }
+  }
+
+  header.size = record.size() - sizeof(header);
+  memcpy(record.data(), &header, sizeof(header));
+  return record;
+}
+
+std::string encode_header() {
+  CheckpointLogHeader header{};
+  memcpy(header.magic, CHECKPOINT_LOG_MAGIC, sizeof(header.magic));
+  header.version = CHECKPOINT_LOG_VERSION;
+  return std::string(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+}
+
+// ============= CheckpointLog ==============
+
+int CheckpointLog::open(const std::string& filename, size_t compact_size) {
+  close();
+  this->filename = filename;
+  this->compact_size = compact_size;
+  num_records = 0;
+  file_size = 0;
+  breakpoints.clear();
+
+  file.open(filename, std::ios::binary | std::ios::trunc);
+  if (!file)
+    return 0;
+
+  const std::string header = encode_header();
+  if (!file.write(header.data(), header.size()).flush()) {
+    close();
+    return 0;
+  }
+  file_size = header.size();
+  return 1;
+}
+
+void CheckpointLog::close() {
+  if (file.is_open())
+    file.close();
+  file.clear();
+}
+
+int CheckpointLog::compact() {
+  if (!is_open() || num_records == 0)
+    return 0;
+
+  const std::string image = encode_header() +
+                            encode_record(CHECKPOINT_BASE, memory, acc, pc, total_cycles, ALL_LINES, &breakpoints);
+  const std::string temporary = filename + ".compact";
+  {
+    std::ofstream compacted(temporary, std::ios::binary | std::ios::trunc);
+    if (!compacted || !compacted.write(image.data(), image.size()).flush())
+      return 0;
+  }
+
+  file.close();
+  const int renamed = std::rename(temporary.c_str(), filename.c_str()) == 0;
+
+  // Either way, keep appending to whichever log is there
+  file.open(filename, std::ios::binary | std::ios::app);
+  if (!renamed || !file)
+    return 0;
+
+  file_size = image.size();
+  num_records = 1;
+  return 1;
+}
+
+int CheckpointLog::is_open() const {
+  return file.is_open();
+}
+
+int CheckpointLog::records() const {
+  return num_records;
+}
+
+size_t CheckpointLog::size() const {
+  return file_size;
+}
+
+int CheckpointLog::checkpoint(const ProcessorState& state, int total_cycles, const std::vector<Breakpoint>& current) {
+  if (!is_open())
+    return 0;
+
+  const int base = (num_records == 0);
+  uint16_t lines = ALL_LINES;
+  if (!base) {
+    lines = 0;
+    for (int line = 0; line < CHECKPOINT_LINES; ++line)
+      if (state.is_dirty(line))
+        lines |= 1u << line;
+  }
+
+  // Breakpoints rarely change, so they are only written when they do
+  int changed = base || current.size() != breakpoints.size();
+  for (size_t idx = 0; !changed && idx < current.size(); ++idx)
+    changed = current.at(idx).get_address() != breakpoints.at(idx).first || current.at(idx).get_name() != breakpoints.at(idx).second;
+
+  BreakpointList listed;
+  if (changed)
+    for (const Breakpoint& breakpoint : current)
+      listed.emplace_back(breakpoint.get_address(), breakpoint.get_name());
+
+  const std::string record = encode_record(base ? CHECKPOINT_BASE : CHECKPOINT_DELTA, state.memory, state.acc, state.pc,
+                                           total_cycles, lines, changed ? &listed : NULL);
+  if (record.empty() || !append(record))
+    return 0;
+
+  // The record is safe, remember what it holds
+  for (int line = 0; line < CHECKPOINT_LINES; ++line)
+    if ((lines >> line) & 1)
+      memcpy(&memory.at(line * DIRTY_LINE_SIZE), &state.memory.at(line * DIRTY_LINE_SIZE), DIRTY_LINE_SIZE);
+  acc = state.acc;
+  pc = state.pc;
+  this->total_cycles = total_cycles;
+  if (changed)
+    breakpoints = std::move(listed);
+
+  if (compact_size > 0 && file_size > compact_size)
+    return compact();
+  return 1;
+}
+
+int CheckpointLog::append(const std::string& record) {
+  if (!file.write(record.data(), record.size()).flush())
+    return 0;
+
+  file_size += record.size();
+  ++num_records;
+  return 1;
+}
+
+// ============= Emulator ==============
+
+int Emulator::save_checkpoint(CheckpointLog& log) {
+  if (!log.checkpoint(state, total_cycles, breakpoints))
+    return 0;
+
+  state.clear_dirty();
+  return 1;
+}
+
+int Emulator::load_checkpoint_log(const std::string filename) {
+  // Same as load_state: the old breakpoints and the whole memory go away
+  clear_breakpoints();
+  invalidate_decoded();
+  reset_journal();
+
+  std::ifstream file(filename, std::ios::binary);
+  if (!file)
+    return 0;
+  const std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  const char* data = contents.data();
+  const size_t size = contents.size();
+
+  CheckpointLogHeader header;
+  if (size < sizeof(header))
+    return 0;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, CHECKPOINT_LOG_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_LOG_VERSION ||
+      header.reserved[0] != 0 || header.reserved[1] != 0)
+    return 0;
+
+  std::array<byte_t, MEMORY_SIZE> memory{};
+  CheckpointRecordHeader last{};
+  std::vector<std::pair<addr_t, std::string_view>> names;
+  int have_base = 0;
+
+  // A record that was cut short ends the log, it's the one being written
+  size_t offset = sizeof(header);
+  CheckpointRecordHeader record;
+  while (size - offset >= sizeof(record)) {
+    memcpy(&record, data + offset, sizeof(record));
+    offset += sizeof(record);
+    if (size - offset < record.size)
+      break;
+
+    if (record.kind == CHECKPOINT_BASE) {
+      if (record.lines != ALL_LINES || record.flags != CHECKPOINT_BREAKPOINTS)
+        return 0;
+      have_base = 1;
+    } else if (record.kind != CHECKPOINT_DELTA || !have_base || (record.flags & ~CHECKPOINT_BREAKPOINTS) != 0) {
+      return 0;
+    }
+    if (record.total_cycles < 0 || (record.lines & ~ALL_LINES) != 0)
+      return 0;
+
+    // The lines, then the breakpoints, and nothing else
+    const char* payload = data + offset;
+    size_t used = std::popcount(record.lines) * DIRTY_LINE_SIZE;
+    if (used > record.size)
+      return 0;
+    for (int line = 0, stored = 0; line < CHECKPOINT_LINES; ++line)
+      if ((record.lines >> line) & 1)
+        memcpy(&memory.at(line * DIRTY_LINE_SIZE), payload + DIRTY_LINE_SIZE * stored++, DIRTY_LINE_SIZE);
+
+    if (record.flags & CHECKPOINT_BREAKPOINTS) {
+      names.clear();
+      for (int idx = 0; idx < record.num_breakpoints; ++idx) {
+        if (record.size - used < BINARY_STATE_BREAKPOINT_SIZE)
+          return 0;
+        const addr_t address = static_cast<byte_t>(payload[used]);
+        uint16_t length;
+        memcpy(&length, payload + used + 1, sizeof(length));
+        used += BINARY_STATE_BREAKPOINT_SIZE;
+
+        if (length == 0 || record.size - used < length)
+          return 0;
+        names.emplace_back(address, std::string_view(payload + used, length));
+        used += length;
+      }
+    } else if (record.num_breakpoints != 0) {
+      return 0;
+    }
+
+    if (used != record.size)
+      return 0;
+    offset += record.size;
+    last = record;
+  }
+
+  if (!have_base)
+    return 0;
+
+  // acc and pc are single bytes, so they can't be out of range
+  total_cycles = last.total_cycles;
+  state.acc = last.acc;
+  state.pc = last.pc;
+  state.memory = memory;
+  state.rehash();
+
+  for (const auto& [address, name] : names)
+    if (!insert_breakpoint(address, name))
+      return 0;
+  return 1;
+}
@@ -0,0 +1,187 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: checkpoint.h
+//
+// Incremental checkpoints of a long-running Emulator into an append-only log
+// (Emulator::save_checkpoint() and Emulator::load_checkpoint_log()).
+//
+// The first checkpoint of a log is a base record with the whole state, as
+// much as a binary state file holds (see binary_state.h). Every later one is a
+// delta record: the registers and cycles, the memory lines that
+// ProcessorState::dirty_lines marks as written since the previous
+// checkpoint, and the breakpoints only if they changed. So a checkpoint
+// costs in proportion to what the program changed, not to the size of the
+// machine.
+//
+// A log file is laid out as:
+//   1. a CheckpointLogHeader (8 bytes)
+//   2. records, each made of
+//      - a CheckpointRecordHeader (16 bytes)
+//      - DIRTY_LINE_SIZE bytes for every line in the `lines` mask, lowest first
+//      - if it has CHECKPOINT_BREAKPOINTS, `num_breakpoints` breakpoint
+//        records in the format of binary state files
+//
+// Records are only ever appended, and a record that was cut short (e.g.
+// the process died while writing it) is ignored by the replay, which then
+// ends at the checkpoint before it. compact() replaces the log with a single
+// base record of its last checkpoint. Like binary states, logs are stored in
+// the byte order of the machine that wrote them.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include <array>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Breakpoint;
+
+/**
+ * The first four bytes of every checkpoint log
+ */
+constexpr char CHECKPOINT_LOG_MAGIC[4] = {'E', 'M', 'U', 'L'};
+
+/**
+ * The format version written by CheckpointLog
+ */
+constexpr uint16_t CHECKPOINT_LOG_VERSION = 1;
+
+struct CheckpointLogHeader {
+  char magic[4];
+  uint16_t version;
+
+  /**
+   * Must be zero
+   */
+  uint8_t reserved[2];
+};
+
+static_assert(sizeof(CheckpointLogHeader) == 8, "CheckpointLogHeader must have no padding");
+
+/**
+ * The kinds of records
+ */
+enum CheckpointKind {
+  // The whole state: every line, and the breakpoints
+  CHECKPOINT_BASE = 1,
+
+  // What changed since the previous record
+  CHECKPOINT_DELTA = 2,
+};
+
+/**
+ * The flags of a record
+ */
+enum CheckpointFlags {
+  // The breakpoints follow the lines, and replace the previous ones
+  CHECKPOINT_BREAKPOINTS = 1,
+};
+
+struct CheckpointRecordHeader {
+  uint8_t kind;
+  uint8_t flags;
+  uint8_t acc;
+  uint8_t pc;
+  int32_t total_cycles;
+
+  /**
+   * One bit per line stored in the record, line 0 in the lowest bit
+   */
+  uint16_t lines;
+  uint16_t num_breakpoints;
+
+  /**
+   * The bytes in the record after this header
+   */
+  uint32_t size;
+};
+
+static_assert(sizeof(CheckpointRecordHeader) == 16, "CheckpointRecordHeader must have no padding");
+static_assert(MEMORY_SIZE / DIRTY_LINE_SIZE <= 16, "the lines of a record must fit in its mask");
+
+class CheckpointLog {
+  public:
+    CheckpointLog() = default;
+
+    // A log is the only writer of its file
+    CheckpointLog(const CheckpointLog&) = delete;
+    CheckpointLog& operator=(const CheckpointLog&) = delete;
+
+    /**
+     * Start a new log, replacing any file with the same name
+     *
+     * @param filename The file to write
+     * @param compact_size Compact the log whenever a checkpoint takes it past this many bytes, 0 never to compact
+     * @return 1 for success, 0 if the file can't be created
+     */
+    int open(const std::string& filename, size_t compact_size = 0);
+
+    /**
+     * Stop writing. The file stays as it is
+     */
+    void close();
+
+    /**
+     * Replace the log with a single base record of its last checkpoint
+     *
+     * The new log is written next to the old one and renamed over it, so a
+     * crash leaves one of the two complete. Later checkpoints are deltas
+     * from the same state as before, so nothing else changes.
+     *
+     * @return 1 for success, 0 if the log isn't open or couldn't be rewritten
+     */
+    int compact();
+
+    /**
+     * Whether the log is open for writing
+     */
+    int is_open() const;
+
+    /**
+     * The number of records in the file
+     */
+    int records() const;
+
+    /**
+     * The size of the file in bytes
+     */
+    size_t size() const;
+
+  private:
+    friend class Emulator;
+
+    /**
+     * Append a checkpoint of a machine: a base record if the log is empty,
+     * a delta with the dirty lines of `state` otherwise
+     *
+     * @param state The processor state, whose dirty lines the caller clears afterwards
+     * @param total_cycles The cycles of the machine
+     * @param breakpoints Its breakpoints, in their order
+     * @return 1 for success, 0 otherwise
+     */
+    int checkpoint(const ProcessorState& state, int total_cycles, const std::vector<Breakpoint>& breakpoints);
+
+    /**
+     * Append a record to the file and flush it
+     *
+     * @return 1 for success, 0 otherwise
+     */
+    int append(const std::string& record);
+
+    std::string filename;
+    std::ofstream file;
+    size_t compact_size{0};
+    size_t file_size{0};
+    int num_records{0};
+
+    // The machine as of the last checkpoint, for compact() and for telling
+    // whether the breakpoints changed
+    std::array<byte_t, MEMORY_SIZE> memory{};
+    data_t acc{0};
+    addr_t pc{0};
+    int total_cycles{0};
+    std::vector<std::pair<addr_t, std::string>> breakpoints;
+};
@@ -14,6 +14,8 @@
 #include <iostream>
 #include <array>
 #include <memory>
+#include <string>
+#include <type_traits>
 
 //------------------------------------------------------------------------------
 //--------------------               CONSTANTS              --------------------
@@ -25,12 +27,28 @@
 // #define MEMORY_SIZE 256
 // #define MAX_NAME 96
 
+// The constants of the 8-bit machine. They are the ones of Arch8 below, the
+// architecture of Emulator
 constexpr int ARCH_BITS = 8;
 constexpr int ARCH_BITMASK = (1 << ARCH_BITS) - 1;
 constexpr int ARCH_MAXVAL = ARCH_BITMASK;
 constexpr int INSTRUCTION_SIZE = 2;
 constexpr int MEMORY_SIZE = 256;
 constexpr int MAX_NAME = 96;
+#define MAX_INSTRUCTIONS ((MEMORY_SIZE) / (INSTRUCTION_SIZE))
+
+// How ProcessorState::cell() accesses memory: 1 for bounds-checked
+// std::array::at(), which throws on a bad address, 0 for plain indexing with
+// the address masked to the memory size, which can't go out of bounds.
+// Test and sanitizer builds are checked, release (NDEBUG) builds aren't,
+// unless the build sets it explicitly
+#ifndef EMULATOR_CHECKED_MEMORY
+#ifdef NDEBUG
+#define EMULATOR_CHECKED_MEMORY 0
+#else
+#define EMULATOR_CHECKED_MEMORY 1
+#endif
+#endif
 
 
 //------------------------------------------------------------------------------
@@ -87,6 +105,81 @@ typedef int data_t;
  */
 typedef uint8_t byte_t;
 
+//------------------------------------------------------------------------------
+//--------------------            ARCHITECTURES             --------------------
+//------------------------------------------------------------------------------
+
+/**
+ * Everything that depends on the word width and the memory size of the machine
+ *
+ * ProcessorState, InstructionData, InstructionBase and the instruction classes
+ * are templates over one of these, so the masks and sizes are compile-time
+ * constants in every instantiation and the 8-bit machine pays nothing for the
+ * wider ones.
+ *
+ * Memory is an array of cells as wide as a word. An instruction is two cells
+ * (opcode and operand), so the operand can reach every cell of memory.
+ *
+ * @tparam Bits The width of the accumulator and of every memory cell
+ * @tparam MemorySize The number of memory cells, a power of two
+ * @tparam Word The type of the accumulator, wide enough for any sum of two words
+ * @tparam Cell The type of a memory cell
+ */
+template <int Bits, int MemorySize, typename Word, typename Cell>
+struct ArchTraits {
+  typedef Word word_t;
+  typedef Cell cell_t;
+
+  static constexpr int BITS = Bits;
+  static constexpr int MEMORY_SIZE = MemorySize;
+  static constexpr int INSTRUCTION_SIZE = 2;
+  static constexpr int INSTRUCTION_SLOTS = MemorySize / INSTRUCTION_SIZE;
+
+  // What execute() keeps of the accumulator and of the PC. Since memory is a
+  // power of two and addresses are masked, indexing memory is always in bounds
+  static constexpr word_t WORD_MASK = (static_cast<word_t>(1) << Bits) - 1;
+  static constexpr int ADDRESS_MASK = MemorySize - 1;
+
+  static_assert((MemorySize & (MemorySize - 1)) == 0, "memory size must be a power of two");
+  static_assert(static_cast<uint64_t>(MemorySize - 1) <= (UINT64_C(1) << Bits) - 1,
+                "an operand must be able to address every memory cell");
+  static_assert(sizeof(Cell) * 8 >= Bits, "memory cells must hold a whole word");
+  static_assert(sizeof(Word) * 8 > Bits || std::is_unsigned_v<Word>, "the accumulator overflows");
+};
+
+/**
+ * The granularity of dirty memory tracking in ProcessorState, in cells
+ */
+constexpr int DIRTY_LINE_SIZE = 16;
+
+/**
+ * The architecture of Emulator: 8-bit words, 256 bytes of memory
+ */
+typedef ArchTraits<ARCH_BITS, MEMORY_SIZE, data_t, byte_t> Arch8;
+
+/**
+ * 16-bit words, 64K cells of memory
+ */
+typedef ArchTraits<16, 1 << 16, data_t, uint16_t> Arch16;
+
+/**
+ * 32-bit words, 1M cells of memory (4 MiB)
+ */
+typedef ArchTraits<32, 1 << 20, int64_t, uint32_t> Arch32;
+
+/**
+ * The splitmix64 finalizer: spreads every bit of x over the whole result.
+ * The building block of the state hashes
+ */
+constexpr uint64_t hash_mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= UINT64_C(0xbf58476d1ce4e5b9);
+  x ^= x >> 27;
+  x *= UINT64_C(0x94d049bb133111eb);
+  x ^= x >> 31;
+  return x;
+}
+
 /**
  * A basic struct that just holds the two bytes representing the instruction in the memory
  *
@@ -98,23 +191,30 @@ typedef uint8_t byte_t;
  * Note, that instructions themselves are 2 Bytes--1 for Opcode and 1 for Operand
  * 
  */
-struct InstructionData {
-  byte_t opcode;
-  byte_t address;
+template <class Arch>
+struct BasicInstructionData {
+  typename Arch::cell_t opcode;
+  typename Arch::cell_t address;
 };
 
+typedef BasicInstructionData<Arch8> InstructionData;
+
 /**
  * A struct containing all the state of the processor.
  *
  * It's split to its own separate struct so that we can easily access it from
  * both the emulator engine and the instructions' code. It's a struct because
  * it offers little encapsulation or functionality.
+ *
+ * Everything in it is constexpr, so it can also be used in constant
+ * expressions (see constexpr_emulator.h).
  */
-struct ProcessorState {
+template <class Arch>
+struct BasicProcessorState {
   /**
    * This is the only general purpose register.
    */
-  data_t acc = 0;
+  typename Arch::word_t acc = 0;
 
   /**
    * Holds the address of the instruction to be executed next.
@@ -125,22 +225,148 @@ struct ProcessorState {
    * Byte array representing the memory of the system
    */
   // byte_t memory[MEMORY_SIZE];
-  std::array<byte_t, MEMORY_SIZE> memory{};
+  std::array<typename Arch::cell_t, Arch::MEMORY_SIZE> memory{};
+
+  /**
+   * The memory cell at an address, with the access policy of
+   * EMULATOR_CHECKED_MEMORY. Every cell access of the engines and the
+   * instructions goes through here
+   *
+   * @param address The address, inside memory
+   * @return a reference to the cell
+   */
+  constexpr typename Arch::cell_t& cell(addr_t address) {
+#if EMULATOR_CHECKED_MEMORY
+    return memory.at(address);
+#else
+    return memory[address & Arch::ADDRESS_MASK];
+#endif
+  }
+
+  constexpr const typename Arch::cell_t& cell(addr_t address) const {
+#if EMULATOR_CHECKED_MEMORY
+    return memory.at(address);
+#else
+    return memory[address & Arch::ADDRESS_MASK];
+#endif
+  }
+
+  /**
+   * The XOR of the hashes of all memory cells (a Zobrist-style hash, with the
+   * random numbers computed by hash_mix() instead of kept in a table).
+   * A cell holding zero hashes to zero, so all-zero memory hashes to zero.
+   *
+   * store() keeps it up to date in O(1). Code that writes `memory` directly
+   * has to call rehash() afterwards
+   */
+  uint64_t memory_hash = 0;
+
+  /**
+   * One bit per DIRTY_LINE_SIZE cells of memory, set for every line that
+   * store() or rehash() touched since the last clear_dirty(). Incremental
+   * checkpoints (see checkpoint.h) only save these lines
+   */
+  static constexpr int DIRTY_LINES = Arch::MEMORY_SIZE / DIRTY_LINE_SIZE;
+  std::array<uint64_t, (DIRTY_LINES + 63) / 64> dirty_lines{};
+
+  /**
+   * Write a memory cell through cell() and update memory_hash and dirty_lines
+   *
+   * @param address The address, inside memory
+   * @param value The new value, which has to fit in a cell
+   */
+  constexpr void store(addr_t address, typename Arch::cell_t value) {
+    typename Arch::cell_t& target = cell(address);
+    memory_hash ^= cell_hash(address, target) ^ cell_hash(address, value);
+    target = value;
+    mark_dirty(address);
+  }
+
+  /**
+   * Recompute memory_hash from the whole memory, which also marks all of it dirty
+   */
+  constexpr void rehash() {
+    memory_hash = 0;
+    for (addr_t address = 0; address < Arch::MEMORY_SIZE; ++address)
+      memory_hash ^= cell_hash(address, memory[address]) ^ cell_hash(address, 0);
+    for (uint64_t& word : dirty_lines)
+      word = ~UINT64_C(0);
+  }
+
+  /**
+   * Mark the line of an address dirty, for code that writes `memory` directly
+   */
+  constexpr void mark_dirty(addr_t address) {
+    const int line = (address & Arch::ADDRESS_MASK) / DIRTY_LINE_SIZE;
+    dirty_lines[line / 64] |= UINT64_C(1) << (line % 64);
+  }
+
+  /**
+   * Whether a line was written since the last clear_dirty()
+   *
+   * @param line The line, from 0 to DIRTY_LINES - 1
+   */
+  constexpr int is_dirty(int line) const {
+    return (dirty_lines[line / 64] >> (line % 64)) & 1;
+  }
+
+  /**
+   * Forget which lines were written
+   */
+  constexpr void clear_dirty() {
+    for (uint64_t& word : dirty_lines)
+      word = 0;
+  }
+
+  /**
+   * A hash of the whole state (acc, pc and memory) in O(1).
+   * Equal states have equal hashes, whatever got them there
+   */
+  constexpr uint64_t hash() const {
+    return memory_hash ^ hash_mix(UINT64_C(0xac) << 56 | static_cast<uint64_t>(acc)) ^
+           hash_mix(UINT64_C(0x9c) << 56 | static_cast<uint64_t>(pc));
+  }
 
   /**
    * The default constructor.
    * It resets the state of the machine.
    * There might be a more elegant way to achieve the same effect.
    */
-  ProcessorState() {
+  constexpr BasicProcessorState() {
     
   }
+
+  private:
+    // A cell holding `value` adds cell_hash(address, value) ^ cell_hash(address, 0)
+    // to memory_hash. The zero half cancels out when store() swaps two values
+    static constexpr uint64_t cell_hash(addr_t address, uint64_t value) {
+      return hash_mix(static_cast<uint64_t>(address) << 32 | value);
+    }
 };
 
+typedef BasicProcessorState<Arch8> ProcessorState;
+
 //------------------------------------------------------------------------------
 //--------------------               CLASSES                --------------------
 //------------------------------------------------------------------------------
 
+/**
+ * The deleter of the pointers InstructionBase::generateInstruction() returns
+ *
+ * Most instructions are shared, immutable objects that outlive every pointer
+ * to them, so the deleter leaves them alone. It only deletes the instructions
+ * allocated for the caller, which are marked as owned.
+ */
+struct InstructionDeleter {
+  bool owned = false;
+
+  template <class Instruction>
+  void operator()(Instruction* instr) const {
+    if (owned)
+      delete instr;
+  }
+};
+
 /**
  * An interface for all the different kinds of instructions.
  *
@@ -168,13 +394,16 @@ struct ProcessorState {
  * So, do this only if you actually want to have "fun" and you have the
  * necessary bandwidth.
  */
-class InstructionBase {
+template <class Arch>
+class BasicInstructionBase {
   public:
+    typedef BasicProcessorState<Arch> State;
+
     /**
     * I declare the destructor as default here to ensure that any derived classes will have their destructors called
     * Behaviour would be undefined otherwise (the InstructionBase() destructor would be incorrectly called)
     */
-    virtual ~InstructionBase() = default;
+    virtual ~BasicInstructionBase() = default;
 
     /**
      * Modifies the system state by executing the instruction
@@ -185,11 +414,11 @@ class InstructionBase {
      *
      * This method exists to do some instruction-independent bookkeeping after the state has changed:
      * 1. Move the pc to the next instruction
-     * 2. Keep only the lower 8-bits for the pc and the accumulator
+     * 2. Keep only the lower bits of the architecture for the pc and the accumulator
      *
      * @param state the processor state we operate on
      */
-    virtual void execute(ProcessorState& state) const;
+    virtual void execute(State& state) const;
 
     /**
      * Convenience getter for _address
@@ -212,7 +441,7 @@ class InstructionBase {
      * Subclasses provide the concrete, instruction-specific behaviour.
      * @param state the processor state we operate on
      */
-    virtual void _execute(ProcessorState& state) const = 0;
+    virtual void _execute(State& state) const = 0;
 
     /**
      * The name of this instruction class
@@ -223,16 +452,27 @@ class InstructionBase {
      */
     virtual const std::string name() const = 0;
 
+    /**
+     * What generateInstruction() returns: a unique_ptr that only deletes the instructions it owns
+     */
+    typedef std::unique_ptr<BasicInstructionBase, InstructionDeleter> Handle;
+
     /**
      * A class method translating opcodes into InstructionBase objects
      *
-     * The method dynamically allocates an object of the right InstuctionBase
-     * subclass and returns an owning pointer to it.
+     * For architectures with up to 256 memory cells (Arch8) every possible
+     * instruction is built once, in a table of NUM_OPCODES x 256 shared
+     * objects, and the method returns a pointer into it: decoding allocates
+     * nothing and the same bytes always give the same object. Wider
+     * architectures have too many possible instructions for a table, so the
+     * method allocates an object of the right subclass and the handle owns it.
+     *
+     * Either way the handle can be used like the owning pointer of old.
      *
      * @param opcode A number identifying the type of the instruction
-     * @return A pointer to an object whose dynamic type matches the type requested
+     * @return A pointer to an object whose dynamic type matches the type requested, NULL for an invalid opcode
      */
-    static std::unique_ptr<InstructionBase> generateInstruction(InstructionData data);
+    static Handle generateInstruction(BasicInstructionData<Arch> data);
 
   protected:
     /**
@@ -242,22 +482,22 @@ class InstructionBase {
      * Other code is not allowed to create plain Instruction objects. Since it's
      * protected you can remove it, if your code does not need it.
      */
-    InstructionBase() { };
+    BasicInstructionBase() { };
 
     
 
     // Copy Constructor
-    InstructionBase(InstructionBase &other) : _address(other._address) {
+    BasicInstructionBase(BasicInstructionBase &other) : _address(other._address) {
       
     }
 
     // Move Constructor
-    InstructionBase(InstructionBase &&other) noexcept : _address(other._address) {
+    BasicInstructionBase(BasicInstructionBase &&other) noexcept : _address(other._address) {
       other._address = 0;
     } 
 
     // Copy Assignment
-    InstructionBase& operator=(const InstructionBase &other) {
+    BasicInstructionBase& operator=(const BasicInstructionBase &other) {
       if (&other != this) {
         _address = other._address;
       }
@@ -265,7 +505,7 @@ class InstructionBase {
     }
 
     // Move Assignment
-    InstructionBase& operator=(InstructionBase &&other) noexcept {
+    BasicInstructionBase& operator=(BasicInstructionBase &&other) noexcept {
       if (&other != this) {
         _address = other._address;
         other._address = 0;
@@ -289,3 +529,6 @@ class InstructionBase {
   private:
     addr_t _address = 0;
 };
+
+typedef BasicInstructionBase<Arch8> InstructionBase;
+typedef InstructionBase::Handle InstructionHandle;
@@ -0,0 +1,196 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: constexpr_emulator.h
+//
+// An emulator that works in constant expressions, for running programs with
+// fixed inputs at compile time and baking their results into the binary.
+//
+// ConstexprEmulator runs a memory image with the StaticInstruction classes
+// of instruction_values.h on a ProcessorState: no allocation, no virtual
+// calls and no streams, so every member function is constexpr. For example, a
+// lookup table can be built by running a program once per entry:
+//
+//   constexpr std::array<byte_t, 16> TABLE = [] {
+//     std::array<byte_t, 16> table{};
+//     for (int i = 0; i < 16; ++i) {
+//       ConstexprEmulator emulator(PROGRAM);
+//       emulator.write_mem(INPUT, i);
+//       emulator.run(1000);
+//       table[i] = emulator.read_mem(OUTPUT);
+//     }
+//     return table;
+//   }();
+//
+// It has the same run() contract as Emulator, with one difference in the
+// loop detection: only a jump to itself is an endless loop. That's how
+// programs end (see `data`), and it's enough to run them to completion with
+// a large step count.
+//
+// Compilers limit how much a constant expression can compute. With the
+// defaults of GCC 12 that's around 50000 instructions of the emulated machine
+// per constant expression, more with a higher -fconstexpr-ops-limit. The
+// same code also runs at run time, but the memory of Arch32 is too big for
+// the stack.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "instruction_values.h"
+#include "loops.h"
+#include <array>
+
+template <class Arch = Arch8>
+class ConstexprEmulator {
+  public:
+    typedef typename Arch::word_t word_t;
+    typedef typename Arch::cell_t cell_t;
+    typedef std::array<cell_t, Arch::MEMORY_SIZE> Image;
+
+    /**
+     * A machine with all memory and registers zero and no breakpoints
+     */
+    constexpr ConstexprEmulator() = default;
+
+    /**
+     * A machine with a memory image loaded
+     *
+     * @param memory The whole memory
+     * @param pc The address of the first instruction
+     * @param acc The initial value of the accumulator
+     */
+    constexpr explicit ConstexprEmulator(const Image& memory, addr_t pc = 0, word_t acc = 0) {
+      state.memory = memory;
+      state.rehash();
+      state.pc = pc & Arch::ADDRESS_MASK;
+      state.acc = acc & Arch::WORD_MASK;
+    }
+
+    /**
+     * The same as Emulator::run(), detecting only jumps to themselves as endless loops
+     *
+     * A JMP or taken JNE to its own address leaves the state as it is, so
+     * the rest of the steps are counted without executing them, the same
+     * as run() skipping the loop.
+     *
+     * @param steps The maximum number of cycles to execute
+     * @return a RunStatus: RUN_STOPPED, RUN_LOOPING at a jump to itself, RUN_ERROR on an error
+     */
+    constexpr int run(int steps) {
+      // Compilers also limit the iterations of each loop in a constant
+      // expression (262144 for GCC), so the steps go in chunks
+      for (int left = steps; left > 0;) {
+        const int chunk = (left < RUN_CHUNK) ? left : RUN_CHUNK;
+        left -= chunk;
+
+        for (int step = chunk; step > 0; --step) {
+          if ((state.pc % 2) == 1)
+            return RUN_ERROR;
+
+          const addr_t pc = state.pc;
+          const cell_t opcode = state.cell(pc);
+          if (!execute(opcode, state.cell(pc + 1) & Arch::ADDRESS_MASK))
+            return RUN_ERROR;
+          ++total_cycles;
+
+          if (breakpoints[state.pc])
+            return RUN_STOPPED;
+
+          if (state.pc == pc && opcode >= JMP) {
+            total_cycles += left + step - 1;
+            return RUN_LOOPING;
+          }
+        }
+      }
+
+      return RUN_STOPPED;
+    }
+
+    /**
+     * Add/remove a breakpoint at an instruction address
+     *
+     * @param address The address, which has to be even and inside memory
+     * @return 1 for success, 0 if the address is invalid or there is already (for delete: there is no) breakpoint at it
+     */
+    constexpr int insert_breakpoint(addr_t address) {
+      if (address < 0 || address >= Arch::MEMORY_SIZE || address % 2 == 1 || breakpoints[address])
+        return 0;
+
+      breakpoints[address] = true;
+      return 1;
+    }
+
+    constexpr int delete_breakpoint(addr_t address) {
+      if (address < 0 || address >= Arch::MEMORY_SIZE || !breakpoints[address])
+        return 0;
+
+      breakpoints[address] = false;
+      return 1;
+    }
+
+    /**
+     * Getters for the processor state, the same as Emulator's
+     */
+    constexpr word_t read_acc() const {
+      return state.acc;
+    }
+
+    constexpr addr_t read_pc() const {
+      return state.pc;
+    }
+
+    constexpr cell_t read_mem(addr_t address) const {
+      return state.memory[address & Arch::ADDRESS_MASK];
+    }
+
+    constexpr int cycles() const {
+      return total_cycles;
+    }
+
+    /**
+     * The whole memory
+     */
+    constexpr const Image& memory() const {
+      return state.memory;
+    }
+
+    /**
+     * Overwrite a memory cell
+     *
+     * @param address The address, masked to the memory size
+     * @param value The new value
+     */
+    constexpr void write_mem(addr_t address, cell_t value) {
+      state.store(address & Arch::ADDRESS_MASK, value);
+    }
+
+  private:
+    static constexpr int RUN_CHUNK = 1 << 16;
+
+    /**
+     * Execute one instruction with its StaticInstruction
+     *
+     * A switch rather than decode_value() and execute_value(): constant
+     * evaluation of the variant costs several times more per instruction
+     *
+     * @return 1 for success, 0 if the opcode is invalid
+     */
+    constexpr int execute(cell_t opcode, cell_t address) {
+      switch (opcode) {
+        case ADD: StaticInstruction<ADD, Arch>{address}.execute(state); return 1;
+        case AND: StaticInstruction<AND, Arch>{address}.execute(state); return 1;
+        case ORR: StaticInstruction<ORR, Arch>{address}.execute(state); return 1;
+        case XOR: StaticInstruction<XOR, Arch>{address}.execute(state); return 1;
+        case LDR: StaticInstruction<LDR, Arch>{address}.execute(state); return 1;
+        case STR: StaticInstruction<STR, Arch>{address}.execute(state); return 1;
+        case JMP: StaticInstruction<JMP, Arch>{address}.execute(state); return 1;
+        case JNE: StaticInstruction<JNE, Arch>{address}.execute(state); return 1;
+        default: return 0;
+      }
+    }
+
+    BasicProcessorState<Arch> state;
+    int total_cycles{0};
+
+    // breakpoints[address] is set if there is a breakpoint at address
+    std::array<bool, Arch::MEMORY_SIZE> breakpoints{};
+};
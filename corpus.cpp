@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include "binary_state.h"
+#include "corpus.h"
+#include "emulator.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// ============= Helpers ==============
+
+int read_whole_file(const std::string& filename, std::vector<char>& buffer) {
+#ifndef _WIN32
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    close(fd);
+    return 0;
+  }
+
+  buffer.resize(info.st_size);
+  size_t done = 0;
+  while (done < buffer.size()) {
+    const ssize_t got = read(fd, buffer.data() + done, buffer.size() - done);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got < 0) {
+      close(fd);
+      return 0;
+    }
+    if (got == 0)
+      break;
+    done += got;
+  }
+  close(fd);
+
+  // The file shrank while we were reading it
+  buffer.resize(done);
+  return 1;
+#else
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file)
+    return 0;
+
+  buffer.resize(file.tellg());
+  file.seekg(0);
+  return static_cast<bool>(file.read(buffer.data(), buffer.size()));
+#endif
+}
+
+int list_corpus(const std::string& path, std::vector<std::string>& files) {
+  namespace fs = std::filesystem;
+  std::error_code error;
+  files.clear();
+
+  if (fs::is_directory(path, error)) {
+    for (fs::directory_iterator entry(path, error), last; !error && entry != last; entry.increment(error)) {
+      const std::string extension = entry->path().extension().string();
+      if (entry->is_regular_file(error) && (extension == ".txt" || extension == ".bin"))
+        files.push_back(entry->path().string());
+    }
+    std::sort(files.begin(), files.end());
+    return !error;
+  }
+
+  std::vector<char> manifest;
+  if (!read_whole_file(path, manifest))
+    return 0;
+
+  const fs::path base = fs::path(path).parent_path();
+  const char* pos = manifest.data();
+  const char* end = pos + manifest.size();
+  while (pos != end) {
+    const char* newline = std::find(pos, end, '\n');
+    std::string line(pos, newline);
+    pos = (newline == end) ? end : newline + 1;
+
+    // Manifests written on Windows
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.empty() || line.front() == '#')
+      continue;
+
+    const fs::path file(line);
+    files.push_back(file.is_absolute() ? line : (base / file).string());
+  }
+  return 1;
+}
+
+// ============= CorpusLoader ==============
+
+namespace {
+
+// Files a worker takes from the shared counter at a time
+constexpr size_t CORPUS_BATCH = 16;
+
+int load_file(Emulator& emulator, const std::string& filename, std::vector<char>& buffer) {
+  if (!read_whole_file(filename, buffer))
+    return 0;
+
+  if (buffer.size() >= sizeof(BINARY_STATE_MAGIC) &&
+      memcmp(buffer.data(), BINARY_STATE_MAGIC, sizeof(BINARY_STATE_MAGIC)) == 0)
+    return emulator.load_binary_state(filename);
+
+  return emulator.load_state_text(buffer.data(), buffer.size());
+}
+
+}
+
+CorpusLoader::CorpusLoader(int num_threads) : num_threads(num_threads) {
+  if (this->num_threads <= 0)
+    this->num_threads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+int CorpusLoader::threads() const {
+  return num_threads;
+}
+
+std::vector<int> CorpusLoader::load(const std::vector<std::string>& files, std::vector<Emulator>& emulators) const {
+  std::vector<int> results(files.size());
+  emulators.resize(files.size());
+  std::atomic<size_t> next{0};
+
+  auto worker = [&]() {
+    std::vector<char> buffer;
+
+    for (;;) {
+      const size_t first = next.fetch_add(CORPUS_BATCH, std::memory_order_relaxed);
+      if (first >= files.size())
+        return;
+
+      const size_t last = std::min(first + CORPUS_BATCH, files.size());
+      for (size_t idx = first; idx < last; ++idx) {
+        // Each slot is written by exactly one worker
+        results.at(idx) = load_file(emulators.at(idx), files.at(idx), buffer);
+        if (!results.at(idx))
+          emulators.at(idx) = Emulator();
+      }
+    }
+  };
+
+  // No point in starting more workers than there are batches
+  const size_t batches = (files.size() + CORPUS_BATCH - 1) / CORPUS_BATCH;
+  const int used = std::max<size_t>(1, std::min<size_t>(num_threads, batches));
+
+  std::vector<std::thread> workers;
+  for (int id = 1; id < used; ++id)
+    workers.emplace_back(worker);
+
+  // The calling thread is worker 0
+  worker();
+
+  // Joining also makes all the slots visible to this thread
+  for (std::thread& thread : workers)
+    thread.join();
+
+  return results;
+}
+
+std::vector<int> CorpusLoader::load(const std::string& path, std::vector<std::string>& files, std::vector<Emulator>& emulators) const {
+  if (!list_corpus(path, files))
+    return {};
+  return load(files, emulators);
+}
@@ -0,0 +1,82 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: corpus.h
+//
+// Loads large corpora of state files into emulators on all cores.
+//
+// A corpus is either a directory of state files or a manifest listing them.
+// CorpusLoader parses the files in parallel straight into a vector of
+// emulators, one slot per file. Every worker thread reads its files with a
+// single read() each into a buffer it reuses, and parses them in memory with
+// Emulator::load_state_text(), so loading a file costs one open, one read and
+// no allocations besides the breakpoints. Files in the binary format (see
+// binary_state.h) are recognised from their first bytes and loaded with
+// Emulator::load_binary_state().
+//
+// A file that fails to load only fails its own slot, the rest of the batch
+// goes on. The validation rules are the ones of load_state() and
+// load_binary_state(), since those are the functions doing the parsing.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include <string>
+#include <vector>
+
+class Emulator;
+
+/**
+ * Reads a whole file into a buffer, with a single read() where possible
+ *
+ * @param filename The file
+ * @param buffer Where to put the contents, resized to the size of the file. Its storage is reused
+ * @return 1 for success, 0 if the file can't be read
+ */
+int read_whole_file(const std::string& filename, std::vector<char>& buffer);
+
+/**
+ * The state files of a corpus
+ *
+ * For a directory: every regular file in it ending in .txt or .bin, sorted by
+ * name. Anything else is a manifest: one file per line, relative to the
+ * directory of the manifest unless it's an absolute path. Empty lines and
+ * lines starting with '#' are skipped.
+ *
+ * @param path The directory or the manifest
+ * @param files Where to put the file names, in their order in the corpus
+ * @return 1 for success, 0 if the directory or the manifest can't be read
+ */
+int list_corpus(const std::string& path, std::vector<std::string>& files);
+
+class CorpusLoader {
+  public:
+    /**
+     * @param num_threads How many workers to use, 0 means one per hardware thread
+     */
+    explicit CorpusLoader(int num_threads = 0);
+
+    /**
+     * Load every file into its own emulator, in parallel
+     *
+     * @param files The state files
+     * @param emulators Resized to one emulator per file, in the same order. The
+     *                  emulator of a file that fails to load is reset to a default Emulator
+     * @return one result per file: 1 if it was loaded, 0 if it couldn't be read or was rejected
+     */
+    std::vector<int> load(const std::vector<std::string>& files, std::vector<Emulator>& emulators) const;
+
+    /**
+     * list_corpus() then load()
+     *
+     * @return the results of load(), empty if the corpus can't be listed
+     */
+    std::vector<int> load(const std::string& path, std::vector<std::string>& files, std::vector<Emulator>& emulators) const;
+
+    /**
+     * The number of worker threads
+     */
+    int threads() const;
+
+  private:
+    int num_threads;
+};
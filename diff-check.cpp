@@ -0,0 +1,63 @@
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: diff-check.cpp
+//
+// Checks the engines against the reference Emulator::run() on random
+// programs (see differential.h), and prints the first divergence.
+//
+// Usage: diff-check <programs> <steps> [first seed]
+//
+// Every engine runs the programs with seeds from `first seed` (1 by default)
+// on, for up to `steps` cycles each. The exit status is 0 if all engines
+// agree with the reference on all programs.
+// -----------------------------------------------------------------------------
+
+#include "differential.h"
+#include "emulator.h"
+#include "memo.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+int main(int argc, char** argv) {
+  if (argc != 3 && argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " <programs> <steps> [first seed]" << std::endl;
+    return 1;
+  }
+
+  const int programs = std::atoi(argv[1]);
+  const int steps = std::atoi(argv[2]);
+  const uint64_t first_seed = (argc == 4) ? std::strtoull(argv[3], NULL, 10) : 1;
+  if (programs <= 0 || steps <= 0) {
+    std::cerr << "The number of programs and steps must be positive" << std::endl;
+    return 1;
+  }
+
+  RunMemo memo;
+  const std::vector<std::pair<const char*, DiffEngine>> engines = {
+    {"run_fast", &Emulator::run_fast},
+    {"run_blocks", &Emulator::run_blocks},
+    {"run_memoized", [&memo](Emulator& emulator, int steps) { return emulator.run_memoized(steps, memo); }},
+    {"run_async", [](Emulator& emulator, int steps) {
+      RunTask task = emulator.run_async(steps, 7);
+      while (task.resume()) {}
+      return task.result().status;
+    }},
+  };
+
+  int failed = 0;
+  for (const auto& [name, engine] : engines) {
+    DifferentialChecker checker(engine, 64);
+    const Divergence divergence = checker.fuzz(first_seed, programs, steps);
+    if (divergence.found) {
+      std::cout << name << ": FAILED\n" << divergence.report << std::endl;
+      failed = 1;
+    } else {
+      std::cout << name << ": " << checker.comparisons() << " comparisons, no divergence" << std::endl;
+    }
+  }
+
+  return failed;
+}
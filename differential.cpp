@@ -0,0 +1,217 @@
+#include "differential.h"
+#include "disassembler.h"
+#include <algorithm>
+#include <bitset>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <vector>
+
+// ============= Helpers ==============
+
+namespace {
+
+/**
+ * The listing of an emulator's memory, as print_program() prints it
+ */
+std::string listing(const Emulator& emulator) {
+  std::vector<char> buffer(DISASSEMBLY_PROGRAM_MAX);
+  char* end = emulator.disassemble(buffer.data());
+  return std::string(buffer.data(), end);
+}
+
+/**
+ * Compare two machines after a run, filling `what` and `address` with the first difference
+ *
+ * @return 1 if they are the same, 0 otherwise
+ */
+int same(const Emulator& reference, int reference_status, const Emulator& tested, int tested_status, Divergence& divergence) {
+  if (reference_status != tested_status)
+    divergence.what = "status";
+  else if (reference.cycles() != tested.cycles())
+    divergence.what = "cycles";
+  else if (reference.read_acc() != tested.read_acc())
+    divergence.what = "acc";
+  else if (reference.read_pc() != tested.read_pc())
+    divergence.what = "pc";
+  else {
+    for (addr_t address = 0; address < MEMORY_SIZE; ++address) {
+      if (reference.read_mem(address) != tested.read_mem(address)) {
+        divergence.what = "memory";
+        divergence.address = address;
+        return 0;
+      }
+    }
+    return 1;
+  }
+  return 0;
+}
+
+void report_row(std::ostream& out, const std::string& name, int reference, int tested) {
+  out << "  " << std::left << std::setw(12) << name << std::right << std::setw(10) << reference << std::setw(10) << tested
+      << ((reference != tested) ? "  <--" : "") << "\n";
+}
+
+/**
+ * The report of a divergence, with the program as it was at the last agreement
+ */
+std::string report(const Divergence& divergence, const std::string& before, const Emulator& reference, int reference_status,
+                   const Emulator& tested, int tested_status) {
+  std::ostringstream out;
+  out << "First divergence in " << divergence.what;
+  if (divergence.what == "memory")
+    out << "[" << divergence.address << "]";
+  out << " at cycle " << divergence.cycle << ", the engines agreed up to cycle " << divergence.agreed << "\n\n";
+
+  out << "  " << std::left << std::setw(12) << "" << std::right << std::setw(10) << "reference" << std::setw(10) << "candidate" << "\n";
+  report_row(out, "status", reference_status, tested_status);
+  report_row(out, "cycles", reference.cycles(), tested.cycles());
+  report_row(out, "acc", reference.read_acc(), tested.read_acc());
+  report_row(out, "pc", reference.read_pc(), tested.read_pc());
+  for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+    if (reference.read_mem(address) != tested.read_mem(address))
+      report_row(out, "[" + std::to_string(address) + "]", reference.read_mem(address), tested.read_mem(address));
+
+  out << "\nProgram at cycle " << divergence.agreed << ":\n" << before;
+  out << "\nReference at cycle " << reference.cycles() << ":\n" << listing(reference);
+  out << "\nCandidate at cycle " << tested.cycles() << ":\n" << listing(tested);
+  return out.str();
+}
+
+}
+
+int random_program(Emulator& emulator, uint64_t seed, const RandomProgramOptions& options) {
+  std::mt19937_64 rng(seed);
+  auto number = [&rng](int count) { return static_cast<int>(rng() % count); };
+  auto percent = [&number](int odds) { return number(100) < odds; };
+
+  const int code_slots = 8 + number(MAX_INSTRUCTIONS - 7);
+  const int code_end = code_slots * INSTRUCTION_SIZE;
+
+  std::array<int, MEMORY_SIZE> memory{};
+  for (int address = code_end; address < MEMORY_SIZE; ++address)
+    memory.at(address) = number(ARCH_MAXVAL + 1);
+
+  for (int slot = 0; slot < code_slots; ++slot) {
+    const int opcode = percent(options.invalid_opcodes) ? NUM_OPCODES + number(ARCH_MAXVAL + 1 - NUM_OPCODES) : number(NUM_OPCODES);
+    int operand;
+    if (opcode == JMP || opcode == JNE)
+      operand = percent(options.odd_targets) ? (number(MEMORY_SIZE) | 1) : number(code_slots) * INSTRUCTION_SIZE;
+    else if (opcode >= NUM_OPCODES || code_end == MEMORY_SIZE || percent(options.code_accesses))
+      operand = number(MEMORY_SIZE);
+    else
+      operand = code_end + number(MEMORY_SIZE - code_end);
+
+    memory.at(slot * INSTRUCTION_SIZE) = opcode;
+    memory.at(slot * INSTRUCTION_SIZE + 1) = operand;
+  }
+
+  const int pc = percent(options.odd_pc) ? (number(code_end) | 1) : number(code_slots) * INSTRUCTION_SIZE;
+  const int acc = number(ARCH_MAXVAL + 1);
+
+  // Through the state file format, which checks everything
+  std::string text = "0\n" + std::to_string(acc) + "\n" + std::to_string(pc) + "\n";
+  for (int byte : memory)
+    text += std::to_string(byte) + "\n";
+
+  // Two breakpoints on the same address would fail the load
+  std::bitset<MEMORY_SIZE> used;
+  const int num_breakpoints = number(options.max_breakpoints + 1);
+  for (int idx = 0; idx < num_breakpoints; ++idx) {
+    const addr_t address = number(code_slots) * INSTRUCTION_SIZE;
+    if (!used.test(address))
+      text += std::to_string(address) + " B" + std::to_string(idx) + "\n";
+    used.set(address);
+  }
+
+  return emulator.load_state_text(text.data(), text.size());
+}
+
+// ============= DifferentialChecker ==============
+
+DifferentialChecker::DifferentialChecker(DiffEngine candidate, int interval)
+    : candidate(std::move(candidate)), interval(std::max(interval, 1)) {}
+
+Divergence DifferentialChecker::check(const Emulator& start, int steps) {
+  Divergence divergence;
+  Emulator reference{start};
+  Emulator tested{start};
+  num_comparisons = 0;
+
+  for (int left = steps; left > 0;) {
+    const int chunk = std::min(interval, left);
+    const EmulatorSnapshot reference_before = reference.snapshot();
+    const EmulatorSnapshot tested_before = tested.snapshot();
+    divergence.agreed = reference.cycles();
+
+    const int reference_status = reference.run(chunk);
+    const int tested_status = candidate(tested, chunk);
+    ++num_comparisons;
+
+    if (!same(reference, reference_status, tested, tested_status, divergence)) {
+      divergence.found = 1;
+      divergence.cycle = reference.cycles();
+
+      // Replay the interval one step at a time, to find the instruction
+      reference.restore(reference_before);
+      tested.restore(tested_before);
+      const std::string before = listing(reference);
+
+      for (int step = 0; step < chunk; ++step) {
+        const int reference_step = reference.run(1);
+        const int tested_step = candidate(tested, 1);
+        ++num_comparisons;
+
+        if (!same(reference, reference_step, tested, tested_step, divergence)) {
+          divergence.cycle = reference.cycles();
+          divergence.report = report(divergence, before, reference, reference_step, tested, tested_step);
+          return divergence;
+        }
+        if (reference_step == RUN_ERROR)
+          break;
+      }
+
+      // Only the whole interval differs: report that
+      reference.restore(reference_before);
+      tested.restore(tested_before);
+      const int reference_again = reference.run(chunk);
+      const int tested_again = candidate(tested, chunk);
+      same(reference, reference_again, tested, tested_again, divergence);
+      divergence.report = report(divergence, before, reference, reference_again, tested, tested_again);
+      return divergence;
+    }
+
+    const int executed = reference.cycles() - divergence.agreed;
+    left -= executed;
+    if (reference_status == RUN_ERROR || executed == 0)
+      break;
+  }
+
+  return divergence;
+}
+
+Divergence DifferentialChecker::fuzz(uint64_t first_seed, int programs, int steps, const RandomProgramOptions& options, int loop_detection) {
+  long total = 0;
+  for (int program = 0; program < programs; ++program) {
+    const uint64_t seed = first_seed + program;
+    Emulator emulator;
+    if (!random_program(emulator, seed, options))
+      continue;
+    emulator.set_loop_detection(loop_detection);
+
+    Divergence divergence = check(emulator, steps);
+    total += num_comparisons;
+    if (divergence.found) {
+      divergence.report = "Program seed " + std::to_string(seed) + "\n" + divergence.report;
+      num_comparisons = total;
+      return divergence;
+    }
+  }
+
+  num_comparisons = total;
+  return Divergence();
+}
+
+long DifferentialChecker::comparisons() const {
+  return num_comparisons;
+}
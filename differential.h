@@ -0,0 +1,133 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: differential.h
+//
+// Differential testing of the engines against the reference Emulator::run(),
+// and random programs to test them on.
+//
+// A DifferentialChecker runs the reference engine and a candidate engine in
+// lockstep on two copies of the same machine, a few cycles at a time. After
+// every interval it compares the statuses the two runs returned, acc, pc,
+// cycles and all of memory. When they differ, it replays the last interval
+// one step at a time on both to find the first cycle where they part, and
+// writes a report with the listings (see Emulator::disassemble()) of the
+// program before and after.
+//
+// random_program() fills an emulator with a program from a seed, so a
+// divergence found on a random program can be reproduced from the seed
+// alone. Programs use the whole InstructionOpcode space, plus invalid
+// opcodes, jumps to odd addresses, odd initial PCs, stores into the code
+// and breakpoints.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "emulator.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * An engine under test: anything with the run() contract, e.g. &Emulator::run_fast or a lambda
+ */
+typedef std::function<int(Emulator& emulator, int steps)> DiffEngine;
+
+/**
+ * The first difference a DifferentialChecker found
+ */
+struct Divergence {
+  // 0 if the engines agreed on every check. The rest is meaningless then
+  int found = 0;
+
+  // The reference cycles when the difference showed up. With single steps
+  // that's right after the first instruction that differed; if single steps
+  // agree (e.g. only the loop detection of a longer run differs), it's at
+  // the end of the interval
+  int cycle = 0;
+
+  // The reference cycles at the last check where both engines agreed
+  int agreed = 0;
+
+  // What differed first: "status", "cycles", "acc", "pc" or "memory" (at `address`)
+  std::string what;
+  addr_t address = 0;
+
+  // Everything above, every difference and the listings, for people
+  std::string report;
+};
+
+/**
+ * How random_program() picks the programs, in percent
+ */
+struct RandomProgramOptions {
+  // Instructions with an opcode of NUM_OPCODES or more
+  int invalid_opcodes = 3;
+
+  // JMPs and JNEs to an odd address
+  int odd_targets = 3;
+
+  // Programs that start at an odd PC
+  int odd_pc = 2;
+
+  // Loads and stores into the program instead of its data
+  int code_accesses = 10;
+
+  // Up to this many breakpoints on even addresses
+  int max_breakpoints = 3;
+};
+
+/**
+ * Load a random program, the same one for the same seed
+ *
+ * Its first 8 to 128 instruction slots hold code, jumping mostly inside
+ * itself, and the rest of memory random data. The cycles start at 0.
+ *
+ * @param emulator Where to load it. Its breakpoints are replaced
+ * @param seed The seed of the program
+ * @param options The odds of the unusual cases
+ * @return 1 for success, 0 otherwise
+ */
+int random_program(Emulator& emulator, uint64_t seed, const RandomProgramOptions& options = RandomProgramOptions());
+
+class DifferentialChecker {
+  public:
+    /**
+     * @param candidate The engine to compare with Emulator::run()
+     * @param interval The cycles between checks. Larger intervals let the candidate run longer stretches, e.g. whole blocks
+     */
+    explicit DifferentialChecker(DiffEngine candidate, int interval = 100);
+
+    /**
+     * Run both engines from the same machine and compare them
+     *
+     * The run goes on past breakpoints, the same as calling run() again,
+     * and ends after `steps` cycles or at the first error.
+     *
+     * @param start The machine to start from, copied for each engine
+     * @param steps The cycles to run the reference engine for
+     * @return the first divergence, if there is one
+     */
+    Divergence check(const Emulator& start, int steps);
+
+    /**
+     * check() every random program from seed `first_seed` to `first_seed + programs - 1`
+     *
+     * @param first_seed The seed of the first program
+     * @param programs How many programs to check
+     * @param steps The cycles to run each for
+     * @param options How to make the programs
+     * @param loop_detection Whether the engines detect endless loops, 0 for candidates without loop detection
+     * @return the first divergence, whose report starts with the seed of its program
+     */
+    Divergence fuzz(uint64_t first_seed, int programs, int steps, const RandomProgramOptions& options = RandomProgramOptions(), int loop_detection = 1);
+
+    /**
+     * The number of comparisons the last check() or fuzz() made, for making sure checks happen
+     */
+    long comparisons() const;
+
+  private:
+    DiffEngine candidate;
+    int interval;
+    long num_comparisons{0};
+};
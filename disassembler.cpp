@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <charconv>
+#include "disassembler.h"
+#include "emulator.h"
+
+// ============= Listings ==============
+
+namespace {
+
+char* append(char* out, std::string_view text) {
+  return std::copy(text.begin(), text.end(), out);
+}
+
+char* append(char* out, int number) {
+  return std::to_chars(out, out + 16, number).ptr;
+}
+
+}
+
+char* disassemble_line(char* out, addr_t offset, InstructionData data) {
+  out = append(out, offset);
+  out = append(out, ":\t");
+  out = append(out, data.opcode);
+  out = append(out, "\t");
+  out = append(out, data.address);
+
+  // Invalid instructions and all-zero slots are printed as plain numbers
+  if (data.opcode < NUM_OPCODES && !(data.opcode == 0 && data.address == 0)) {
+    out = append(out, "\t:\t");
+    out = format_instruction(out, static_cast<InstructionOpcode>(data.opcode), data.address);
+  }
+
+  *out++ = '\n';
+  return out;
+}
+
+char* disassemble_program(char* out, const std::array<byte_t, MEMORY_SIZE>& memory) {
+  for (int offset = 0; offset < MEMORY_SIZE; offset += INSTRUCTION_SIZE)
+    out = disassemble_line(out, offset, {memory[offset], memory[offset + 1]});
+  return out;
+}
+
+// ============= DisassemblySink ==============
+
+DisassemblySink::DisassemblySink(std::ostream& out, size_t capacity)
+  : out(out), buffer(std::max<size_t>(capacity, DISASSEMBLY_PROGRAM_MAX)) {
+
+}
+
+DisassemblySink::~DisassemblySink() {
+  flush();
+}
+
+int DisassemblySink::reserve(size_t size) {
+  if (used + size <= buffer.size())
+    return 1;
+  if (!flush())
+    return 0;
+  if (size > buffer.size())
+    buffer.resize(size);
+  return 1;
+}
+
+int DisassemblySink::write_program(const Emulator& emulator) {
+  if (!reserve(DISASSEMBLY_PROGRAM_MAX))
+    return 0;
+
+  char* start = buffer.data() + used;
+  used += emulator.disassemble(start) - start;
+  return 1;
+}
+
+int DisassemblySink::write(std::string_view text) {
+  if (!reserve(text.size()))
+    return 0;
+
+  std::copy(text.begin(), text.end(), buffer.data() + used);
+  used += text.size();
+  return 1;
+}
+
+int DisassemblySink::flush() {
+  if (used > 0) {
+    out.write(buffer.data(), used);
+    used = 0;
+  }
+  out.flush();
+  return !out.fail();
+}
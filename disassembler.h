@@ -0,0 +1,97 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: disassembler.h
+//
+// A disassembler that writes program listings into caller-provided buffers.
+//
+// The listings are byte-for-byte what Emulator::print_program() prints (see
+// `ref/print_program*.txt`), but nothing is allocated and no stream is
+// involved: every line is formatted with std::to_chars from the
+// INSTRUCTION_FORMATS table. DisassemblySink collects the listings of many
+// programs in one buffer and writes it out in large chunks.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "instructions.h"
+#include <array>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+class Emulator;
+
+// Room for the longest line of a listing, and for a whole listing
+constexpr int DISASSEMBLY_LINE_MAX = 64;
+constexpr int DISASSEMBLY_PROGRAM_MAX = MAX_INSTRUCTIONS * DISASSEMBLY_LINE_MAX;
+
+/**
+ * Writes one line of a listing, including its '\n'
+ *
+ * @param out Where to write, with room for DISASSEMBLY_LINE_MAX chars
+ * @param offset The address of the instruction
+ * @param data The instruction bytes
+ * @return the end of the line (no '\0' is written)
+ */
+char* disassemble_line(char* out, addr_t offset, InstructionData data);
+
+/**
+ * Writes the listing of a whole memory image, one line per instruction slot
+ *
+ * @param out Where to write, with room for DISASSEMBLY_PROGRAM_MAX chars
+ * @param memory The memory image
+ * @return the end of the listing (no '\0' is written)
+ */
+char* disassemble_program(char* out, const std::array<byte_t, MEMORY_SIZE>& memory);
+
+/**
+ * A buffered destination for many listings
+ *
+ * Listings are appended to an internal buffer, which is written to the stream
+ * only when it fills up, on flush(), and on destruction.
+ */
+class DisassemblySink {
+  public:
+    /**
+     * @param out Where the listings go
+     * @param capacity The size of the buffer, at least DISASSEMBLY_PROGRAM_MAX
+     */
+    explicit DisassemblySink(std::ostream& out, size_t capacity = 1 << 16);
+
+    // Not copyable: two copies would write the same buffered text twice
+    DisassemblySink(const DisassemblySink&) = delete;
+    DisassemblySink& operator=(const DisassemblySink&) = delete;
+
+    ~DisassemblySink();
+
+    /**
+     * Appends the listing of the emulator's program
+     *
+     * @return 1 for success, 0 if writing to the stream failed
+     */
+    int write_program(const Emulator& emulator);
+
+    /**
+     * Appends any other text, e.g. a header between listings
+     *
+     * @return 1 for success, 0 if writing to the stream failed
+     */
+    int write(std::string_view text);
+
+    /**
+     * Writes everything buffered so far to the stream
+     *
+     * @return 1 for success, 0 if writing to the stream failed
+     */
+    int flush();
+
+  private:
+    /**
+     * Makes room for this many more chars, flushing if needed
+     */
+    int reserve(size_t size);
+
+    std::ostream& out;
+    std::vector<char> buffer;
+    size_t used{0};
+};
@@ -0,0 +1,173 @@
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: emulator-server.cpp
+//
+// Serves resident emulator sessions (see server.h) to other processes.
+//
+// Usage: emulator-server [socket path]
+//
+// Without an argument, batches are read from stdin and the responses written
+// to stdout, for a client that starts the server as a child process. With a
+// path, the server listens on a Unix domain socket there and serves clients
+// one after another; sessions outlive the connections. A stale socket at the
+// path is replaced, any other file makes the server refuse to start. A malformed batch
+// closes the connection. Responses are written with writev(), straight from
+// the memory of the sessions.
+// -----------------------------------------------------------------------------
+
+#include "server.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifndef _WIN32
+#include <csignal>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Larger batches are refused rather than buffered
+constexpr uint32_t MAX_BATCH_SIZE = 1u << 26;
+
+/**
+ * Read exactly `size` bytes
+ *
+ * @return 1 for success, 0 at the end of the input or on an error
+ */
+int read_all(int fd, byte_t* data, size_t size) {
+  while (size > 0) {
+    const ssize_t count = read(fd, data, size);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return 0;
+    data += count;
+    size -= count;
+  }
+  return 1;
+}
+
+/**
+ * Write a whole response, gathering its pieces
+ *
+ * @return 1 for success, 0 on an error
+ */
+int write_response(int fd, const ServerResponse& response) {
+  std::vector<iovec> vectors;
+  for (const auto& [data, length] : response.pieces())
+    vectors.push_back(iovec{const_cast<byte_t*>(data), length});
+
+  size_t first = 0;
+  while (first < vectors.size()) {
+    const int count = std::min<size_t>(vectors.size() - first, IOV_MAX);
+    ssize_t written = writev(fd, vectors.data() + first, count);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0)
+      return 0;
+
+    // Skip what went out, which may end in the middle of a piece
+    while (first < vectors.size() && static_cast<size_t>(written) >= vectors.at(first).iov_len) {
+      written -= vectors.at(first).iov_len;
+      ++first;
+    }
+    if (written > 0) {
+      vectors.at(first).iov_base = static_cast<byte_t*>(vectors.at(first).iov_base) + written;
+      vectors.at(first).iov_len -= written;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Serve batches until the input ends or a batch is malformed
+ */
+void serve(EmulatorServer& server, int in, int out) {
+  std::vector<byte_t> batch;
+  ServerResponse response;
+
+  for (;;) {
+    ServerBatchHeader header;
+    batch.resize(sizeof(header));
+    if (!read_all(in, batch.data(), sizeof(header)))
+      return;
+    memcpy(&header, batch.data(), sizeof(header));
+    if (header.size > MAX_BATCH_SIZE) {
+      std::cerr << "Batch too large, closing the connection" << std::endl;
+      return;
+    }
+
+    batch.resize(sizeof(header) + header.size);
+    if (!read_all(in, batch.data() + sizeof(header), header.size))
+      return;
+    if (!server.handle(batch.data(), batch.size(), response)) {
+      std::cerr << "Malformed batch, closing the connection" << std::endl;
+      return;
+    }
+    if (!write_response(out, response))
+      return;
+  }
+}
+
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2) {
+    std::cerr << "Usage: " << argv[0] << " [socket path]" << std::endl;
+    return 1;
+  }
+
+  EmulatorServer server;
+  if (argc == 1) {
+    serve(server, STDIN_FILENO, STDOUT_FILENO);
+    return 0;
+  }
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (strlen(argv[1]) >= sizeof(address.sun_path)) {
+    std::cerr << "The socket path is too long" << std::endl;
+    return 1;
+  }
+  strcpy(address.sun_path, argv[1]);
+
+  // Only a socket left behind by an earlier server is ours to remove
+  struct stat existing;
+  if (lstat(argv[1], &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode)) {
+      std::cerr << argv[1] << " exists and is not a socket" << std::endl;
+      return 1;
+    }
+    unlink(argv[1]);
+  }
+
+  // A client that goes away mid-response only ends its own connection
+  signal(SIGPIPE, SIG_IGN);
+
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+    std::cerr << "Can't listen on " << argv[1] << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  for (;;) {
+    const int client = accept(listener, NULL, NULL);
+    if (client < 0)
+      continue;
+    serve(server, client, client);
+    close(client);
+  }
+}
+#else
+int main() {
+  std::cerr << "emulator-server needs a POSIX system" << std::endl;
+  return 1;
+}
+#endif
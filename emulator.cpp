@@ -1,40 +1,57 @@
 #include <cassert>
+#include <charconv>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <utility>
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#include <string_view>
+#include <vector>
 #include <memory>
+#include "corpus.h"
+#include "disassembler.h"
 #include "emulator.h"
+#include "instructions.h"
 
 // ============= Breakpoint ==============
-Breakpoint::Breakpoint() : _address(0), _name("") { }
+Breakpoint::Breakpoint() : _address(0) { }
 
-Breakpoint::Breakpoint(addr_t address, const std::string& name) 
-    : _address(address & ARCH_BITMASK), _name(name) {
-  
+Breakpoint::Breakpoint(addr_t address, std::string_view name) 
+    : _address(address & ARCH_BITMASK) {
+  if (name.empty())
+    return;
+
+  _owned = std::make_unique<char[]>(name.size());
+  memcpy(_owned.get(), name.data(), name.size());
+  _name = std::string_view(_owned.get(), name.size());
+}
+
+Breakpoint Breakpoint::interned(addr_t address, std::string_view name) {
+  Breakpoint breakpoint;
+  breakpoint._address = address & ARCH_BITMASK;
+  breakpoint._name = name;
+  return breakpoint;
 }
 
 // Copy constructor
 Breakpoint::Breakpoint(const Breakpoint& other) 
-    : _address(other._address), _name(other._name) {
+    : Breakpoint(other._address, other._name) {
   
 }
 
 // Move constructor
 Breakpoint::Breakpoint(Breakpoint&& other) noexcept 
-    : _address(other._address), _name(std::move(other._name)) {
+    : _address(other._address), _owned(std::move(other._owned)), _name(other._name) {
   other._address = 0;
+  other._name = std::string_view();
 }
 
 // Copy assignment
 Breakpoint& Breakpoint::operator=(const Breakpoint& other) {
   if (this == &other)
     return *this;
-  _address = other.get_address();
-  _name = other.get_name();
+  *this = Breakpoint(other);
   return *this;
 }
 
@@ -42,10 +59,11 @@ Breakpoint& Breakpoint::operator=(const Breakpoint& other) {
 Breakpoint& Breakpoint::operator=(Breakpoint&& other) noexcept {
   if (this != &other) {
     _address = std::move(other._address);
-    _name = std::move(other._name);
+    _owned = std::move(other._owned);
+    _name = other._name;
 
     other._address = 0;
-    other._name.clear();
+    other._name = std::string_view();
   }
   return *this;
 }
@@ -54,7 +72,7 @@ const addr_t& Breakpoint::get_address() const {
   return _address;
 }
 
-const std::string& Breakpoint::get_name() const {
+std::string_view Breakpoint::get_name() const {
   return _name;
 }
 
@@ -62,7 +80,7 @@ int Breakpoint::has(addr_t address) const {
   return _address == (address & ARCH_BITMASK);
 }
 
-int Breakpoint::has(const std::string& name) const {
+int Breakpoint::has(std::string_view name) const {
   return _name == name;
 }
 
@@ -72,28 +90,59 @@ int Breakpoint::has(const std::string& name) const {
 Emulator::Emulator() : breakpoints() {
   state = ProcessorState();
 
-  // An array as big as the max number of instructions we could ever have
-  // This is obviously an overkill. Initialising the array to be shorter
-  // is okay, as long as you can handle the worst case of MAX_INSTRUCTIONS
-  // breakpoints
+  // Room for as many breakpoints as the max number of instructions we could
+  // ever have, so inserting never moves the existing ones. Only the
+  // breakpoints that exist are constructed, copied or destroyed
   // breakpoints = new Breakpoint[MAX_INSTRUCTIONS];
+  breakpoints.reserve(MAX_INSTRUCTIONS);
 }
 
 // Copy Constructor
 Emulator::Emulator(const Emulator& other)
-  : state(other.state), breakpoints(other.breakpoints), breakpoints_sz(other.breakpoints_sz), total_cycles(other.total_cycles) {
-  
+  : state(other.state), breakpoint_map(other.breakpoint_map), breakpoint_slots(other.breakpoint_slots),
+    breakpoint_names(other.breakpoint_names), breakpoint_name_slots(other.breakpoint_name_slots),
+    total_cycles(other.total_cycles),
+    snapshot_pages(other.snapshot_pages), dirty_pages(other.dirty_pages),
+    snapshot_breakpoints(other.snapshot_breakpoints), breakpoints_changed(other.breakpoints_changed),
+    loops(other.loops), watches(other.watches), last_watch_hit(other.last_watch_hit) {
+  breakpoints.reserve(MAX_INSTRUCTIONS);
+  copy_breakpoints(other.breakpoints);
+
+  // The decode cache is not copied, it will be refilled on demand
 }
 
 // Move Constructor
 Emulator::Emulator(Emulator&& other) noexcept
   : state(std::move(other.state)),
     breakpoints(std::move(other.breakpoints)),
-    breakpoints_sz(other.breakpoints_sz),
-    total_cycles(other.total_cycles) {
+    breakpoint_map(other.breakpoint_map),
+    breakpoint_slots(other.breakpoint_slots),
+    breakpoint_names(std::move(other.breakpoint_names)),
+    breakpoint_name_slots(std::move(other.breakpoint_name_slots)),
+    total_cycles(other.total_cycles),
+    decoded(std::move(other.decoded)),
+    decoded_hits(other.decoded_hits),
+    decoded_misses(other.decoded_misses),
+    decoded_allocations(other.decoded_allocations),
+    breakpoint_checks(other.breakpoint_checks),
+    blocks(std::move(other.blocks)),
+    snapshot_pages(std::move(other.snapshot_pages)),
+    dirty_pages(other.dirty_pages),
+    snapshot_breakpoints(std::move(other.snapshot_breakpoints)),
+    breakpoints_changed(other.breakpoints_changed),
+    journal(std::move(other.journal)),
+    loops(other.loops),
+    trace(other.trace),
+    watches(other.watches),
+    last_watch_hit(other.last_watch_hit) {
   
-  other.breakpoints_sz = 0;
+  // Leaves other without breakpoints, watchpoints, translated blocks or trace
+  other.clear_breakpoints();
+  other.breakpoints.reserve(MAX_INSTRUCTIONS);
+  other.watches = WatchList();
+  other.trace = NULL;
   other.total_cycles = 0;
+  other.reset_engine_counters();
 }
 
 // Copy Assignment Operator
@@ -102,9 +151,23 @@ Emulator& Emulator::operator=(const Emulator& other) {
     return *this;
 
   state = other.state;
-  breakpoints = other.breakpoints;
-  breakpoints_sz = other.breakpoints_sz;
+  breakpoint_map = other.breakpoint_map;
+  breakpoint_slots = other.breakpoint_slots;
+  breakpoint_names = other.breakpoint_names;
+  copy_breakpoints(other.breakpoints);
+  breakpoint_name_slots = other.breakpoint_name_slots;
   total_cycles = other.total_cycles;
+  snapshot_pages = other.snapshot_pages;
+  snapshot_breakpoints = other.snapshot_breakpoints;
+  breakpoints_changed = other.breakpoints_changed;
+  loops = other.loops;
+  watches = other.watches;
+  last_watch_hit = other.last_watch_hit;
+
+  invalidate_decoded();
+  dirty_pages = other.dirty_pages;
+  reset_journal();
+  reset_engine_counters();
 
   return *this;
 }
@@ -116,11 +179,34 @@ Emulator& Emulator::operator=(Emulator&& other) noexcept {
 
   state = std::move(other.state);
   breakpoints = std::move(other.breakpoints);
-  breakpoints_sz = other.breakpoints_sz;
+  breakpoint_map = other.breakpoint_map;
+  breakpoint_slots = other.breakpoint_slots;
+  breakpoint_names = std::move(other.breakpoint_names);
+  breakpoint_name_slots = std::move(other.breakpoint_name_slots);
   total_cycles = other.total_cycles;
-
-  other.breakpoints_sz = 0;
+  decoded = std::move(other.decoded);
+  decoded_hits = other.decoded_hits;
+  decoded_misses = other.decoded_misses;
+  decoded_allocations = other.decoded_allocations;
+  breakpoint_checks = other.breakpoint_checks;
+  blocks = std::move(other.blocks);
+  snapshot_pages = std::move(other.snapshot_pages);
+  dirty_pages = other.dirty_pages;
+  snapshot_breakpoints = std::move(other.snapshot_breakpoints);
+  breakpoints_changed = other.breakpoints_changed;
+  journal = std::move(other.journal);
+  loops = other.loops;
+  trace = other.trace;
+  watches = other.watches;
+  last_watch_hit = other.last_watch_hit;
+
+  // Leaves other without breakpoints, watchpoints, translated blocks or trace
+  other.clear_breakpoints();
+  other.breakpoints.reserve(MAX_INSTRUCTIONS);
+  other.watches = WatchList();
+  other.trace = NULL;
   other.total_cycles = 0;
+  other.reset_engine_counters();
 
   return *this;
 }
@@ -128,11 +214,11 @@ Emulator& Emulator::operator=(Emulator&& other) noexcept {
 // ----------> Main emulation loop
 
 InstructionData Emulator::fetch() const {
-  return {state.memory.at(state.pc), state.memory.at(state.pc + 1)};
+  return {state.cell(state.pc), state.cell(state.pc + 1)};
 }
 
 
-std::unique_ptr<InstructionBase> Emulator::decode(InstructionData data) const {
+InstructionHandle Emulator::decode(InstructionData data) const {
   // decode here is just a thin wrapper around generateInstruction()
   // In a more complex emulator, more things would happen here
   return InstructionBase::generateInstruction(data);
@@ -142,6 +228,12 @@ int Emulator::execute(InstructionBase* instr) {
   // Again this is just a thin wrapper,
   // but this is a side-effect of having a simple emulator
   instr->execute(state);
+
+  // A store might have overwritten a decoded instruction. run() checks the
+  // opcode instead, this is only for callers that have just the object
+  if (dynamic_cast<const Istr*>(instr) != NULL)
+    invalidate_decoded(instr->get_address());
+
   return 1;
 }
 
@@ -150,6 +242,11 @@ int Emulator::run(int steps) {
   if (steps == 0)
     return 1;
 
+  if (needs_run_fast(1))
+    return run_fast(steps);
+
+  loops.reset();
+
   // Repeat for the given number of steps
   // Break with return code 0, if we find an error
   // Break with return code 1, if we find a breakpoint
@@ -161,32 +258,128 @@ int Emulator::run(int steps) {
       return 0;
 
     // Fetch the next instruction from memory and transform it into an InstructionBase-derived object
-    std::unique_ptr<InstructionBase> instr = decode(fetch());
+    // (or reuse the one we decoded the last time we were here)
+    InstructionBase* instr = decode_cached();
 
     if (instr == NULL)
       return 0;
 
-    // What the function name says
-    int success = execute(instr.get());
+    // What the watchpoints need to know about the instruction
+    const addr_t pc = state.pc;
+    const byte_t opcode = state.cell(pc);
+    const addr_t address = instr->get_address();
+    const byte_t old = state.cell(address);
 
-    // Terminate if we didn't execute the instruction successfully
-    if (success == 0)
-      return 0;
+    // What execute() does, but we already know the opcode, so finding out
+    // whether this is a store doesn't need a dynamic_cast
+    instr->execute(state);
+    if (opcode == STR)
+      invalidate_decoded(address);
 
     ++total_cycles;
+
+    if (watches.active() && watch_triggered(opcode, address, pc, old))
+      return RUN_WATCH;
     
+    ++breakpoint_checks;
     if (is_breakpoint() == 1)
-      return 1;
+      return RUN_STOPPED;
+
+    // Jumped back to a state we've already been in: skip the rest of the loop
+    if (state.pc <= pc && loops.searching()) {
+      const int period = loops.visit(state.pc, state.acc, total_cycles);
+      if (period > 0)
+        steps -= skip_loop(period, steps - 1);
+    }
   }
 
-  return 1;
+  return loops.looping() ? RUN_LOOPING : RUN_STOPPED;
+}
+
+int Emulator::skip_loop(int period, int steps) {
+  // Whole periods bring us back to the current state, the rest of the steps
+  // (less than one period) are executed normally
+  const int skipped = (steps / period) * period;
+  total_cycles += skipped;
+  loops.set_looping(period);
+  return skipped;
+}
+
+void Emulator::set_loop_detection(int enabled) {
+  loops.set_enabled(enabled);
+}
+
+int Emulator::run_fast(int steps) {
+  // Where the other engines send the runs they can't handle (see needs_run_fast())
+  if (journal != NULL)
+    return run_journaled(steps);
+  if (trace != NULL)
+    return run_traced(steps);
+
+  NullObserver observer;
+  return run_with(steps, observer);
+}
+
+// ----------> Decoded instruction cache
+
+uint64_t Emulator::decode_hits() const {
+  return decoded_hits;
+}
+
+uint64_t Emulator::decode_misses() const {
+  return decoded_misses;
+}
+
+EngineCounters Emulator::engine_counters() const {
+  return EngineCounters{decoded_misses, decoded_allocations, breakpoint_checks, decoded_hits};
+}
+
+void Emulator::reset_engine_counters() {
+  decoded_hits = 0;
+  decoded_misses = 0;
+  decoded_allocations = 0;
+  breakpoint_checks = 0;
+}
+
+InstructionBase* Emulator::decode_cached() {
+  InstructionHandle& slot = decoded.at(state.pc / INSTRUCTION_SIZE);
+
+  if (slot != NULL) {
+    ++decoded_hits;
+    return slot.get();
+  }
+
+  // Invalid instructions are never cached, they stop the emulation anyway
+  ++decoded_misses;
+  slot = decode(fetch());
+  decoded_allocations += slot.get_deleter().owned;
+  return slot.get();
+}
+
+int Emulator::invalidate_decoded(addr_t address) {
+  decoded.at((address & ARCH_BITMASK) / INSTRUCTION_SIZE).reset();
+  dirty_pages.set((address & ARCH_BITMASK) / SNAPSHOT_PAGE_SIZE);
+  loops.memory_changed();
+  return blocks.invalidate(state.memory, address);
+}
+
+void Emulator::invalidate_decoded() {
+  for (InstructionHandle& slot : decoded)
+    slot.reset();
+  dirty_pages.set();
+  loops.memory_changed();
+  blocks.clear();
+}
+
+const std::bitset<MEMORY_SIZE>& Emulator::breakpoint_addresses() const {
+  return breakpoint_map;
 }
 
 // ----------> Breakpoint management
 
-int Emulator::insert_breakpoint(addr_t address, std::string name) {
+int Emulator::insert_breakpoint(addr_t address, std::string_view name) {
   // breakpoints is full (should never happen though!)
-  if (breakpoints_sz == MAX_INSTRUCTIONS)
+  if (num_breakpoints() == MAX_INSTRUCTIONS)
     return 0;
 
   // Breakpoint already exists
@@ -197,32 +390,52 @@ int Emulator::insert_breakpoint(addr_t address, std::string name) {
   if (find_breakpoint(name) != NULL)
     return 0;
 
-  // Insert breakpoint and increment breakpoints_sz in a single step
-  breakpoints.at(breakpoints_sz++) = Breakpoint(address, name);
+  // The breakpoint only keeps a view of its interned name
+  const int id = breakpoint_names.intern(name);
+  breakpoints.push_back(Breakpoint::interned(address, breakpoint_names.name(id)));
+
+  // Keep the indexes in sync
+  const Breakpoint& inserted = breakpoints.back();
+  breakpoint_map.set(inserted.get_address());
+  breakpoint_slots.at(inserted.get_address()) = breakpoints.size();
+  if (id >= static_cast<int>(breakpoint_name_slots.size()))
+    breakpoint_name_slots.resize(id + 1, 0);
+  breakpoint_name_slots.at(id) = breakpoints.size();
+  breakpoints_changed = true;
+
+  // Translated blocks might now run past the new breakpoint
+  blocks.clear();
   return 1;
 }
 
 
 const Breakpoint* Emulator::find_breakpoint(addr_t address) const {
-  // iterate over all breakpoints
-  for (int idx = 0; idx < breakpoints_sz; ++idx) {
-    if (breakpoints.at(idx).has(address)) {
-      // if this one has the address we're looking for return it
-      return &breakpoints.at(idx);
-    }
-  }
+  // breakpoint_slots holds the index + 1 of the breakpoint on each address, 0 for none
+  const int slot = breakpoint_slots.at(address & ARCH_BITMASK);
+
   // indicates failure to find a breakpoint
-  return NULL;
+  if (slot == 0)
+    return NULL;
+
+  return &breakpoints.at(slot - 1);
 }
 
 // Basically the same as above, but for the name
-const Breakpoint* Emulator::find_breakpoint(const std::string name) const {
-  for (int idx = 0; idx < breakpoints_sz; ++idx) {
-    if (breakpoints.at(idx).has(name)) {
-      return &breakpoints.at(idx);
-    }
-  }
-  return NULL;
+const Breakpoint* Emulator::find_breakpoint(std::string_view name) const {
+  const int id = breakpoint_names.find(name);
+  if (id < 0 || breakpoint_name_slots.at(id) == 0)
+    return NULL;
+  return &breakpoints.at(breakpoint_name_slots.at(id) - 1);
+}
+
+const Breakpoint* Emulator::find_breakpoint(const std::string& name) const {
+  return find_breakpoint(std::string_view(name));
+}
+
+const Breakpoint* Emulator::find_breakpoint(const char* name) const {
+  if (name == NULL)
+    return NULL;
+  return find_breakpoint(std::string_view(name));
 }
 
 int Emulator::delete_breakpoint(addr_t address) {
@@ -231,46 +444,98 @@ int Emulator::delete_breakpoint(addr_t address) {
   if (found == NULL)
     return 0;
 
-  // Remove one breakpoint
-  --breakpoints_sz;
-
   // Urghh: C pointer magic to find the index of the breakpoint from its pointer
   // `found` is a pointer in the `breakpoints` array, so the difference of
   // `found` and `breakpoints` is the index of `found` in the array.
-  int found_idx = found - breakpoints.data();
-
-  // Move all breakpoints above found one position to the left, to fill the gap 
-  for (int idx = found_idx; idx < breakpoints_sz; ++idx) {
-    // This is an object assignment operation, assigning to breakpoints[idx]
-    // the object currently in breakpoints[idx + 1]. Without std::move, this
-    // would cause a copy
-    breakpoints.at(idx) = std::move(breakpoints.at(idx + 1));
-  }
-
+  remove_breakpoint(found - breakpoints.data());
   return 1;
 }
 
 // Oh, look, this function is practically identical to the one above
-int Emulator::delete_breakpoint(const char* name) {
+int Emulator::delete_breakpoint(std::string_view name) {
   const Breakpoint* found = find_breakpoint(name);
 
   if (found == NULL)
     return 0;
 
-  --breakpoints_sz;
+  remove_breakpoint(found - breakpoints.data());
+  return 1;
+}
 
-  int found_idx = found - breakpoints.data();
+int Emulator::delete_breakpoint(const char* name) {
+  if (name == NULL)
+    return 0;
+  return delete_breakpoint(std::string_view(name));
+}
+
+void Emulator::remove_breakpoint(int idx) {
+  const Breakpoint& removed = breakpoints.at(idx);
+  breakpoint_map.reset(removed.get_address());
+  breakpoint_slots.at(removed.get_address()) = 0;
+  breakpoint_name_slots.at(breakpoint_names.find(removed.get_name())) = 0;
+
+  // Fill the gap with the last breakpoint instead of shifting everything
+  // above it. This is an object assignment operation, assigning to
+  // breakpoints[idx] the object currently at the back of breakpoints.
+  // Without std::move, this would cause a copy
+  const int last = num_breakpoints() - 1;
+  if (idx != last) {
+    breakpoints.at(idx) = std::move(breakpoints.at(last));
+
+    const Breakpoint& moved = breakpoints.at(idx);
+    breakpoint_slots.at(moved.get_address()) = idx + 1;
+    breakpoint_name_slots.at(breakpoint_names.find(moved.get_name())) = idx + 1;
+  }
 
-  // Move all breakpoints above found, one position to the left to fill the gap 
-  for (int idx = found_idx; idx < breakpoints_sz; ++idx) {
-    breakpoints.at(idx) = std::move(breakpoints.at(idx + 1));
+  // Remove one breakpoint
+  breakpoints.pop_back();
+  breakpoints_changed = true;
+
+  // Names of breakpoints long gone would pile up in a session that keeps
+  // making new ones
+  if (breakpoint_names.size() > 4 * MAX_INSTRUCTIONS)
+    reintern_breakpoint_names();
+
+  // Blocks ending at the old breakpoint can now be longer
+  blocks.clear();
+}
+
+void Emulator::clear_breakpoints() {
+  breakpoints.clear();
+  breakpoints_changed = true;
+  breakpoint_map.reset();
+  breakpoint_slots.fill(0);
+  breakpoint_names.clear();
+  breakpoint_name_slots.clear();
+  blocks.clear();
+}
+
+void Emulator::reintern_breakpoint_names() {
+  // The names of the breakpoints are views into the old arena, so the new
+  // one can't reuse its chunks
+  NameArena names;
+  breakpoint_name_slots.assign(breakpoints.size(), 0);
+  for (size_t idx = 0; idx < breakpoints.size(); ++idx) {
+    Breakpoint& breakpoint = breakpoints.at(idx);
+    const int id = names.intern(breakpoint.get_name());
+    breakpoint = Breakpoint::interned(breakpoint.get_address(), names.name(id));
+    breakpoint_name_slots.at(id) = idx + 1;
   }
+  breakpoint_names = std::move(names);
+}
 
-  return 1;
+void Emulator::copy_breakpoints(const std::vector<Breakpoint>& other) {
+  // The names of other are views into its own arena, breakpoint_names
+  // already has the same ones
+  breakpoints.clear();
+  for (const Breakpoint& breakpoint : other) {
+    const int id = breakpoint_names.find(breakpoint.get_name());
+    breakpoints.push_back(Breakpoint::interned(breakpoint.get_address(), breakpoint_names.name(id)));
+  }
 }
 
 int Emulator::num_breakpoints() const {
-  return breakpoints_sz;
+  return breakpoints.size();
 }
 
 // ----------> Manage state
@@ -290,7 +555,11 @@ addr_t Emulator::read_pc() const {
 addr_t Emulator::read_mem(addr_t address) const {
   // limit address to the allowed range of values
   address &= ARCH_BITMASK;
-  return state.memory.at(address);
+  return state.cell(address);
+}
+
+const ProcessorState& Emulator::processor_state() const {
+  return state;
 }
 
 // ----------> Utilities
@@ -300,77 +569,187 @@ int Emulator::is_zero() const {
 }
 
 int Emulator::is_breakpoint() const {
-  return find_breakpoint(state.pc) != NULL;
+  // A single bit test, this is called after every instruction
+  return breakpoint_map[state.pc];
 }
 
 int Emulator::print_program() const {
-  for (int offset = 0; offset < MEMORY_SIZE; offset += INSTRUCTION_SIZE) {
-    InstructionData data{state.memory.at(offset), state.memory.at(offset + 1)};
-    std::unique_ptr<InstructionBase> instr = decode(data);
+  // One write and one flush for the whole listing
+  char buffer[DISASSEMBLY_PROGRAM_MAX];
+  char* end = disassemble(buffer);
+  std::cout.write(buffer, end - buffer);
+  std::cout.flush();
+  return !std::cout.fail();
+}
 
-    if ((instr == NULL) || (data.opcode == 0 && data.address == 0)) {
-      // printf("%d:\t%d\t%d\n", offset, data.opcode, data.address);
-      std::cout << offset << ":\t" << static_cast<int>(data.opcode) << "\t" << static_cast<int>(data.address) << std::endl;
-    }
-    else 
-      // printf("%d:\t%d\t%d\t:\t%s\n", offset, data.opcode, data.address, instr->to_string());
-      std::cout << offset << ":\t" << static_cast<int>(data.opcode) << "\t" << static_cast<int>(data.address) << "\t:\t" << instr->to_string() << std::endl;
-  }
+char* Emulator::disassemble(char* out) const {
+  return disassemble_program(out, state.memory);
+}
+
+namespace {
+
+/**
+ * The whitespace that the stream operators skip ("C" locale isspace())
+ */
+int is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/**
+ * std::getline() on a buffer: the text up to the next '\n', which is skipped
+ *
+ * @return 1 for success, 0 if we are at the end of the text
+ */
+int next_line(const char*& pos, const char* end, std::string_view& line) {
+  if (pos == end)
+    return 0;
+
+  const char* newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+  if (newline == NULL)
+    newline = end;
+
+  line = std::string_view(pos, newline - pos);
+  pos = (newline == end) ? end : newline + 1;
+  return 1;
+}
+
+/**
+ * `stream >> value` for an int on a buffer, with std::from_chars(): skips
+ * whitespace, then takes an optional sign and all the digits after it
+ *
+ * @param at_end Set to 1 if the end of the text was reached, like the eof() of the stream
+ * @return 1 for success, 0 if there are no digits or the number doesn't fit in an int
+ */
+int next_int(const char*& pos, const char* end, int& value, int& at_end) {
+  while (pos != end && is_space(*pos))
+    ++pos;
+
+  // from_chars() doesn't take a '+'
+  const char* number = pos;
+  if (pos != end && (*pos == '+' || *pos == '-'))
+    ++pos;
+  if (number != end && *number == '+')
+    ++number;
+
+  const char* digits = pos;
+  while (pos != end && *pos >= '0' && *pos <= '9')
+    ++pos;
+  at_end = (pos == end);
+
+  if (pos == digits)
+    return 0;
+  return std::from_chars(number, pos, value).ec == std::errc();
+}
+
+/**
+ * `stream >> word` for a std::string on a buffer: skips whitespace, then
+ * takes everything up to the next whitespace
+ *
+ * @return 1 for success, 0 if only whitespace was left (at_end is then 1)
+ */
+int next_word(const char*& pos, const char* end, std::string_view& word, int& at_end) {
+  while (pos != end && is_space(*pos))
+    ++pos;
+
+  const char* start = pos;
+  while (pos != end && !is_space(*pos))
+    ++pos;
+  at_end = (pos == end);
+
+  word = std::string_view(start, pos - start);
+  return !word.empty();
+}
+
+/**
+ * A header line: a number, then anything
+ */
+int parse_header(std::string_view line, int& value) {
+  const char* pos = line.data();
+  int at_end;
+  return next_int(pos, line.data() + line.size(), value, at_end);
+}
+
+/**
+ * A memory line: a number, and nothing but whitespace after it
+ */
+int parse_memory(std::string_view line, int& value) {
+  const char* pos = line.data();
+  const char* end = line.data() + line.size();
+  int at_end;
+  if (!next_int(pos, end, value, at_end))
+    return 0;
+
+  while (pos != end && is_space(*pos))
+    ++pos;
+  return pos == end;
+}
+
+}
+
+int Emulator::valid_breakpoint_name(std::string_view name) {
+  if (name.empty())
+    return 0;
+  for (char c : name)
+    if (is_space(c))
+      return 0;
   return 1;
 }
 
 int Emulator::load_state(const std::string filename) {
+  // One read for the whole file, then parse it in memory. A file that can't
+  // be read fails like an empty one, after the same resets
+  std::vector<char> text;
+  if (!read_whole_file(filename, text))
+    text.clear();
+
+  return load_state_text(text.data(), text.size());
+}
+
+int Emulator::load_state_text(const char* text, size_t size) {
   // Delete all breakpoints
-  breakpoints_sz = 0;
+  clear_breakpoints();
 
-  int read = 0;
+  // The whole memory is about to change
+  invalidate_decoded();
+  reset_journal();
 
-  std::ifstream file(filename);
+  // This parses exactly what the std::ifstream/std::istringstream version
+  // did: every line read with std::getline() and the numbers on it
+  // with operator>>, which skips leading whitespace, takes a sign and
+  // ignores whatever follows the number on the first three lines
+  const char* pos = text;
+  const char* end = text + size;
+  std::string_view line;
 
-  if (!file)
+  if (!next_line(pos, end, line) || line.empty() || !parse_header(line, total_cycles) || total_cycles < 0)
     return 0;
 
-  std::string line;
-  if (std::getline(file, line) && !line.empty()) {
-    std::istringstream iss(line);
-    if (!(iss >> total_cycles) || total_cycles < 0) 
-      return 0;
-  } else
-      return 0;
-
-  if (std::getline(file, line)) {
-    std::istringstream iss(line);
-    if (!(iss >> state.acc) || state.acc > ARCH_MAXVAL || state.acc < 0) 
-      return 0;
-  } else 
-      return 0;
+  if (!next_line(pos, end, line) || !parse_header(line, state.acc) || state.acc > ARCH_MAXVAL || state.acc < 0)
+    return 0;
 
-  if (std::getline(file, line)) {
-    std::istringstream iss(line);
-    if (!(iss >> state.pc) || state.pc >= MEMORY_SIZE || state.pc < 0) 
-      return 0;
-    
-  } else      
-      return 0;
+  if (!next_line(pos, end, line) || !parse_header(line, state.pc) || state.pc >= MEMORY_SIZE || state.pc < 0)
+    return 0;
 
   int num = 0;
   for (int offset = 0; offset < MEMORY_SIZE; ++offset) {
-    if (!std::getline(file, line) || line.empty()) {
-        return 0;
-    }
+    if (!next_line(pos, end, line) || line.empty())
+      return 0;
 
-    std::istringstream iss(line);
-    if (!(iss >> num) || !(iss >> std::ws).eof() || num > ARCH_MAXVAL || num < 0) {
-        return 0;
-    }
+    if (!parse_memory(line, num) || num > ARCH_MAXVAL || num < 0)
+      return 0;
 
-    state.memory.at(offset) = num;
+    state.store(offset, num);
   }
 
+  // The breakpoints are read as a stream of words, not lines: an address and
+  // a name, over and over. Running out of text before either of them,
+  // or in the middle of the address, ends the list; anything else wrong
+  // fails the load
   while (true) {
-    std::string name;
-    if (!(file >> num >> name)) {
-        if (file.eof()) break;
+    std::string_view name;
+    int at_end = 0;
+    if (!next_int(pos, end, num, at_end) || !next_word(pos, end, name, at_end)) {
+        if (at_end) break;
         return 0;
     }
 
@@ -456,19 +835,38 @@ int Emulator::save_state(std::string filename) const {
   
   if (!file) 
     return 0;
-  
-  file << total_cycles << std::endl;
-  file << state.acc << std::endl;
-  file << state.pc << std::endl;
 
+  // Format everything into one buffer and write it in a single call, instead
+  // of flushing the stream with std::endl after every one of the ~260 lines
+  std::string text;
+  text.reserve(4 * (MEMORY_SIZE + 3));
+
+  char number[16];
+  auto append_number = [&](int value, char separator) {
+    const std::to_chars_result result = std::to_chars(number, number + sizeof(number), value);
+    text.append(number, result.ptr);
+    text.push_back(separator);
+  };
+
+  append_number(total_cycles, '\n');
+  append_number(state.acc, '\n');
+  append_number(state.pc, '\n');
+
+  // Memory bytes go through an int, or they'd be written as characters
   for (int offset = 0; offset < MEMORY_SIZE; ++offset) 
-    file << state.memory.at(offset) << std::endl;
-  
-  for (int idx = 0; idx < breakpoints_sz; ++idx)
-    file << breakpoints.at(idx).get_address() << " " << breakpoints.at(idx).get_name() << std::endl;
+    append_number(state.cell(offset), '\n');
   
+  for (int idx = 0; idx < num_breakpoints(); ++idx) {
+    append_number(breakpoints.at(idx).get_address(), ' ');
+    text.append(breakpoints.at(idx).get_name());
+    text.push_back('\n');
+  }
 
+  file.write(text.data(), text.size());
   file.close();
+
+  if (file.fail())
+    return 0;
   
   // FILE* fp = fopen(filename, "w");
 
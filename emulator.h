@@ -21,14 +21,27 @@
 // -----------------------------------------------------------------------------
 
 #include "common.h"
+#include "aot.h"
+#include "async.h"
+#include "blocks.h"
+#include "checkpoint.h"
+#include "perf_counters.h"
+#include "instructions.h"
+#include "journal.h"
+#include "loops.h"
+#include "memo.h"
+#include "names.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "watch.h"
 #include <iostream>
 #include <array>
+#include <bitset>
 #include <memory>
-
-//------------------------------------------------------------------------------
-//--------------------               CONSTANTS              --------------------
-//------------------------------------------------------------------------------
-#define MAX_INSTRUCTIONS ((MEMORY_SIZE) / (INSTRUCTION_SIZE))
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 //------------------------------------------------------------------------------
 //--------------------               CLASSES                --------------------
@@ -56,7 +69,7 @@ class Breakpoint {
      * @param address The address on which we break
      * @param name A symbolic name for the breakpoint. We are not allowed to modify or take ownership of this string. The name can contain any alphanumeric character (no spaces allowed). The name is guaranteed to be valid (i.e. not null)
      */
-    Breakpoint(addr_t address, const std::string& name);
+    Breakpoint(addr_t address, std::string_view name);
 
     // Copy/Move Constructors
     Breakpoint(const Breakpoint& other);
@@ -75,8 +88,11 @@ class Breakpoint {
 
     /**
      * Getter for the name
+     *
+     * The view is valid as long as the breakpoint, and for a breakpoint in
+     * an Emulator, until it's deleted
      */
-    const std::string& get_name() const;
+    std::string_view get_name() const;
 
     /**
      * Testing whether the breakpoint targets this address
@@ -86,11 +102,26 @@ class Breakpoint {
     /**
      * Testing whether the breakpoint targets this name
      */
-    int has(const std::string&) const;
+    int has(std::string_view name) const;
 
   private:
+    friend class Emulator;
+
+    /**
+     * A breakpoint whose name was interned by an Emulator, without a copy of its own
+     *
+     * @param address The address on which we break
+     * @param name A view into the NameArena of the emulator, which has to outlive the breakpoint
+     */
+    static Breakpoint interned(addr_t address, std::string_view name);
+
     addr_t _address;
-    std::string _name;
+
+    // The characters of the name, unless it lives in the NameArena of an
+    // Emulator. Copies always get characters of their own, so they can
+    // outlive the emulator
+    std::unique_ptr<char[]> _owned;
+    std::string_view _name;
 };
 
 /**
@@ -158,9 +189,9 @@ class Emulator {
      * Transforms the instruction bytes into an InstructionBase object of the right dynamic type
      *
      * @param instruction The byte representation of the instruction
-     * @return an **owning** object pointer inheriting from InstructionBase that has a) the dynamic type indicated by the instruction opcode and b) the target address indicated by the instruction's second byte
+     * @return a pointer to an object inheriting from InstructionBase that has a) the dynamic type indicated by the instruction opcode and b) the target address indicated by the instruction's second byte. The object is shared and nothing is allocated (see InstructionBase::generateInstruction()), NULL for an invalid opcode
      */
-    std::unique_ptr<InstructionBase> decode(InstructionData instruction) const;
+    InstructionHandle decode(InstructionData instruction) const;
 
     /**
      * A simple function just calling the instructions execute function
@@ -173,11 +204,254 @@ class Emulator {
     /**
      * Run iterations for a certain number of steps, until an error happens, or we reach a breakpoint
      *
+     * If the machine gets stuck in an endless loop (see loops.h), the rest of
+     * the steps are not executed one by one: the cycles are counted as if they
+     * were, the machine is left in the state it would be in after them, and
+     * we return RUN_LOOPING. This is not done while the undo journal is enabled.
+     *
      * @param steps The maximum number of cycles to execute 
-     * @return whether we stopped normally or abnormally (1 means normally due to a breakpoint or after the maximum number of steps, 0 means abnormally due to an error)
+     * @return whether we stopped normally or abnormally (1 means normally due to a breakpoint or after the maximum number of steps, 2 normally with the machine in an endless loop, 3 normally at a watchpoint, 0 means abnormally due to an error)
      */
     int run(int steps);
 
+    /**
+     * Same contract as run(), but without going through InstructionBase
+     *
+     * The instruction bytes are decoded straight from memory and dispatched
+     * with a switch on the opcode, so there are no heap allocations and no
+     * virtual calls per cycle. Cycle counts, failure returns (odd PC, invalid
+     * opcode), breakpoint stops and loop detection are identical to run().
+     *
+     * @param steps The maximum number of cycles to execute
+     * @return a RunStatus, the same as run()
+     */
+    int run_fast(int steps);
+
+    /**
+     * Same contract as run(), executing whole translated blocks at a time
+     *
+     * Straight-line runs of instructions are translated once (see blocks.h)
+     * and then replayed without per-instruction decoding or masking.
+     * Translations are dropped when a store writes into them or the
+     * breakpoints change. Results, cycle counts and loop detection are identical to run().
+     * With watchpoints or acc conditions, this runs the same loop as run_fast().
+     *
+     * @param steps The maximum number of cycles to execute
+     * @return a RunStatus, the same as run()
+     */
+    int run_blocks(int steps);
+
+    /**
+     * Turn the endless loop detection of the engines on or off (on by default)
+     *
+     * With it off every step is executed and the engines never return
+     * RUN_LOOPING, e.g. for measuring how fast instructions execute
+     *
+     * @param enabled 1 to detect loops, 0 not to
+     */
+    void set_loop_detection(int enabled);
+
+    /**
+     * Same loop as run_fast(), calling an observer around every instruction
+     *
+     * The observer type provides:
+     * - `static constexpr bool stops_at_breakpoints`: whether the run stops at breakpoints and
+     *   watchpoints like run() does
+     * - `static constexpr bool detects_loops`: whether endless loops are skipped like run() does.
+     *   Observers that need to see every step should set this to false
+     * - `void before_step(Emulator& emulator, byte_t opcode, addr_t address)`: called for every
+     *   valid instruction, right before it is executed
+     * - optionally `void after_step(Emulator& emulator)`: called right after every instruction,
+     *   once the cycle is counted
+     *
+     * The hooks are resolved at compile time, so an observer with empty hooks
+     * costs nothing (run_fast() is run_with() with NullObserver).
+     *
+     * @param steps The maximum number of cycles to execute
+     * @param observer The observer
+     * @return a RunStatus, the same as run()
+     */
+    template <class Observer>
+    int run_with(int steps, Observer& observer);
+
+    // ----------> Decoded instruction cache
+
+    /**
+     * Number of times run() found the instruction at the PC already decoded
+     */
+    uint64_t decode_hits() const;
+
+    /**
+     * Number of times run() had to decode the instruction at the PC
+     */
+    uint64_t decode_misses() const;
+
+    /**
+     * What run() did besides executing instructions (see perf_counters.h)
+     */
+    EngineCounters engine_counters() const;
+
+    /**
+     * Zero the engine counters, the decode hits and misses included
+     */
+    void reset_engine_counters();
+
+    // ----------> Snapshots
+
+    /**
+     * Take a snapshot of the processor state, the cycles and the breakpoints
+     *
+     * Only the memory pages written and the breakpoints changed since the last
+     * snapshot() or restore() are copied, the rest is shared (see snapshot.h)
+     *
+     * @return the snapshot
+     */
+    EmulatorSnapshot snapshot();
+
+    /**
+     * Go back to the state saved in a snapshot
+     *
+     * The snapshot can come from any emulator. Only the pages that differ are
+     * copied back, and the breakpoints are only rebuilt if they differ.
+     *
+     * @param saved The snapshot to restore
+     * @return 1 for success, 0 if the snapshot is empty
+     */
+    int restore(const EmulatorSnapshot& saved);
+
+    // ----------> Reverse execution
+
+    /**
+     * Start recording an undo journal (see journal.h)
+     *
+     * While the journal is enabled, run(), run_fast() and run_blocks() all
+     * record every instruction they execute. Loading or restoring a state
+     * clears the journal, as does enabling it again.
+     *
+     * @param capacity The maximum number of cycles that can be undone
+     * @param checkpoint_interval The number of cycles between full checkpoints
+     * @return 1 for success, 0 if either argument is not positive
+     */
+    int enable_journal(int capacity, int checkpoint_interval);
+
+    /**
+     * Stop recording and forget the journal
+     */
+    void disable_journal();
+
+    /**
+     * Run backwards for a certain number of steps, until we run out of journal, or we reach a breakpoint
+     *
+     * Every step undoes the last executed instruction, including the cycle
+     * count. reverse_run(1) is a single reverse step.
+     *
+     * @param steps The maximum number of cycles to undo
+     * @return 1 if we stopped normally (breakpoint or after the maximum number of steps), 0 if the journal ran out or is disabled
+     */
+    int reverse_run(int steps);
+
+    /**
+     * Go back to the state after a given number of cycles
+     *
+     * Breakpoints are ignored and left as they are now.
+     *
+     * @param cycle The cycle to go to, between journal_oldest_cycle() and cycles()
+     * @return 1 for success, 0 if the cycle is out of that range or the journal is disabled
+     */
+    int seek(int cycle);
+
+    /**
+     * The oldest cycle we can still go back to
+     *
+     * @return the cycle, or -1 if the journal is disabled
+     */
+    int journal_oldest_cycle() const;
+
+    // ----------> Tracing
+
+    /**
+     * Report every instruction that run(), run_fast() and run_blocks() execute (see trace.h)
+     *
+     * Traced runs execute every step, without loop detection. Runs with the
+     * journal enabled are not traced. The sink is not owned and not copied
+     * along with the emulator.
+     *
+     * @param sink Where to report, NULL to stop tracing
+     */
+    void set_trace(TraceSink* sink);
+
+    // ----------> Memoization
+
+    /**
+     * A hash of the processor state (acc, pc and memory), maintained incrementally
+     *
+     * Costs O(1): the memory part is updated on every store (see
+     * ProcessorState::memory_hash). Equal states have equal hashes,
+     * so it can tell quickly whether a state has been seen before.
+     * The cycle count and the breakpoints are not part of it
+     */
+    uint64_t state_hash() const;
+
+    /**
+     * Same contract as run(), reusing the result of an identical earlier run (see memo.h)
+     *
+     * If the memo has a run of the same number of steps from the same state
+     * with the same breakpoints and loop detection setting, the emulator
+     * jumps to its end state and counts its cycles without executing
+     * anything. Otherwise this is run_fast(), and the run is recorded. Runs
+     * with the journal, a trace, watchpoints or acc conditions are never
+     * memoized.
+     *
+     * @param steps The maximum number of cycles to execute
+     * @param memo The recorded runs
+     * @return a RunStatus, the same as run()
+     */
+    int run_memoized(int steps, RunMemo& memo);
+
+    // ----------> Ahead-of-time compilation
+
+    /**
+     * Compile the program in memory into a C++ translation unit (see aot.h)
+     *
+     * Only the instruction slots reachable from the current PC are compiled.
+     * The translation unit defines `extern const AotProgram aot_<name>`
+     *
+     * @param out Where to write the translation unit
+     * @param name The name of the program, a C identifier
+     * @return 1 for success, 0 if the name is invalid or the PC is odd
+     */
+    int compile(std::ostream& out, const std::string& name) const;
+
+    /**
+     * Same contract as run() without loop detection, executing compiled code
+     *
+     * Falls back to the interpreter for the whole run if the compiled slots
+     * in memory differ from the image the program was compiled from, or with
+     * the journal, a trace, watchpoints or acc conditions, and for the rest
+     * of the run if the compiled code returns AOT_FALLBACK. Results, cycle
+     * counts and breakpoint stops are identical to run() with
+     * set_loop_detection(0) either way.
+     *
+     * @param steps The maximum number of cycles to execute
+     * @param program The compiled program
+     * @return a RunStatus, the same as run()
+     */
+    int run_compiled(int steps, const AotProgram& program);
+
+    // ----------> Coroutine runs
+
+    /**
+     * Same contract as run_fast(), as a coroutine that suspends every `slice` cycles (see async.h)
+     *
+     * Nothing runs until the task is resumed. The emulator has to outlive
+     * the task, and must not be used for anything else until the task is done
+     *
+     * @param steps The maximum number of cycles to execute
+     * @param slice The cycles per resume, 0 for the whole run in one go
+     * @return the task, whose result has the RunStatus and the cycles of the run
+     */
+    RunTask run_async(int steps, int slice);
+
     // ----------> Breakpoint management
 
     /**
@@ -185,11 +459,26 @@ class Emulator {
      *
      * Fail if the name or the address are already registered. Also if we ran out of breakpoint storage but this should never happen.
      *
+     * Takes any string-like name without copying it, only the new Breakpoint
+     * gets a copy
+     *
      * @param address The address to register
-     * @param name The name of the breakpoints (non-owning pointer)
+     * @param name The name of the breakpoints (non-owning)
      * @return whether the operation was successful (1 means success, 0 failure)
      */
-    int insert_breakpoint(addr_t address, const std::string name);
+    int insert_breakpoint(addr_t address, std::string_view name);
+
+    /**
+     * Whether a breakpoint name can be written to a text state file and read back
+     *
+     * load_state() reads a name up to the next whitespace, so a valid name is
+     * non-empty and has no whitespace in it. The binary loaders and the
+     * server accept the same names.
+     *
+     * @param name The name to check
+     * @return 1 if the name is valid, 0 otherwise
+     */
+    static int valid_breakpoint_name(std::string_view name);
 
     /**
      * Find the breakpoint with the given address in our breakpoint storage
@@ -202,10 +491,16 @@ class Emulator {
     /**
      * Find the breakpoint with the given name in our breakpoint storage
      *
-     * @param name The name of the breakpoint (non-owning pointer)
+     * The name is looked up in the interned names (see names.h), without
+     * building a std::string. The other overloads are thin wrappers that
+     * keep every string-like argument unambiguous
+     *
+     * @param name The name of the breakpoint (non-owning)
      * @return A non-owning pointer to the Breakpoint or null if the name was not found
      */
-    const Breakpoint* find_breakpoint(const std::string name) const;
+    const Breakpoint* find_breakpoint(std::string_view name) const;
+    const Breakpoint* find_breakpoint(const std::string& name) const;
+    const Breakpoint* find_breakpoint(const char* name) const;
 
     /**
      * Unregister the breakpoint with the given address
@@ -218,9 +513,12 @@ class Emulator {
     /**
      * Unregister the breakpoint with the given name
      *
-     * @param name The name of the breakpoint (non-owning pointer)
+     * Same lookup as find_breakpoint(std::string_view)
+     *
+     * @param name The name of the breakpoint (non-owning)
      * @return Whether a breakpoint was removed (1 means removed, 0 means none removed)
      */
+    int delete_breakpoint(std::string_view name);
     int delete_breakpoint(const char* name);
 
     /**
@@ -230,6 +528,56 @@ class Emulator {
      */
     int num_breakpoints() const;
 
+    // ----------> Watchpoints
+
+    /**
+     * Stop runs after instructions that access a memory byte (see watch.h)
+     *
+     * Watchpoints are checked by every engine on the instructions whose
+     * operand is the watched address, and stop the run with RUN_WATCH. They
+     * are not part of the state files or snapshots. A watchpoint already on
+     * the address is replaced.
+     *
+     * @param address The address to watch
+     * @param kinds What to stop at: WatchKinds combined with |
+     * @param value The value a STR has to leave in the byte, for WATCH_VALUE
+     * @return 1 for success, 0 if the address, kinds or value are invalid
+     */
+    int insert_watchpoint(addr_t address, int kinds, data_t value = 0);
+
+    /**
+     * Remove the watchpoint on an address
+     *
+     * @return 1 if a watchpoint was removed, 0 if there was none
+     */
+    int delete_watchpoint(addr_t address);
+
+    /**
+     * Get the number of watched addresses
+     */
+    int num_watchpoints() const;
+
+    /**
+     * Stop runs after an ADD, AND, ORR, XOR or LDR that leaves a matching value in the accumulator
+     *
+     * Conditions are combined with OR, and stop the run with RUN_WATCH.
+     *
+     * @param condition How to compare the accumulator with `value`
+     * @param value The value to compare with
+     * @return 1 for success, 0 if the value is invalid or no accumulator value can match
+     */
+    int insert_acc_condition(AccCondition condition, data_t value);
+
+    /**
+     * Remove all acc conditions
+     */
+    void clear_acc_conditions();
+
+    /**
+     * What stopped the last run that returned RUN_WATCH
+     */
+    const WatchHit& watch_hit() const;
+
     // ----------> Manage state
 
     /**
@@ -257,6 +605,13 @@ class Emulator {
      */
     addr_t read_mem(addr_t address) const;
 
+    /**
+     * A read-only view of the processor state, valid as long as the emulator
+     *
+     * For handing acc, pc and memory out without copying them (see server.h)
+     */
+    const ProcessorState& processor_state() const;
+
     // ----------> Utilities
 
     /**
@@ -281,6 +636,14 @@ class Emulator {
      */
     int print_program() const;
 
+    /**
+     * Writes what print_program() prints into a buffer (see disassembler.h)
+     *
+     * @param out Where to write, with room for DISASSEMBLY_PROGRAM_MAX chars
+     * @return the end of the listing (no '\0' is written)
+     */
+    char* disassemble(char* out) const;
+
     /**
      * Reads the processor state from a file
      *
@@ -296,6 +659,17 @@ class Emulator {
      */
     int load_state(const std::string state_filename);
 
+    /**
+     * Reads the processor state from the contents of a state file that is already in memory
+     *
+     * Same format and validation as load_state(), which reads the whole file and calls this
+     *
+     * @param text The contents of the file (no '\0' needed)
+     * @param size The size of the contents in bytes
+     * @return 1 for success, 0 otherwise
+     */
+    int load_state_text(const char* text, size_t size);
+
     /**
      * Stores the processor state in a file, in the same format used by load_state
      *
@@ -305,11 +679,351 @@ class Emulator {
      * @return 1 for success, 0 otherwise
      */
     int save_state(const std::string state_filename) const;
+
+    /**
+     * Reads the processor state from a binary state file (see binary_state.h)
+     *
+     * The file is memory-mapped and validated with the same rules as load_state:
+     * non-negative cycles, and breakpoints with unique addresses and non-empty names.
+     *
+     * @param state_filename A string containing the name of the file to read
+     * @return 1 for success, 0 otherwise
+     */
+    int load_binary_state(const std::string state_filename);
+
+    /**
+     * Reads the processor state from the contents of a binary state file that is already in memory
+     *
+     * Same format and validation as load_binary_state()
+     *
+     * @param data The contents of the file
+     * @param size The size of the contents in bytes
+     * @return 1 for success, 0 otherwise
+     */
+    int load_binary_state_data(const byte_t* data, size_t size);
+
+    /**
+     * Stores the processor state in a binary state file (see binary_state.h)
+     *
+     * @param state_filename A string containing the name of the file to write
+     * @return 1 for success, 0 otherwise
+     */
+    int save_binary_state(const std::string state_filename) const;
+
+    /**
+     * Append a checkpoint to a log (see checkpoint.h)
+     *
+     * The first checkpoint of a log holds the whole state, the others only
+     * the memory lines written since the previous one. The dirty lines are
+     * cleared, so an emulator should only checkpoint into one log at a time
+     *
+     * @param log The log, which has to be open
+     * @return 1 for success, 0 otherwise
+     */
+    int save_checkpoint(CheckpointLog& log);
+
+    /**
+     * Replays a checkpoint log, to the state of its last complete checkpoint
+     *
+     * The result is the same as load_state() of a state file saved at that
+     * checkpoint
+     *
+     * @param log_filename The log file
+     * @return 1 for success, 0 otherwise
+     */
+    int load_checkpoint_log(const std::string log_filename);
   
   private:
+    /**
+     * Whether an engine has to hand the run over to run_fast()
+     *
+     * The journal and the trace need to see every instruction, so only the
+     * instrumented loops of run_fast() can run with them. Engines that don't
+     * execute one instruction at a time can't stop where a watchpoint or an
+     * acc condition triggers either
+     *
+     * @param checks_watches Whether the engine checks the watchpoints itself
+     * @return 1 if the run has to go through run_fast(), 0 otherwise
+     */
+    int needs_run_fast(int checks_watches) const {
+      return journal != NULL || trace != NULL || (!checks_watches && watches.active());
+    }
+
+    /**
+     * The loop of run_with(), continuing the loop detection of the current run
+     *
+     * @tparam Watched Whether to check the watchpoints and acc conditions
+     */
+    template <class Observer, bool Watched = false>
+    int run_loop(int steps, Observer& observer);
+
+    /**
+     * Check the watchpoints after an instruction, remembering the hit
+     *
+     * @param opcode The opcode of the instruction
+     * @param address Its operand
+     * @param pc Its address
+     * @param old The byte at `address` before it executed
+     * @return 1 if the run has to stop, 0 otherwise
+     */
+    int watch_triggered(byte_t opcode, addr_t address, addr_t pc, byte_t old) {
+      const int kinds = watches.check(opcode, address, old, state.cell(address), state.acc);
+      if (kinds == 0)
+        return 0;
+
+      last_watch_hit = {kinds, address, pc};
+      return 1;
+    }
+
+    /**
+     * Count the cycles of whole periods of an endless loop without executing them
+     *
+     * @param period The number of cycles in one period of the loop
+     * @param steps How many steps are left in this run
+     * @return the number of steps skipped
+     */
+    int skip_loop(int period, int steps);
+
+    /**
+     * run_with() recording into the journal
+     */
+    int run_journaled(int steps);
+
+    /**
+     * run_with() reporting to the trace sink
+     */
+    int run_traced(int steps);
+
+    /**
+     * Undo the instruction recorded in a journal entry
+     */
+    void undo(const JournalEntry& entry);
+
+    /**
+     * The part of restore() that doesn't touch the breakpoints
+     */
+    void restore_processor(const EmulatorSnapshot& saved);
+
+    /**
+     * Forget the recorded history, because the state was replaced
+     */
+    void reset_journal();
+
+    /**
+     * Validate and load the contents of a binary state file
+     *
+     * @param data The file contents
+     * @param size The size of the file in bytes
+     * @return 1 for success, 0 otherwise
+     */
+    int load_binary_image(const byte_t* data, size_t size);
+
+    /**
+     * Get the decoded instruction at the PC, decoding it only on first use
+     *
+     * @return a non-owning pointer into the decode cache, or NULL for an invalid instruction
+     */
+    InstructionBase* decode_cached();
+
+    /**
+     * Forget the decoded instruction and any translated blocks of the slot holding this address
+     *
+     * Called whenever a byte of memory changes, so that self-modifying code
+     * gets re-decoded on its next visit
+     *
+     * @param address The address that was written
+     * @return 1 if a translated block was dropped, 0 otherwise
+     */
+    int invalidate_decoded(addr_t address);
+
+    /**
+     * Forget all decoded instructions and translated blocks
+     */
+    void invalidate_decoded();
+
+    /**
+     * Execute a translated block from its first instruction
+     *
+     * Stops early after a store that modifies a translated block
+     *
+     * @param block The block to execute, starting at the current PC
+     * @return the number of instructions executed
+     */
+    int execute_block(const TranslatedBlock& block);
+
+    /**
+     * The set of addresses with a breakpoint
+     */
+    const std::bitset<MEMORY_SIZE>& breakpoint_addresses() const;
+
+    /**
+     * Remove the breakpoint at this index of `breakpoints`, keeping the indexes in sync
+     */
+    void remove_breakpoint(int idx);
+
+    /**
+     * Remove all breakpoints
+     */
+    void clear_breakpoints();
+
+    /**
+     * Intern the names of the existing breakpoints again, forgetting all the others
+     */
+    void reintern_breakpoint_names();
+
+    /**
+     * Replace the breakpoints with those of another emulator, whose names are already interned
+     */
+    void copy_breakpoints(const std::vector<Breakpoint>& other);
+
     ProcessorState state;
     // Breakpoint* breakpoints;
-    std::array<Breakpoint, MAX_INSTRUCTIONS> breakpoints;
-    int breakpoints_sz{0};
+    // Reserved for MAX_INSTRUCTIONS, so breakpoints never move while they exist
+    std::vector<Breakpoint> breakpoints;
+
+    // Indexes over `breakpoints`, kept in sync by insert/delete/load:
+    // - which addresses have a breakpoint, for the check after every instruction
+    // - the index + 1 of the breakpoint on each address (0 means none)
+    // - the index + 1 of the breakpoint with each interned name, by name id
+    //   (0 means none). The names of removed breakpoints stay interned, so
+    //   inserting a breakpoint with a name seen before costs the index nothing.
+    //   The breakpoints only hold views of their names in breakpoint_names
+    std::bitset<MEMORY_SIZE> breakpoint_map;
+    std::array<uint8_t, MEMORY_SIZE> breakpoint_slots{};
+    NameArena breakpoint_names;
+    std::vector<uint8_t> breakpoint_name_slots;
+
     int total_cycles{0};
+
+    // One lazily decoded instruction per instruction slot, indexed by pc / 2.
+    // Copies of an emulator start with an empty cache
+    std::array<InstructionHandle, MAX_INSTRUCTIONS> decoded;
+    uint64_t decoded_hits{0};
+    uint64_t decoded_misses{0};
+    uint64_t decoded_allocations{0};
+    uint64_t breakpoint_checks{0};
+
+    // Translated blocks for run_blocks(), same copy rules as the decode cache
+    BlockCache blocks;
+
+    // The pages and breakpoints of the last snapshot taken or restored, which
+    // the next snapshot can share if they haven't changed since
+    std::array<std::shared_ptr<const SnapshotPage>, SNAPSHOT_PAGES> snapshot_pages;
+    std::bitset<SNAPSHOT_PAGES> dirty_pages{(1ull << SNAPSHOT_PAGES) - 1};
+    std::shared_ptr<const std::vector<Breakpoint>> snapshot_breakpoints;
+    bool breakpoints_changed{true};
+
+    // NULL unless enable_journal() was called. Copies of an emulator don't get the journal
+    std::unique_ptr<UndoJournal> journal;
+
+    // The states seen during the current run, for finding endless loops
+    LoopDetector loops;
+
+    // NULL unless set_trace() was called
+    TraceSink* trace{NULL};
+
+    WatchList watches;
+    WatchHit last_watch_hit{0, 0, 0};
+};
+
+//------------------------------------------------------------------------------
+//--------------------              OBSERVERS               --------------------
+//------------------------------------------------------------------------------
+
+/**
+ * An observer for Emulator::run_with() that does nothing
+ */
+struct NullObserver {
+  static constexpr bool stops_at_breakpoints = true;
+  static constexpr bool detects_loops = true;
+
+  void before_step(Emulator&, byte_t, addr_t) {}
 };
+
+template <class Observer>
+int Emulator::run_with(int steps, Observer& observer) {
+  loops.reset();
+
+  // Unwatched runs don't pay for the watchpoint checks
+  if (Observer::stops_at_breakpoints && watches.active())
+    return run_loop<Observer, true>(steps, observer);
+  return run_loop<Observer, false>(steps, observer);
+}
+
+template <class Observer, bool Watched>
+int Emulator::run_loop(int steps, Observer& observer) {
+  // Same loop as run(), with decode and execute folded into a switch.
+  // Each case does what _execute() and InstructionBase::execute() do together
+  for (; steps > 0; --steps) {
+    if ((state.pc % 2) == 1)
+      return 0;
+
+    const byte_t opcode = state.cell(state.pc);
+    const addr_t address = state.cell(state.pc + 1);
+
+    // Invalid opcode: same as decode() returning NULL in run()
+    if (opcode >= NUM_OPCODES)
+      return 0;
+
+    observer.before_step(*this, opcode, address);
+    const addr_t pc = state.pc;
+    byte_t old = 0;
+    if constexpr (Watched)
+      old = state.cell(address);
+
+    switch (opcode) {
+      case ADD:
+        state.acc = (state.acc + state.cell(address)) & ARCH_BITMASK;
+        state.pc = (state.pc + INSTRUCTION_SIZE) & ARCH_BITMASK;
+        break;
+      case AND:
+        state.acc &= state.cell(address);
+        state.pc = (state.pc + INSTRUCTION_SIZE) & ARCH_BITMASK;
+        break;
+      case ORR:
+        state.acc |= state.cell(address);
+        state.pc = (state.pc + INSTRUCTION_SIZE) & ARCH_BITMASK;
+        break;
+      case XOR:
+        state.acc ^= state.cell(address);
+        state.pc = (state.pc + INSTRUCTION_SIZE) & ARCH_BITMASK;
+        break;
+      case LDR:
+        state.acc = state.cell(address);
+        state.pc = (state.pc + INSTRUCTION_SIZE) & ARCH_BITMASK;
+        break;
+      case STR:
+        state.store(address, state.acc);
+        invalidate_decoded(address);
+        state.pc = (state.pc + INSTRUCTION_SIZE) & ARCH_BITMASK;
+        break;
+      case JMP:
+        state.pc = address;
+        break;
+      case JNE:
+        state.pc = (state.acc != 0) ? address : ((state.pc + INSTRUCTION_SIZE) & ARCH_BITMASK);
+        break;
+    }
+
+    ++total_cycles;
+
+    if constexpr (requires { observer.after_step(*this); })
+      observer.after_step(*this);
+
+    if constexpr (Watched) {
+      if (watch_triggered(opcode, address, pc, old))
+        return RUN_WATCH;
+    }
+
+    if (Observer::stops_at_breakpoints && is_breakpoint() == 1)
+      return RUN_STOPPED;
+
+    if (Observer::detects_loops && state.pc <= pc && loops.searching()) {
+      const int period = loops.visit(state.pc, state.acc, total_cycles);
+      if (period > 0)
+        steps -= skip_loop(period, steps - 1);
+    }
+  }
+
+  return (Observer::detects_loops && loops.looping()) ? RUN_LOOPING : RUN_STOPPED;
+}
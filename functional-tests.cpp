@@ -3,11 +3,33 @@
 #include "catch.hpp"
 #include "instructions.h"
 #include "emulator.h"
-
+#include "batch.h"
+#include "runner.h"
+#include "trace.h"
+#include "arch_emulator.h"
+#include "binary_state.h"
+#include "checkpoint.h"
+#include "constexpr_emulator.h"
+#include "corpus.h"
+#include "differential.h"
+#include "disassembler.h"
+#include "instruction_values.h"
+#include "multicore.h"
+#include "names.h"
+#include "profiler.h"
+#include "server.h"
+
+#include <algorithm>
+#include <cstddef>
 #include <cstdio>
+#include <fstream>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
 #include <string_view>
+#include <utility>
 
 // Argh, windows libc is a bit non-standard
 #ifdef _WIN32
@@ -294,6 +316,45 @@ TEST_CASE("Instruction: Factory, with invalid data", "[instruction][init]") {
   }
 } 
 
+TEST_CASE("Instruction: Factory, shared instructions", "[instruction][init]") {
+  // Nothing can change a shared instruction through the handle
+  STATIC_REQUIRE(!std::is_copy_constructible_v<Iadd>);
+  STATIC_REQUIRE(!std::is_move_constructible_v<Iadd>);
+  STATIC_REQUIRE(!std::is_copy_assignable_v<Ijne>);
+  STATIC_REQUIRE(!std::is_move_assignable_v<Ijne>);
+
+  // Every 8-bit instruction comes from one table, nothing is allocated
+  for (int opcode = ADD; opcode < NUM_OPCODES; ++opcode) {
+    for (int address = 0; address < 256; ++address) {
+      const InstructionData data{static_cast<byte_t>(opcode), static_cast<byte_t>(address)};
+      InstructionHandle first = InstructionBase::generateInstruction(data);
+      InstructionHandle second = InstructionBase::generateInstruction(data);
+      REQUIRE(first != NULL);
+      CHECK(first.get() == second.get());
+      CHECK(!first.get_deleter().owned);
+      CHECK(first->get_address() == address);
+      CHECK(first->name() == INSTRUCTION_FORMATS[opcode].mnemonic);
+      if (address > 0)
+        CHECK(InstructionBase::generateInstruction({data.opcode, static_cast<byte_t>(address - 1)}).get() != first.get());
+    }
+  }
+
+  // Dropping a handle leaves the object for the next decode
+  Emulator emulator;
+  InstructionBase* shared = emulator.decode({STR, 17}).get();
+  InstructionHandle again = emulator.decode({STR, 17});
+  CHECK(again.get() == shared);
+  CHECK(again->to_string() == "STR: ACC -> [17]");
+
+  // The wider architectures allocate, and the handle owns the object
+  BasicInstructionBase<Arch16>::Handle wide = BasicInstructionBase<Arch16>::generateInstruction({JMP, 40000});
+  REQUIRE(wide != NULL);
+  CHECK(wide.get_deleter().owned);
+  CHECK(wide->get_address() == 40000);
+  CHECK(dynamic_cast<BasicIjmp<Arch16>*>(wide.get()) != NULL);
+  CHECK(BasicInstructionBase<Arch16>::generateInstruction({NUM_OPCODES, 0}) == NULL);
+}
+
 // Check the actual functionality of the instructions
 TEST_CASE("Iadd Execution", "[instruction][exec]") {
   ProcessorState state;
@@ -1224,45 +1285,45 @@ TEST_CASE("Breakpoint Constructors and Getters", "[breakpoint][init][getters]")
   SECTION("Constructor: Basic Usage") {
     Breakpoint bkp(10, "BKP1");
     CHECK(bkp.get_address() == 10);
-    CHECK_THAT(bkp.get_name(), Catch::Matchers::Equals("BKP1"));
+    CHECK(bkp.get_name() == "BKP1");
   }
 
   SECTION("Constructor: Large Address") {
     Breakpoint bkp(1000, "BKP");
     CHECK(bkp.get_address() == (1000 & 255));
-    CHECK_THAT(bkp.get_name(), Catch::Matchers::Equals("BKP"));
+    CHECK(bkp.get_name() == "BKP");
   }
 
   SECTION("Constructor: Very Large Name") {
     Breakpoint bkp(10, "BKP0123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789");
     CHECK(bkp.get_address() == 10);
-    CHECK_THAT(bkp.get_name(), Catch::Matchers::Equals("BKP0123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789"));
+    CHECK(bkp.get_name() == "BKP0123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789");
   }
   
   SECTION("Constructor: Zero-length Name") {
     Breakpoint bkp(10, "");
     CHECK(bkp.get_address() == 10);
-    CHECK_THAT(bkp.get_name(), Catch::Matchers::Equals(""));
+    CHECK(bkp.get_name() == "");
   }
 
   SECTION("Constructor: Copies the name argument") {
     std::string name{"BKP6"};
     Breakpoint bkp = create_bkp<Breakpoint>(10, name);
     CHECK(bkp.get_address() == 10);
-    CHECK_THAT(bkp.get_name(), Catch::Matchers::Equals(name));
+    CHECK(bkp.get_name() == name);
     name[0] = 'G';
-    CHECK_THAT(bkp.get_name(), !Catch::Matchers::Equals(name));
+    CHECK(bkp.get_name() != name);
     CHECK(not same_memory(bkp.get_name(), name));
   }
 
   SECTION("Copy Constructor") {
     Breakpoint bkp1(10, "BKP1");
     CHECK(bkp1.get_address() == 10);
-    CHECK_THAT(bkp1.get_name(), Catch::Matchers::Equals("BKP1"));
+    CHECK(bkp1.get_name() == "BKP1");
 
     Breakpoint bkp2{bkp1};
     CHECK(bkp2.get_address() == 10);
-    CHECK_THAT(bkp2.get_name(), Catch::Matchers::Equals("BKP1"));
+    CHECK(bkp2.get_name() == "BKP1");
 
     // Did we actually copy the name data, or did we copy the name pointer?
     CHECK(not same_memory(bkp1.get_name(), bkp2.get_name()));
@@ -1271,15 +1332,15 @@ TEST_CASE("Breakpoint Constructors and Getters", "[breakpoint][init][getters]")
   SECTION("Copy Assignment Operator") {
     Breakpoint bkp1(12, "BKPx");
     CHECK(bkp1.get_address() == 12);
-    CHECK_THAT(bkp1.get_name(), Catch::Matchers::Equals("BKPx"));
+    CHECK(bkp1.get_name() == "BKPx");
 
     Breakpoint bkp2(16, "BKP0");
     CHECK(bkp2.get_address() == 16);
-    CHECK_THAT(bkp2.get_name(), Catch::Matchers::Equals("BKP0"));
+    CHECK(bkp2.get_name() == "BKP0");
 
     bkp2 = bkp1;
     CHECK(bkp2.get_address() == 12);
-    CHECK_THAT(bkp2.get_name(), Catch::Matchers::Equals("BKPx"));
+    CHECK(bkp2.get_name() == "BKPx");
 
     // Did we actually copy the name data, or did we copy the name pointer?
     CHECK(not same_memory(bkp1.get_name(), bkp2.get_name()));
@@ -1290,12 +1351,12 @@ TEST_CASE("Breakpoint Constructors and Getters", "[breakpoint][init][getters]")
     // So, I am going to force it to do a move
     Breakpoint bkp1(20, "BKP11aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
     CHECK(bkp1.get_address() == 20);
-    CHECK_THAT(bkp1.get_name(), Catch::Matchers::Equals("BKP11aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    CHECK(bkp1.get_name() == "BKP11aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
     const void* name_ptr1 = get_location(bkp1.get_name());
 
     Breakpoint bkp2{std::move(bkp1)};
     CHECK(bkp2.get_address() == 20);
-    CHECK_THAT(bkp2.get_name(), Catch::Matchers::Equals("BKP11aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    CHECK(bkp2.get_name() == "BKP11aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
     const void* name_ptr2 = get_location(bkp2.get_name());
 
     // If we did it right, we shouldn't have created a copy of the name data,
@@ -1308,20 +1369,20 @@ TEST_CASE("Breakpoint Constructors and Getters", "[breakpoint][init][getters]")
     // So, I am going to force it to do a move
     Breakpoint bkp1(22, "BKPxxaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
     CHECK(bkp1.get_address() == 22);
-    CHECK_THAT(bkp1.get_name(), Catch::Matchers::Equals("BKPxxaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    CHECK(bkp1.get_name() == "BKPxxaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
     // location of the internal string of the first breakpoint
     const void* name_ptr1 = get_location(bkp1.get_name());
 
     Breakpoint bkp2(16, "BKP0");
     CHECK(bkp2.get_address() == 16);
-    CHECK_THAT(bkp2.get_name(), Catch::Matchers::Equals("BKP0"));
+    CHECK(bkp2.get_name() == "BKP0");
 
     // Move the internals of the first breakpoint into the second
     bkp2 = std::move(bkp1);
     // Address is correct
     CHECK(bkp2.get_address() == 22);
     // Name is correct
-    CHECK_THAT(bkp2.get_name(), Catch::Matchers::Equals("BKPxxaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    CHECK(bkp2.get_name() == "BKPxxaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
     // location of the internal string of the second breakpoint
     const void* name_ptr2 = get_location(bkp2.get_name());
 
@@ -1368,6 +1429,17 @@ const T* get_address(Dereferencable auto ptr) {
 	return &(*ptr);
 }
 
+// Fills up the breakpoints of an emulator without any, checking that the
+// first one never moves
+static void check_breakpoints_stay(Emulator& emulator) {
+  REQUIRE(emulator.num_breakpoints() == 0);
+  REQUIRE(emulator.insert_breakpoint(0, "B0"));
+  const Breakpoint* first = emulator.find_breakpoint(0);
+  for (int i = 1; i < MAX_INSTRUCTIONS; ++i)
+    REQUIRE(emulator.insert_breakpoint(i * INSTRUCTION_SIZE, "B" + std::to_string(i)));
+  CHECK(emulator.find_breakpoint(0) == first);
+}
+
 // -----------------------------------------------------------------------------
 // -------------------------          EMULATOR         -------------------------
 // -----------------------------------------------------------------------------
@@ -1404,7 +1476,7 @@ TEST_CASE("Emulator Constructors, Initialisers, and Getters", "[emulator][init][
   REQUIRE(emulator.read_mem(35) == 0);
   REQUIRE(emulator.cycles() == 0);
   REQUIRE(emulator.num_breakpoints() == 1);
-  REQUIRE_THAT(emulator.find_breakpoint(32)->get_name(), Catch::Matchers::Equals("END"));
+  REQUIRE(emulator.find_breakpoint(32)->get_name() == "END");
 
   // Essentially a pointer to the beginning of the breakpoints storage
   const Breakpoint* breakpoints = get_address<Breakpoint>(emulator.find_breakpoint(32));
@@ -1509,11 +1581,14 @@ TEST_CASE("Emulator Constructors, Initialisers, and Getters", "[emulator][init][
     CHECK(emulator1.read_mem(35) == 0);
     CHECK(emulator1.cycles() == 0);
     CHECK(emulator1.num_breakpoints() == 1);
-    CHECK_THAT(emulator1.find_breakpoint(32)->get_name(), Catch::Matchers::Equals("END"));
+    CHECK(emulator1.find_breakpoint(32)->get_name() == "END");
 
     // We should have moved the breakpoints data instead of copying them
     const Breakpoint* breakpoints1 = get_address<Breakpoint>(emulator1.find_breakpoint(32));
     CHECK(breakpoints1 == breakpoints);
+
+    // The moved-from emulator keeps its reserved breakpoints storage
+    check_breakpoints_stay(emulator);
   }
 
   SECTION("Move Assignment Operator") {
@@ -1540,11 +1615,14 @@ TEST_CASE("Emulator Constructors, Initialisers, and Getters", "[emulator][init][
     CHECK(emulator1.read_mem(35) == 0);
     CHECK(emulator1.cycles() == 0);
     CHECK(emulator1.num_breakpoints() == 1);
-    CHECK_THAT(emulator1.find_breakpoint(32)->get_name(), Catch::Matchers::Equals("END"));
+    CHECK(emulator1.find_breakpoint(32)->get_name() == "END");
 
     // We should have moved the breakpoints data instead of copying them
     const Breakpoint* breakpoints1 = get_address<Breakpoint>(emulator1.find_breakpoint(32));
     CHECK(breakpoints1 == breakpoints);
+
+    // The moved-from emulator keeps its reserved breakpoints storage
+    check_breakpoints_stay(emulator);
   }
 }
 
@@ -1576,7 +1654,7 @@ TEST_CASE("Emulator::fetch1", "[emulator][exec]") {
   REQUIRE(emulator.read_mem(35) == 0);
   REQUIRE(emulator.cycles() == 0);
   REQUIRE(emulator.num_breakpoints() == 1);
-  REQUIRE_THAT(emulator.find_breakpoint(32)->get_name(), Catch::Matchers::Equals("END"));
+  REQUIRE(emulator.find_breakpoint(32)->get_name() == "END");
   
   // pc is 4
   data = emulator.fetch();
@@ -2118,6 +2196,553 @@ TEST_CASE("Emulator::run4", "[emulator][exec]") {
   CHECK(emulator.cycles() == 8);
 }
 
+// The alternative engines must be indistinguishable from run(), so we drive
+// two emulators with the same sequence of step counts and compare everything
+// after each call
+void check_same_as_run(int (Emulator::*engine)(int)) {
+  const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt"};
+  const int step_counts[] = {0, 1, 1, 3, 7, 16, 50, 100, 400};
+
+  for (const char* file : files) {
+    REQUIRE(fopen(file, "r") != NULL);
+
+    Emulator reference;
+    Emulator candidate;
+    REQUIRE(reference.load_state(file));
+    REQUIRE(candidate.load_state(file));
+
+    // An extra breakpoint in the middle of the loops of state1 and state2
+    REQUIRE(reference.insert_breakpoint(14, "LOOP"));
+    REQUIRE(candidate.insert_breakpoint(14, "LOOP"));
+
+    for (int steps : step_counts) {
+      CHECK((candidate.*engine)(steps) == reference.run(steps));
+      CHECK(candidate.read_pc() == reference.read_pc());
+      CHECK(candidate.read_acc() == reference.read_acc());
+      CHECK(candidate.cycles() == reference.cycles());
+      for (int i = 0; i < 256; ++i)
+        CHECK(candidate.read_mem(i) == reference.read_mem(i));
+    }
+
+    // And once more without the extra breakpoint
+    REQUIRE(reference.delete_breakpoint("LOOP"));
+    REQUIRE(candidate.delete_breakpoint("LOOP"));
+    CHECK((candidate.*engine)(1000) == reference.run(1000));
+    CHECK(candidate.read_pc() == reference.read_pc());
+    CHECK(candidate.read_acc() == reference.read_acc());
+    CHECK(candidate.cycles() == reference.cycles());
+  }
+}
+
+TEST_CASE("Emulator::run_fast", "[emulator][exec]") {
+  check_same_as_run(&Emulator::run_fast);
+}
+
+TEST_CASE("Emulator::run_blocks", "[emulator][exec]") {
+  check_same_as_run(&Emulator::run_blocks);
+
+  auto check_same = [](const Emulator& candidate, const Emulator& reference) {
+    CHECK(candidate.cycles() == reference.cycles());
+    CHECK(candidate.read_acc() == reference.read_acc());
+    CHECK(candidate.read_pc() == reference.read_pc());
+    for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+      CHECK(candidate.read_mem(address) == reference.read_mem(address));
+  };
+
+  SECTION("A store into the running block") {
+    REQUIRE(fopen("data/state_selfmod.txt", "r") != NULL);
+
+    Emulator reference;
+    Emulator candidate;
+    REQUIRE(reference.load_state("data/state_selfmod.txt"));
+    REQUIRE(candidate.load_state("data/state_selfmod.txt"));
+
+    // Mix short runs (finished by the interpreter) with runs of whole blocks
+    for (int i = 0; i < 12; ++i) {
+      const int steps = 1 + (i * 7) % 23;
+      CHECK(candidate.run_blocks(steps) == reference.run(steps));
+      CHECK(candidate.read_pc() == reference.read_pc());
+      CHECK(candidate.read_acc() == reference.read_acc());
+      CHECK(candidate.cycles() == reference.cycles());
+      CHECK(candidate.read_mem(9) == reference.read_mem(9));
+      CHECK(candidate.read_mem(42) == reference.read_mem(42));
+    }
+    CHECK(candidate.read_pc() == 20);
+  }
+
+  SECTION("Stores into operands and restarts") {
+    // state2 rewrites the operand of its ADD on every iteration
+    REQUIRE(fopen("data/state2.txt", "r") != NULL);
+    Emulator reference;
+    REQUIRE(reference.load_state("data/state2.txt"));
+    reference.set_loop_detection(0);
+    Emulator candidate{reference};
+    const EmulatorSnapshot start = candidate.snapshot();
+
+    for (int restart = 0; restart < 3; ++restart) {
+      for (int i = 0; i < 20; ++i) {
+        const int steps = 3 + (i * 11) % 40;
+        CHECK(candidate.run_blocks(steps) == reference.run(steps));
+        check_same(candidate, reference);
+      }
+      REQUIRE(candidate.restore(start));
+      REQUIRE(reference.restore(start));
+    }
+  }
+
+  SECTION("Jumps to themselves") {
+    REQUIRE(fopen("data/state1.txt", "r") != NULL);
+    Emulator reference;
+    REQUIRE(reference.load_state("data/state1.txt"));
+    REQUIRE(reference.delete_breakpoint("END"));
+    reference.set_loop_detection(0);
+    Emulator candidate{reference};
+
+    // state1 ends in JMP 32 after 40 cycles, and stays there for the rest of the run
+    CHECK(candidate.run_blocks(100000) == reference.run(100000));
+    check_same(candidate, reference);
+    CHECK(candidate.read_pc() == 32);
+
+    // A breakpoint on the jump still stops every time
+    REQUIRE(candidate.insert_breakpoint(32, "PARK"));
+    REQUIRE(reference.insert_breakpoint(32, "PARK"));
+    CHECK(candidate.run_blocks(1000) == reference.run(1000));
+    check_same(candidate, reference);
+    CHECK(candidate.cycles() == reference.cycles());
+  }
+}
+
+// Every lane of a BatchEmulator must behave exactly like its own Emulator
+TEST_CASE("BatchEmulator", "[emulator][batch][exec]") {
+  const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt", "data/state_selfmod.txt"};
+
+  // 70 lanes: more than one vector of lanes, with the last one partially used.
+  // Lanes start at different points of their programs, and only some of
+  // them have an extra breakpoint
+  std::vector<Emulator> machines;
+  for (const char* file : files) {
+    REQUIRE(fopen(file, "r") != NULL);
+    for (int skip = 0; skip < 14; ++skip) {
+      Emulator machine;
+      REQUIRE(machine.load_state(file));
+      machine.run(skip);
+      if (skip % 2 == 1)
+        machine.insert_breakpoint(14, "LOOP");
+      machines.push_back(machine);
+    }
+  }
+
+  BatchEmulator batch(machines);
+  REQUIRE(batch.lanes() == 70);
+  CHECK(BatchEmulator::simd_width() >= 1);
+
+  const int step_counts[] = {0, 1, 5, 17, 100, 1000};
+  for (int steps : step_counts) {
+    int normal = 0;
+    std::vector<int> returns;
+    for (Emulator& machine : machines) {
+      // The batch runs every step, so it never reports RUN_LOOPING
+      returns.push_back(machine.run(steps) != RUN_ERROR);
+      normal += returns.back();
+    }
+    CHECK(batch.run(steps) == normal);
+
+    for (int lane = 0; lane < batch.lanes(); ++lane) {
+      const Emulator& machine = machines.at(lane);
+      LaneResult result = batch.result(lane);
+      CHECK(result.success == returns.at(lane));
+      CHECK(result.acc == machine.read_acc());
+      CHECK(result.pc == machine.read_pc());
+      CHECK(result.cycles == machine.cycles());
+      for (int i = 0; i < 256; ++i)
+        CHECK(batch.read_mem(lane, i) == machine.read_mem(i));
+    }
+  }
+}
+
+// A single core must behave exactly like run(), and several cores like the
+// interleaving their schedule says
+TEST_CASE("MultiCoreEmulator", "[emulator][multicore][exec]") {
+  // Loads a memory image with acc and pc at 0 from (address, byte) pairs
+  auto load_cells = [](Emulator& emulator, const std::vector<std::pair<int, int>>& cells) {
+    std::array<int, MEMORY_SIZE> memory{};
+    for (const auto& [address, value] : cells)
+      memory.at(address) = value;
+    std::string text = "0\n0\n0\n";
+    for (int byte : memory)
+      text += std::to_string(byte) + "\n";
+    return emulator.load_state_text(text.data(), text.size());
+  };
+
+  // Every core adds 1 to [100] in a loop: LDR 100, ADD 101, STR 100, JMP 0
+  Emulator counter;
+  REQUIRE(load_cells(counter, {{0, LDR}, {1, 100}, {2, ADD}, {3, 101}, {4, STR}, {5, 100}, {6, JMP}, {7, 0}, {101, 1}}));
+
+  SECTION("One core is run()") {
+    const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt", "data/state_selfmod.txt", "data/state_breakpoints.txt"};
+    for (const char* file : files) {
+      Emulator emulator;
+      REQUIRE(emulator.load_state(file));
+      emulator.set_loop_detection(0);
+      MultiCoreEmulator multicore(emulator, 1);
+      const int start = emulator.cycles();
+
+      for (int steps : {1, 7, 100, 1000}) {
+        const int status = emulator.run(steps);
+        CHECK(multicore.run(steps) == status);
+        CHECK(multicore.stopped_core() == ((status == RUN_ERROR || emulator.is_breakpoint()) ? 0 : -1));
+        CHECK(multicore.read_acc(0) == emulator.read_acc());
+        CHECK(multicore.read_pc(0) == emulator.read_pc());
+        CHECK(multicore.cycles(0) == emulator.cycles() - start);
+        for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+          CHECK(multicore.read_mem(address) == emulator.read_mem(address));
+      }
+      CHECK(multicore.switches() == 1);
+    }
+  }
+
+  SECTION("Interleaving decides which updates are lost") {
+    // Round robin: both cores load [100] before either stores it
+    MultiCoreEmulator round_robin(counter, 2);
+    REQUIRE(round_robin.run(40) == RUN_STOPPED);
+    CHECK(round_robin.stopped_core() == -1);
+    CHECK(round_robin.read_mem(100) == 10);
+    CHECK(round_robin.cycles(0) == 40);
+    CHECK(round_robin.cycles(1) == 40);
+    CHECK(round_robin.instructions() == 80);
+    CHECK(round_robin.switches() == 80);
+
+    // A whole iteration per turn: no update is lost
+    MultiCoreEmulator whole(counter, 2);
+    REQUIRE(whole.set_schedule(SCHEDULE_QUANTUM, 4));
+    REQUIRE(whole.run(40) == RUN_STOPPED);
+    CHECK(whole.read_mem(100) == 20);
+    CHECK(whole.switches() == 20);
+
+    // Half an iteration per turn: loads, then stores, again
+    MultiCoreEmulator half(counter, 2);
+    REQUIRE(half.set_schedule(SCHEDULE_QUANTUM, 2));
+    REQUIRE(half.run(40) == RUN_STOPPED);
+    CHECK(half.read_mem(100) == 10);
+
+    // A turn longer than the run
+    MultiCoreEmulator long_turns(counter, 3);
+    REQUIRE(long_turns.set_schedule(SCHEDULE_QUANTUM, 1000));
+    REQUIRE(long_turns.run(40) == RUN_STOPPED);
+    CHECK(long_turns.read_mem(100) == 30);
+    CHECK(long_turns.switches() == 3);
+
+    CHECK_FALSE(long_turns.set_schedule(SCHEDULE_QUANTUM, 0));
+  }
+
+  SECTION("The same machine and schedule give the same result") {
+    MultiCoreEmulator first(counter, 3);
+    REQUIRE(first.set_registers(1, 5, 2));
+    REQUIRE(first.set_registers(2, 0, 4));
+    REQUIRE(first.set_schedule(SCHEDULE_QUANTUM, 3));
+    MultiCoreEmulator second(counter, 3);
+    REQUIRE(second.set_registers(1, 5, 2));
+    REQUIRE(second.set_registers(2, 0, 4));
+    REQUIRE(second.set_schedule(SCHEDULE_QUANTUM, 3));
+
+    // In whole turns, a run split in parts is the same as one run
+    REQUIRE(first.run(999) == RUN_STOPPED);
+    for (int steps : {3, 30, 300, 666})
+      REQUIRE(second.run(steps) == RUN_STOPPED);
+    CHECK(first.read_mem(100) == second.read_mem(100));
+    for (int core = 0; core < 3; ++core) {
+      CHECK(first.read_acc(core) == second.read_acc(core));
+      CHECK(first.read_pc(core) == second.read_pc(core));
+    }
+
+    CHECK_FALSE(first.set_registers(3, 0, 0));
+    CHECK_FALSE(first.set_registers(0, 256, 0));
+    CHECK_FALSE(first.set_registers(0, 0, MEMORY_SIZE));
+  }
+
+  SECTION("Per-core breakpoints and errors stop the machine") {
+    MultiCoreEmulator multicore(counter, 2);
+    REQUIRE(multicore.insert_breakpoint(1, 4));
+    CHECK_FALSE(multicore.insert_breakpoint(1, 4));
+    CHECK_FALSE(multicore.insert_breakpoint(2, 4));
+    CHECK_FALSE(multicore.insert_breakpoint(0, MEMORY_SIZE));
+
+    // Core 0 goes past 4, core 1 stops there after its second instruction
+    REQUIRE(multicore.run(100) == RUN_STOPPED);
+    CHECK(multicore.stopped_core() == 1);
+    CHECK(multicore.read_pc(0) == 4);
+    CHECK(multicore.read_pc(1) == 4);
+    CHECK(multicore.cycles(1) == 2);
+
+    // Carries on with core 0, then stops core 1 at 4 again an iteration later
+    REQUIRE(multicore.run(100) == RUN_STOPPED);
+    CHECK(multicore.stopped_core() == 1);
+    CHECK(multicore.cycles(0) == 6);
+    CHECK(multicore.cycles(1) == 6);
+
+    REQUIRE(multicore.delete_breakpoint(1, 4));
+    CHECK_FALSE(multicore.delete_breakpoint(1, 4));
+    REQUIRE(multicore.run(100) == RUN_STOPPED);
+    CHECK(multicore.stopped_core() == -1);
+
+    REQUIRE(multicore.set_registers(0, 0, 9));
+    CHECK(multicore.run(100) == RUN_ERROR);
+    CHECK(multicore.stopped_core() == 0);
+    CHECK(multicore.failed(0));
+    CHECK(not multicore.failed(1));
+  }
+
+  SECTION("Threads") {
+    // Core c adds 1 to [200 + c] in a loop of its own at 16 * c
+    std::vector<std::pair<int, int>> cells = {{101, 1}};
+    for (int core = 0; core < 4; ++core) {
+      const std::vector<std::pair<int, int>> loop = {{LDR, 200 + core}, {ADD, 101}, {STR, 200 + core}, {JMP, 16 * core}};
+      for (int idx = 0; idx < 4; ++idx) {
+        cells.emplace_back(16 * core + 2 * idx, loop.at(idx).first);
+        cells.emplace_back(16 * core + 2 * idx + 1, loop.at(idx).second);
+      }
+    }
+    Emulator disjoint;
+    REQUIRE(load_cells(disjoint, cells));
+
+    MultiCoreEmulator threaded(disjoint, 4);
+    MultiCoreEmulator interleaved(disjoint, 4);
+    for (int core = 1; core < 4; ++core) {
+      REQUIRE(threaded.set_registers(core, 0, 16 * core));
+      REQUIRE(interleaved.set_registers(core, 0, 16 * core));
+    }
+    CHECK(threaded.run_threaded(4000) == 4);
+    REQUIRE(interleaved.run(4000) == RUN_STOPPED);
+    for (int core = 0; core < 4; ++core) {
+      CHECK(threaded.read_mem(200 + core) == 1000 % 256);
+      CHECK(threaded.cycles(core) == 4000);
+      CHECK(threaded.read_pc(core) == interleaved.read_pc(core));
+      CHECK(threaded.read_acc(core) == interleaved.read_acc(core));
+    }
+
+    // The deterministic run carries on from the memory the threads left
+    REQUIRE(threaded.run(4));
+    CHECK(threaded.read_mem(200) == 1001 % 256);
+
+    // Racing on one counter loses some updates, but never adds any
+    MultiCoreEmulator racing(counter, 4);
+    CHECK(racing.run_threaded(400) == 4);
+    CHECK(racing.read_mem(100) >= 1);
+    CHECK(racing.read_mem(100) <= 400);
+
+    // Errors and breakpoints only stop their own core
+    MultiCoreEmulator stopping(counter, 3);
+    REQUIRE(stopping.set_registers(1, 0, 3));
+    REQUIRE(stopping.insert_breakpoint(2, 4));
+    CHECK(stopping.run_threaded(100) == 2);
+    CHECK(not stopping.failed(0));
+    CHECK(stopping.failed(1));
+    CHECK(stopping.cycles(0) == 100);
+    CHECK(stopping.cycles(1) == 0);
+    CHECK(stopping.cycles(2) == 2);
+  }
+}
+
+// The job runner must produce the same results as running the jobs one by
+// one, no matter how the jobs end up distributed between the workers
+TEST_CASE("JobRunner", "[emulator][runner][exec]") {
+  const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt", "data/state_selfmod.txt", "data/invalid1.txt"};
+
+  std::vector<EmulatorJob> jobs;
+  for (int i = 0; i < 60; ++i) {
+    EmulatorJob job;
+    job.state_file = files[i % 6];
+    job.steps = (i * 37) % 500;
+    if (i % 4 == 0)
+      job.breakpoints.push_back({14, "LOOP"});
+    // Clashes with END in state1
+    if (i % 7 == 0)
+      job.breakpoints.push_back({30, "END"});
+    jobs.push_back(job);
+  }
+
+  for (int threads : {1, 3, 8}) {
+    JobRunner runner(threads);
+    REQUIRE(runner.threads() == threads);
+    std::vector<JobResult> results = runner.run(jobs);
+    REQUIRE(results.size() == jobs.size());
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      Emulator emulator;
+      int loaded = emulator.load_state(jobs[i].state_file);
+      for (const auto& breakpoint : jobs[i].breakpoints)
+        loaded = loaded && emulator.insert_breakpoint(breakpoint.first, breakpoint.second);
+
+      CHECK(results[i].loaded == loaded);
+      if (!loaded)
+        continue;
+
+      CHECK(results[i].status == emulator.run(jobs[i].steps));
+      CHECK(results[i].acc == emulator.read_acc());
+      CHECK(results[i].pc == emulator.read_pc());
+      CHECK(results[i].cycles == emulator.cycles());
+    }
+  }
+}
+
+// run() decodes each instruction slot once and then reuses it until a store
+// overwrites the slot
+TEST_CASE("Emulator decode cache", "[emulator][exec]") {
+  REQUIRE(fopen("data/state1.txt", "r") != NULL);
+  REQUIRE(fopen("data/state2.txt", "r") != NULL);
+
+  Emulator emulator;
+
+  SECTION("state1 only writes data, so every slot is decoded once") {
+    REQUIRE(emulator.load_state("data/state1.txt"));
+    REQUIRE(emulator.delete_breakpoint("END"));
+    // Parks at JMP 32, so the end of the run is skipped
+    REQUIRE(emulator.run(1000) == RUN_LOOPING);
+    CHECK(emulator.decode_hits() + emulator.decode_misses() < 1000);
+    // Slots 4 to 24 and the final JMP 32
+    CHECK(emulator.decode_misses() == 12);
+  }
+
+  SECTION("state2 patches the operand of the ADD at address 2 on every iteration") {
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    // The loop ends in JMP 20 before the steps run out, the rest is skipped
+    REQUIRE(emulator.run(395) == RUN_LOOPING);
+    CHECK(emulator.cycles() == 400);
+    CHECK(emulator.read_mem(63) == 48);
+    CHECK(emulator.decode_hits() + emulator.decode_misses() < 395);
+    CHECK(emulator.decode_misses() == 42);
+  }
+
+  SECTION("Executing a store through execute() invalidates the slot") {
+    REQUIRE(emulator.load_state("data/state1.txt"));
+    // pc = 4 -> LDR 10
+    REQUIRE(emulator.run(1));
+    CHECK(emulator.decode_misses() == 1);
+
+    // Turn the instruction at address 4 from AND 10 into AND 36 and go back to it
+    Ildr load(11);
+    Istr store(5);
+    Ijmp jump(4);
+    REQUIRE(emulator.execute(&load));
+    REQUIRE(emulator.execute(&store));
+    REQUIRE(emulator.execute(&jump));
+    REQUIRE(emulator.read_mem(5) == 36);
+
+    // 36 & [36] = 36 & 255, the stale AND 10 would have produced 0
+    REQUIRE(emulator.run(1));
+    CHECK(emulator.read_acc() == 36);
+    CHECK(emulator.read_pc() == 6);
+    CHECK(emulator.decode_misses() == 2);
+  }
+
+  SECTION("Loading a new state drops the cache") {
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    REQUIRE(emulator.run(10));
+    REQUIRE(emulator.load_state("data/state1.txt"));
+    REQUIRE(emulator.run(1));
+    CHECK(emulator.read_acc() == 0);
+    CHECK(emulator.read_pc() == 6);
+  }
+}
+
+TEST_CASE("Performance counters", "[emulator][counters][exec]") {
+  Emulator emulator;
+  REQUIRE(emulator.load_state("data/state1.txt"));
+  HostCounters host;
+
+  SECTION("Engine counters of run()") {
+    REQUIRE(emulator.delete_breakpoint("END"));
+    emulator.set_loop_detection(0);
+    REQUIRE(emulator.run(1000) == RUN_STOPPED);
+
+    // Slots 4 to 24 and the final JMP 32, decoded once each
+    const EngineCounters counters = emulator.engine_counters();
+    CHECK(counters.decodes == 12);
+    CHECK(counters.allocations == 0);
+    CHECK(counters.breakpoint_checks == 1000);
+    CHECK(counters.cache_hits == 988);
+    CHECK(counters.decodes == emulator.decode_misses());
+    CHECK(counters.cache_hits == emulator.decode_hits());
+
+    // The other engines don't count
+    REQUIRE(emulator.run_fast(1000));
+    CHECK(emulator.engine_counters().breakpoint_checks == 1000);
+
+    emulator.reset_engine_counters();
+    CHECK(emulator.engine_counters().decodes == 0);
+    CHECK(emulator.engine_counters().breakpoint_checks == 0);
+    CHECK(emulator.decode_hits() == 0);
+  }
+
+  SECTION("Invalid instructions allocate nothing") {
+    std::string text = "0\n0\n0\n9\n";
+    for (int address = 1; address < MEMORY_SIZE; ++address)
+      text += "0\n";
+    REQUIRE(emulator.load_state_text(text.data(), text.size()));
+    REQUIRE(emulator.run(10) == RUN_ERROR);
+    CHECK(emulator.engine_counters().decodes == 1);
+    CHECK(emulator.engine_counters().allocations == 0);
+    CHECK(emulator.engine_counters().breakpoint_checks == 0);
+  }
+
+  SECTION("Measured runs") {
+    REQUIRE(emulator.run(1));
+    const RunMeasurement measurement = measure_run(emulator, 1000, host);
+    CHECK(measurement.status == RUN_STOPPED);
+    CHECK(emulator.read_pc() == 32);
+    CHECK(measurement.cycles == emulator.cycles() - 1);
+    // Stops at END before decoding the JMP 32
+    CHECK(measurement.engine.decodes == 10);
+    CHECK(measurement.engine.breakpoint_checks == measurement.cycles);
+    CHECK(measurement.mips() >= 0);
+
+    // Hosts without the events (e.g. in a container) still measure the rest
+    for (int event = 0; event < NUM_HOST_EVENTS; ++event) {
+      CHECK(measurement.host_available.at(event) == host.available(static_cast<HostEvent>(event)));
+      if (!measurement.host_available.at(event)) {
+        CHECK(measurement.host.at(event) == 0);
+        CHECK(measurement.per_instruction(static_cast<HostEvent>(event)) == -1);
+      }
+    }
+    CHECK(host.start() == host.any_available());
+    CHECK(host.stop() == host.any_available());
+
+    // Host cycles and instructions only count the run, which does more with more steps
+    if (host.available(HOST_INSTRUCTIONS)) {
+      Emulator longer;
+      REQUIRE(longer.load_state("data/state2.txt"));
+      longer.set_loop_detection(0);
+      const RunMeasurement short_run = measure_run(longer, 100, host);
+      const RunMeasurement long_run = measure_run(longer, 100000, host);
+      CHECK(short_run.host.at(HOST_INSTRUCTIONS) > 0);
+      CHECK(long_run.host.at(HOST_INSTRUCTIONS) > short_run.host.at(HOST_INSTRUCTIONS));
+    }
+
+    // The other engines
+    Emulator fast;
+    REQUIRE(fast.load_state("data/state1.txt"));
+    const RunMeasurement fast_run = measure_run(fast, 1000, host, &Emulator::run_fast);
+    CHECK(fast_run.status == RUN_STOPPED);
+    CHECK(fast_run.cycles == fast.cycles());
+    CHECK(fast_run.engine.decodes == 0);
+  }
+
+  SECTION("JSON") {
+    const RunMeasurement measurement = measure_run(emulator, 1000, host);
+    const std::string json = measurement.json();
+    CHECK(json.front() == '{');
+    CHECK(json.back() == '}');
+    CHECK(json.find("\"status\": 1, \"cycles\": " + std::to_string(measurement.cycles) + ",") != std::string::npos);
+    CHECK(json.find("\"engine\": {\"decodes\": 11, \"allocations\": 0, \"breakpoint_checks\": " +
+                    std::to_string(measurement.cycles) + ", \"cache_hits\": " + std::to_string(measurement.cycles - 11) + "}") != std::string::npos);
+    for (int event = 0; event < NUM_HOST_EVENTS; ++event) {
+      const std::string key = std::string("\"") + host_event_name(static_cast<HostEvent>(event)) + "\": ";
+      CHECK((json.find(key + "null") != std::string::npos) == !measurement.host_available.at(event));
+    }
+    CHECK((json.find("\"host_cycles_per_instruction\": null") != std::string::npos) == !host.available(HOST_CYCLES));
+  }
+}
+
 // -----------------------------------------------------------------------------
 // -------------------------    BREAKPOINT MANAGEMENT  -------------------------
 // -----------------------------------------------------------------------------
@@ -2202,7 +2827,7 @@ TEST_CASE("Find Breakpoint", "[emulator][breakpoint][exec]") {
       auto bkp = emulator.find_breakpoint(addresses[i]);
       CHECK(bkp != NULL);
       CHECK(bkp->get_address() == addresses[i]);
-      CHECK_THAT(bkp->get_name(), Catch::Matchers::Equals(names[i]));
+      CHECK(bkp->get_name() == names[i]);
     }
 
     // Also check the same for argument values > 256
@@ -2210,7 +2835,7 @@ TEST_CASE("Find Breakpoint", "[emulator][breakpoint][exec]") {
       auto bkp = emulator.find_breakpoint(addresses[i] + (256 * i));
       CHECK(bkp != NULL);
       CHECK(bkp->get_address() == addresses[i]);
-      CHECK_THAT(bkp->get_name(), Catch::Matchers::Equals(names[i]));
+      CHECK(bkp->get_name() == names[i]);
     }
   }
 
@@ -2219,7 +2844,7 @@ TEST_CASE("Find Breakpoint", "[emulator][breakpoint][exec]") {
       auto bkp = emulator.find_breakpoint(names[i]);
       CHECK(bkp != NULL);
       CHECK(bkp->get_address() == addresses[i]);
-      CHECK_THAT(bkp->get_name(), Catch::Matchers::Equals(names[i]));
+      CHECK(bkp->get_name() == names[i]);
     }
   }
 
@@ -2287,7 +2912,7 @@ TEST_CASE("Delete Breakpoint", "[emulator][breakpoint][exec]") {
     REQUIRE(bkp2 != NULL);
     REQUIRE(bkp1 == bkp2);
     REQUIRE(bkp1->get_address() == addresses[i]);
-    REQUIRE_THAT(bkp1->get_name(), Catch::Matchers::Equals(names[i]));
+    REQUIRE(bkp1->get_name() == names[i]);
   }
 
   SECTION("delete_breakpoint() deletes existing breakpoints by address") {
@@ -2386,6 +3011,186 @@ TEST_CASE("Delete Breakpoint", "[emulator][breakpoint][exec]") {
   }
 }
 
+// Deleting breakpoints moves other breakpoints around in the storage, so
+// check that lookups by address and name keep agreeing through a lot of churn
+TEST_CASE("Breakpoint lookup indexes", "[emulator][breakpoint][exec]") {
+  Emulator emulator;
+
+  // Fill up the whole breakpoint storage
+  for (int i = 0; i < 128; ++i)
+    REQUIRE(emulator.insert_breakpoint(i * 2, "B" + std::to_string(i)));
+  REQUIRE(emulator.num_breakpoints() == 128);
+  CHECK(not emulator.insert_breakpoint(1, "FULL"));
+
+  // Delete every third one, alternating between deleting by address and by name
+  for (int i = 0; i < 128; i += 3) {
+    if (i % 2 == 0)
+      REQUIRE(emulator.delete_breakpoint(i * 2));
+    else
+      REQUIRE(emulator.delete_breakpoint(("B" + std::to_string(i)).c_str()));
+  }
+
+  for (int i = 0; i < 128; ++i) {
+    const std::string name = "B" + std::to_string(i);
+    if (i % 3 == 0) {
+      CHECK(emulator.find_breakpoint(i * 2) == NULL);
+      CHECK(emulator.find_breakpoint(name) == NULL);
+    } else {
+      REQUIRE(emulator.find_breakpoint(i * 2) != NULL);
+      CHECK(emulator.find_breakpoint(i * 2) == emulator.find_breakpoint(name));
+      CHECK(emulator.find_breakpoint(i * 2)->get_address() == i * 2);
+      CHECK(emulator.find_breakpoint(i * 2)->get_name() == name);
+    }
+  }
+  CHECK(emulator.num_breakpoints() == 128 - 43);
+
+  // is_breakpoint() follows the same indexes. Memory is all zeros: ADD 0
+  REQUIRE(emulator.insert_breakpoint(0, "B0"));
+  for (int i = 1; i < 128; ++i) {
+    CHECK(emulator.run(1));
+    CHECK(emulator.read_pc() == i * 2);
+    CHECK(emulator.is_breakpoint() == (i % 3 != 0));
+  }
+
+  // A freed name can be reused on a different address
+  REQUIRE(emulator.insert_breakpoint(3, "B3"));
+  CHECK(emulator.find_breakpoint("B3")->get_address() == 3);
+}
+
+TEST_CASE("Breakpoint names", "[emulator][breakpoint][exec]") {
+  SECTION("Every string-like argument") {
+    Emulator emulator;
+    const std::string owned = "OWNED";
+    const char text[] = "TEXT_AND_MORE";
+    REQUIRE(emulator.insert_breakpoint(2, owned));
+    REQUIRE(emulator.insert_breakpoint(4, std::string_view(text, 4)));
+    REQUIRE(emulator.insert_breakpoint(6, "A_NAME_TOO_LONG_FOR_A_SMALL_STRING"));
+
+    CHECK(emulator.find_breakpoint("OWNED")->get_address() == 2);
+    CHECK(emulator.find_breakpoint(std::string("TEXT"))->get_address() == 4);
+    CHECK(emulator.find_breakpoint(std::string_view(text, 4))->get_address() == 4);
+    CHECK(emulator.find_breakpoint(std::string_view(text)) == NULL);
+    CHECK(emulator.find_breakpoint("A_NAME_TOO_LONG_FOR_A_SMALL_STRING")->get_address() == 6);
+    CHECK(emulator.find_breakpoint(static_cast<const char*>(NULL)) == NULL);
+    CHECK(emulator.find_breakpoint(4)->get_name() == "TEXT");
+
+    CHECK(not emulator.insert_breakpoint(8, std::string_view(owned)));
+    CHECK(not emulator.delete_breakpoint(static_cast<const char*>(NULL)));
+    CHECK(emulator.delete_breakpoint(std::string_view(text, 4)));
+    CHECK(emulator.delete_breakpoint(owned.c_str()));
+    CHECK(emulator.num_breakpoints() == 1);
+  }
+
+  SECTION("Names survive churn, copies and moves") {
+    Emulator emulator;
+    for (int round = 0; round < 20; ++round) {
+      for (int i = 0; i < 64; ++i)
+        REQUIRE(emulator.insert_breakpoint(i * 2, "R" + std::to_string(round) + "_" + std::to_string(i)));
+      // Keep the even ones of this round, delete the rest and the last round
+      for (int i = 1; i < 64; i += 2)
+        REQUIRE(emulator.delete_breakpoint(i * 2));
+      for (int i = 0; i < 64; i += 2)
+        REQUIRE(emulator.delete_breakpoint(("R" + std::to_string(round) + "_" + std::to_string(i)).c_str()));
+      CHECK(emulator.num_breakpoints() == 0);
+      CHECK(emulator.find_breakpoint("R" + std::to_string(round) + "_0") == NULL);
+    }
+
+    for (int i = 0; i < 128; ++i)
+      REQUIRE(emulator.insert_breakpoint(i * 2, "N" + std::to_string(i)));
+    for (int i = 0; i < 128; i += 2)
+      REQUIRE(emulator.delete_breakpoint(i * 2));
+
+    Emulator copy(emulator);
+    Emulator moved(std::move(copy));
+    for (int i = 0; i < 128; ++i) {
+      const std::string name = "N" + std::to_string(i);
+      if (i % 2 == 0) {
+        CHECK(moved.find_breakpoint(name) == NULL);
+      } else {
+        REQUIRE(moved.find_breakpoint(name) != NULL);
+        CHECK(moved.find_breakpoint(name)->get_address() == i * 2);
+        CHECK(emulator.find_breakpoint(name)->get_address() == i * 2);
+      }
+    }
+
+    REQUIRE(moved.insert_breakpoint(0, "N0"));
+    CHECK(emulator.find_breakpoint("N0") == NULL);
+  }
+
+  SECTION("Names are only stored in the arena") {
+    const std::string name(100, 'L');
+    std::unique_ptr<Emulator> emulator = std::make_unique<Emulator>();
+    REQUIRE(emulator->insert_breakpoint(2, name));
+    REQUIRE(emulator->insert_breakpoint(4, "OTHER"));
+    CHECK(not same_memory(emulator->find_breakpoint(2)->get_name(), name));
+
+    // Copies use the names of their own arena, and outlive the original
+    Emulator copy{*emulator};
+    Emulator assigned;
+    REQUIRE(assigned.insert_breakpoint(6, "REPLACED"));
+    assigned = *emulator;
+    CHECK(not same_memory(copy.find_breakpoint(2)->get_name(), emulator->find_breakpoint(2)->get_name()));
+    CHECK(not same_memory(assigned.find_breakpoint(2)->get_name(), emulator->find_breakpoint(2)->get_name()));
+
+    // So do the breakpoints of snapshots and standalone copies
+    const EmulatorSnapshot saved = emulator->snapshot();
+    const Breakpoint standalone = *emulator->find_breakpoint(4);
+    emulator.reset();
+
+    CHECK(copy.find_breakpoint(2)->get_name() == name);
+    CHECK(copy.find_breakpoint(4)->get_name() == "OTHER");
+    CHECK(assigned.find_breakpoint(2)->get_name() == name);
+    CHECK(assigned.find_breakpoint("REPLACED") == NULL);
+    CHECK(standalone.get_name() == "OTHER");
+
+    Emulator restored;
+    REQUIRE(restored.restore(saved));
+    CHECK(restored.find_breakpoint(2)->get_name() == name);
+    CHECK(restored.find_breakpoint(4)->get_name() == "OTHER");
+  }
+}
+
+TEST_CASE("NameArena", "[names]") {
+  NameArena names;
+  CHECK(names.size() == 0);
+  CHECK(names.find("A") == -1);
+
+  CHECK(names.intern("A") == 0);
+  CHECK(names.intern("B") == 1);
+  CHECK(names.intern("A") == 0);
+  CHECK(names.intern(std::string(5000, 'x')) == 2);
+  CHECK(names.intern("") == 3);
+  CHECK(names.size() == 4);
+
+  CHECK(names.find("B") == 1);
+  CHECK(names.find(std::string(5000, 'x')) == 2);
+  CHECK(names.find("") == 3);
+  CHECK(names.name(0) == "A");
+  CHECK(names.name(2).size() == 5000);
+
+  // Views stay valid while chunks fill up
+  const std::string_view first = names.name(0);
+  for (int i = 0; i < 2000; ++i)
+    REQUIRE(names.intern("name" + std::to_string(i)) == 4 + i);
+  CHECK(first == "A");
+  CHECK(first.data() == names.name(0).data());
+
+  NameArena copy(names);
+  CHECK(copy.size() == names.size());
+  CHECK(copy.find("name1999") == names.find("name1999"));
+  CHECK(copy.name(1) == "B");
+  CHECK(copy.name(1).data() != names.name(1).data());
+
+  NameArena moved(std::move(copy));
+  CHECK(moved.find("name0") == 4);
+
+  names.clear();
+  CHECK(names.size() == 0);
+  CHECK(names.find("A") == -1);
+  CHECK(names.intern("B") == 0);
+  CHECK(moved.name(1) == "B");
+}
+
 // -----------------------------------------------------------------------------
 // -------------------------        UTILITIES          -------------------------
 // -----------------------------------------------------------------------------
@@ -2393,142 +3198,1573 @@ TEST_CASE("Delete Breakpoint", "[emulator][breakpoint][exec]") {
 // This mainly tests is_zero() and is_breakpoint(), but indirectly
 // tests the whole emulator. If you get an error here, make sure
 // you don't have another error in an earlier test
-TEST_CASE("Emulator state helpers", "[emulator][exec]") {
-  REQUIRE(fopen("data/state2.txt", "r") != NULL);
-
+TEST_CASE("Emulator snapshots", "[emulator][snapshot][exec]") {
   Emulator emulator;
   REQUIRE(emulator.load_state("data/state2.txt"));
+  REQUIRE(emulator.insert_breakpoint(30, "LATE"));
 
-  // Check that state is as expected
-  REQUIRE(emulator.read_acc() == 0);
-  REQUIRE(emulator.read_pc() == 0);
-  int sum = 0;
-  for (int i = 64; i < 96; ++i)
-    sum += emulator.read_mem(i);
-  REQUIRE(sum == 48);
-  REQUIRE(emulator.cycles() == 5);
-  REQUIRE(emulator.num_breakpoints() == 0);
+  Emulator reference{emulator};
+  REQUIRE(reference.run(1000));
 
-  // Add a few breakpoints
-  int num_breakpoints = 4;
-  const addr_t addresses[] = {0, 4, 18, 20};
-  const char* names[] = {"START", "UPDATE", "LOOPEND", "END"};
+  SECTION("Restore rolls back memory, registers, cycles and breakpoints") {
+    const EmulatorSnapshot start = emulator.snapshot();
+    CHECK(start.valid());
+    CHECK(start.cycles() == emulator.cycles());
+    CHECK(start.read_pc() == emulator.read_pc());
+    CHECK(start.num_breakpoints() == 1);
 
-  for (int i = 0; i < num_breakpoints; ++i) 
-    REQUIRE(emulator.insert_breakpoint(addresses[i], names[i]));
-  REQUIRE(emulator.num_breakpoints() == num_breakpoints);
+    REQUIRE(emulator.run(1000));
+    REQUIRE(emulator.delete_breakpoint(30));
+    REQUIRE(emulator.insert_breakpoint(40, "OTHER"));
 
-  CHECK(emulator.is_zero());
-  CHECK(emulator.is_breakpoint());
+    REQUIRE(emulator.restore(start));
+    CHECK(emulator.cycles() == start.cycles());
+    CHECK(emulator.read_acc() == start.read_acc());
+    CHECK(emulator.read_pc() == start.read_pc());
+    for (int i = 0; i < 256; ++i)
+      CHECK(emulator.read_mem(i) == start.read_mem(i));
+    CHECK(emulator.num_breakpoints() == 1);
+    REQUIRE(emulator.find_breakpoint("LATE") != NULL);
+    CHECK(emulator.find_breakpoint(30) == emulator.find_breakpoint("LATE"));
+    CHECK(emulator.find_breakpoint(40) == NULL);
+
+    // Running again from the snapshot gives the same results, with all engines
+    for (auto engine : {&Emulator::run, &Emulator::run_fast, &Emulator::run_blocks}) {
+      REQUIRE(emulator.restore(start));
+      REQUIRE((emulator.*engine)(1000));
+      CHECK(emulator.read_acc() == reference.read_acc());
+      CHECK(emulator.read_pc() == reference.read_pc());
+      CHECK(emulator.cycles() == reference.cycles());
+      for (int i = 0; i < 256; ++i)
+        CHECK(emulator.read_mem(i) == reference.read_mem(i));
+    }
+  }
 
-  // Run till next breakpoint
-  REQUIRE(emulator.run(1000000));
-  REQUIRE(emulator.read_pc() == 4);
-  REQUIRE(emulator.read_acc() == 1);
-  REQUIRE(emulator.cycles() == 7);
-  REQUIRE(emulator.read_mem(63) == 0);
+  SECTION("Snapshots share unchanged pages") {
+    const EmulatorSnapshot first = emulator.snapshot();
+    const EmulatorSnapshot again = emulator.snapshot();
+    CHECK(again.shared_pages(first) == SNAPSHOT_PAGES);
 
-  CHECK(not emulator.is_zero());
-  CHECK(emulator.is_breakpoint());
+    // The loop in state2 only stores into address 63 and into its own code
+    // at address 3, so only the first and fourth pages are copied
+    REQUIRE(emulator.run(20));
+    const EmulatorSnapshot later = emulator.snapshot();
+    CHECK(later.shared_pages(first) == SNAPSHOT_PAGES - 2);
+    CHECK(later.read_mem(63) != first.read_mem(63));
 
-  // Run till next breakpoint
-  REQUIRE(emulator.run(1000000));
-  REQUIRE(emulator.read_pc() == 18);
-  REQUIRE(emulator.read_acc() == 31);
-  REQUIRE(emulator.cycles() == 14);
-  REQUIRE(emulator.read_mem(63) == 1);
+    // Snapshots are immutable: the older one still has the old value
+    CHECK(first.read_mem(63) == 0);
 
-  CHECK(not emulator.is_zero());
-  CHECK(emulator.is_breakpoint());
+    // After a restore, the next snapshot shares everything with the restored one
+    REQUIRE(emulator.restore(first));
+    CHECK(emulator.snapshot().shared_pages(first) == SNAPSHOT_PAGES);
+  }
 
-  // Run till next breakpoint
-  REQUIRE(emulator.run(1000000));
-  REQUIRE(emulator.read_pc() == 0);
-  REQUIRE(emulator.read_acc() == 31);
-  REQUIRE(emulator.cycles() == 15);
-  REQUIRE(emulator.read_mem(63) == 1);
+  SECTION("Snapshots can be restored on other emulators") {
+    const EmulatorSnapshot start = emulator.snapshot();
+
+    Emulator other;
+    REQUIRE(other.load_state("data/state_selfmod.txt"));
+    REQUIRE(other.run_blocks(50));
+    REQUIRE(other.restore(start));
+    REQUIRE(other.run_blocks(1000));
+    CHECK(other.read_acc() == reference.read_acc());
+    CHECK(other.read_pc() == reference.read_pc());
+    CHECK(other.cycles() == reference.cycles());
+    CHECK(other.read_mem(63) == reference.read_mem(63));
+    CHECK(other.num_breakpoints() == 1);
+  }
 
-  CHECK(not emulator.is_zero());
-  CHECK(emulator.is_breakpoint());
+  SECTION("Self-modified code is rolled back") {
+    Emulator selfmod;
+    REQUIRE(selfmod.load_state("data/state_selfmod.txt"));
+    Emulator selfmod_reference{selfmod};
+    REQUIRE(selfmod_reference.run(500));
+
+    const EmulatorSnapshot start = selfmod.snapshot();
+    REQUIRE(selfmod.run_blocks(500));
+    REQUIRE(selfmod.read_mem(9) != start.read_mem(9));
+
+    REQUIRE(selfmod.restore(start));
+    REQUIRE(selfmod.run_blocks(500));
+    CHECK(selfmod.read_acc() == selfmod_reference.read_acc());
+    CHECK(selfmod.read_mem(40) == selfmod_reference.read_mem(40));
+    CHECK(selfmod.cycles() == selfmod_reference.cycles());
+  }
 
-  // One step
-  REQUIRE(emulator.run(1));
-  REQUIRE(emulator.read_pc() == 2);
-  REQUIRE(emulator.read_acc() == 1);
-  REQUIRE(emulator.cycles() == 16);
-  REQUIRE(emulator.read_mem(63) == 1);
+  SECTION("Empty snapshots cannot be restored") {
+    EmulatorSnapshot empty;
+    CHECK(not empty.valid());
+    CHECK(not emulator.restore(empty));
+  }
+}
 
-  CHECK(not emulator.is_zero());
-  CHECK(not emulator.is_breakpoint());
+static void check_same_as_snapshot(const Emulator& emulator, const EmulatorSnapshot& expected) {
+  CHECK(emulator.cycles() == expected.cycles());
+  CHECK(emulator.read_acc() == expected.read_acc());
+  CHECK(emulator.read_pc() == expected.read_pc());
+  for (int i = 0; i < 256; ++i)
+    CHECK(emulator.read_mem(i) == expected.read_mem(i));
+}
 
-  // Leave only the last two breakpoints
-  REQUIRE(emulator.delete_breakpoint(0));
-  REQUIRE(emulator.delete_breakpoint(4));
-  
-  // Assuming we will only break at the LOOPEND breakpoint
-  // the following is equivalent to executing the loop 30 times
-  for (int i = 0; i < 30; ++i) {
-    REQUIRE(emulator.run(1000));
-    REQUIRE(emulator.read_pc() == 18);
-    REQUIRE(emulator.read_acc() == 30 - i);
-    REQUIRE(emulator.cycles() == 24 + 10 * i);
-    CHECK(not emulator.is_zero());
-    CHECK(emulator.is_breakpoint());
+TEST_CASE("Reverse execution", "[emulator][journal][exec]") {
+  // The state after every cycle of state2 (which starts from cycle 5), and of state_selfmod
+  std::vector<EmulatorSnapshot> history, selfmod_history;
+  Emulator reference;
+  REQUIRE(reference.load_state("data/state2.txt"));
+  for (int i = 0; i <= 400; ++i) {
+    history.push_back(reference.snapshot());
+    REQUIRE(reference.run_fast(1));
+  }
+  REQUIRE(reference.load_state("data/state_selfmod.txt"));
+  for (int i = 0; i <= 150; ++i) {
+    selfmod_history.push_back(reference.snapshot());
+    REQUIRE(reference.run_fast(1));
   }
 
-  // This should be the last iteration
-  REQUIRE(emulator.run(1000));
-  REQUIRE(emulator.read_pc() == 18);
-  REQUIRE(emulator.read_acc() == 0);
-  REQUIRE(emulator.cycles() == 324);
-  CHECK(emulator.is_zero());
-  CHECK(emulator.is_breakpoint());
+  Emulator emulator;
+  REQUIRE(emulator.load_state("data/state2.txt"));
+  const int start = emulator.cycles();
+
+  SECTION("Without a journal") {
+    CHECK(emulator.journal_oldest_cycle() == -1);
+    REQUIRE(emulator.run(10));
+    CHECK(not emulator.reverse_run(1));
+    CHECK(not emulator.seek(5));
+    CHECK(not emulator.enable_journal(0, 10));
+    CHECK(not emulator.enable_journal(10, 0));
+  }
 
-  // We will not the JNE jump, instead we will go to the next instruction
-  // which is also a breakpoint (and an idle loop signifying the end of the program)
-  REQUIRE(emulator.run(1000));
-  REQUIRE(emulator.read_pc() == 20);
-  REQUIRE(emulator.read_acc() == 0);
-  REQUIRE(emulator.cycles() == 325);
-  CHECK(emulator.is_zero());
-  CHECK(emulator.is_breakpoint());
+  SECTION("Reverse steps undo one cycle at a time") {
+    REQUIRE(emulator.enable_journal(1000, 64));
+    REQUIRE(emulator.run(400));
+    CHECK(emulator.journal_oldest_cycle() == start);
 
-  // At this point, we stuck on instruction 20 forever
-  // Running 1k steps, actually only runs for one cycle
-  REQUIRE(emulator.run(1000));
-  REQUIRE(emulator.read_pc() == 20);
-  REQUIRE(emulator.read_acc() == 0);
-  REQUIRE(emulator.cycles() == 326);
-  CHECK(emulator.is_zero());
-  CHECK(emulator.is_breakpoint());
+    for (int cycle = 399; cycle >= 0; --cycle) {
+      REQUIRE(emulator.reverse_run(1));
+      check_same_as_snapshot(emulator, history.at(cycle));
+    }
+    CHECK(not emulator.reverse_run(1));
+  }
 
-  // Remove the breakpoint at the end
-  REQUIRE(emulator.delete_breakpoint(20));
+  SECTION("Seeking goes to the exact cycle, with all engines") {
+    for (auto engine : {&Emulator::run, &Emulator::run_fast, &Emulator::run_blocks}) {
+      REQUIRE(emulator.load_state("data/state2.txt"));
+      REQUIRE(emulator.enable_journal(1000, 64));
+      REQUIRE((emulator.*engine)(400));
 
-  // Now running for 1000 steps, should actually run for 1000 steps
-  REQUIRE(emulator.run(1000));
-  REQUIRE(emulator.read_pc() == 20);
-  REQUIRE(emulator.read_acc() == 0);
-  REQUIRE(emulator.cycles() == 1326);
-  CHECK(emulator.is_zero());
-  CHECK(not emulator.is_breakpoint());
+      for (int cycle : {397, 251, 250, 200, 130, 65, 64, 63, 1, 0}) {
+        REQUIRE(emulator.seek(start + cycle));
+        check_same_as_snapshot(emulator, history.at(cycle));
 
-  // Verify that the program has executed correctly
-  CHECK(emulator.read_mem(63) == 48);
-}
+        // Running forward again from there records new history
+        REQUIRE((emulator.*engine)(3));
+        check_same_as_snapshot(emulator, history.at(cycle + 3));
+      }
 
-// ----------- Magic for capturing the printf --------------
-int capture_stdout(const char* filename) {
-  // Get a file descriptor handle for the original stdout
-  int original_stdout = dup(STDOUT_FILENO);
+      CHECK(not emulator.seek(emulator.cycles() + 1));
+    }
+  }
 
-  // Open the file where we will send the standard output
-  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-  if (fd == -1)
-    return -1;
+  SECTION("Self-modifying code is undone") {
+    REQUIRE(emulator.load_state("data/state_selfmod.txt"));
+    REQUIRE(emulator.enable_journal(1000, 16));
+    REQUIRE(emulator.run_blocks(150));
 
-  // Make the standard output handle point to our file
-  // Effectively standard output goes to the file
+    for (int cycle : {149, 100, 37, 0}) {
+      REQUIRE(emulator.seek(cycle));
+      check_same_as_snapshot(emulator, selfmod_history.at(cycle));
+    }
+
+    REQUIRE(emulator.seek(0));
+    REQUIRE(emulator.run_blocks(150));
+    check_same_as_snapshot(emulator, selfmod_history.at(150));
+  }
+
+  SECTION("The journal forgets the oldest cycles when full") {
+    REQUIRE(emulator.enable_journal(100, 32));
+    REQUIRE(emulator.run_fast(400));
+    CHECK(emulator.journal_oldest_cycle() == start + 300);
+
+    CHECK(not emulator.seek(start + 299));
+    REQUIRE(emulator.seek(start + 300));
+    check_same_as_snapshot(emulator, history.at(300));
+    CHECK(not emulator.reverse_run(1));
+  }
+
+  SECTION("Reverse runs stop at breakpoints") {
+    REQUIRE(emulator.enable_journal(1000, 64));
+    REQUIRE(emulator.run(400));
+    REQUIRE(emulator.insert_breakpoint(4, "LOOP"));
+
+    REQUIRE(emulator.reverse_run(1000));
+    CHECK(emulator.read_pc() == 4);
+    check_same_as_snapshot(emulator, history.at(emulator.cycles() - start));
+  }
+
+  SECTION("Loading a state clears the journal") {
+    REQUIRE(emulator.enable_journal(1000, 64));
+    REQUIRE(emulator.run(100));
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    CHECK(emulator.journal_oldest_cycle() == start);
+    CHECK(not emulator.reverse_run(1));
+  }
+}
+
+TEST_CASE("Profiler", "[emulator][profiler][exec]") {
+  Emulator emulator;
+  REQUIRE(emulator.load_state("data/state2.txt"));
+  Emulator reference{emulator};
+  const int start = emulator.cycles();
+
+  Profiler profiler;
+  REQUIRE(emulator.run_with(1000, profiler));
+  REQUIRE(reference.run(1000));
+
+  // Profiling doesn't change what the program does
+  CHECK(emulator.read_acc() == reference.read_acc());
+  CHECK(emulator.read_pc() == reference.read_pc());
+  CHECK(emulator.cycles() == reference.cycles());
+  for (int i = 0; i < 256; ++i)
+    CHECK(emulator.read_mem(i) == reference.read_mem(i));
+
+  SECTION("Counts") {
+    CHECK(profiler.total() == static_cast<uint64_t>(emulator.cycles() - start));
+
+    uint64_t executions = 0, opcodes = 0;
+    for (int pc = 0; pc < 256; ++pc)
+      executions += profiler.executions(pc);
+    for (int opcode = ADD; opcode < NUM_OPCODES; ++opcode)
+      opcodes += profiler.opcode_count(static_cast<InstructionOpcode>(opcode));
+    CHECK(executions == profiler.total());
+    CHECK(opcodes == profiler.total());
+
+    // The loop body runs once per iteration, the JNE at 18 falls through once
+    // at the end, and the rest of the time is spent at 20: JMP 20
+    const uint64_t iterations = profiler.executions(0);
+    CHECK(iterations > 1);
+    for (int pc = 0; pc <= 18; pc += 2)
+      CHECK(profiler.executions(pc) == iterations);
+    CHECK(profiler.branches_taken(18) == iterations - 1);
+    CHECK(profiler.branches_not_taken(18) == 1);
+    CHECK(profiler.executions(20) == profiler.total() - 10 * iterations);
+    CHECK(profiler.opcode_count(JMP) == profiler.executions(20));
+    CHECK(profiler.opcode_count(JNE) == iterations);
+
+    // 0: LDR 63, 4: STR 63, 8: ADD 60, 10: STR 3
+    CHECK(profiler.memory_reads(63) == iterations);
+    CHECK(profiler.memory_writes(63) == iterations);
+    CHECK(profiler.memory_writes(3) == iterations);
+    CHECK(profiler.memory_reads(60) == iterations);
+    CHECK(profiler.memory_writes(60) == 0);
+
+    profiler.reset();
+    CHECK(profiler.total() == 0);
+    CHECK(profiler.executions(20) == 0);
+  }
+
+  SECTION("Annotated program") {
+    std::ostringstream annotated;
+    REQUIRE(profiler.print_annotated(emulator, annotated));
+
+    std::istringstream lines(annotated.str());
+    std::string line;
+    int count = 0;
+    while (std::getline(lines, line)) {
+      const addr_t offset = count * 2;
+      const std::string prefix = std::to_string(profiler.executions(offset)) + "\t| " + std::to_string(offset) + ":";
+      CHECK(line.substr(0, prefix.size()) == prefix);
+      ++count;
+    }
+    CHECK(count == 128);
+
+    // std::cout is left alone, wherever it goes
+    std::ostringstream redirected;
+    std::streambuf* original = std::cout.rdbuf(redirected.rdbuf());
+    std::ostringstream again;
+    const int printed = profiler.print_annotated(emulator, again);
+    std::cout.rdbuf(original);
+    CHECK(printed);
+    CHECK(redirected.str().empty());
+    CHECK(again.str() == annotated.str());
+  }
+
+  SECTION("Profiled runs stop at breakpoints") {
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    REQUIRE(emulator.insert_breakpoint(20, "DONE"));
+    profiler.reset();
+    REQUIRE(emulator.run_with(1000, profiler));
+    CHECK(emulator.read_pc() == 20);
+    CHECK(profiler.executions(20) == 0);
+  }
+}
+
+TEST_CASE("Instruction values", "[instruction]") {
+  STATIC_REQUIRE(sizeof(InstructionValue) == 2);
+  STATIC_REQUIRE(std::is_trivially_copyable_v<InstructionValue>);
+
+  InstructionValue value;
+  CHECK(!decode_value<Arch8>({NUM_OPCODES, 0}, value));
+  CHECK(!decode_value<Arch8>({255, 0}, value));
+
+  SECTION("Same as the InstructionBase classes") {
+    // Each instruction on a few states, compared with the virtual version
+    const data_t accs[] = {0, 1, 200, 255};
+    for (int opcode = ADD; opcode < NUM_OPCODES; ++opcode) {
+      for (int address = 0; address < 256; address += 5) {
+        InstructionHandle instr = InstructionBase::generateInstruction({static_cast<byte_t>(opcode), static_cast<byte_t>(address)});
+        REQUIRE(decode_value<Arch8>({static_cast<byte_t>(opcode), static_cast<byte_t>(address)}, value));
+        CHECK(value_opcode(value) == opcode);
+        CHECK(value_address(value) == instr->get_address());
+        CHECK(value_name(value) == instr->name());
+
+        for (data_t acc : accs) {
+          ProcessorState expected;
+          for (int i = 0; i < 256; ++i)
+            expected.memory[i] = (i * 37) & 0xff;
+          expected.acc = acc;
+          expected.pc = 254;
+          ProcessorState actual = expected;
+
+          instr->execute(expected);
+          execute_value(value, actual);
+          CHECK(actual.acc == expected.acc);
+          CHECK(actual.pc == expected.pc);
+          CHECK(actual.memory == expected.memory);
+        }
+      }
+    }
+  }
+
+  SECTION("Adapters") {
+    REQUIRE(decode_value<Arch8>({JNE, 42}, value));
+    InstructionHandle instr = to_instruction(value);
+    REQUIRE(instr != NULL);
+    CHECK(dynamic_cast<Ijne*>(instr.get()) != NULL);
+    CHECK(instr->get_address() == 42);
+
+    InstructionValue back = Sadd{0};
+    Istr str(17);
+    REQUIRE(to_value(str, back));
+    CHECK(std::holds_alternative<Sstr>(back));
+    CHECK(value_address(back) == 17);
+  }
+
+  SECTION("Wider architectures") {
+    BasicInstructionValue<Arch16> wide;
+    REQUIRE(decode_value<Arch16>({JMP, 40000}, wide));
+    BasicProcessorState<Arch16> state;
+    execute_value(wide, state);
+    CHECK(state.pc == 40000);
+  }
+}
+
+TEST_CASE("Memory access policy", "[processor]") {
+  ProcessorState state;
+  state.cell(10) = 5;
+  CHECK(state.memory[10] == 5);
+  CHECK(std::as_const(state).cell(10) == 5);
+
+#if EMULATOR_CHECKED_MEMORY
+  CHECK_THROWS_AS(state.cell(MEMORY_SIZE), std::out_of_range);
+  CHECK_THROWS_AS(state.cell(-1), std::out_of_range);
+#else
+  // Unchecked accesses wrap around instead
+  CHECK(&state.cell(MEMORY_SIZE + 10) == &state.cell(10));
+#endif
+}
+
+TEST_CASE("Architecture templates", "[emulator][exec]") {
+  SECTION("ArchEmulator<Arch8> runs like Emulator") {
+    const char* files[] = {"data/state2.txt", "data/state3.txt", "data/state4.txt", "data/state_selfmod.txt"};
+    for (const char* file : files) {
+      REQUIRE(fopen(file, "r") != NULL);
+
+      Emulator reference;
+      REQUIRE(reference.load_state(file));
+      REQUIRE(reference.read_pc() == 0);
+      REQUIRE(reference.read_acc() == 0);
+      const int start = reference.cycles();
+      for (addr_t address = 0; address < 256; address += 2)
+        if (reference.find_breakpoint(address) != NULL)
+          REQUIRE(reference.delete_breakpoint(address));
+
+      std::vector<byte_t> program;
+      for (int i = 0; i < 256; ++i)
+        program.push_back(reference.read_mem(i));
+      ArchEmulator<Arch8> candidate;
+      REQUIRE(candidate.load_program(program));
+
+      for (int steps : {1, 3, 17, 100}) {
+        // The profiled run executes every step, like ArchEmulator does
+        Profiler profiler;
+        CHECK(candidate.run(steps) == (reference.run_with(steps, profiler) != RUN_ERROR));
+        CHECK(candidate.read_pc() == reference.read_pc());
+        CHECK(candidate.read_acc() == reference.read_acc());
+        CHECK(candidate.cycles() == reference.cycles() - start);
+        for (int i = 0; i < 256; ++i)
+          CHECK(candidate.read_mem(i) == reference.read_mem(i));
+      }
+    }
+  }
+
+  SECTION("16-bit words") {
+    Emulator16 emulator;
+    REQUIRE(emulator.load_program({LDR, 1000, ADD, 1001, STR, 1002, ADD, 1003, JMP, 8}));
+    REQUIRE(emulator.load_program({300, 40000, 0, 25236}, 1000));
+    REQUIRE(emulator.insert_breakpoint(6));
+    REQUIRE(emulator.run(100));
+    CHECK(emulator.read_pc() == 6);
+    CHECK(emulator.read_acc() == 40300);
+    CHECK(emulator.read_mem(1002) == 40300);
+
+    // 40300 + 25236 wraps around 2^16
+    REQUIRE(emulator.run(2));
+    CHECK(emulator.read_pc() == 8);
+    CHECK(emulator.read_acc() == 0);
+    CHECK(emulator.cycles() == 5);
+
+    CHECK(!emulator.insert_breakpoint(7));
+    CHECK(!emulator.insert_breakpoint(1 << 16));
+    CHECK(!emulator.load_program({0, 0}, (1 << 16) - 1));
+  }
+
+  SECTION("32-bit words and 1M cells") {
+    auto emulator = std::make_unique<Emulator32>();
+    REQUIRE(emulator->load_program({LDR, 700000, ADD, 700001, STR, 800000, JMP, 900000}));
+    REQUIRE(emulator->load_program({0xffffffff, 2}, 700000));
+    REQUIRE(emulator->run(3));
+    CHECK(emulator->read_acc() == 1);
+    CHECK(emulator->read_mem(800000) == 1);
+
+    // The jump lands outside the program, on an all-zeros ADD 0, which adds
+    // the LDR opcode in cell 0
+    REQUIRE(emulator->run(2));
+    CHECK(emulator->read_pc() == 900002);
+    CHECK(emulator->read_acc() == 1 + LDR);
+  }
+
+  SECTION("Invalid opcodes and odd PCs stop the run") {
+    Emulator16 emulator;
+    REQUIRE(emulator.load_program({JMP, 3}));
+    CHECK(emulator.run(10) == RUN_ERROR);
+    CHECK(emulator.read_pc() == 3);
+    CHECK(emulator.cycles() == 1);
+
+    Emulator16 invalid;
+    REQUIRE(invalid.load_program({NUM_OPCODES, 0}));
+    CHECK(invalid.run(10) == RUN_ERROR);
+    CHECK(invalid.cycles() == 0);
+  }
+}
+
+// A memory image with the program at 0 and the data at 40
+static constexpr ConstexprEmulator<>::Image constexpr_image(std::initializer_list<byte_t> program, std::initializer_list<byte_t> data) {
+  ConstexprEmulator<>::Image image{};
+  int address = 0;
+  for (byte_t cell : program)
+    image[address++] = cell;
+  address = 40;
+  for (byte_t cell : data)
+    image[address++] = cell;
+  return image;
+}
+
+// memory[42] = memory[40] * memory[41], by adding memory[40] memory[41] times.
+// The loop counter counts down with an ADD of 255, then the program stays at 4
+static constexpr ConstexprEmulator<>::Image MULTIPLY = constexpr_image(
+  {LDR, 41, JNE, 6, JMP, 4, ADD, 44, STR, 41, LDR, 42, ADD, 40, STR, 42, JMP, 0},
+  {0, 0, 0, 0, 255});
+
+// The table is computed by the compiler, with a run of MULTIPLY per entry
+static constexpr std::array<byte_t, 16> SQUARES = [] {
+  std::array<byte_t, 16> table{};
+  for (int i = 0; i < 16; ++i) {
+    ConstexprEmulator<> emulator(MULTIPLY);
+    emulator.write_mem(40, i);
+    emulator.write_mem(41, i);
+    emulator.run(100000);
+    table[i] = emulator.read_mem(42);
+  }
+  return table;
+}();
+
+static_assert(SQUARES[0] == 0 && SQUARES[3] == 9 && SQUARES[15] == 225);
+
+static_assert([] {
+  ConstexprEmulator<> emulator(MULTIPLY);
+  emulator.write_mem(40, 7);
+  emulator.write_mem(41, 6);
+  return emulator.run(1000) == RUN_LOOPING && emulator.read_pc() == 4 && emulator.cycles() == 1000 &&
+         emulator.read_mem(42) == 42;
+}());
+
+TEST_CASE("Constexpr emulator", "[emulator][exec]") {
+  SECTION("Tables computed at compile time") {
+    for (int i = 0; i < 16; ++i)
+      CHECK(SQUARES.at(i) == i * i);
+  }
+
+  SECTION("Runs like Emulator") {
+    const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt", "data/state_selfmod.txt"};
+    for (const char* file : files) {
+      Emulator reference;
+      REQUIRE(reference.load_state(file));
+      reference.set_loop_detection(0);
+
+      ConstexprEmulator<>::Image image{};
+      for (int i = 0; i < MEMORY_SIZE; ++i)
+        image.at(i) = reference.read_mem(i);
+      ConstexprEmulator<> candidate(image, reference.read_pc(), reference.read_acc());
+      for (addr_t address = 0; address < MEMORY_SIZE; address += INSTRUCTION_SIZE)
+        if (reference.find_breakpoint(address) != NULL)
+          REQUIRE(candidate.insert_breakpoint(address));
+      const int start = reference.cycles();
+
+      // Jumps to themselves are the only difference: the candidate reports them as loops
+      for (int steps : {0, 1, 3, 17, 100, 1000}) {
+        const int status = candidate.run(steps);
+        const int expected = reference.run(steps);
+        CHECK((status == RUN_LOOPING ? RUN_STOPPED : status) == expected);
+        CHECK(candidate.read_pc() == reference.read_pc());
+        CHECK(candidate.read_acc() == reference.read_acc());
+        CHECK(candidate.cycles() == reference.cycles() - start);
+        for (int i = 0; i < MEMORY_SIZE; ++i)
+          CHECK(candidate.read_mem(i) == reference.read_mem(i));
+      }
+    }
+  }
+
+  SECTION("Breakpoints and errors") {
+    ConstexprEmulator<> emulator(MULTIPLY);
+    emulator.write_mem(40, 2);
+    emulator.write_mem(41, 2);
+    REQUIRE(emulator.insert_breakpoint(16));
+    CHECK(!emulator.insert_breakpoint(16));
+    CHECK(!emulator.insert_breakpoint(17));
+    CHECK(!emulator.insert_breakpoint(MEMORY_SIZE));
+    CHECK(emulator.run(1000) == RUN_STOPPED);
+    CHECK(emulator.read_pc() == 16);
+    CHECK(emulator.read_mem(42) == 2);
+    REQUIRE(emulator.delete_breakpoint(16));
+    CHECK(!emulator.delete_breakpoint(16));
+    CHECK(emulator.run(1000) == RUN_LOOPING);
+    CHECK(emulator.read_mem(42) == 4);
+
+    ConstexprEmulator<> odd(constexpr_image({JMP, 3}, {}));
+    CHECK(odd.run(10) == RUN_ERROR);
+    CHECK(odd.cycles() == 1);
+    ConstexprEmulator<> invalid(constexpr_image({NUM_OPCODES, 0}, {}));
+    CHECK(invalid.run(10) == RUN_ERROR);
+    CHECK(invalid.cycles() == 0);
+  }
+
+  SECTION("Wider words") {
+    // 300 + 40000 + 25236 wraps around 2^16
+    static constexpr ConstexprEmulator<Arch16> emulator = [] {
+      ConstexprEmulator<Arch16> emulator;
+      const uint16_t program[] = {LDR, 1000, ADD, 1001, ADD, 1002, STR, 1003, JMP, 8};
+      for (int i = 0; i < 10; ++i)
+        emulator.write_mem(i, program[i]);
+      emulator.write_mem(1000, 300);
+      emulator.write_mem(1001, 40000);
+      emulator.write_mem(1002, 25236);
+      emulator.run(100);
+      return emulator;
+    }();
+    STATIC_CHECK(emulator.read_mem(1003) == 0);
+    STATIC_CHECK(emulator.cycles() == 100);
+  }
+}
+
+// Profiled runs execute every step, so they are the reference for the
+// engines that skip endless loops
+void check_skipped_loop(Emulator start, int steps) {
+  Emulator reference = start;
+  Profiler profiler;
+  const int expected = reference.run_with(steps, profiler);
+
+  int (Emulator::*engines[])(int) = {&Emulator::run, &Emulator::run_fast, &Emulator::run_blocks};
+  for (auto engine : engines) {
+    Emulator candidate = start;
+    const int status = (candidate.*engine)(steps);
+    CHECK((status != RUN_ERROR) == (expected != RUN_ERROR));
+    CHECK(candidate.read_pc() == reference.read_pc());
+    CHECK(candidate.read_acc() == reference.read_acc());
+    CHECK(candidate.cycles() == reference.cycles());
+    for (int i = 0; i < 256; ++i)
+      CHECK(candidate.read_mem(i) == reference.read_mem(i));
+  }
+}
+
+TEST_CASE("Loop detection", "[emulator][exec]") {
+  REQUIRE(fopen("data/state1.txt", "r") != NULL);
+  REQUIRE(fopen("data/state2.txt", "r") != NULL);
+
+  const int step_counts[] = {1, 2, 3, 7, 64, 129, 1000, 12345};
+
+  SECTION("A jump to itself") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    REQUIRE(emulator.run(1000) == RUN_LOOPING);
+    CHECK(emulator.read_pc() == 20);
+
+    // The loop is skipped in a single run, so this doesn't take 2^30 steps
+    const int cycles = emulator.cycles();
+    REQUIRE(emulator.run(1 << 30) == RUN_LOOPING);
+    CHECK(emulator.cycles() == cycles + (1 << 30));
+    CHECK(emulator.read_pc() == 20);
+
+    for (int steps : step_counts) {
+      Emulator start;
+      REQUIRE(start.load_state("data/state2.txt"));
+      check_skipped_loop(start, steps);
+    }
+  }
+
+  SECTION("Wrapping around the end of memory") {
+    // All zeros is ADD 0 everywhere, a loop of 128 instructions
+    for (int steps : step_counts)
+      check_skipped_loop(Emulator(), steps);
+
+    Emulator emulator;
+    REQUIRE(emulator.run(1000) == RUN_LOOPING);
+    CHECK(emulator.cycles() == 1000);
+    CHECK(emulator.read_pc() == (1000 * 2) % 256);
+  }
+
+  SECTION("A breakpoint on the loop") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state1.txt"));
+    REQUIRE(emulator.run(1000) == RUN_STOPPED);
+    CHECK(emulator.read_pc() == 32);
+    REQUIRE(emulator.run(1000) == RUN_STOPPED);
+    CHECK(emulator.read_pc() == 32);
+
+    REQUIRE(emulator.delete_breakpoint("END"));
+    REQUIRE(emulator.run(1000) == RUN_LOOPING);
+    CHECK(emulator.read_pc() == 32);
+  }
+
+  SECTION("Loops that write memory are executed") {
+    // state2 stores on every iteration until it falls through to JMP 20
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    REQUIRE(emulator.insert_breakpoint(20, "DONE"));
+    REQUIRE(emulator.run(100000) == RUN_STOPPED);
+    CHECK(emulator.read_pc() == 20);
+  }
+
+  SECTION("Detection turned off") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    emulator.set_loop_detection(0);
+    CHECK(emulator.run(1000) == RUN_STOPPED);
+    CHECK(emulator.run_fast(1000) == RUN_STOPPED);
+    CHECK(emulator.run_blocks(1000) == RUN_STOPPED);
+    CHECK(emulator.cycles() == 3005);
+    CHECK(emulator.read_pc() == 20);
+
+    emulator.set_loop_detection(1);
+    CHECK(emulator.run(1000) == RUN_LOOPING);
+  }
+
+  SECTION("No skipping with the journal enabled") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    REQUIRE(emulator.enable_journal(5000, 100));
+    REQUIRE(emulator.run(3000) == RUN_STOPPED);
+    REQUIRE(emulator.reverse_run(500));
+    CHECK(emulator.read_pc() == 20);
+  }
+}
+
+// The hash of the emulator's state, computed from scratch
+static uint64_t rehashed(const Emulator& emulator) {
+  ProcessorState state;
+  state.acc = emulator.read_acc();
+  state.pc = emulator.read_pc();
+  for (int i = 0; i < MEMORY_SIZE; ++i)
+    state.memory[i] = emulator.read_mem(i);
+  state.rehash();
+  return state.hash();
+}
+
+TEST_CASE("State hashing", "[emulator][memo][exec]") {
+  const char* programs[] = {"data/state1.txt", "data/state2.txt", "data/state_selfmod.txt"};
+  for (const char* program : programs)
+    REQUIRE(fopen(program, "r") != NULL);
+
+  SECTION("ProcessorState") {
+    ProcessorState state1;
+    CHECK(state1.memory_hash == 0);
+
+    for (int i = 0; i < 1000; ++i)
+      state1.store(rand() & 255, rand() & 255);
+    const uint64_t incremental = state1.memory_hash;
+    state1.rehash();
+    CHECK(state1.memory_hash == incremental);
+
+    // The same memory, written in a different order
+    ProcessorState state2;
+    for (int i = 255; i >= 0; --i)
+      state2.store(i, state1.memory[i]);
+    CHECK(state2.hash() == state1.hash());
+
+    state2.store(7, state2.memory[7] ^ 1);
+    CHECK(state2.hash() != state1.hash());
+    state2.store(7, state2.memory[7] ^ 1);
+    CHECK(state2.hash() == state1.hash());
+
+    state2.acc ^= 1;
+    CHECK(state2.hash() != state1.hash());
+    state2.acc ^= 1;
+    state2.pc += 2;
+    CHECK(state2.hash() != state1.hash());
+  }
+
+  SECTION("Kept up to date by every engine") {
+    int (Emulator::*engines[])(int) = {&Emulator::run, &Emulator::run_fast, &Emulator::run_blocks};
+    for (const char* program : programs) {
+      for (auto engine : engines) {
+        Emulator emulator;
+        REQUIRE(emulator.load_state(program));
+        CHECK(emulator.state_hash() == rehashed(emulator));
+
+        for (int run = 0; run < 20; ++run) {
+          (emulator.*engine)(1 + run * 7);
+          REQUIRE(emulator.state_hash() == rehashed(emulator));
+        }
+      }
+    }
+  }
+
+  SECTION("Kept up to date when the state is replaced") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state_selfmod.txt"));
+    REQUIRE(emulator.enable_journal(1000, 50));
+    EmulatorSnapshot start = emulator.snapshot();
+    const uint64_t start_hash = emulator.state_hash();
+
+    emulator.run(300);
+    REQUIRE(emulator.reverse_run(150));
+    CHECK(emulator.state_hash() == rehashed(emulator));
+    REQUIRE(emulator.seek(20));
+    CHECK(emulator.state_hash() == rehashed(emulator));
+
+    REQUIRE(emulator.restore(start));
+    CHECK(emulator.state_hash() == start_hash);
+
+    REQUIRE(emulator.save_binary_state("output/hashing.bin"));
+    emulator.run(100);
+    REQUIRE(emulator.load_binary_state("output/hashing.bin"));
+    CHECK(emulator.state_hash() == start_hash);
+  }
+
+  SECTION("Memoized runs") {
+    for (const char* program : programs) {
+      Emulator emulator;
+      REQUIRE(emulator.load_state(program));
+      Emulator reference{emulator};
+      RunMemo memo;
+
+      // Every segment is run twice from the same state: once for real, once from the memo
+      for (int segment = 0; segment < 10; ++segment) {
+        EmulatorSnapshot start = emulator.snapshot();
+        const int status = emulator.run_memoized(37, memo);
+        EmulatorSnapshot end = emulator.snapshot();
+        CHECK(status == reference.run_fast(37));
+        check_same_as_snapshot(reference, end);
+
+        REQUIRE(emulator.restore(start));
+        CHECK(emulator.run_memoized(37, memo) == status);
+        check_same_as_snapshot(emulator, end);
+        CHECK(emulator.state_hash() == rehashed(emulator));
+      }
+      // At least the second run of every segment is a hit. Programs that
+      // loop come back to states they were in before, so there can be more
+      CHECK(memo.hits() >= 10);
+      CHECK(memo.hits() + memo.misses() == 20);
+
+      // The decode cache must not replay code that the memoized run overwrote
+      CHECK(emulator.run(50) == reference.run(50));
+      check_same_as_snapshot(emulator, reference.snapshot());
+    }
+  }
+
+  SECTION("Breakpoints are part of the key") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    EmulatorSnapshot start = emulator.snapshot();
+    RunMemo memo;
+
+    emulator.run_memoized(100, memo);
+    const int cycles = emulator.cycles();
+    REQUIRE(emulator.restore(start));
+    REQUIRE(emulator.insert_breakpoint(emulator.read_pc() + INSTRUCTION_SIZE, "NEXT"));
+    emulator.run_memoized(100, memo);
+    CHECK(memo.misses() == 2);
+    CHECK(emulator.cycles() == start.cycles() + 1);
+    CHECK(cycles == start.cycles() + 100);
+
+    // The new run replaced the first one, which had the same key.
+    // A different step count is a different run
+    REQUIRE(emulator.restore(start));
+    emulator.run_memoized(99, memo);
+    CHECK(memo.hits() == 0);
+    CHECK(memo.size() == 2);
+  }
+
+  SECTION("Capacity") {
+    Emulator emulator;
+    RunMemo memo(4);
+    for (int i = 0; i < 10; ++i)
+      emulator.run_memoized(1, memo);
+    CHECK(memo.size() <= 4);
+    CHECK(memo.misses() == 10);
+  }
+
+  SECTION("Watchpoints are never memoized") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    EmulatorSnapshot start = emulator.snapshot();
+    RunMemo memo;
+    REQUIRE(emulator.run_memoized(50, memo) == RUN_STOPPED);
+
+    REQUIRE(emulator.restore(start));
+    for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+      REQUIRE(emulator.insert_watchpoint(address, WATCH_READ));
+    Emulator reference{emulator};
+    CHECK(emulator.run_memoized(50, memo) == RUN_WATCH);
+    CHECK(reference.run_fast(50) == RUN_WATCH);
+    CHECK(emulator.watch_hit().kinds == WATCH_READ);
+    check_same_as_snapshot(emulator, reference.snapshot());
+    CHECK(memo.hits() == 0);
+    CHECK(memo.misses() == 1);
+  }
+
+  SECTION("Loop detection is part of the key") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state1.txt"));
+    REQUIRE(emulator.delete_breakpoint("END"));
+    EmulatorSnapshot start = emulator.snapshot();
+    RunMemo memo;
+    REQUIRE(emulator.run_memoized(1000, memo) == RUN_LOOPING);
+
+    REQUIRE(emulator.restore(start));
+    emulator.set_loop_detection(0);
+    Emulator reference{emulator};
+    CHECK(emulator.run_memoized(1000, memo) == RUN_STOPPED);
+    CHECK(reference.run_fast(1000) == RUN_STOPPED);
+    check_same_as_snapshot(emulator, reference.snapshot());
+    CHECK(memo.hits() == 0);
+    CHECK(memo.size() == 2);
+
+    // Each setting finds its own run
+    REQUIRE(emulator.restore(start));
+    CHECK(emulator.run_memoized(1000, memo) == RUN_STOPPED);
+    REQUIRE(emulator.restore(start));
+    emulator.set_loop_detection(1);
+    CHECK(emulator.run_memoized(1000, memo) == RUN_LOOPING);
+    CHECK(memo.hits() == 2);
+  }
+}
+
+TEST_CASE("Watchpoints", "[emulator][watch][exec]") {
+  REQUIRE(fopen("data/state2.txt", "r") != NULL);
+
+  // state2 starts at cycle 5 and loops 32 times over:
+  //  0: LDR 63   2: ADD 64   4: STR 63   (memory[63] counts up from 0, memory[64...] are 1)
+  //  6: LDR 3    8: ADD 60  10: STR 3    (the operand of ADD 64 goes up by one)
+  // 12: LDR 62  14: ADD 61  16: STR 62   (memory[62] counts down from 32)
+  // 18: JNE 0   20: JMP 20
+  Emulator start;
+  REQUIRE(start.load_state("data/state2.txt"));
+
+  int (Emulator::*engines[])(int) = {&Emulator::run, &Emulator::run_fast, &Emulator::run_blocks};
+
+  // Every engine stops at the same place for the same reason
+  auto check_stop = [&](const Emulator& setup, int steps, int status, int cycles, addr_t pc, int kinds, addr_t address) {
+    for (auto engine : engines) {
+      Emulator emulator{setup};
+      CHECK((emulator.*engine)(steps) == status);
+      CHECK(emulator.cycles() == cycles);
+      CHECK(emulator.read_pc() == pc);
+      if (status == RUN_WATCH) {
+        CHECK(emulator.watch_hit().kinds == kinds);
+        CHECK(emulator.watch_hit().address == address);
+        CHECK(emulator.watch_hit().pc == pc - INSTRUCTION_SIZE);
+      }
+    }
+  };
+
+  SECTION("Writes") {
+    Emulator emulator{start};
+    REQUIRE(emulator.insert_watchpoint(63, WATCH_WRITE));
+    CHECK(emulator.num_watchpoints() == 1);
+    check_stop(emulator, 1000, RUN_WATCH, 8, 6, WATCH_WRITE, 63);
+
+    // Running again stops at the next write, one iteration later
+    REQUIRE(emulator.run(1000) == RUN_WATCH);
+    REQUIRE(emulator.run_fast(1000) == RUN_WATCH);
+    CHECK(emulator.cycles() == 18);
+
+    Emulator changed{start};
+    REQUIRE(changed.insert_watchpoint(3, WATCH_CHANGE));
+    check_stop(changed, 1000, RUN_WATCH, 11, 12, WATCH_CHANGE, 3);
+  }
+
+  SECTION("Values") {
+    Emulator emulator{start};
+    REQUIRE(emulator.insert_watchpoint(62, WATCH_VALUE, 30));
+    check_stop(emulator, 1000, RUN_WATCH, 24, 18, WATCH_VALUE, 62);
+
+    // Not reached within the steps
+    check_stop(emulator, 15, RUN_STOPPED, 20, 10, 0, 0);
+
+    // Several kinds on the same address
+    REQUIRE(emulator.insert_watchpoint(62, WATCH_VALUE | WATCH_CHANGE, 31));
+    check_stop(emulator, 1000, RUN_WATCH, 14, 18, WATCH_VALUE | WATCH_CHANGE, 62);
+  }
+
+  SECTION("Reads") {
+    Emulator emulator{start};
+    REQUIRE(emulator.insert_watchpoint(61, WATCH_READ));
+    check_stop(emulator, 1000, RUN_WATCH, 13, 16, WATCH_READ, 61);
+
+    // A STR is not a read
+    Emulator stored{start};
+    REQUIRE(stored.insert_watchpoint(62, WATCH_READ));
+    check_stop(stored, 1000, RUN_WATCH, 12, 14, WATCH_READ, 62);
+  }
+
+  SECTION("Acc conditions") {
+    Emulator emulator{start};
+    REQUIRE(emulator.insert_acc_condition(ACC_EQUAL, 31));
+    check_stop(emulator, 1000, RUN_WATCH, 13, 16, WATCH_ACC, 61);
+
+    // Conditions are combined
+    REQUIRE(emulator.insert_acc_condition(ACC_GREATER, 63));
+    check_stop(emulator, 1000, RUN_WATCH, 9, 8, WATCH_ACC, 3);
+
+    emulator.clear_acc_conditions();
+    check_stop(emulator, 1000, RUN_LOOPING, 1005, 20, 0, 0);
+
+    // Reads and the acc at once: LDR 63 loads 0
+    REQUIRE(emulator.insert_acc_condition(ACC_LESS, 1));
+    REQUIRE(emulator.insert_watchpoint(63, WATCH_READ));
+    check_stop(emulator, 1000, RUN_WATCH, 6, 2, WATCH_READ | WATCH_ACC, 63);
+  }
+
+  SECTION("Which kinds match") {
+    WatchList watches;
+    REQUIRE(watches.insert(63, WATCH_WRITE | WATCH_CHANGE | WATCH_VALUE, 5));
+    CHECK_FALSE(watches.check(JMP, 63, 0, 0, 0));
+    CHECK_FALSE(watches.check(LDR, 63, 0, 0, 0));
+    CHECK_FALSE(watches.check(STR, 62, 0, 1, 0));
+    CHECK(watches.check(STR, 63, 4, 4, 4) == WATCH_WRITE);
+    CHECK(watches.check(STR, 63, 4, 6, 6) == (WATCH_WRITE | WATCH_CHANGE));
+    CHECK(watches.check(STR, 63, 5, 5, 5) == (WATCH_WRITE | WATCH_VALUE));
+    CHECK(watches.check(STR, 63, 4, 5, 5) == (WATCH_WRITE | WATCH_CHANGE | WATCH_VALUE));
+    CHECK(watches.kinds(63) == (WATCH_WRITE | WATCH_CHANGE | WATCH_VALUE));
+
+    // The acc is only checked after instructions that set it
+    REQUIRE(watches.insert_acc_condition(ACC_NOT_EQUAL, 0));
+    CHECK(watches.check(ADD, 10, 0, 0, 7) == WATCH_ACC);
+    CHECK_FALSE(watches.check(ADD, 10, 0, 0, 0));
+    CHECK_FALSE(watches.check(JNE, 10, 0, 0, 7));
+    CHECK(watches.check(STR, 10, 0, 7, 7) == 0);
+  }
+
+  SECTION("Breakpoints, journal and profiler") {
+    Emulator emulator{start};
+    REQUIRE(emulator.insert_watchpoint(63, WATCH_WRITE));
+    REQUIRE(emulator.insert_breakpoint(6, "AFTER"));
+    check_stop(emulator, 1000, RUN_WATCH, 8, 6, WATCH_WRITE, 63);
+
+    REQUIRE(emulator.enable_journal(1000, 10));
+    REQUIRE(emulator.run(1000) == RUN_WATCH);
+    REQUIRE(emulator.run(1000) == RUN_WATCH);
+    CHECK(emulator.cycles() == 18);
+    // Going back replays the history without stopping at the watchpoint
+    REQUIRE(emulator.seek(9));
+    CHECK(emulator.cycles() == 9);
+    CHECK(emulator.read_pc() == 8);
+    emulator.disable_journal();
+
+    Profiler profiler;
+    CHECK(emulator.run_with(1000, profiler) == RUN_WATCH);
+    CHECK(profiler.total() == 9);
+  }
+
+  SECTION("Managing watchpoints") {
+    Emulator emulator{start};
+    CHECK_FALSE(emulator.insert_watchpoint(-1, WATCH_READ));
+    CHECK_FALSE(emulator.insert_watchpoint(256, WATCH_READ));
+    CHECK_FALSE(emulator.insert_watchpoint(63, 0));
+    CHECK_FALSE(emulator.insert_watchpoint(63, WATCH_ACC));
+    CHECK_FALSE(emulator.insert_watchpoint(63, WATCH_VALUE, 256));
+    CHECK_FALSE(emulator.insert_acc_condition(ACC_LESS, 0));
+    CHECK_FALSE(emulator.insert_acc_condition(ACC_GREATER, 255));
+    CHECK_FALSE(emulator.insert_acc_condition(ACC_EQUAL, -1));
+    CHECK(emulator.num_watchpoints() == 0);
+    CHECK(emulator.watch_hit().kinds == 0);
+
+    REQUIRE(emulator.insert_watchpoint(63, WATCH_WRITE));
+    REQUIRE(emulator.insert_watchpoint(62, WATCH_WRITE));
+    CHECK_FALSE(emulator.delete_watchpoint(61));
+    REQUIRE(emulator.delete_watchpoint(63));
+    CHECK(emulator.num_watchpoints() == 1);
+    check_stop(emulator, 1000, RUN_WATCH, 14, 18, WATCH_WRITE, 62);
+
+    // Copies keep the watchpoints, moves take them
+    Emulator copy{emulator};
+    CHECK(copy.num_watchpoints() == 1);
+    Emulator moved{std::move(copy)};
+    CHECK(moved.num_watchpoints() == 1);
+    CHECK(copy.num_watchpoints() == 0);
+
+    REQUIRE(emulator.delete_watchpoint(62));
+    check_stop(emulator, 1000, RUN_LOOPING, 1005, 20, 0, 0);
+  }
+}
+
+// Compiled from the data files by aot-compile at build time (see CMakeLists.txt)
+extern const AotProgram aot_state1;
+extern const AotProgram aot_state2;
+extern const AotProgram aot_state_selfmod;
+
+TEST_CASE("Ahead-of-time compilation", "[emulator][aot][exec]") {
+  // state1 never writes its code, state2 and state_selfmod patch their own operands
+  const std::pair<const char*, const AotProgram*> programs[] = {
+    {"data/state1.txt", &aot_state1},
+    {"data/state2.txt", &aot_state2},
+    {"data/state_selfmod.txt", &aot_state_selfmod},
+  };
+
+  SECTION("Same results as the interpreter") {
+    for (auto [filename, program] : programs) {
+      Emulator emulator;
+      REQUIRE(emulator.load_state(filename));
+      Emulator reference{emulator};
+      reference.set_loop_detection(0);
+
+      for (int steps : {0, 1, 2, 3, 7, 10, 50, 1000, 1}) {
+        CHECK(emulator.run_compiled(steps, *program) == reference.run(steps));
+        check_same_as_snapshot(emulator, reference.snapshot());
+        CHECK(emulator.state_hash() == rehashed(emulator));
+      }
+
+      // The decode cache must not replay code that the compiled stores overwrote
+      emulator.set_loop_detection(0);
+      CHECK(emulator.run(50) == reference.run(50));
+      check_same_as_snapshot(emulator, reference.snapshot());
+    }
+  }
+
+  SECTION("No steps") {
+    for (auto [filename, program] : programs) {
+      Emulator emulator;
+      REQUIRE(emulator.load_state(filename));
+      Emulator reference{emulator};
+      const int cycles = emulator.cycles();
+
+      for (int steps : {0, -1, -1000, std::numeric_limits<int>::min()}) {
+        CHECK(emulator.run_compiled(steps, *program) == reference.run(steps));
+        check_same_as_snapshot(emulator, reference.snapshot());
+        CHECK(emulator.cycles() == cycles);
+      }
+    }
+  }
+
+  SECTION("Breakpoints") {
+    for (auto [filename, program] : programs) {
+      Emulator emulator;
+      REQUIRE(emulator.load_state(filename));
+      REQUIRE(emulator.insert_breakpoint(10, "TEN"));
+      REQUIRE(emulator.insert_breakpoint(18, "EIGHTEEN"));
+      Emulator reference{emulator};
+      reference.set_loop_detection(0);
+
+      for (int run = 0; run < 20; ++run) {
+        CHECK(emulator.run_compiled(100, *program) == reference.run(100));
+        check_same_as_snapshot(emulator, reference.snapshot());
+      }
+
+      REQUIRE(emulator.delete_breakpoint("TEN"));
+      REQUIRE(reference.delete_breakpoint("TEN"));
+      CHECK(emulator.run_compiled(100, *program) == reference.run(100));
+      check_same_as_snapshot(emulator, reference.snapshot());
+    }
+  }
+
+  SECTION("Code that doesn't match the program") {
+    // state1's code isn't in the other files, so they run in the interpreter
+    for (const char* filename : {"data/state2.txt", "data/state_selfmod.txt", "data/state3.txt", "data/state4.txt"}) {
+      Emulator emulator;
+      REQUIRE(emulator.load_state(filename));
+      Emulator reference{emulator};
+      reference.set_loop_detection(0);
+
+      CHECK(emulator.run_compiled(1000, aot_state1) == reference.run(1000));
+      check_same_as_snapshot(emulator, reference.snapshot());
+    }
+  }
+
+  SECTION("Watchpoints use the interpreter") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    REQUIRE(emulator.insert_watchpoint(62, WATCH_WRITE));
+    CHECK(emulator.run_compiled(1000, aot_state2) == RUN_WATCH);
+    CHECK(emulator.watch_hit().address == 62);
+  }
+
+  SECTION("Generated code") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state1.txt"));
+
+    std::ostringstream out;
+    REQUIRE(emulator.compile(out, "state1"));
+    const std::string code = out.str();
+    CHECK(code.find("extern const AotProgram aot_state1;") != std::string::npos);
+    CHECK(code.find("pc_4: // AND: ACC <- ACC & [10]") != std::string::npos);
+    CHECK(code.find("state.store(34, acc);") != std::string::npos);
+
+    // Only the reachable slots (4 to 24 and 32) are compiled, and state1 doesn't write them
+    CHECK(code.find("pc_0:") == std::string::npos);
+    CHECK(code.find("pc_26:") == std::string::npos);
+    CHECK(code.find("pc_32:") != std::string::npos);
+    CHECK(code.find("AOT_FALLBACK;\n  goto done;") == std::string::npos);
+    CHECK(aot_state1.num_stores == 2);
+
+    std::ostringstream rejected;
+    CHECK_FALSE(emulator.compile(rejected, ""));
+    CHECK_FALSE(emulator.compile(rejected, "1st"));
+    CHECK_FALSE(emulator.compile(rejected, "state-1"));
+    CHECK(rejected.str().empty());
+
+    // An odd PC has no instruction to start from
+    std::string text = "0\n0\n3\n";
+    for (int i = 0; i < MEMORY_SIZE; ++i)
+      text += "0\n";
+    REQUIRE(emulator.load_state_text(text.data(), text.size()));
+    CHECK_FALSE(emulator.compile(rejected, "odd"));
+  }
+}
+
+TEST_CASE("Coroutine runs", "[emulator][async][exec]") {
+  // state1 ends in a jump to itself once END is deleted, which loop detection skips
+  const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt", "data/state_selfmod.txt"};
+
+  SECTION("Same results as run_fast()") {
+    for (const char* filename : files) {
+      for (int with_breakpoints : {1, 0}) {
+        for (int slice : {1, 3, 7, 64, 0}) {
+          Emulator emulator;
+          REQUIRE(emulator.load_state(filename));
+          if (!with_breakpoints)
+            emulator.delete_breakpoint("END");
+          Emulator reference{emulator};
+
+          for (int steps : {0, 1, 10, 1000, 100000}) {
+            const int before = reference.cycles();
+            const int status = reference.run_fast(steps);
+
+            RunTask task = emulator.run_async(steps, slice);
+            CHECK(task.result().cycles == 0);
+
+            int slices = 0;
+            while (task.resume())
+              ++slices;
+            REQUIRE(task.done());
+            CHECK_FALSE(task.resume());
+
+            CHECK(task.result().status == status);
+            CHECK(task.result().cycles == reference.cycles() - before);
+            check_same_as_snapshot(emulator, reference.snapshot());
+            if (slice > 0)
+              CHECK(slices <= steps / slice);
+            else
+              CHECK(slices == 0);
+          }
+        }
+      }
+    }
+  }
+
+  SECTION("Suspends between slices") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state1.txt"));
+    REQUIRE(emulator.delete_breakpoint("END"));
+
+    RunTask task = emulator.run_async(1000000, 5);
+    CHECK_FALSE(task.done());
+    CHECK(emulator.cycles() == 0);
+    REQUIRE(task.resume());
+    CHECK(task.result().cycles == 5);
+    CHECK(emulator.cycles() == 5);
+    REQUIRE(task.resume());
+    CHECK(task.result().cycles == 10);
+
+    // The loop is skipped to the end of the run as soon as it's found
+    while (task.resume()) {}
+    CHECK(task.result().status == RUN_LOOPING);
+    CHECK(task.result().cycles == 1000000);
+    CHECK(emulator.read_pc() == 32);
+
+    // Tasks move, and an empty one is done
+    RunTask moved = emulator.run_async(10, 1);
+    RunTask empty;
+    CHECK(empty.done());
+    CHECK_FALSE(empty.resume());
+    empty = std::move(moved);
+    CHECK(moved.done());
+    CHECK(empty.resume());
+
+    // Destroying a task that isn't done just abandons the run
+    RunTask abandoned = emulator.run_async(10, 1);
+    abandoned.resume();
+  }
+
+  SECTION("Watchpoints and the journal") {
+    Emulator watched;
+    REQUIRE(watched.load_state("data/state2.txt"));
+    REQUIRE(watched.insert_watchpoint(62, WATCH_WRITE));
+    Emulator reference{watched};
+
+    RunTask task = watched.run_async(1000, 2);
+    while (task.resume()) {}
+    CHECK(task.result().status == reference.run_fast(1000));
+    CHECK(task.result().status == RUN_WATCH);
+    check_same_as_snapshot(watched, reference.snapshot());
+
+    Emulator journaled;
+    REQUIRE(journaled.load_state("data/state_selfmod.txt"));
+    REQUIRE(journaled.enable_journal(1000, 16));
+    Emulator expected{journaled};
+    REQUIRE(expected.run_fast(100));
+
+    RunTask journaled_task = journaled.run_async(100, 3);
+    while (journaled_task.resume()) {}
+    CHECK(journaled_task.result().status == RUN_STOPPED);
+    check_same_as_snapshot(journaled, expected.snapshot());
+    REQUIRE(journaled.reverse_run(100));
+    CHECK(journaled.cycles() == 0);
+  }
+
+  SECTION("Interleaving many emulators") {
+    std::vector<Emulator> emulators;
+    std::vector<Emulator> references;
+    for (int copy = 0; copy < 20; ++copy) {
+      for (const char* filename : files) {
+        Emulator emulator;
+        REQUIRE(emulator.load_state(filename));
+        if (copy % 2 == 1)
+          emulator.delete_breakpoint("END");
+        references.push_back(emulator);
+        emulators.push_back(std::move(emulator));
+      }
+    }
+
+    // The emulators don't move while their tasks run
+    std::vector<RunTask> tasks;
+    for (size_t idx = 0; idx < emulators.size(); ++idx)
+      tasks.push_back(emulators.at(idx).run_async(500 + idx, 1 + idx % 16));
+
+    CHECK(run_interleaved(tasks) > static_cast<long>(tasks.size()));
+    for (size_t idx = 0; idx < emulators.size(); ++idx) {
+      CHECK(tasks.at(idx).done());
+      CHECK(tasks.at(idx).result().status == references.at(idx).run_fast(500 + idx));
+      check_same_as_snapshot(emulators.at(idx), references.at(idx).snapshot());
+    }
+  }
+}
+
+// The state an emulator would have with another acc, through the state file format
+static void reload_with_acc(Emulator& emulator, data_t acc) {
+  std::string text = std::to_string(emulator.cycles()) + "\n" + std::to_string(acc) + "\n" + std::to_string(emulator.read_pc()) + "\n";
+  for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+    text += std::to_string(emulator.read_mem(address)) + "\n";
+  REQUIRE(emulator.load_state_text(text.data(), text.size()));
+}
+
+// An engine with a bug that single steps don't show
+struct IgnoreBreakpoints {
+  static constexpr bool stops_at_breakpoints = false;
+  static constexpr bool detects_loops = true;
+  void before_step(Emulator&, byte_t, addr_t) {}
+};
+
+TEST_CASE("Differential checker", "[emulator][differential][exec]") {
+  SECTION("Random programs") {
+    Emulator first;
+    Emulator again;
+    REQUIRE(random_program(first, 42));
+    REQUIRE(random_program(again, 42));
+    for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+      CHECK(first.read_mem(address) == again.read_mem(address));
+    CHECK(first.read_pc() == again.read_pc());
+    CHECK(first.num_breakpoints() == again.num_breakpoints());
+
+    // The unusual cases all show up
+    int invalid = 0;
+    int odd_targets = 0;
+    int odd_pcs = 0;
+    int breakpoints = 0;
+    for (uint64_t seed = 0; seed < 200; ++seed) {
+      Emulator emulator;
+      REQUIRE(random_program(emulator, seed));
+      CHECK(emulator.cycles() == 0);
+      odd_pcs += emulator.read_pc() % 2;
+      breakpoints += emulator.num_breakpoints();
+      for (addr_t pc = 0; pc < MEMORY_SIZE; pc += INSTRUCTION_SIZE) {
+        invalid += emulator.read_mem(pc) >= NUM_OPCODES;
+        odd_targets += (emulator.read_mem(pc) == JMP || emulator.read_mem(pc) == JNE) && emulator.read_mem(pc + 1) % 2 == 1;
+      }
+    }
+    CHECK(invalid > 0);
+    CHECK(odd_targets > 0);
+    CHECK(odd_pcs > 0);
+    CHECK(breakpoints > 0);
+
+    RandomProgramOptions options;
+    options.odd_pc = 100;
+    options.max_breakpoints = 0;
+    REQUIRE(random_program(first, 7, options));
+    CHECK(first.read_pc() % 2 == 1);
+    CHECK(first.num_breakpoints() == 0);
+  }
+
+  SECTION("The engines agree with run()") {
+    RunMemo memo;
+    const std::pair<const char*, DiffEngine> engines[] = {
+      {"run", &Emulator::run},
+      {"run_fast", &Emulator::run_fast},
+      {"run_blocks", &Emulator::run_blocks},
+      {"run_memoized", [&memo](Emulator& emulator, int steps) { return emulator.run_memoized(steps, memo); }},
+      {"run_async", [](Emulator& emulator, int steps) {
+        RunTask task = emulator.run_async(steps, 3);
+        while (task.resume()) {}
+        return task.result().status;
+      }},
+    };
+
+    for (const auto& [name, engine] : engines) {
+      for (int interval : {1, 10, 100}) {
+        DifferentialChecker checker(engine, interval);
+        const Divergence divergence = checker.fuzz(1000, 100, 500);
+        INFO(name << " every " << interval << " cycles\n" << divergence.report);
+        CHECK_FALSE(divergence.found);
+        CHECK(checker.comparisons() > 100);
+      }
+    }
+
+    // Compiled programs don't detect loops
+    const std::pair<const char*, const AotProgram*> programs[] = {
+      {"data/state1.txt", &aot_state1}, {"data/state2.txt", &aot_state2}, {"data/state_selfmod.txt", &aot_state_selfmod},
+    };
+    for (auto [filename, program] : programs) {
+      Emulator emulator;
+      REQUIRE(emulator.load_state(filename));
+      emulator.set_loop_detection(0);
+      DifferentialChecker checker([program = program](Emulator& emulator, int steps) { return emulator.run_compiled(steps, *program); }, 16);
+      const Divergence divergence = checker.check(emulator, 2000);
+      INFO(filename << "\n" << divergence.report);
+      CHECK_FALSE(divergence.found);
+    }
+  }
+
+  SECTION("Finds the first divergence") {
+    // state1 multiplies 3 by 4 with repeated additions. This engine gets
+    // the last addition wrong
+    DiffEngine wrong_product = [](Emulator& emulator, int steps) {
+      for (int step = 0; step < steps; ++step) {
+        const int status = emulator.run_fast(1);
+        if (emulator.read_acc() == 12)
+          reload_with_acc(emulator, 13);
+        if (status != RUN_STOPPED || emulator.is_breakpoint())
+          return status;
+      }
+      return static_cast<int>(RUN_STOPPED);
+    };
+
+    Emulator reference;
+    REQUIRE(reference.load_state("data/state1.txt"));
+    Emulator start{reference};
+    int cycle = 0;
+    while (reference.read_acc() != 12) {
+      REQUIRE(reference.run(1));
+      ++cycle;
+    }
+
+    DifferentialChecker checker(wrong_product, 50);
+    const Divergence divergence = checker.check(start, 1000);
+    REQUIRE(divergence.found);
+    CHECK(divergence.what == "acc");
+    CHECK(divergence.cycle == cycle);
+    CHECK(divergence.agreed == 0);
+    CHECK(divergence.report.find("First divergence in acc at cycle " + std::to_string(cycle)) != std::string::npos);
+    CHECK(divergence.report.find("acc                 12        13  <--") != std::string::npos);
+
+    // The listings are the ones print_program() prints
+    std::vector<char> listing(DISASSEMBLY_PROGRAM_MAX);
+    const std::string expected(listing.data(), start.disassemble(listing.data()));
+    CHECK(divergence.report.find("Program at cycle 0:\n" + expected) != std::string::npos);
+
+    // Single steps can't tell an engine that ignores breakpoints, the interval does
+    DifferentialChecker ignoring([](Emulator& emulator, int steps) {
+      IgnoreBreakpoints observer;
+      return emulator.run_with(steps, observer);
+    }, 100);
+    const Divergence missed = ignoring.check(start, 1000);
+    REQUIRE(missed.found);
+    CHECK(missed.agreed == 0);
+    CHECK(missed.what == "status");
+    CHECK(missed.cycle < 100);
+
+    // Random programs have breakpoints too
+    const Divergence fuzzed = ignoring.fuzz(0, 50, 1000);
+    REQUIRE(fuzzed.found);
+    CHECK(fuzzed.report.rfind("Program seed ", 0) == 0);
+  }
+}
+
+TEST_CASE("Emulator state helpers", "[emulator][exec]") {
+  REQUIRE(fopen("data/state2.txt", "r") != NULL);
+
+  Emulator emulator;
+  REQUIRE(emulator.load_state("data/state2.txt"));
+
+  // Check that state is as expected
+  REQUIRE(emulator.read_acc() == 0);
+  REQUIRE(emulator.read_pc() == 0);
+  int sum = 0;
+  for (int i = 64; i < 96; ++i)
+    sum += emulator.read_mem(i);
+  REQUIRE(sum == 48);
+  REQUIRE(emulator.cycles() == 5);
+  REQUIRE(emulator.num_breakpoints() == 0);
+
+  // Add a few breakpoints
+  int num_breakpoints = 4;
+  const addr_t addresses[] = {0, 4, 18, 20};
+  const char* names[] = {"START", "UPDATE", "LOOPEND", "END"};
+
+  for (int i = 0; i < num_breakpoints; ++i) 
+    REQUIRE(emulator.insert_breakpoint(addresses[i], names[i]));
+  REQUIRE(emulator.num_breakpoints() == num_breakpoints);
+
+  CHECK(emulator.is_zero());
+  CHECK(emulator.is_breakpoint());
+
+  // Run till next breakpoint
+  REQUIRE(emulator.run(1000000));
+  REQUIRE(emulator.read_pc() == 4);
+  REQUIRE(emulator.read_acc() == 1);
+  REQUIRE(emulator.cycles() == 7);
+  REQUIRE(emulator.read_mem(63) == 0);
+
+  CHECK(not emulator.is_zero());
+  CHECK(emulator.is_breakpoint());
+
+  // Run till next breakpoint
+  REQUIRE(emulator.run(1000000));
+  REQUIRE(emulator.read_pc() == 18);
+  REQUIRE(emulator.read_acc() == 31);
+  REQUIRE(emulator.cycles() == 14);
+  REQUIRE(emulator.read_mem(63) == 1);
+
+  CHECK(not emulator.is_zero());
+  CHECK(emulator.is_breakpoint());
+
+  // Run till next breakpoint
+  REQUIRE(emulator.run(1000000));
+  REQUIRE(emulator.read_pc() == 0);
+  REQUIRE(emulator.read_acc() == 31);
+  REQUIRE(emulator.cycles() == 15);
+  REQUIRE(emulator.read_mem(63) == 1);
+
+  CHECK(not emulator.is_zero());
+  CHECK(emulator.is_breakpoint());
+
+  // One step
+  REQUIRE(emulator.run(1));
+  REQUIRE(emulator.read_pc() == 2);
+  REQUIRE(emulator.read_acc() == 1);
+  REQUIRE(emulator.cycles() == 16);
+  REQUIRE(emulator.read_mem(63) == 1);
+
+  CHECK(not emulator.is_zero());
+  CHECK(not emulator.is_breakpoint());
+
+  // Leave only the last two breakpoints
+  REQUIRE(emulator.delete_breakpoint(0));
+  REQUIRE(emulator.delete_breakpoint(4));
+  
+  // Assuming we will only break at the LOOPEND breakpoint
+  // the following is equivalent to executing the loop 30 times
+  for (int i = 0; i < 30; ++i) {
+    REQUIRE(emulator.run(1000));
+    REQUIRE(emulator.read_pc() == 18);
+    REQUIRE(emulator.read_acc() == 30 - i);
+    REQUIRE(emulator.cycles() == 24 + 10 * i);
+    CHECK(not emulator.is_zero());
+    CHECK(emulator.is_breakpoint());
+  }
+
+  // This should be the last iteration
+  REQUIRE(emulator.run(1000));
+  REQUIRE(emulator.read_pc() == 18);
+  REQUIRE(emulator.read_acc() == 0);
+  REQUIRE(emulator.cycles() == 324);
+  CHECK(emulator.is_zero());
+  CHECK(emulator.is_breakpoint());
+
+  // We will not the JNE jump, instead we will go to the next instruction
+  // which is also a breakpoint (and an idle loop signifying the end of the program)
+  REQUIRE(emulator.run(1000));
+  REQUIRE(emulator.read_pc() == 20);
+  REQUIRE(emulator.read_acc() == 0);
+  REQUIRE(emulator.cycles() == 325);
+  CHECK(emulator.is_zero());
+  CHECK(emulator.is_breakpoint());
+
+  // At this point, we stuck on instruction 20 forever
+  // Running 1k steps, actually only runs for one cycle
+  REQUIRE(emulator.run(1000));
+  REQUIRE(emulator.read_pc() == 20);
+  REQUIRE(emulator.read_acc() == 0);
+  REQUIRE(emulator.cycles() == 326);
+  CHECK(emulator.is_zero());
+  CHECK(emulator.is_breakpoint());
+
+  // Remove the breakpoint at the end
+  REQUIRE(emulator.delete_breakpoint(20));
+
+  // Now running for 1000 steps, should actually run for 1000 steps
+  REQUIRE(emulator.run(1000));
+  REQUIRE(emulator.read_pc() == 20);
+  REQUIRE(emulator.read_acc() == 0);
+  REQUIRE(emulator.cycles() == 1326);
+  CHECK(emulator.is_zero());
+  CHECK(not emulator.is_breakpoint());
+
+  // Verify that the program has executed correctly
+  CHECK(emulator.read_mem(63) == 48);
+}
+
+// ----------- Magic for capturing the printf --------------
+int capture_stdout(const char* filename) {
+  // Get a file descriptor handle for the original stdout
+  int original_stdout = dup(STDOUT_FILENO);
+
+  // Open the file where we will send the standard output
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd == -1)
+    return -1;
+
+  // Make the standard output handle point to our file
+  // Effectively standard output goes to the file
   fflush(stdout);
   dup2(fd, STDOUT_FILENO);
 
@@ -2629,6 +4865,164 @@ TEST_CASE("Program Print", "[emulator][exec]") {
   }
 }
 
+std::string read_file(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+TEST_CASE("Execution trace", "[emulator][trace]") {
+  REQUIRE(fopen("data/state2.txt", "r") != NULL);
+
+  SECTION("Ring buffer") {
+    TraceRing ring(3);
+    TraceRecord record{1, 2, 3, 4, 5, 0, 0};
+    for (int idx = 0; idx < 4; ++idx)
+      REQUIRE(ring.push(record));
+    CHECK(!ring.push(record));
+
+    TraceRecord out[8];
+    CHECK(ring.pop(out, 3) == 3);
+    CHECK(out[2].pc == 2);
+    CHECK(ring.pop(out, 8) == 1);
+    CHECK(ring.empty());
+  }
+
+  const int compressions[] = {0, 1};
+  for (int compress : compressions) {
+    if (compress && !TraceWriter::compression_available())
+      continue;
+
+    SECTION("Every cycle is recorded, compressed " + std::to_string(compress)) {
+      const std::string filename = "output/trace" + std::to_string(compress) + ".bin";
+      Emulator emulator;
+      REQUIRE(emulator.load_state("data/state2.txt"));
+      Emulator reference = emulator;
+
+      // A small ring, so the emulator has to wait for the writer
+      TraceWriter writer(16);
+      REQUIRE(writer.open(filename, emulator.cycles(), compress));
+      CHECK(!writer.open(filename, emulator.cycles(), compress));
+      emulator.set_trace(&writer);
+      REQUIRE(emulator.run(300) == RUN_STOPPED);
+      REQUIRE(emulator.run_fast(300) == RUN_STOPPED);
+      REQUIRE(emulator.run_blocks(400) == RUN_STOPPED);
+      REQUIRE(writer.close());
+      CHECK(writer.records() == 1000);
+
+      TraceHeader header;
+      std::vector<TraceRecord> records;
+      REQUIRE(read_trace(filename, header, records));
+      CHECK(header.start_cycle == 5);
+      REQUIRE(records.size() == 1000);
+
+      for (const TraceRecord& record : records) {
+        CHECK(record.cycle_delta == 1);
+        CHECK(record.pc == reference.read_pc());
+        CHECK(record.opcode == reference.read_mem(reference.read_pc()));
+        CHECK(record.operand == reference.read_mem(reference.read_pc() + 1));
+        REQUIRE(reference.run(1));
+        CHECK(record.acc == reference.read_acc());
+        CHECK(((record.flags & TRACE_WRITE) != 0) == (record.opcode == STR));
+      }
+
+      std::ostringstream text;
+      REQUIRE(decode_trace(filename, text));
+      std::istringstream lines(text.str());
+      std::string line;
+      int count = 0;
+      while (std::getline(lines, line))
+        ++count;
+      CHECK(count == 1000);
+      const std::string first = "6\t0:\t4\t63\t:\tLDR: ACC <- [63]\tACC = ";
+      CHECK(text.str().substr(0, first.size()) == first);
+    }
+  }
+
+  SECTION("Untraced cycles") {
+    const std::string filename = "output/trace_gap.bin";
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    TraceWriter writer;
+    REQUIRE(writer.open(filename, emulator.cycles()));
+    emulator.set_trace(&writer);
+    REQUIRE(emulator.run(2));
+
+    // Skipped by the loop detection, without the trace
+    emulator.set_trace(NULL);
+    REQUIRE(emulator.run(200000));
+    emulator.set_trace(&writer);
+    REQUIRE(emulator.run(1));
+    REQUIRE(writer.close());
+
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+    REQUIRE(read_trace(filename, header, records));
+    REQUIRE(records.size() == 6);
+    CHECK(records.at(2).flags == TRACE_GAP);
+    CHECK(records.at(3).flags == TRACE_GAP);
+    CHECK(records.at(4).flags == TRACE_GAP);
+
+    uint64_t cycle = header.start_cycle;
+    for (const TraceRecord& record : records)
+      cycle += record.cycle_delta;
+    CHECK(cycle == static_cast<uint64_t>(emulator.cycles()));
+
+    std::ostringstream text;
+    REQUIRE(decode_trace(filename, text));
+    CHECK(text.str().find("\n" + std::to_string(emulator.cycles()) + "\t") != std::string::npos);
+  }
+
+  SECTION("Bad files") {
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+    CHECK(!read_trace("data/does_not_exist.bin", header, records));
+    CHECK(!read_trace("data/state2.txt", header, records));
+  }
+}
+
+TEST_CASE("Disassembler", "[emulator][exec]") {
+  std::string all;
+  std::ostringstream streamed;
+  {
+    DisassemblySink sink(streamed, 1000);
+    for (int state_id = 1; state_id <= 4; ++state_id) {
+      const std::string infile = "data/state" + std::to_string(state_id) + ".txt";
+      const std::string expected = read_file("ref/print_program" + std::to_string(state_id) + ".txt");
+      REQUIRE(fopen(infile.c_str(), "r") != NULL);
+      REQUIRE(!expected.empty());
+
+      Emulator emulator;
+      REQUIRE(emulator.load_state(infile));
+
+      std::vector<char> buffer(DISASSEMBLY_PROGRAM_MAX);
+      char* end = emulator.disassemble(buffer.data());
+      CHECK(std::string(buffer.data(), end) == expected);
+
+      REQUIRE(sink.write("# " + infile + "\n"));
+      REQUIRE(sink.write_program(emulator));
+      all += "# " + infile + "\n" + expected;
+    }
+  }
+  // Everything is out once the sink is gone
+  CHECK(streamed.str() == all);
+
+  SECTION("Lines") {
+    char line[DISASSEMBLY_LINE_MAX];
+    CHECK(std::string(line, disassemble_line(line, 254, {JNE, 255})) == "254:\t7\t255\t:\tJNE: PC  <- 255 if ACC != 0\n");
+    CHECK(std::string(line, disassemble_line(line, 0, {0, 0})) == "0:\t0\t0\n");
+    CHECK(std::string(line, disassemble_line(line, 10, {200, 3})) == "10:\t200\t3\n");
+  }
+
+  SECTION("to_string() is unchanged") {
+    CHECK(Iadd(5).to_string() == "ADD: ACC <- ACC + [5]");
+    CHECK(Istr(255).to_string() == "STR: ACC -> [255]");
+    CHECK(Ijmp(32).to_string() == "JMP: PC  <- 32");
+    CHECK(Ijne(0).to_string() == "JNE: PC  <- 0 if ACC != 0");
+  }
+}
+
 // We have indirectly tested load_state() multiple times,
 // so here we'll keep this short
 TEST_CASE("Load State: Correct cases", "[emulator][exec]") {
@@ -2654,7 +5048,7 @@ TEST_CASE("Load State: Correct cases", "[emulator][exec]") {
     CHECK(emulator.read_mem(35) == 0);
     CHECK(emulator.cycles() == 0);
     CHECK(emulator.num_breakpoints() == 1);
-    CHECK_THAT(emulator.find_breakpoint(32)->get_name(), Catch::Matchers::Equals("END"));
+    CHECK(emulator.find_breakpoint(32)->get_name() == "END");
   }
 
   SECTION("State3: Successive values in memory") {
@@ -2678,21 +5072,21 @@ TEST_CASE("Load State: Correct cases", "[emulator][exec]") {
     CHECK(emulator.num_breakpoints() == 19);
 
     REQUIRE(emulator.find_breakpoint(0) != NULL);
-    CHECK_THAT(emulator.find_breakpoint(0)->get_name(), Catch::Matchers::Equals("START"));
+    CHECK(emulator.find_breakpoint(0)->get_name() == "START");
     
     REQUIRE(emulator.find_breakpoint(254) != NULL);
-    CHECK_THAT(emulator.find_breakpoint(254)->get_name(), Catch::Matchers::Equals("END"));
+    CHECK(emulator.find_breakpoint(254)->get_name() == "END");
     
     REQUIRE(emulator.find_breakpoint(128) != NULL);
-    CHECK_THAT(emulator.find_breakpoint(128)->get_name(), Catch::Matchers::Equals("MID"));
+    CHECK(emulator.find_breakpoint(128)->get_name() == "MID");
     
     REQUIRE(emulator.find_breakpoint(60) != NULL);
-    CHECK_THAT(emulator.find_breakpoint(60)->get_name(), Catch::Matchers::Equals("VERYLARGENAMEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEE"));
+    CHECK(emulator.find_breakpoint(60)->get_name() == "VERYLARGENAMEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEE");
 
     const char* names[15] = {"A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O"};
     for (int i = 0; i < 15; ++i) {
       REQUIRE(emulator.find_breakpoint(i*2 + 2) != NULL);
-      CHECK_THAT(emulator.find_breakpoint(i*2 + 2)->get_name(), Catch::Matchers::Equals(names[i]));
+      CHECK(emulator.find_breakpoint(i*2 + 2)->get_name() == names[i]);
     }
   }
 }
@@ -2762,3 +5156,797 @@ TEST_CASE("Load State: Wrong cases", "[emulator][exec]") {
     REQUIRE(not emulator.load_state("data/invalid9.txt"));
   }
 }
+
+static void check_same_state(const Emulator& loaded, const Emulator& original) {
+  CHECK(loaded.cycles() == original.cycles());
+  CHECK(loaded.read_acc() == original.read_acc());
+  CHECK(loaded.read_pc() == original.read_pc());
+  for (int i = 0; i < MEMORY_SIZE; ++i)
+    CHECK(loaded.read_mem(i) == original.read_mem(i));
+
+  REQUIRE(loaded.num_breakpoints() == original.num_breakpoints());
+  for (int i = 0; i < MEMORY_SIZE; ++i) {
+    const Breakpoint* expected = original.find_breakpoint(i);
+    if (expected == NULL) {
+      CHECK(loaded.find_breakpoint(i) == NULL);
+    } else {
+      REQUIRE(loaded.find_breakpoint(i) != NULL);
+      CHECK(loaded.find_breakpoint(i)->get_name() == expected->get_name());
+    }
+  }
+}
+
+// save_state() must write exactly what load_state() reads
+TEST_CASE("Save State", "[emulator][exec]") {
+  const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt", "data/state_breakpoints.txt"};
+
+  for (const char* file : files) {
+    Emulator original;
+    REQUIRE(original.load_state(file));
+    original.run_fast(17);
+
+    REQUIRE(original.save_state("output/save_state.txt"));
+
+    Emulator loaded;
+    REQUIRE(loaded.load_state("output/save_state.txt"));
+    check_same_state(loaded, original);
+  }
+}
+
+TEST_CASE("Binary State", "[emulator][exec]") {
+  const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt", "data/state_breakpoints.txt"};
+
+  SECTION("Round trips through the binary format") {
+    for (const char* file : files) {
+      Emulator original;
+      REQUIRE(original.load_state(file));
+      original.run_fast(17);
+
+      REQUIRE(original.save_binary_state("output/state.bin"));
+      CHECK(is_binary_state_file("output/state.bin"));
+      CHECK(not is_binary_state_file(file));
+
+      Emulator loaded;
+      REQUIRE(loaded.insert_breakpoint(100, "STALE"));
+      REQUIRE(loaded.load_binary_state("output/state.bin"));
+      check_same_state(loaded, original);
+
+      // And back to text
+      REQUIRE(loaded.save_state("output/state.txt"));
+      Emulator reloaded;
+      REQUIRE(reloaded.load_state("output/state.txt"));
+      check_same_state(reloaded, original);
+    }
+  }
+
+  SECTION("Text files are not binary state files") {
+    Emulator emulator;
+    REQUIRE(fopen("data/state1.txt", "r") != NULL);
+    CHECK(not emulator.load_binary_state("data/state1.txt"));
+    CHECK(not emulator.load_binary_state("data/invalid0000000000000000000000.txt"));
+  }
+
+  SECTION("Corrupted binary state files") {
+    Emulator original;
+    REQUIRE(original.load_state("data/state_breakpoints.txt"));
+    REQUIRE(original.save_binary_state("output/state.bin"));
+
+    std::ifstream in("output/state.bin", std::ios::binary);
+    const std::string image((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    REQUIRE(image.size() > sizeof(BinaryStateHeader) + MEMORY_SIZE);
+
+    auto load_modified = [&](std::string modified) {
+      std::ofstream out("output/state_bad.bin", std::ios::binary);
+      out.write(modified.data(), modified.size());
+      out.close();
+      Emulator emulator;
+      return emulator.load_binary_state("output/state_bad.bin");
+    };
+
+    // Unchanged, as a sanity check
+    CHECK(load_modified(image));
+
+    std::string bad_magic = image;
+    bad_magic[0] = 'X';
+    CHECK(not load_modified(bad_magic));
+
+    std::string bad_version = image;
+    bad_version[offsetof(BinaryStateHeader, version)] = 99;
+    CHECK(not load_modified(bad_version));
+
+    std::string negative_cycles = image;
+    negative_cycles[offsetof(BinaryStateHeader, total_cycles) + 3] = static_cast<char>(0x80);
+    CHECK(not load_modified(negative_cycles));
+
+    CHECK(not load_modified(image.substr(0, sizeof(BinaryStateHeader) + MEMORY_SIZE - 1)));
+    CHECK(not load_modified(image.substr(0, image.size() - 1)));
+    CHECK(not load_modified(image + "X"));
+
+    // Two breakpoints on the same address: move the second one (after "START") onto the first
+    std::string duplicate = image;
+    duplicate[sizeof(BinaryStateHeader) + MEMORY_SIZE + BINARY_STATE_BREAKPOINT_SIZE + 5] = image[sizeof(BinaryStateHeader) + MEMORY_SIZE];
+    CHECK(not load_modified(duplicate));
+
+    // Names the text format can't hold, since state-convert has to write them there
+    const size_t first_name = sizeof(BinaryStateHeader) + MEMORY_SIZE + BINARY_STATE_BREAKPOINT_SIZE;
+    for (char c : {' ', '\n', '\t', '\r'}) {
+      std::string bad_name = image;
+      bad_name[first_name] = c;
+      CHECK(not load_modified(bad_name));
+    }
+    CHECK(Emulator::valid_breakpoint_name("LOOP_1"));
+    CHECK(not Emulator::valid_breakpoint_name(""));
+    CHECK(not Emulator::valid_breakpoint_name("TWO WORDS"));
+  }
+}
+
+// The istringstream parser load_state() had before it moved to std::from_chars(),
+// as the reference for what has to be accepted and rejected. The breakpoints
+// are inserted into `breakpoints`, so the same insert_breakpoint() rules apply
+struct ReferenceState {
+  int cycles = 0;
+  int acc = 0;
+  int pc = 0;
+  int memory[MEMORY_SIZE] = {};
+  Emulator breakpoints;
+};
+
+static int reference_load_state(const std::string& text, ReferenceState& loaded) {
+  std::istringstream file(text);
+  std::string line;
+  if (std::getline(file, line) && !line.empty()) {
+    std::istringstream iss(line);
+    if (!(iss >> loaded.cycles) || loaded.cycles < 0)
+      return 0;
+  } else
+    return 0;
+
+  if (std::getline(file, line)) {
+    std::istringstream iss(line);
+    if (!(iss >> loaded.acc) || loaded.acc > ARCH_MAXVAL || loaded.acc < 0)
+      return 0;
+  } else
+    return 0;
+
+  if (std::getline(file, line)) {
+    std::istringstream iss(line);
+    if (!(iss >> loaded.pc) || loaded.pc >= MEMORY_SIZE || loaded.pc < 0)
+      return 0;
+  } else
+    return 0;
+
+  int num = 0;
+  for (int offset = 0; offset < MEMORY_SIZE; ++offset) {
+    if (!std::getline(file, line) || line.empty())
+      return 0;
+    std::istringstream iss(line);
+    if (!(iss >> num) || !(iss >> std::ws).eof() || num > ARCH_MAXVAL || num < 0)
+      return 0;
+    loaded.memory[offset] = num;
+  }
+
+  while (true) {
+    std::string name;
+    if (!(file >> num >> name)) {
+      if (file.eof()) break;
+      return 0;
+    }
+    if (num < 0 || num >= MEMORY_SIZE)
+      return 0;
+    if (!loaded.breakpoints.insert_breakpoint(num, name))
+      return 0;
+  }
+  return 1;
+}
+
+static void check_same_as_reference(const std::string& text) {
+  ReferenceState expected;
+  const int accepted = reference_load_state(text, expected);
+
+  Emulator emulator;
+  REQUIRE(emulator.load_state_text(text.data(), text.size()) == accepted);
+  if (!accepted)
+    return;
+
+  CHECK(emulator.cycles() == expected.cycles);
+  CHECK(emulator.read_acc() == expected.acc);
+  CHECK(emulator.read_pc() == expected.pc);
+  for (int i = 0; i < MEMORY_SIZE; ++i)
+    CHECK(emulator.read_mem(i) == expected.memory[i]);
+
+  REQUIRE(emulator.num_breakpoints() == expected.breakpoints.num_breakpoints());
+  for (int i = 0; i < MEMORY_SIZE; ++i) {
+    const Breakpoint* breakpoint = expected.breakpoints.find_breakpoint(i);
+    if (breakpoint == NULL) {
+      CHECK(emulator.find_breakpoint(i) == NULL);
+    } else {
+      REQUIRE(emulator.find_breakpoint(i) != NULL);
+      CHECK(emulator.find_breakpoint(i)->get_name() == breakpoint->get_name());
+    }
+  }
+}
+
+TEST_CASE("ProcessorState dirty lines", "[processor]") {
+  ProcessorState state;
+  for (int line = 0; line < ProcessorState::DIRTY_LINES; ++line)
+    CHECK(not state.is_dirty(line));
+
+  state.store(0x35, 1);
+  Istr(0x80).execute(state);
+  for (int line = 0; line < ProcessorState::DIRTY_LINES; ++line)
+    CHECK(state.is_dirty(line) == (line == 3 || line == 8));
+
+  state.clear_dirty();
+  CHECK(not state.is_dirty(3));
+  state.rehash();
+  for (int line = 0; line < ProcessorState::DIRTY_LINES; ++line)
+    CHECK(state.is_dirty(line));
+}
+
+TEST_CASE("Checkpoint logs", "[emulator][checkpoint][exec]") {
+  const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt", "data/state_selfmod.txt", "data/state_breakpoints.txt"};
+  const std::string filename = "output/checkpoints.log";
+
+  SECTION("Replays to the last checkpoint") {
+    for (const char* file : files) {
+      Emulator emulator;
+      REQUIRE(emulator.load_state(file));
+      CheckpointLog log;
+      REQUIRE(log.open(filename));
+      CHECK(log.is_open());
+      CHECK(log.records() == 0);
+
+      for (int checkpoint = 0; checkpoint < 20; ++checkpoint) {
+        REQUIRE(emulator.save_checkpoint(log));
+        CHECK(log.records() == checkpoint + 1);
+        CHECK(log.size() == read_file(filename).size());
+
+        Emulator replayed;
+        REQUIRE(replayed.insert_breakpoint(100, "STALE"));
+        REQUIRE(replayed.load_checkpoint_log(filename));
+        check_same_state(replayed, emulator);
+
+        // The same as saving the state and loading it again
+        REQUIRE(replayed.save_state("output/checkpoint.txt"));
+        REQUIRE(emulator.save_state("output/state.txt"));
+        CHECK(read_file("output/checkpoint.txt") == read_file("output/state.txt"));
+
+        emulator.run_fast(1 + checkpoint * 7);
+      }
+    }
+  }
+
+  SECTION("Deltas scale with the change") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state1.txt"));
+    CheckpointLog log;
+    REQUIRE(log.open(filename));
+    REQUIRE(emulator.save_checkpoint(log));
+    const size_t base = sizeof(CheckpointLogHeader) + sizeof(CheckpointRecordHeader) + MEMORY_SIZE + BINARY_STATE_BREAKPOINT_SIZE + 3;
+    CHECK(log.size() == base);
+
+    // Nothing written: only the registers
+    REQUIRE(emulator.save_checkpoint(log));
+    CHECK(log.size() == base + sizeof(CheckpointRecordHeader));
+
+    // state1 stores its product in [34] and [35], one line
+    REQUIRE(emulator.run(1000));
+    REQUIRE(emulator.read_pc() == 32);
+    REQUIRE(emulator.save_checkpoint(log));
+    CHECK(log.size() == base + 2 * sizeof(CheckpointRecordHeader) + DIRTY_LINE_SIZE);
+
+    // Breakpoints are only written when they change
+    REQUIRE(emulator.insert_breakpoint(8, "EIGHT"));
+    REQUIRE(emulator.save_checkpoint(log));
+    CHECK(log.size() == base + 3 * sizeof(CheckpointRecordHeader) + DIRTY_LINE_SIZE + 2 * BINARY_STATE_BREAKPOINT_SIZE + 8);
+    REQUIRE(emulator.save_checkpoint(log));
+    CHECK(log.size() == base + 4 * sizeof(CheckpointRecordHeader) + DIRTY_LINE_SIZE + 2 * BINARY_STATE_BREAKPOINT_SIZE + 8);
+
+    REQUIRE(emulator.delete_breakpoint("END"));
+    REQUIRE(emulator.save_checkpoint(log));
+    Emulator replayed;
+    REQUIRE(replayed.load_checkpoint_log(filename));
+    check_same_state(replayed, emulator);
+  }
+
+  SECTION("Every way of writing memory is tracked") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state_selfmod.txt"));
+    CheckpointLog log;
+    REQUIRE(log.open(filename));
+    REQUIRE(emulator.save_checkpoint(log));
+    const EmulatorSnapshot start = emulator.snapshot();
+
+    RunMemo memo;
+    Emulator other{emulator};
+    REQUIRE(other.run_memoized(50, memo));
+    for (int round = 0; round < 3; ++round) {
+      REQUIRE(emulator.run_memoized(50, memo));
+      REQUIRE(emulator.save_checkpoint(log));
+      Emulator replayed;
+      REQUIRE(replayed.load_checkpoint_log(filename));
+      check_same_state(replayed, emulator);
+
+      REQUIRE(emulator.restore(start));
+      REQUIRE(emulator.save_checkpoint(log));
+      REQUIRE(replayed.load_checkpoint_log(filename));
+      check_same_state(replayed, emulator);
+    }
+
+    REQUIRE(emulator.run_compiled(50, aot_state_selfmod));
+    REQUIRE(emulator.run_blocks(50));
+    REQUIRE(emulator.save_checkpoint(log));
+    Emulator replayed;
+    REQUIRE(replayed.load_checkpoint_log(filename));
+    check_same_state(replayed, emulator);
+  }
+
+  SECTION("Compaction") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    CheckpointLog log;
+    REQUIRE(log.open(filename));
+    CHECK_FALSE(log.compact());
+
+    for (int checkpoint = 0; checkpoint < 10; ++checkpoint) {
+      emulator.run_fast(13);
+      REQUIRE(emulator.save_checkpoint(log));
+    }
+    const size_t base = sizeof(CheckpointLogHeader) + sizeof(CheckpointRecordHeader) + MEMORY_SIZE;
+    CHECK(log.size() > base);
+
+    REQUIRE(log.compact());
+    CHECK(log.records() == 1);
+    CHECK(log.size() == base);
+    CHECK(read_file(filename).size() == base);
+    CHECK(not std::ifstream(filename + ".compact"));
+
+    // Later deltas carry on from the compacted base
+    Emulator replayed;
+    REQUIRE(replayed.load_checkpoint_log(filename));
+    check_same_state(replayed, emulator);
+    emulator.run_fast(13);
+    REQUIRE(emulator.save_checkpoint(log));
+    CHECK(log.records() == 2);
+    REQUIRE(replayed.load_checkpoint_log(filename));
+    check_same_state(replayed, emulator);
+
+    // And automatically, whenever the log grows past a size
+    REQUIRE(log.open(filename, 2 * base));
+    for (int checkpoint = 0; checkpoint < 50; ++checkpoint) {
+      emulator.run_fast(13);
+      REQUIRE(emulator.save_checkpoint(log));
+      CHECK(log.size() <= 2 * base);
+    }
+    CHECK(log.records() < 50);
+    REQUIRE(replayed.load_checkpoint_log(filename));
+    check_same_state(replayed, emulator);
+  }
+
+  SECTION("Torn and invalid logs") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    CheckpointLog log;
+    REQUIRE(log.open(filename));
+    REQUIRE(emulator.save_checkpoint(log));
+    emulator.run_fast(100);
+    const Emulator before{emulator};
+    REQUIRE(emulator.save_checkpoint(log));
+    emulator.run_fast(100);
+    REQUIRE(emulator.save_checkpoint(log));
+    log.close();
+    CHECK(not log.is_open());
+    CHECK_FALSE(emulator.save_checkpoint(log));
+
+    // A record cut short is the one that was being written
+    const std::string contents = read_file(filename);
+    const size_t last = contents.size() - sizeof(CheckpointRecordHeader) - DIRTY_LINE_SIZE;
+    for (size_t cut : {last + 1, last + sizeof(CheckpointRecordHeader), contents.size() - 1}) {
+      std::ofstream(filename, std::ios::binary).write(contents.data(), cut);
+      Emulator replayed;
+      REQUIRE(replayed.load_checkpoint_log(filename));
+      check_same_state(replayed, before);
+    }
+    std::ofstream(filename, std::ios::binary).write(contents.data(), last);
+    Emulator replayed;
+    REQUIRE(replayed.load_checkpoint_log(filename));
+    check_same_state(replayed, before);
+
+    // No base, not a log, or a broken record
+    std::ofstream(filename, std::ios::binary).write(contents.data(), sizeof(CheckpointLogHeader));
+    CHECK_FALSE(replayed.load_checkpoint_log(filename));
+    CHECK_FALSE(replayed.load_checkpoint_log("data/state2.txt"));
+    CHECK_FALSE(replayed.load_checkpoint_log("output/missing.log"));
+
+    std::string broken = contents;
+    broken.at(sizeof(CheckpointLogHeader)) = CHECKPOINT_DELTA;
+    std::ofstream(filename, std::ios::binary).write(broken.data(), broken.size());
+    CHECK_FALSE(replayed.load_checkpoint_log(filename));
+  }
+}
+
+namespace {
+
+// Builds a batch for EmulatorServer::handle()
+struct BatchBuilder {
+  std::string commands;
+  uint32_t count = 0;
+
+  BatchBuilder& add(ServerOp op, uint32_t session, const std::string& payload = "") {
+    ServerCommandHeader header{};
+    header.op = op;
+    header.session = session;
+    header.length = payload.size();
+    commands.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    commands.append(payload);
+    ++count;
+    return *this;
+  }
+
+  std::string batch() const {
+    const ServerBatchHeader header{static_cast<uint32_t>(commands.size()), count};
+    return std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + commands;
+  }
+};
+
+template <class T>
+std::string bytes_of(const T& value) {
+  return std::string(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+struct ServerReply {
+  ServerResponseHeader header;
+  std::string payload;
+};
+
+// Handles a batch and splits the response into its replies
+std::vector<ServerReply> handle_batch(EmulatorServer& server, const std::string& batch, ServerResponse& response) {
+  std::vector<ServerReply> replies;
+  REQUIRE(server.handle(reinterpret_cast<const byte_t*>(batch.data()), batch.size(), response));
+  const std::string flat = response.flatten();
+  REQUIRE(flat.size() == response.size());
+
+  ServerBatchHeader header;
+  REQUIRE(flat.size() >= sizeof(header));
+  memcpy(&header, flat.data(), sizeof(header));
+  REQUIRE(header.size == flat.size() - sizeof(header));
+
+  size_t offset = sizeof(header);
+  for (uint32_t idx = 0; idx < header.count; ++idx) {
+    ServerReply reply;
+    REQUIRE(flat.size() - offset >= sizeof(reply.header));
+    memcpy(&reply.header, flat.data() + offset, sizeof(reply.header));
+    offset += sizeof(reply.header);
+    REQUIRE(flat.size() - offset >= reply.header.length);
+    reply.payload = flat.substr(offset, reply.header.length);
+    offset += reply.header.length;
+    replies.push_back(reply);
+  }
+  CHECK(offset == flat.size());
+  return replies;
+}
+
+}
+
+TEST_CASE("EmulatorServer", "[emulator][server][exec]") {
+  EmulatorServer server;
+  ServerResponse response;
+  const std::string state1 = read_file("data/state1.txt");
+  const std::string state2 = read_file("data/state2.txt");
+
+  SECTION("Sessions run like emulators") {
+    const std::vector<ServerReply> replies = handle_batch(server, BatchBuilder()
+      .add(SERVER_LOAD_TEXT, 1, state1)
+      .add(SERVER_LOAD_TEXT, 2, state2)
+      .add(SERVER_RUN, 1, bytes_of<int32_t>(1000))
+      .add(SERVER_RUN, 2, bytes_of<int32_t>(50))
+      .add(SERVER_READ_STATE, 1)
+      .add(SERVER_READ_STATE, 2)
+      .batch(), response);
+    REQUIRE(replies.size() == 6);
+    CHECK(server.sessions() == 2);
+
+    for (int session : {1, 2}) {
+      Emulator emulator;
+      REQUIRE(emulator.load_state(session == 1 ? "data/state1.txt" : "data/state2.txt"));
+      const int status = emulator.run(session == 1 ? 1000 : 50);
+
+      const ServerReply& run = replies.at(session + 1);
+      CHECK(run.header.op == SERVER_RUN);
+      CHECK(run.header.ok == 1);
+      CHECK(run.header.session == session);
+      int32_t result[2];
+      REQUIRE(run.payload.size() == sizeof(result));
+      memcpy(result, run.payload.data(), sizeof(result));
+      CHECK(result[0] == status);
+      CHECK(result[1] == emulator.cycles());
+
+      const ServerReply& state = replies.at(session + 3);
+      ServerStateView view;
+      REQUIRE(state.payload.size() == sizeof(view) + MEMORY_SIZE);
+      memcpy(&view, state.payload.data(), sizeof(view));
+      CHECK(view.cycles == emulator.cycles());
+      CHECK(view.acc == emulator.read_acc());
+      CHECK(view.pc == emulator.read_pc());
+      CHECK(view.num_breakpoints == emulator.num_breakpoints());
+      for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+        CHECK(static_cast<byte_t>(state.payload.at(sizeof(view) + address)) == emulator.read_mem(address));
+
+      check_same_state(*server.session(session), emulator);
+    }
+
+    // Memory was sent from the sessions, not copied
+    CHECK(response.viewed() == 2 * MEMORY_SIZE);
+    CHECK(response.pieces().size() < 10);
+  }
+
+  SECTION("Each reply shows the memory when its command ran") {
+    const std::string read = std::string(1, static_cast<char>(34)) + bytes_of<uint16_t>(2);
+    const std::vector<ServerReply> replies = handle_batch(server, BatchBuilder()
+      .add(SERVER_LOAD_TEXT, 1, state1)
+      .add(SERVER_READ_MEM, 1, read)
+      .add(SERVER_RUN, 1, bytes_of<int32_t>(1000))
+      .add(SERVER_READ_MEM, 1, read)
+      .batch(), response);
+    Emulator initial;
+    REQUIRE(initial.load_state("data/state1.txt"));
+    CHECK(replies.at(1).payload == std::string({static_cast<char>(initial.read_mem(34)), static_cast<char>(initial.read_mem(35))}));
+    CHECK(replies.at(3).payload == std::string({static_cast<char>(server.session(1)->read_mem(34)), static_cast<char>(server.session(1)->read_mem(35))}));
+    CHECK(replies.at(3).payload != replies.at(1).payload);
+
+    // Only the last read is still a view
+    CHECK(response.viewed() == 2);
+
+    // Reads past the end of memory fail
+    const std::vector<ServerReply> past = handle_batch(server, BatchBuilder()
+      .add(SERVER_READ_MEM, 1, std::string(1, static_cast<char>(250)) + bytes_of<uint16_t>(6))
+      .add(SERVER_READ_MEM, 1, std::string(1, static_cast<char>(250)) + bytes_of<uint16_t>(7))
+      .batch(), response);
+    CHECK(past.at(0).header.ok == 1);
+    CHECK(past.at(0).payload.size() == 6);
+    CHECK(past.at(1).header.ok == 0);
+    CHECK(past.at(1).payload.empty());
+  }
+
+  SECTION("Breakpoints, snapshots and binary states") {
+    Emulator emulator;
+    REQUIRE(emulator.load_state("data/state2.txt"));
+    REQUIRE(emulator.save_binary_state("output/server.bin"));
+
+    const std::vector<ServerReply> replies = handle_batch(server, BatchBuilder()
+      .add(SERVER_LOAD_BINARY, 7, read_file("output/server.bin"))
+      .add(SERVER_INSERT_BREAKPOINT, 7, std::string(1, static_cast<char>(20)) + "LOOP")
+      .add(SERVER_INSERT_BREAKPOINT, 7, std::string(1, static_cast<char>(22)) + "LOOP")
+      .add(SERVER_SNAPSHOT, 7)
+      .add(SERVER_RUN, 7, bytes_of<int32_t>(10000))
+      .add(SERVER_RESTORE, 7, bytes_of<uint32_t>(0))
+      .add(SERVER_RESTORE, 7, bytes_of<uint32_t>(1))
+      .add(SERVER_DELETE_BREAKPOINT, 7, std::string(1, static_cast<char>(20)))
+      .add(SERVER_DELETE_BREAKPOINT, 7, std::string(1, static_cast<char>(20)))
+      .batch(), response);
+    const int expected[] = {1, 1, 0, 1, 1, 1, 0, 1, 0};
+    const ServerOp ops[] = {SERVER_LOAD_BINARY, SERVER_INSERT_BREAKPOINT, SERVER_INSERT_BREAKPOINT, SERVER_SNAPSHOT, SERVER_RUN,
+                            SERVER_RESTORE, SERVER_RESTORE, SERVER_DELETE_BREAKPOINT, SERVER_DELETE_BREAKPOINT};
+    REQUIRE(replies.size() == 9);
+    for (size_t idx = 0; idx < replies.size(); ++idx) {
+      CHECK(replies.at(idx).header.ok == expected[idx]);
+      CHECK(replies.at(idx).header.op == ops[idx]);
+    }
+    CHECK(replies.at(3).payload == bytes_of<uint32_t>(0));
+
+    // Names a text state file couldn't hold are refused, like in binary states
+    for (const char* name : {"TWO WORDS", "LINE\n"}) {
+      const std::vector<ServerReply> refused = handle_batch(server, BatchBuilder()
+        .add(SERVER_INSERT_BREAKPOINT, 7, std::string(1, static_cast<char>(24)) + name)
+        .batch(), response);
+      REQUIRE(refused.size() == 1);
+      CHECK(refused.at(0).header.ok == 0);
+    }
+    CHECK(server.session(7)->find_breakpoint(24) == NULL);
+
+    REQUIRE(emulator.insert_breakpoint(20, "LOOP"));
+    const EmulatorSnapshot start = emulator.snapshot();
+    int32_t result[2];
+    memcpy(result, replies.at(4).payload.data(), sizeof(result));
+    CHECK(result[0] == emulator.run(10000));
+    CHECK(result[1] == emulator.cycles());
+
+    // Restored to the snapshot, then without the breakpoint
+    emulator.restore(start);
+    REQUIRE(emulator.delete_breakpoint(20));
+    check_same_state(*server.session(7), emulator);
+  }
+
+  SECTION("Failures") {
+    const std::vector<ServerReply> replies = handle_batch(server, BatchBuilder()
+      .add(SERVER_RUN, 3, bytes_of<int32_t>(10))
+      .add(SERVER_LOAD_TEXT, 3, "not a state")
+      .add(SERVER_RUN, 3, bytes_of<int32_t>(-1))
+      .add(SERVER_RUN, 3, bytes_of<int16_t>(10))
+      .add(SERVER_LOAD_TEXT, 3, state1)
+      .add(static_cast<ServerOp>(99), 3)
+      .add(SERVER_READ_STATE, 3, "x")
+      .add(SERVER_RUN, 3, bytes_of<int32_t>(10))
+      .add(SERVER_CLOSE, 3)
+      .add(SERVER_CLOSE, 3)
+      .batch(), response);
+    const int expected[] = {0, 0, 0, 0, 1, 0, 0, 1, 1, 0};
+    REQUIRE(replies.size() == 10);
+    for (size_t idx = 0; idx < replies.size(); ++idx)
+      CHECK(replies.at(idx).header.ok == expected[idx]);
+    CHECK(replies.at(5).header.op == 99);
+    CHECK(server.sessions() == 0);
+    CHECK(server.session(3) == NULL);
+
+    // Malformed batches run nothing
+    const std::string batch = BatchBuilder().add(SERVER_LOAD_TEXT, 1, state1).add(SERVER_RUN, 1, bytes_of<int32_t>(10)).batch();
+    for (size_t size : {size_t(0), size_t(4), batch.size() - 1}) {
+      CHECK_FALSE(server.handle(reinterpret_cast<const byte_t*>(batch.data()), size, response));
+    }
+    std::string longer = batch + "x";
+    CHECK_FALSE(server.handle(reinterpret_cast<const byte_t*>(longer.data()), longer.size(), response));
+    std::string miscounted = batch;
+    miscounted.at(4) = 3;
+    CHECK_FALSE(server.handle(reinterpret_cast<const byte_t*>(miscounted.data()), miscounted.size(), response));
+    CHECK(server.sessions() == 0);
+    CHECK(response.size() == 0);
+
+    // An empty batch has an empty reply
+    CHECK(handle_batch(server, BatchBuilder().batch(), response).empty());
+  }
+}
+
+TEST_CASE("Load State: parsing", "[emulator][exec]") {
+  const char* files[] = {"data/state1.txt", "data/state2.txt", "data/state3.txt", "data/state4.txt",
+                         "data/state_breakpoints.txt", "data/state_selfmod.txt",
+                         "data/invalid1.txt", "data/invalid2.txt", "data/invalid3.txt", "data/invalid4.txt",
+                         "data/invalid5a.txt", "data/invalid5b.txt", "data/invalid5c.txt", "data/invalid6.txt",
+                         "data/invalid7.txt", "data/invalid8.txt", "data/invalid9.txt"};
+
+  SECTION("Same results as the stream parser") {
+    for (const char* file : files) {
+      REQUIRE(fopen(file, "r") != NULL);
+      check_same_as_reference(read_file(file));
+    }
+  }
+
+  SECTION("Odd spacing, signs and garbage") {
+    const std::string memory = [] {
+      std::string lines;
+      for (int i = 0; i < MEMORY_SIZE; ++i)
+        lines += std::to_string(i) + "\n";
+      return lines;
+    }();
+
+    const std::string headers[] = {"5\n0\n0\n", " 5\n\t0 \n+0\n", "5x\n0 junk\n0\n", "+5\n-0\n0\n", "\n0\n0\n",
+                                   "5\n\n0\n", "5\n0\n+\n", "5\n0\n+-1\n", "99999999999\n0\n0\n", "5\r\n0\r\n0\r\n",
+                                   "-2147483648\n0\n0\n", "2147483647\n0\n0\n", "5\n0\n0x10\n"};
+    const std::string breakpoints[] = {"", "32 END\n", "32 END", "32END\n", "  32\n\n END  \n", "32 END 34\n",
+                                       "32 END 34", "32 END -\n", "32 END -", "32 END x\n", "+32 A -0 B\n",
+                                       "32 END\n99999999999\n", "32 END 99999999999", "32 A 32 B\n", "32 A 34 A\n",
+                                       "32 END\r\n34 MID\r\n", "256 X\n"};
+
+    for (const std::string& header : headers)
+      for (const std::string& breakpoint : breakpoints)
+        check_same_as_reference(header + memory + breakpoint);
+
+    // Memory lines take nothing after the number except whitespace
+    const std::string values[] = {"7", " 7", "7 ", "7\r", "+7", "-0", "7x", "", " ", "256", "-1", "0x7", "07"};
+    for (const std::string& value : values) {
+      std::string text = "5\n0\n0\n" + memory;
+      text.replace(text.find("\n100\n") + 1, 3, value);
+      check_same_as_reference(text);
+    }
+  }
+
+  SECTION("Random edits") {
+    const std::string original = read_file("data/state_breakpoints.txt");
+    const char alphabet[] = " \t\r\n+-0123456789axEND";
+
+    for (int round = 0; round < 2000; ++round) {
+      std::string text = original;
+      for (int edit = rand() % 4; edit >= 0; --edit) {
+        const size_t at = rand() % (text.size() + 1);
+        switch (rand() % 4) {
+          case 0: text.insert(at, 1, alphabet[rand() % (sizeof(alphabet) - 1)]); break;
+          case 1: if (at < text.size()) text.erase(at, 1); break;
+          case 2: if (at < text.size()) text[at] = alphabet[rand() % (sizeof(alphabet) - 1)]; break;
+          case 3: text.resize(at); break;
+        }
+      }
+      check_same_as_reference(text);
+    }
+  }
+
+  SECTION("load_state() is read + load_state_text()") {
+    for (const char* file : files) {
+      Emulator from_file;
+      Emulator from_text;
+      const std::string text = read_file(file);
+      REQUIRE(from_file.load_state(file) == from_text.load_state_text(text.data(), text.size()));
+    }
+
+    // Directories and missing files can't be read, and reset the emulator like any failed load
+    Emulator emulator;
+    CHECK(not emulator.load_state("data"));
+    REQUIRE(emulator.load_state("data/state_breakpoints.txt"));
+    REQUIRE(emulator.num_breakpoints() > 0);
+    CHECK(not emulator.load_state("data/invalid0000000000000000000000.txt"));
+    CHECK(emulator.num_breakpoints() == 0);
+  }
+}
+
+TEST_CASE("Corpus loader", "[emulator][corpus]") {
+  REQUIRE(fopen("data/state1.txt", "r") != NULL);
+
+  SECTION("A directory") {
+    std::vector<std::string> files;
+    REQUIRE(list_corpus("data", files));
+    REQUIRE(files.size() == 17);
+    CHECK(std::is_sorted(files.begin(), files.end()));
+    CHECK(std::find(files.begin(), files.end(), "data/README.md") == files.end());
+
+    for (int threads : {1, 3, 0}) {
+      std::vector<Emulator> emulators;
+      const std::vector<int> results = CorpusLoader(threads).load(files, emulators);
+      REQUIRE(results.size() == files.size());
+      REQUIRE(emulators.size() == files.size());
+
+      // The same as loading every file on its own
+      for (size_t idx = 0; idx < files.size(); ++idx) {
+        Emulator expected;
+        const int loaded = expected.load_state(files.at(idx));
+        CHECK(results.at(idx) == loaded);
+        CHECK((files.at(idx).find("invalid") == std::string::npos) == loaded);
+        if (loaded)
+          check_same_state(emulators.at(idx), expected);
+        else
+          check_same_state(emulators.at(idx), Emulator());
+      }
+    }
+  }
+
+  SECTION("A manifest") {
+    Emulator binary;
+    REQUIRE(binary.load_state("data/state_breakpoints.txt"));
+    binary.run(10);
+    REQUIRE(binary.save_binary_state("output/corpus.bin"));
+
+    std::ofstream manifest("output/corpus.manifest");
+    manifest << "# a comment\n../data/state1.txt\n\n../data/invalid8.txt\r\nmissing.txt\ncorpus.bin\n";
+    manifest.close();
+
+    std::vector<std::string> files;
+    std::vector<Emulator> emulators(2);
+    const std::vector<int> results = CorpusLoader(2).load("output/corpus.manifest", files, emulators);
+    REQUIRE(files.size() == 4);
+    CHECK(files.at(0) == "output/../data/state1.txt");
+    REQUIRE(results == std::vector<int>{1, 0, 0, 1});
+
+    Emulator expected;
+    REQUIRE(expected.load_state("data/state1.txt"));
+    check_same_state(emulators.at(0), expected);
+    check_same_state(emulators.at(3), binary);
+  }
+
+  SECTION("Many files") {
+    // More files than threads and batches, with every tenth one broken
+    std::vector<std::string> files;
+    for (int idx = 0; idx < 500; ++idx)
+      files.push_back(idx % 10 == 9 ? "data/invalid4.txt" : "data/state2.txt");
+
+    std::vector<Emulator> emulators;
+    const std::vector<int> results = CorpusLoader(4).load(files, emulators);
+    for (int idx = 0; idx < 500; ++idx) {
+      CHECK(results.at(idx) == (idx % 10 != 9));
+      CHECK(emulators.at(idx).cycles() == ((idx % 10 != 9) ? 5 : 0));
+    }
+  }
+
+  SECTION("Missing corpus") {
+    std::vector<std::string> files;
+    std::vector<Emulator> emulators;
+    CHECK(not list_corpus("output/no_such_manifest", files));
+    CHECK(CorpusLoader().load("output/no_such_manifest", files, emulators).empty());
+  }
+}
@@ -0,0 +1,22 @@
+#include "instruction_values.h"
+
+// ============= Adapters ==============
+
+InstructionHandle to_instruction(const InstructionValue& value) {
+  const InstructionData data{static_cast<byte_t>(value_opcode(value)), static_cast<byte_t>(value_address(value))};
+  return InstructionBase::generateInstruction(data);
+}
+
+int to_value(const InstructionBase& instr, InstructionValue& value) {
+  // The classes don't know their opcode, but their names are unique
+  const std::string name = instr.name();
+  for (int opcode = ADD; opcode < NUM_OPCODES; ++opcode) {
+    InstructionValue candidate;
+    decode_value<Arch8>({static_cast<byte_t>(opcode), static_cast<byte_t>(instr.get_address())}, candidate);
+    if (value_name(candidate) == name) {
+      value = candidate;
+      return 1;
+    }
+  }
+  return 0;
+}
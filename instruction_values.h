@@ -0,0 +1,169 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: instruction_values.h
+//
+// Instructions as plain values, next to the InstructionBase hierarchy.
+//
+// StaticInstruction<Opcode> holds nothing but its operand, and everything
+// opcode-specific is resolved at compile time. InstructionValue is a variant
+// of the eight of them: two bytes for the 8-bit machine (operand and
+// variant index), passed by value, never allocated, and executed with
+// std::visit, which the compiler turns into a jump table with every
+// instruction inlined.
+//
+// The alternatives are in opcode order, so the index of the variant is the
+// opcode. to_instruction() and to_value() convert from and to the virtual
+// hierarchy.
+//
+// Decoding and executing values is constexpr, like ProcessorState, which is
+// what lets ConstexprEmulator (see constexpr_emulator.h) run programs at
+// compile time.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "instructions.h"
+#include <memory>
+#include <string_view>
+#include <variant>
+
+/**
+ * An instruction with its opcode fixed at compile time
+ *
+ * execute() does what InstructionBase::execute() does for the same
+ * instruction: the instruction-specific work, moving the PC forward and
+ * trimming the accumulator and the PC to the architecture.
+ */
+template <InstructionOpcode Opcode, class Arch = Arch8>
+struct StaticInstruction {
+  static_assert(Opcode >= ADD && Opcode < NUM_OPCODES, "not an instruction");
+
+  static constexpr InstructionOpcode opcode = Opcode;
+
+  /**
+   * The operand, already limited to the memory size
+   */
+  typename Arch::cell_t address;
+
+  constexpr void execute(BasicProcessorState<Arch>& state) const {
+    if constexpr (Opcode == ADD)
+      state.acc += state.cell(address);
+    else if constexpr (Opcode == AND)
+      state.acc &= state.cell(address);
+    else if constexpr (Opcode == ORR)
+      state.acc |= state.cell(address);
+    else if constexpr (Opcode == XOR)
+      state.acc ^= state.cell(address);
+    else if constexpr (Opcode == LDR)
+      state.acc = state.cell(address);
+    else if constexpr (Opcode == STR)
+      state.store(address, state.acc);
+
+    // No need for the "minus two" of Ijmp and Ijne here
+    if constexpr (Opcode == JMP)
+      state.pc = address;
+    else if constexpr (Opcode == JNE)
+      state.pc = (state.acc != 0) ? address : state.pc + Arch::INSTRUCTION_SIZE;
+    else
+      state.pc += Arch::INSTRUCTION_SIZE;
+
+    state.acc &= Arch::WORD_MASK;
+    state.pc &= Arch::ADDRESS_MASK;
+  }
+
+  constexpr addr_t get_address() const {
+    return address;
+  }
+
+  /**
+   * The instruction mnemonic, the same as InstructionBase::name()
+   */
+  static constexpr std::string_view name() {
+    constexpr std::string_view names[NUM_OPCODES] = {"ADD", "AND", "ORR", "XOR", "LDR", "STR", "JMP", "JNE"};
+    return names[Opcode];
+  }
+};
+
+/**
+ * Any instruction, as a value. The variant index is the opcode
+ */
+template <class Arch>
+using BasicInstructionValue = std::variant<
+  StaticInstruction<ADD, Arch>, StaticInstruction<AND, Arch>, StaticInstruction<ORR, Arch>,
+  StaticInstruction<XOR, Arch>, StaticInstruction<LDR, Arch>, StaticInstruction<STR, Arch>,
+  StaticInstruction<JMP, Arch>, StaticInstruction<JNE, Arch>>;
+
+typedef StaticInstruction<ADD> Sadd;
+typedef StaticInstruction<AND> Sand;
+typedef StaticInstruction<ORR> Sorr;
+typedef StaticInstruction<XOR> Sxor;
+typedef StaticInstruction<LDR> Sldr;
+typedef StaticInstruction<STR> Sstr;
+typedef StaticInstruction<JMP> Sjmp;
+typedef StaticInstruction<JNE> Sjne;
+
+typedef BasicInstructionValue<Arch8> InstructionValue;
+
+static_assert(std::variant_size_v<InstructionValue> == NUM_OPCODES);
+static_assert(sizeof(InstructionValue) == 2, "instruction values should be as small as the instruction bytes");
+
+/**
+ * The value counterpart of InstructionBase::generateInstruction()
+ *
+ * @param data The instruction bytes
+ * @param value Where to put the instruction
+ * @return 1 for success, 0 if the opcode is invalid (value is left as it was)
+ */
+template <class Arch>
+constexpr int decode_value(BasicInstructionData<Arch> data, BasicInstructionValue<Arch>& value) {
+  const typename Arch::cell_t address = data.address & Arch::ADDRESS_MASK;
+
+  switch (data.opcode) {
+    case ADD: value = StaticInstruction<ADD, Arch>{address}; return 1;
+    case AND: value = StaticInstruction<AND, Arch>{address}; return 1;
+    case ORR: value = StaticInstruction<ORR, Arch>{address}; return 1;
+    case XOR: value = StaticInstruction<XOR, Arch>{address}; return 1;
+    case LDR: value = StaticInstruction<LDR, Arch>{address}; return 1;
+    case STR: value = StaticInstruction<STR, Arch>{address}; return 1;
+    case JMP: value = StaticInstruction<JMP, Arch>{address}; return 1;
+    case JNE: value = StaticInstruction<JNE, Arch>{address}; return 1;
+    default: return 0;
+  }
+}
+
+/**
+ * Execute an instruction value, the same as InstructionBase::execute()
+ */
+template <class Arch>
+constexpr void execute_value(const BasicInstructionValue<Arch>& value, BasicProcessorState<Arch>& state) {
+  std::visit([&state](const auto& instr) { instr.execute(state); }, value);
+}
+
+/**
+ * Getters for the opcode, operand and mnemonic of an instruction value
+ */
+template <class Arch>
+constexpr InstructionOpcode value_opcode(const BasicInstructionValue<Arch>& value) {
+  return static_cast<InstructionOpcode>(value.index());
+}
+
+template <class Arch>
+constexpr addr_t value_address(const BasicInstructionValue<Arch>& value) {
+  return std::visit([](const auto& instr) { return instr.get_address(); }, value);
+}
+
+template <class Arch>
+constexpr std::string_view value_name(const BasicInstructionValue<Arch>& value) {
+  return std::visit([](const auto& instr) { return instr.name(); }, value);
+}
+
+/**
+ * Adapters between instruction values and the InstructionBase hierarchy
+ *
+ * to_instruction() gives the InstructionBase object generateInstruction()
+ * gives for the same bytes. to_value() goes the other way.
+ *
+ * @return the instruction / 1 for success, 0 if instr is not one of the eight instruction classes
+ */
+InstructionHandle to_instruction(const InstructionValue& value);
+int to_value(const InstructionBase& instr, InstructionValue& value);
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -10,219 +12,288 @@
 #include <memory>
 #include "instructions.h"
 
+// ========== Formatting ==========
+
+char* format_instruction(char* out, InstructionOpcode opcode, addr_t address) {
+  const InstructionFormat& format = INSTRUCTION_FORMATS[opcode];
+  out = std::copy(format.prefix.begin(), format.prefix.end(), out);
+  out = std::to_chars(out, out + 16, address).ptr;
+  return std::copy(format.suffix.begin(), format.suffix.end(), out);
+}
+
 // ========== InstructionBase ==========
 
 
-void InstructionBase::execute(ProcessorState& state) const {
+template <class Arch>
+void BasicInstructionBase<Arch>::execute(State& state) const {
   // virtual call that implements the actual functionality of the instruction
   _execute(state);
 
   // move the pc forward
-  state.pc += INSTRUCTION_SIZE;
+  state.pc += Arch::INSTRUCTION_SIZE;
 
   // trim the accumulator and the PC to fit in number of bits of the architecture
-  state.acc &= ARCH_BITMASK;
-  state.pc &= ARCH_BITMASK;
+  state.acc &= Arch::WORD_MASK;
+  state.pc &= Arch::ADDRESS_MASK;
 }
 
-addr_t InstructionBase::get_address() const {
+template <class Arch>
+addr_t BasicInstructionBase<Arch>::get_address() const {
   return _address;
 }
 
-void InstructionBase::_set_address(addr_t address) {
-  _address = address & ARCH_BITMASK;
+template <class Arch>
+void BasicInstructionBase<Arch>::_set_address(addr_t address) {
+  _address = address & Arch::ADDRESS_MASK;
 }
 
-std::string InstructionBase::to_string() const {
-  // Having a malloc is definitely a bad sign
-  std::stringstream result;
-
-
+template <class Arch>
+std::string BasicInstructionBase<Arch>::to_string() const {
   // Figure out what the instruction actually is based on the return value of name()
-  // and then generate an appropriate instruction-specific string
-  if (name() == "ADD") {
-    result << name() << ": ACC <- " << "ACC " << "+ [" << get_address() << "]";
-  }
-  else if (name() == "AND") {
-    result << name() << ": ACC <- " << "ACC " << "& [" << get_address() << "]";
-  }
-  else if (name() == "ORR") {
-    result << name() << ": ACC <- " << "ACC " << "| [" << get_address() << "]";
-  }
-  else if (name() == "XOR") {
-    result << name() << ": ACC <- " << "ACC " << "^ [" << get_address() << "]";
-  }
-  else if (name() == "LDR") {
-    result << name() << ": ACC <- [" << get_address() << "]";
-  }
-  else if (name() == "STR") {
-    result << name() << ": ACC -> [" << get_address() << "]";
-  }
-  else if (name() == "JMP") {
-    result << name() << ": PC  <- " << get_address() << "";
-  }
-  else if (name() == "JNE") {
-    result << name() << ": PC  <- " << get_address() << " if ACC != 0";
+  // and then format it with the instruction-specific text from INSTRUCTION_FORMATS
+  const std::string mnemonic = name();
+  for (int opcode = ADD; opcode < NUM_OPCODES; ++opcode) {
+    if (INSTRUCTION_FORMATS[opcode].mnemonic == mnemonic) {
+      char buffer[INSTRUCTION_TEXT_MAX];
+      char* end = format_instruction(buffer, static_cast<InstructionOpcode>(opcode), get_address());
+      return std::string(buffer, end);
+    }
   }
-  else {
-    std::cout << "issue";
-    assert(0);
+
+  // This should never happen unless we have an error in name()
+  assert(0);
+  return "";
+}
+
+// Architectures with up to this many memory cells get a table of every instruction
+constexpr int SHARED_INSTRUCTIONS_MAX_MEMORY = 256;
+
+namespace {
+
+template <class Instruction, size_t... Addresses>
+std::array<Instruction, sizeof...(Addresses)> make_instructions(std::index_sequence<Addresses...>) {
+  // Each object is built in place, the instructions can't be copied
+  return {Instruction(Addresses)...};
+}
+
+/**
+ * One object for each opcode and address, built on the first decode
+ */
+template <class Arch>
+struct SharedInstructions {
+  typedef std::make_index_sequence<Arch::MEMORY_SIZE> Addresses;
+
+  std::array<BasicIadd<Arch>, Arch::MEMORY_SIZE> add = make_instructions<BasicIadd<Arch>>(Addresses{});
+  std::array<BasicIand<Arch>, Arch::MEMORY_SIZE> and_ = make_instructions<BasicIand<Arch>>(Addresses{});
+  std::array<BasicIorr<Arch>, Arch::MEMORY_SIZE> orr = make_instructions<BasicIorr<Arch>>(Addresses{});
+  std::array<BasicIxor<Arch>, Arch::MEMORY_SIZE> xor_ = make_instructions<BasicIxor<Arch>>(Addresses{});
+  std::array<BasicIldr<Arch>, Arch::MEMORY_SIZE> ldr = make_instructions<BasicIldr<Arch>>(Addresses{});
+  std::array<BasicIstr<Arch>, Arch::MEMORY_SIZE> str = make_instructions<BasicIstr<Arch>>(Addresses{});
+  std::array<BasicIjmp<Arch>, Arch::MEMORY_SIZE> jmp = make_instructions<BasicIjmp<Arch>>(Addresses{});
+  std::array<BasicIjne<Arch>, Arch::MEMORY_SIZE> jne = make_instructions<BasicIjne<Arch>>(Addresses{});
+
+  // The objects above, indexed by opcode * MEMORY_SIZE + address
+  std::array<BasicInstructionBase<Arch>*, NUM_OPCODES * Arch::MEMORY_SIZE> index;
+
+  SharedInstructions() {
+    for (int address = 0; address < Arch::MEMORY_SIZE; ++address) {
+      index.at(ADD * Arch::MEMORY_SIZE + address) = &add.at(address);
+      index.at(AND * Arch::MEMORY_SIZE + address) = &and_.at(address);
+      index.at(ORR * Arch::MEMORY_SIZE + address) = &orr.at(address);
+      index.at(XOR * Arch::MEMORY_SIZE + address) = &xor_.at(address);
+      index.at(LDR * Arch::MEMORY_SIZE + address) = &ldr.at(address);
+      index.at(STR * Arch::MEMORY_SIZE + address) = &str.at(address);
+      index.at(JMP * Arch::MEMORY_SIZE + address) = &jmp.at(address);
+      index.at(JNE * Arch::MEMORY_SIZE + address) = &jne.at(address);
+    }
   }
+};
+
+template <class Instruction, class Arch>
+typename BasicInstructionBase<Arch>::Handle allocate_instruction(addr_t address) {
+  return typename BasicInstructionBase<Arch>::Handle(new Instruction(address), InstructionDeleter{true});
+}
+
+}
 
-  // if (strncmp(name(), "ADD", 3) == 0)
-  //   sprintf(buffer, "%s: ACC <- ACC + [%d]", name(), get_address()); // cout << name(): "ACC <- " << "ACC + " << get_address();
-  // else if (strncmp(name(), "AND", 3) == 0)
-  //   sprintf(buffer, "%s: ACC <- ACC & [%d]", name(), get_address());
-  // else if (strncmp(name(), "ORR", 3) == 0)
-  //   sprintf(buffer, "%s: ACC <- ACC | [%d]", name(), get_address());
-  // else if (strncmp(name(), "XOR", 3) == 0)
-  //   sprintf(buffer, "%s: ACC <- ACC ^ [%d]", name(), get_address());
-  // else if (strncmp(name(), "LDR", 3) == 0)
-    // sprintf(buffer, "%s: ACC <- [%d]", name(), get_address());
-  // else if (strncmp(name(), "STR", 3) == 0)
-    // sprintf(buffer, "%s: ACC -> [%d]", name(), get_address());
-  // else if (strncmp(name(), "JMP", 3) == 0)
-    // sprintf(buffer, "%s: PC  <- %d", name(), get_address());
-  // else if (strncmp(name(), "JNE", 3) == 0)
-    // sprintf(buffer, "%s: PC  <- %d if ACC != 0", name(), get_address());
-  // else
-  //   // This should never happen unless we have an error in name() or one of the strncmp's above
-  //   // i.e. the tests will never try to trigger this code
-  //   assert(0);
-  return result.str();
-}
-
-std::unique_ptr<InstructionBase> InstructionBase::generateInstruction(InstructionData data) {
-    if (data.opcode == ADD)
-        return std::make_unique<Iadd>(data.address);
-    if (data.opcode == AND)
-        return std::make_unique<Iand>(data.address);
-    if (data.opcode == ORR)
-        return std::make_unique<Iorr>(data.address);
-    if (data.opcode == XOR)
-        return std::make_unique<Ixor>(data.address);
-    if (data.opcode == LDR)
-        return std::make_unique<Ildr>(data.address);
-    if (data.opcode == STR)
-        return std::make_unique<Istr>(data.address);
-    if (data.opcode == JMP)
-        return std::make_unique<Ijmp>(data.address);
-    if (data.opcode == JNE)
-        return std::make_unique<Ijne>(data.address);
-
-    return nullptr;  // Return nullptr if the opcode is not found
+template <class Arch>
+typename BasicInstructionBase<Arch>::Handle BasicInstructionBase<Arch>::generateInstruction(BasicInstructionData<Arch> data) {
+    if (data.opcode >= NUM_OPCODES)
+        return nullptr;  // Return nullptr if the opcode is not found
+
+    if constexpr (Arch::MEMORY_SIZE <= SHARED_INSTRUCTIONS_MAX_MEMORY) {
+        // Thread-safe, built by whoever decodes first
+        static SharedInstructions<Arch> shared;
+        return Handle(shared.index.at(data.opcode * Arch::MEMORY_SIZE + (data.address & Arch::ADDRESS_MASK)));
+    } else {
+        if (data.opcode == ADD)
+            return allocate_instruction<BasicIadd<Arch>, Arch>(data.address);
+        if (data.opcode == AND)
+            return allocate_instruction<BasicIand<Arch>, Arch>(data.address);
+        if (data.opcode == ORR)
+            return allocate_instruction<BasicIorr<Arch>, Arch>(data.address);
+        if (data.opcode == XOR)
+            return allocate_instruction<BasicIxor<Arch>, Arch>(data.address);
+        if (data.opcode == LDR)
+            return allocate_instruction<BasicIldr<Arch>, Arch>(data.address);
+        if (data.opcode == STR)
+            return allocate_instruction<BasicIstr<Arch>, Arch>(data.address);
+        if (data.opcode == JMP)
+            return allocate_instruction<BasicIjmp<Arch>, Arch>(data.address);
+        return allocate_instruction<BasicIjne<Arch>, Arch>(data.address);
+    }
 }
 
 // ========== ADD Instruction ==========
-Iadd::Iadd(addr_t address) {
-  _set_address(address);
+template <class Arch>
+BasicIadd<Arch>::BasicIadd(addr_t address) {
+  this->_set_address(address);
 }
 
-void Iadd::_execute(ProcessorState& state) const {
-  state.acc += state.memory.at(get_address());
+template <class Arch>
+void BasicIadd<Arch>::_execute(BasicProcessorState<Arch>& state) const {
+  state.acc += state.cell(this->get_address());
 }
 
-const std::string Iadd::name() const {
+template <class Arch>
+const std::string BasicIadd<Arch>::name() const {
   return "ADD";
 }
 
 // ========== AND Instruction ==========
-Iand::Iand(addr_t address) {
-  _set_address(address);
+template <class Arch>
+BasicIand<Arch>::BasicIand(addr_t address) {
+  this->_set_address(address);
 }
 
-void Iand::_execute(ProcessorState& state) const {
-  state.acc &= state.memory.at(get_address());
+template <class Arch>
+void BasicIand<Arch>::_execute(BasicProcessorState<Arch>& state) const {
+  state.acc &= state.cell(this->get_address());
 }
 
-const std::string Iand::name() const {
+template <class Arch>
+const std::string BasicIand<Arch>::name() const {
   return "AND";
 }
 
 // ========== ORR Instruction ==========
-Iorr::Iorr(addr_t address) {
-  _set_address(address);
+template <class Arch>
+BasicIorr<Arch>::BasicIorr(addr_t address) {
+  this->_set_address(address);
 }
 
-void Iorr::_execute(ProcessorState &state) const
+template <class Arch>
+void BasicIorr<Arch>::_execute(BasicProcessorState<Arch>& state) const
 {
-    state.acc |= state.memory.at(get_address());
+    state.acc |= state.cell(this->get_address());
 }
 
-const std::string Iorr::name() const {
+template <class Arch>
+const std::string BasicIorr<Arch>::name() const {
   return "ORR";
 }
 
 // ========== XOR Instruction ==========
-Ixor::Ixor(addr_t address) {
-  _set_address(address);
+template <class Arch>
+BasicIxor<Arch>::BasicIxor(addr_t address) {
+  this->_set_address(address);
 }
 
 
-void Ixor::_execute(ProcessorState& state) const {
-  state.acc ^= state.memory.at(get_address());
+template <class Arch>
+void BasicIxor<Arch>::_execute(BasicProcessorState<Arch>& state) const {
+  state.acc ^= state.cell(this->get_address());
 }
 
-const std::string Ixor::name() const {
+template <class Arch>
+const std::string BasicIxor<Arch>::name() const {
   return "XOR";
 }
 
 // ========== LDR Instruction ==========
-Ildr::Ildr(addr_t address) {
-  _set_address(address);
+template <class Arch>
+BasicIldr<Arch>::BasicIldr(addr_t address) {
+  this->_set_address(address);
 }
 
-void Ildr::_execute(ProcessorState& state) const {
-  state.acc = state.memory.at(get_address());
+template <class Arch>
+void BasicIldr<Arch>::_execute(BasicProcessorState<Arch>& state) const {
+  state.acc = state.cell(this->get_address());
 }
 
-const std::string Ildr::name() const {
+template <class Arch>
+const std::string BasicIldr<Arch>::name() const {
   return "LDR";
 }
 
 // ========== STR Instruction ==========
-Istr::Istr(addr_t address) {
-  _set_address(address);
+template <class Arch>
+BasicIstr<Arch>::BasicIstr(addr_t address) {
+  this->_set_address(address);
 }
 
-void Istr::_execute(ProcessorState& state) const {
-  state.memory.at(get_address()) = state.acc;
+template <class Arch>
+void BasicIstr<Arch>::_execute(BasicProcessorState<Arch>& state) const {
+  state.store(this->get_address(), state.acc);
 }
 
-const std::string Istr::name() const {
+template <class Arch>
+const std::string BasicIstr<Arch>::name() const {
   return "STR";
 }
 
 // ========== JMP Instruction ==========
-Ijmp::Ijmp(addr_t address) {
-  _set_address(address);
+template <class Arch>
+BasicIjmp<Arch>::BasicIjmp(addr_t address) {
+  this->_set_address(address);
 }
 
-void Ijmp::_execute(ProcessorState& state) const {
+template <class Arch>
+void BasicIjmp<Arch>::_execute(BasicProcessorState<Arch>& state) const {
   // Why minus two? Because execute() will increment PC by two,
   // so to make the PC take (eventually) the value `address`
   // I need to subtract two here. Same applies for JNE below
   // This kind of unintuitive behaviour is a clear sign of bad
   // class hierarchy design 
-  state.pc = get_address() - 2;
+  state.pc = this->get_address() - 2;
 }
 
-const std::string Ijmp::name() const {
+template <class Arch>
+const std::string BasicIjmp<Arch>::name() const {
   return "JMP";
 }
 
 // ========== JNE Instruction ==========
-Ijne::Ijne(addr_t address) {
-  _set_address(address);
+template <class Arch>
+BasicIjne<Arch>::BasicIjne(addr_t address) {
+  this->_set_address(address);
 }
 
-void Ijne::_execute(ProcessorState& state) const {
+template <class Arch>
+void BasicIjne<Arch>::_execute(BasicProcessorState<Arch>& state) const {
   // Same hack as above
   if (state.acc != 0)
-    state.pc = get_address() - 2;
+    state.pc = this->get_address() - 2;
 }
 
-const std::string Ijne::name() const {
+template <class Arch>
+const std::string BasicIjne<Arch>::name() const {
   return "JNE";
 }
 
+// ========== Instantiations ==========
+
+#define INSTANTIATE_INSTRUCTIONS(ARCH) \
+  template class BasicInstructionBase<ARCH>; \
+  template class BasicIadd<ARCH>; \
+  template class BasicIand<ARCH>; \
+  template class BasicIorr<ARCH>; \
+  template class BasicIxor<ARCH>; \
+  template class BasicIldr<ARCH>; \
+  template class BasicIstr<ARCH>; \
+  template class BasicIjmp<ARCH>; \
+  template class BasicIjne<ARCH>;
+
+INSTANTIATE_INSTRUCTIONS(Arch8)
+INSTANTIATE_INSTRUCTIONS(Arch16)
+INSTANTIATE_INSTRUCTIONS(Arch32)
@@ -22,6 +22,7 @@
 #include "common.h"
 #include "iostream"
 #include "memory"
+#include <string_view>
 
 /** 
  * Enum representing the various opcodes.
@@ -38,86 +39,166 @@ enum InstructionOpcode {
   NUM_OPCODES
 };
 
+/**
+ * How InstructionBase::to_string() and the disassembler (disassembler.h)
+ * describe an instruction: its mnemonic, then the text before and after its
+ * address
+ */
+struct InstructionFormat {
+  std::string_view mnemonic;
+  std::string_view prefix;
+  std::string_view suffix;
+};
+
+constexpr InstructionFormat INSTRUCTION_FORMATS[NUM_OPCODES] = {
+  {"ADD", "ADD: ACC <- ACC + [", "]"},
+  {"AND", "AND: ACC <- ACC & [", "]"},
+  {"ORR", "ORR: ACC <- ACC | [", "]"},
+  {"XOR", "XOR: ACC <- ACC ^ [", "]"},
+  {"LDR", "LDR: ACC <- [", "]"},
+  {"STR", "STR: ACC -> [", "]"},
+  {"JMP", "JMP: PC  <- ", ""},
+  {"JNE", "JNE: PC  <- ", " if ACC != 0"},
+};
+
+// Room format_instruction() needs for any instruction and address
+constexpr int INSTRUCTION_TEXT_MAX = 48;
+
+/**
+ * Writes the same text as to_string() into a buffer, without allocating
+ *
+ * @param out Where to write, with room for INSTRUCTION_TEXT_MAX chars
+ * @param opcode A valid opcode
+ * @param address The address of the instruction
+ * @return the end of the text (no '\0' is written)
+ */
+char* format_instruction(char* out, InstructionOpcode opcode, addr_t address);
+
 //------------------------------------------------------------------------------
 //--------------------        INSTRUCTION SUBCLASSES        --------------------
 //------------------------------------------------------------------------------
+// Templates over the architecture like InstructionBase, they are instantiated
+// in instructions.cpp for Arch8, Arch16 and Arch32. Iadd and friends are the
+// 8-bit instructions that Emulator uses. They can't be copied or moved: the
+// instructions generateInstruction() hands out are shared by every caller,
+// and moving from one would change it for all of them
 
 /**
  * Class representing an ADD instruction
  */
-class Iadd : public InstructionBase{
+template <class Arch>
+class BasicIadd : public BasicInstructionBase<Arch> {
   public:
-    Iadd(addr_t address);
-    void _execute(ProcessorState& state) const override;
+    BasicIadd(addr_t address);
+    BasicIadd(const BasicIadd&) = delete;
+    BasicIadd& operator=(const BasicIadd&) = delete;
+    void _execute(BasicProcessorState<Arch>& state) const override;
     const std::string name() const override;
 };
 
+typedef BasicIadd<Arch8> Iadd;
+
 /**
  * Class representing an AND instruction
  */
-class Iand : public InstructionBase{
+template <class Arch>
+class BasicIand : public BasicInstructionBase<Arch> {
   public:
-    Iand(addr_t address);
-    void _execute(ProcessorState& state) const override;
+    BasicIand(addr_t address);
+    BasicIand(const BasicIand&) = delete;
+    BasicIand& operator=(const BasicIand&) = delete;
+    void _execute(BasicProcessorState<Arch>& state) const override;
     const std::string name() const override;
 };
 
+typedef BasicIand<Arch8> Iand;
+
 /**
  * Class representing an ORR instruction
  */
-class Iorr : public InstructionBase{
+template <class Arch>
+class BasicIorr : public BasicInstructionBase<Arch> {
   public:
-    Iorr(addr_t address);
-    void _execute(ProcessorState& state) const override;
+    BasicIorr(addr_t address);
+    BasicIorr(const BasicIorr&) = delete;
+    BasicIorr& operator=(const BasicIorr&) = delete;
+    void _execute(BasicProcessorState<Arch>& state) const override;
     const std::string name() const override;
 };
 
+typedef BasicIorr<Arch8> Iorr;
+
 /**
  * Class representing a XOR instruction
  */
-class Ixor : public InstructionBase{
+template <class Arch>
+class BasicIxor : public BasicInstructionBase<Arch> {
   public:
-    Ixor(addr_t address);
-    void _execute(ProcessorState& state) const override;
+    BasicIxor(addr_t address);
+    BasicIxor(const BasicIxor&) = delete;
+    BasicIxor& operator=(const BasicIxor&) = delete;
+    void _execute(BasicProcessorState<Arch>& state) const override;
     const std::string name() const override;
 };
 
+typedef BasicIxor<Arch8> Ixor;
+
 /**
  * Class representing an LDR instruction
  */
-class Ildr : public InstructionBase{
+template <class Arch>
+class BasicIldr : public BasicInstructionBase<Arch> {
   public:
-    Ildr(addr_t address);
-    void _execute(ProcessorState& state) const override;
+    BasicIldr(addr_t address);
+    BasicIldr(const BasicIldr&) = delete;
+    BasicIldr& operator=(const BasicIldr&) = delete;
+    void _execute(BasicProcessorState<Arch>& state) const override;
     const std::string name() const override;
 };
 
+typedef BasicIldr<Arch8> Ildr;
+
 /**
  * Class representing an STR instruction
  */
-class Istr : public InstructionBase{
+template <class Arch>
+class BasicIstr : public BasicInstructionBase<Arch> {
   public:
-    Istr(addr_t address);
-    void _execute(ProcessorState& state) const override;
+    BasicIstr(addr_t address);
+    BasicIstr(const BasicIstr&) = delete;
+    BasicIstr& operator=(const BasicIstr&) = delete;
+    void _execute(BasicProcessorState<Arch>& state) const override;
     const std::string name() const override;
 };
 
+typedef BasicIstr<Arch8> Istr;
+
 /**
  * Class representing an unconditional JMP
  */
-class Ijmp : public InstructionBase {
-public:
-    Ijmp(addr_t address);
-    void _execute(ProcessorState& state) const override;
+template <class Arch>
+class BasicIjmp : public BasicInstructionBase<Arch> {
+  public:
+    BasicIjmp(addr_t address);
+    BasicIjmp(const BasicIjmp&) = delete;
+    BasicIjmp& operator=(const BasicIjmp&) = delete;
+    void _execute(BasicProcessorState<Arch>& state) const override;
     const std::string name() const override;
 };
 
+typedef BasicIjmp<Arch8> Ijmp;
+
 /**
  * Class representing a conditional JNE
  */
-class Ijne : public InstructionBase{
+template <class Arch>
+class BasicIjne : public BasicInstructionBase<Arch> {
   public:
-    Ijne(addr_t address);
-    void _execute(ProcessorState& state) const override;
+    BasicIjne(addr_t address);
+    BasicIjne(const BasicIjne&) = delete;
+    BasicIjne& operator=(const BasicIjne&) = delete;
+    void _execute(BasicProcessorState<Arch>& state) const override;
     const std::string name() const override;
 };
+
+typedef BasicIjne<Arch8> Ijne;
@@ -0,0 +1,188 @@
+#include "emulator.h"
+#include "journal.h"
+
+// ============= UndoJournal ==============
+
+UndoJournal::UndoJournal(int capacity, int checkpoint_interval)
+  : entries(capacity), checkpoint_interval(checkpoint_interval) {
+
+}
+
+void UndoJournal::record(const JournalEntry& entry, int cycle) {
+  const int capacity = entries.size();
+
+  if (count == capacity) {
+    // Full: the newest entry replaces the oldest one
+    entries.at(oldest) = entry;
+    oldest = (oldest + 1) % capacity;
+  } else {
+    entries.at((oldest + count) % capacity) = entry;
+    ++count;
+  }
+
+  // Keep the newest checkpoint at or before the oldest cycle we can go back
+  // to, and forget the ones before it
+  const int first_cycle = cycle + 1 - count;
+  while (checkpoints.size() > 1 && checkpoints.at(1).cycle <= first_cycle)
+    checkpoints.pop_front();
+}
+
+const JournalEntry& UndoJournal::newest() const {
+  return entries.at((oldest + count - 1) % entries.size());
+}
+
+void UndoJournal::pop_newest() {
+  --count;
+}
+
+int UndoJournal::size() const {
+  return count;
+}
+
+int UndoJournal::checkpoint_due(int cycle) const {
+  return checkpoints.empty() || cycle >= checkpoints.back().cycle + checkpoint_interval;
+}
+
+void UndoJournal::add_checkpoint(int cycle, EmulatorSnapshot snapshot) {
+  checkpoints.push_back({cycle, std::move(snapshot)});
+}
+
+const JournalCheckpoint* UndoJournal::checkpoint_before(int cycle) const {
+  for (auto checkpoint = checkpoints.rbegin(); checkpoint != checkpoints.rend(); ++checkpoint)
+    if (checkpoint->cycle <= cycle)
+      return &*checkpoint;
+  return NULL;
+}
+
+void UndoJournal::drop_checkpoints_after(int cycle) {
+  while (!checkpoints.empty() && checkpoints.back().cycle > cycle)
+    checkpoints.pop_back();
+}
+
+void UndoJournal::clear() {
+  oldest = 0;
+  count = 0;
+  checkpoints.clear();
+}
+
+// ============= Observers ==============
+
+namespace {
+
+/**
+ * Records every instruction into the journal before it executes
+ */
+struct JournalRecorder {
+  static constexpr bool stops_at_breakpoints = true;
+  static constexpr bool detects_loops = false;
+
+  UndoJournal& journal;
+
+  void before_step(Emulator& emulator, byte_t, addr_t address) {
+    const int cycle = emulator.cycles();
+    if (journal.checkpoint_due(cycle))
+      journal.add_checkpoint(cycle, emulator.snapshot());
+
+    journal.record({static_cast<byte_t>(emulator.read_acc()), static_cast<byte_t>(emulator.read_pc()),
+                    static_cast<byte_t>(address), static_cast<byte_t>(emulator.read_mem(address))}, cycle);
+  }
+};
+
+/**
+ * Replays history that is already in the journal, so it records nothing and
+ * doesn't stop at breakpoints
+ */
+struct JournalReplayer {
+  static constexpr bool stops_at_breakpoints = false;
+  static constexpr bool detects_loops = false;
+
+  void before_step(Emulator&, byte_t, addr_t) {}
+};
+
+}
+
+// ============= Emulator ==============
+
+int Emulator::enable_journal(int capacity, int checkpoint_interval) {
+  if (capacity <= 0 || checkpoint_interval <= 0)
+    return 0;
+
+  journal = std::make_unique<UndoJournal>(capacity, checkpoint_interval);
+  return 1;
+}
+
+void Emulator::disable_journal() {
+  journal.reset();
+}
+
+void Emulator::reset_journal() {
+  if (journal != NULL)
+    journal->clear();
+}
+
+int Emulator::journal_oldest_cycle() const {
+  if (journal == NULL)
+    return -1;
+  return total_cycles - journal->size();
+}
+
+int Emulator::run_journaled(int steps) {
+  JournalRecorder recorder{*journal};
+  return run_with(steps, recorder);
+}
+
+void Emulator::undo(const JournalEntry& entry) {
+  // Only a store changes this byte, all other instructions leave it as it was
+  if (state.cell(entry.address) != entry.old_byte) {
+    state.store(entry.address, entry.old_byte);
+    invalidate_decoded(entry.address);
+  }
+
+  state.acc = entry.acc;
+  state.pc = entry.pc;
+  --total_cycles;
+}
+
+int Emulator::reverse_run(int steps) {
+  for (; steps > 0; --steps) {
+    if (journal == NULL || journal->size() == 0)
+      return 0;
+
+    undo(journal->newest());
+    journal->pop_newest();
+    journal->drop_checkpoints_after(total_cycles);
+
+    if (is_breakpoint() == 1)
+      return 1;
+  }
+
+  return 1;
+}
+
+int Emulator::seek(int cycle) {
+  if (journal == NULL || cycle < journal_oldest_cycle() || cycle > total_cycles)
+    return 0;
+
+  // Either undo everything after `cycle`, or start from the closest
+  // checkpoint before it and execute forward, whichever is shorter
+  const int undo_steps = total_cycles - cycle;
+  const JournalCheckpoint* checkpoint = journal->checkpoint_before(cycle);
+
+  if (checkpoint != NULL && cycle - checkpoint->cycle < undo_steps) {
+    restore_processor(checkpoint->snapshot);
+
+    JournalReplayer replayer;
+    run_with(cycle - checkpoint->cycle, replayer);
+
+    for (int step = 0; step < undo_steps; ++step)
+      journal->pop_newest();
+  } else {
+    for (int step = 0; step < undo_steps; ++step) {
+      undo(journal->newest());
+      journal->pop_newest();
+    }
+  }
+
+  journal->drop_checkpoints_after(cycle);
+  return 1;
+}
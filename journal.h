@@ -0,0 +1,112 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: journal.h
+//
+// The undo journal behind Emulator::reverse_run() and Emulator::seek().
+//
+// While the journal is enabled, every executed instruction records what it is
+// about to overwrite: the old acc, the old pc and the old value of the byte at
+// its target address (4 bytes per cycle). Undoing an entry puts these back.
+// Only STR changes the byte, so for every other instruction restoring it is a
+// no-op. Entries live in a ring buffer, so the oldest history is forgotten once
+// the journal is full.
+//
+// Every `checkpoint_interval` cycles the journal also keeps an EmulatorSnapshot
+// (see snapshot.h; they share unchanged pages, so they are cheap). Seeking to
+// a cycle either undoes entries from the current state or restores the
+// closest earlier checkpoint and replays forward from it, whichever is
+// shorter, so it never takes more than about `checkpoint_interval` steps.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "snapshot.h"
+#include <deque>
+#include <vector>
+
+/**
+ * What one instruction overwrote
+ */
+struct JournalEntry {
+  byte_t acc;
+  byte_t pc;
+  byte_t address;
+  byte_t old_byte;
+};
+
+/**
+ * A full state, taken before executing the instruction of cycle `cycle`
+ */
+struct JournalCheckpoint {
+  int cycle;
+  EmulatorSnapshot snapshot;
+};
+
+class UndoJournal {
+  public:
+    /**
+     * @param capacity The maximum number of cycles that can be undone
+     * @param checkpoint_interval The number of cycles between checkpoints
+     */
+    UndoJournal(int capacity, int checkpoint_interval);
+
+    /**
+     * Add an entry for the newest cycle, forgetting the oldest one if the journal is full
+     *
+     * @param entry What the instruction is about to overwrite
+     * @param cycle The number of cycles executed before this instruction
+     */
+    void record(const JournalEntry& entry, int cycle);
+
+    /**
+     * The entry of the newest cycle. The journal must not be empty
+     */
+    const JournalEntry& newest() const;
+
+    /**
+     * Forget the entry of the newest cycle (after undoing it)
+     */
+    void pop_newest();
+
+    /**
+     * The number of cycles that can be undone
+     */
+    int size() const;
+
+    /**
+     * Whether a checkpoint should be taken before executing cycle `cycle`
+     */
+    int checkpoint_due(int cycle) const;
+
+    /**
+     * Keep a checkpoint of the state before executing cycle `cycle`
+     */
+    void add_checkpoint(int cycle, EmulatorSnapshot snapshot);
+
+    /**
+     * The newest checkpoint taken at or before a cycle
+     *
+     * @return a non-owning pointer to the checkpoint, or NULL if there isn't one
+     */
+    const JournalCheckpoint* checkpoint_before(int cycle) const;
+
+    /**
+     * Forget the checkpoints taken after a cycle, because the history after it has been undone
+     */
+    void drop_checkpoints_after(int cycle);
+
+    /**
+     * Forget everything
+     */
+    void clear();
+
+  private:
+    std::vector<JournalEntry> entries;
+
+    // entries[oldest] is the oldest entry, there are `count` of them
+    int oldest{0};
+    int count{0};
+
+    int checkpoint_interval;
+    std::deque<JournalCheckpoint> checkpoints;
+};
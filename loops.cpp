@@ -0,0 +1,39 @@
+#include "loops.h"
+
+// ============= LoopDetector ==============
+
+void LoopDetector::memory_changed() {
+  // Only clear the bits that are set, there are usually just a few
+  for (int idx = 0; idx < num_visits; ++idx)
+    seen.reset(visits[idx].first);
+  num_visits = 0;
+}
+
+void LoopDetector::reset() {
+  memory_changed();
+  found = 0;
+  loop_period = 0;
+}
+
+void LoopDetector::set_looping(int period) {
+  // The loop has no writes, so nothing will reset this before the run ends
+  memory_changed();
+  found = 1;
+  loop_period = period;
+}
+
+int LoopDetector::looping() const {
+  return found;
+}
+
+int LoopDetector::period() const {
+  return loop_period;
+}
+
+int LoopDetector::detecting() const {
+  return enabled;
+}
+
+void LoopDetector::set_enabled(int enabled) {
+  this->enabled = enabled;
+}
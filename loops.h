@@ -0,0 +1,127 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: loops.h
+//
+// Detection of programs that are stuck in an endless loop, so that run() can
+// skip the rest of the loop instead of executing it.
+//
+// After every instruction that moves the PC backwards or keeps it in place
+// (a taken jump back, a jump to itself, or wrapping around the end of
+// memory), the engines record the (pc, acc) pair with the current cycle.
+// Every loop goes through at least one such instruction. Any memory write
+// forgets all recorded pairs. If a pair shows up again before that, memory,
+// acc and pc are all the same as they were, so the machine repeats the same
+// instructions forever with a period equal to the difference of the two cycles.
+// No breakpoint can be on the loop, since we would have stopped at it.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include <array>
+#include <bitset>
+#include <utility>
+
+/**
+ * What Emulator::run() and the other engines return
+ *
+ * Any status other than RUN_ERROR is a normal stop, so the return value can
+ * still be used as a boolean
+ */
+enum RunStatus {
+  // Stopped because of an error (odd PC or invalid instruction)
+  RUN_ERROR = 0,
+
+  // Stopped at a breakpoint or after the maximum number of steps
+  RUN_STOPPED = 1,
+
+  // The machine was found in an endless loop. The cycles were counted as if
+  // all the steps had been executed, and the state is the one after the last step
+  RUN_LOOPING = 2,
+
+  // Stopped after an instruction that triggered a watchpoint or an acc
+  // condition (see watch.h)
+  RUN_WATCH = 3,
+};
+
+class LoopDetector {
+  public:
+    /**
+     * Record the state after an instruction that moved the PC backwards
+     *
+     * @param pc The new PC
+     * @param acc The new acc
+     * @param cycle The number of cycles executed so far
+     * @return the period of the loop if this state was recorded before, 0 otherwise
+     */
+    int visit(addr_t pc, data_t acc, int cycle) {
+      const int key = (pc << ARCH_BITS) | acc;
+
+      if (seen.test(key)) {
+        for (int idx = 0; idx < num_visits; ++idx)
+          if (visits[idx].first == key)
+            return cycle - visits[idx].second;
+      }
+
+      // Past this many distinct states we just stop recording
+      if (num_visits < MAX_VISITS) {
+        seen.set(key);
+        visits[num_visits++] = {key, cycle};
+      }
+      return 0;
+    }
+
+    /**
+     * Forget the recorded states, because memory has changed
+     */
+    void memory_changed();
+
+    /**
+     * Forget everything, at the start of every run
+     */
+    void reset();
+
+    /**
+     * Remember that the rest of this run is a loop that was skipped
+     *
+     * @param period The number of cycles in one period of the loop
+     */
+    void set_looping(int period);
+
+    /**
+     * Whether a loop was found during this run
+     */
+    int looping() const;
+
+    /**
+     * The period of the loop found during this run, 0 if there is none
+     */
+    int period() const;
+
+    /**
+     * Turn detection on or off. While it's off, the engines never call visit()
+     */
+    void set_enabled(int enabled);
+
+    /**
+     * Whether detection is on
+     */
+    int detecting() const;
+
+    /**
+     * Whether the engines should keep recording states: detection is on and
+     * no loop was found yet
+     */
+    int searching() const {
+      return enabled && !found;
+    }
+
+  private:
+    static constexpr int MAX_VISITS = 256;
+
+    std::bitset<(1 << (2 * ARCH_BITS))> seen;
+    std::array<std::pair<int, int>, MAX_VISITS> visits;
+    int num_visits{0};
+    int found{0};
+    int loop_period{0};
+    int enabled{1};
+};
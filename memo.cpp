@@ -0,0 +1,90 @@
+#include "emulator.h"
+#include "memo.h"
+
+namespace {
+
+int same_state(const ProcessorState& first, const ProcessorState& second) {
+  return first.acc == second.acc && first.pc == second.pc && first.memory_hash == second.memory_hash &&
+         first.memory == second.memory;
+}
+
+}
+
+// ============= RunMemo ==============
+
+RunMemo::RunMemo(size_t capacity) : capacity(capacity) {
+
+}
+
+uint64_t RunMemo::key(uint64_t state_hash, int loop_detection, int steps) {
+  return state_hash ^ hash_mix(static_cast<uint64_t>(steps) << 1 | (loop_detection != 0));
+}
+
+const MemoEntry* RunMemo::find(const ProcessorState& state, const std::bitset<MEMORY_SIZE>& breakpoints, int loop_detection, int steps) {
+  auto found = entries.find(key(state.hash(), loop_detection, steps));
+  if (found == entries.end() || found->second.breakpoints != breakpoints || found->second.loop_detection != loop_detection ||
+      !same_state(found->second.start, state)) {
+    ++num_misses;
+    return NULL;
+  }
+
+  ++num_hits;
+  return &found->second;
+}
+
+void RunMemo::insert(int steps, const MemoEntry& entry) {
+  if (entries.size() >= capacity)
+    entries.clear();
+  entries.insert_or_assign(key(entry.start.hash(), entry.loop_detection, steps), entry);
+}
+
+uint64_t RunMemo::hits() const {
+  return num_hits;
+}
+
+uint64_t RunMemo::misses() const {
+  return num_misses;
+}
+
+size_t RunMemo::size() const {
+  return entries.size();
+}
+
+void RunMemo::clear() {
+  entries.clear();
+}
+
+// ============= Emulator ==============
+
+uint64_t Emulator::state_hash() const {
+  return state.hash();
+}
+
+int Emulator::run_memoized(int steps, RunMemo& memo) {
+  if (needs_run_fast(0))
+    return run_fast(steps);
+
+  const int loop_detection = (loops.detecting() != 0);
+  const MemoEntry* entry = memo.find(state, breakpoint_addresses(), loop_detection, steps);
+  if (entry != NULL) {
+    // Same bookkeeping as if the stores of the run had been executed
+    const auto dirty_lines = state.dirty_lines;
+    state = entry->end;
+    state.dirty_lines = dirty_lines;
+    for (addr_t address = 0; address < MEMORY_SIZE; ++address) {
+      if (entry->start.memory[address] != entry->end.memory[address]) {
+        invalidate_decoded(address);
+        state.mark_dirty(address);
+      }
+    }
+
+    total_cycles += entry->cycles;
+    return entry->status;
+  }
+
+  const ProcessorState start = state;
+  const int start_cycles = total_cycles;
+  const int status = run_fast(steps);
+  memo.insert(steps, {start, breakpoint_addresses(), loop_detection, state, total_cycles - start_cycles, status});
+  return status;
+}
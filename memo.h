@@ -0,0 +1,101 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: memo.h
+//
+// Memoization of runs, for state-space exploration that keeps coming back to
+// the same machine states.
+//
+// The machine is deterministic: a run of N steps from a given state (acc, pc,
+// memory) with a given set of breakpoints always ends in the same state,
+// after the same number of cycles, with the same RunStatus.
+// Emulator::run_memoized() looks the run up in a RunMemo, keyed by the O(1)
+// state hash (ProcessorState::hash()), the step count and whether loop
+// detection is on. On a hit, it jumps straight to the recorded end state. On
+// a miss, it runs with run_fast() and records the result. Runs with
+// watchpoints or acc conditions are never memoized: the entries don't record
+// where they would have stopped.
+//
+// Every entry keeps the full start state and breakpoints, and the lookup
+// compares them, so a hash collision only costs a miss and can never give a
+// wrong result.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include <bitset>
+#include <cstddef>
+#include <unordered_map>
+
+/**
+ * One memoized run
+ */
+struct MemoEntry {
+  // Where the run started from
+  ProcessorState start;
+  std::bitset<MEMORY_SIZE> breakpoints;
+  int loop_detection;
+
+  // Where it ended, the number of cycles it counted and what it returned
+  ProcessorState end;
+  int cycles;
+  int status;
+};
+
+class RunMemo {
+  public:
+    /**
+     * @param capacity The maximum number of runs to remember. When it's
+     *                 reached, everything is forgotten and recording starts over
+     */
+    explicit RunMemo(size_t capacity = 1 << 12);
+
+    /**
+     * The recorded run from this state, if there is one
+     *
+     * @param state The state the run starts from
+     * @param breakpoints The addresses with a breakpoint
+     * @param loop_detection Whether loop detection is on
+     * @param steps The step count of the run
+     * @return a non-owning pointer to the entry, valid until the next insert() or clear(), or NULL on a miss
+     */
+    const MemoEntry* find(const ProcessorState& state, const std::bitset<MEMORY_SIZE>& breakpoints, int loop_detection, int steps);
+
+    /**
+     * Record a run, replacing any recorded run with the same key
+     *
+     * @param steps The step count of the run
+     * @param entry The run
+     */
+    void insert(int steps, const MemoEntry& entry);
+
+    /**
+     * Number of find() calls that found / didn't find a run
+     */
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+    /**
+     * The number of runs recorded
+     */
+    size_t size() const;
+
+    /**
+     * Forget all recorded runs (the hit and miss counts stay)
+     */
+    void clear();
+
+  private:
+    static uint64_t key(uint64_t state_hash, int loop_detection, int steps);
+
+    // The state hash is already well mixed
+    struct KeyHash {
+      size_t operator()(uint64_t key) const {
+        return key;
+      }
+    };
+
+    std::unordered_map<uint64_t, MemoEntry, KeyHash> entries;
+    size_t capacity;
+    uint64_t num_hits{0};
+    uint64_t num_misses{0};
+};
@@ -0,0 +1,237 @@
+#include "multicore.h"
+#include "instructions.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+MultiCoreEmulator::MultiCoreEmulator(const Emulator& image, int num_cores)
+  : core_states(std::max(num_cores, 1)) {
+  for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+    memory.memory.at(address) = image.read_mem(address);
+  memory.rehash();
+
+  for (Core& core : core_states) {
+    core.acc = image.read_acc();
+    core.pc = image.read_pc();
+    for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+      if (image.find_breakpoint(address) != NULL)
+        core.breakpoints.set(address);
+  }
+}
+
+int MultiCoreEmulator::set_schedule(SchedulePolicy policy, int quantum) {
+  if (quantum < 1)
+    return 0;
+
+  this->policy = policy;
+  this->quantum = (policy == SCHEDULE_ROUND_ROBIN) ? 1 : quantum;
+  return 1;
+}
+
+// ============= Deterministic runs ==============
+
+int MultiCoreEmulator::step(Core& core) {
+  // Same checks as Emulator::run()
+  if ((core.pc % 2) == 1)
+    return 0;
+
+  InstructionHandle& slot = decoded.at(core.pc / INSTRUCTION_SIZE);
+  if (slot == NULL)
+    slot = InstructionBase::generateInstruction({memory.cell(core.pc), memory.cell(core.pc + 1)});
+  if (slot == NULL)
+    return 0;
+
+  // The instruction runs on the shared memory with this core's registers
+  const int store = (memory.cell(core.pc) == STR);
+  const addr_t address = slot->get_address();
+  memory.acc = core.acc;
+  memory.pc = core.pc;
+  slot->execute(memory);
+  core.acc = memory.acc;
+  core.pc = memory.pc;
+  ++core.cycles;
+  ++num_instructions;
+
+  // Stores into the code drop the stale instruction, which may be this one
+  if (store)
+    decoded.at(address / INSTRUCTION_SIZE).reset();
+  return 1;
+}
+
+int MultiCoreEmulator::run(int steps) {
+  stopped = -1;
+  for (Core& core : core_states)
+    core.failed = 0;
+  if (steps <= 0)
+    return RUN_STOPPED;
+
+  const int num_cores = core_states.size();
+  std::vector<int> left(num_cores, steps);
+  int unfinished = num_cores;
+
+  for (int index = next_core; unfinished > 0; index = (index + 1) % num_cores) {
+    if (left.at(index) == 0)
+      continue;
+
+    Core& core = core_states.at(index);
+    if (index != last_core)
+      ++num_switches;
+    last_core = index;
+
+    const int turn = std::min(quantum, left.at(index));
+    for (int executed = 0; executed < turn; ++executed) {
+      if (!step(core)) {
+        core.failed = 1;
+        stopped = index;
+        next_core = index;
+        return RUN_ERROR;
+      }
+      --left.at(index);
+
+      if (core.breakpoints.test(core.pc)) {
+        stopped = index;
+        next_core = (index + 1) % num_cores;
+        return RUN_STOPPED;
+      }
+    }
+
+    if (left.at(index) == 0)
+      --unfinished;
+    next_core = (index + 1) % num_cores;
+  }
+
+  return RUN_STOPPED;
+}
+
+// ============= Threaded runs ==============
+
+int MultiCoreEmulator::run_threaded(int steps) {
+  stopped = -1;
+  std::array<std::atomic<byte_t>, MEMORY_SIZE> shared;
+  for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+    shared.at(address).store(memory.cell(address), std::memory_order_relaxed);
+
+  auto run_core = [&shared, steps](Core& core) {
+    // Each thread decodes into its own cache, checked against the bytes it
+    // came from since the other cores may rewrite them at any time
+    std::array<InstructionHandle, MAX_INSTRUCTIONS> cache;
+    std::array<InstructionData, MAX_INSTRUCTIONS> cached_bytes{};
+    ProcessorState scratch;
+    core.failed = 0;
+
+    for (int step = 0; step < steps; ++step) {
+      if ((core.pc % 2) == 1) {
+        core.failed = 1;
+        return;
+      }
+
+      const InstructionData bytes = {shared.at(core.pc).load(std::memory_order_relaxed), shared.at(core.pc + 1).load(std::memory_order_relaxed)};
+      const int slot = core.pc / INSTRUCTION_SIZE;
+      InstructionHandle& instr = cache.at(slot);
+      if (instr == NULL || cached_bytes.at(slot).opcode != bytes.opcode || cached_bytes.at(slot).address != bytes.address) {
+        instr = InstructionBase::generateInstruction(bytes);
+        cached_bytes.at(slot) = bytes;
+      }
+      if (instr == NULL) {
+        core.failed = 1;
+        return;
+      }
+
+      // The one byte the instruction can touch goes through the scratch state
+      const addr_t address = instr->get_address();
+      scratch.acc = core.acc;
+      scratch.pc = core.pc;
+      scratch.cell(address) = shared.at(address).load(std::memory_order_relaxed);
+      instr->execute(scratch);
+      if (bytes.opcode == STR)
+        shared.at(address).store(scratch.cell(address), std::memory_order_relaxed);
+
+      core.acc = scratch.acc;
+      core.pc = scratch.pc;
+      ++core.cycles;
+      if (core.breakpoints.test(core.pc))
+        return;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(core_states.size());
+  for (Core& core : core_states)
+    threads.emplace_back(run_core, std::ref(core));
+  for (std::thread& thread : threads)
+    thread.join();
+
+  for (addr_t address = 0; address < MEMORY_SIZE; ++address)
+    memory.cell(address) = shared.at(address).load(std::memory_order_relaxed);
+  memory.rehash();
+  for (InstructionHandle& slot : decoded)
+    slot.reset();
+
+  int normal = 0;
+  for (const Core& core : core_states)
+    normal += !core.failed;
+  return normal;
+}
+
+// ============= Getters and setters ==============
+
+int MultiCoreEmulator::stopped_core() const {
+  return stopped;
+}
+
+int MultiCoreEmulator::failed(int core) const {
+  return core_states.at(core).failed;
+}
+
+int MultiCoreEmulator::cores() const {
+  return core_states.size();
+}
+
+data_t MultiCoreEmulator::read_acc(int core) const {
+  return core_states.at(core).acc;
+}
+
+addr_t MultiCoreEmulator::read_pc(int core) const {
+  return core_states.at(core).pc;
+}
+
+int MultiCoreEmulator::cycles(int core) const {
+  return core_states.at(core).cycles;
+}
+
+int MultiCoreEmulator::set_registers(int core, data_t acc, addr_t pc) {
+  if (core < 0 || core >= cores() || acc < 0 || acc > ARCH_MAXVAL || pc < 0 || pc >= MEMORY_SIZE)
+    return 0;
+
+  core_states.at(core).acc = acc;
+  core_states.at(core).pc = pc;
+  return 1;
+}
+
+int MultiCoreEmulator::insert_breakpoint(int core, addr_t address) {
+  if (core < 0 || core >= cores() || address < 0 || address >= MEMORY_SIZE || core_states.at(core).breakpoints.test(address))
+    return 0;
+
+  core_states.at(core).breakpoints.set(address);
+  return 1;
+}
+
+int MultiCoreEmulator::delete_breakpoint(int core, addr_t address) {
+  if (core < 0 || core >= cores() || address < 0 || address >= MEMORY_SIZE || !core_states.at(core).breakpoints.test(address))
+    return 0;
+
+  core_states.at(core).breakpoints.reset(address);
+  return 1;
+}
+
+byte_t MultiCoreEmulator::read_mem(addr_t address) const {
+  return memory.cell(address);
+}
+
+uint64_t MultiCoreEmulator::switches() const {
+  return num_switches;
+}
+
+uint64_t MultiCoreEmulator::instructions() const {
+  return num_instructions;
+}
@@ -0,0 +1,176 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: multicore.h
+//
+// An emulator for several cores sharing one memory, for modelling small
+// multiprocessor workloads.
+//
+// Every core has its own acc, pc, cycles and breakpoints; memory is shared.
+// run() interleaves the cores deterministically on the calling thread, so
+// the same machine and schedule always give the same result:
+// - SCHEDULE_ROUND_ROBIN runs one instruction of each core in turn
+// - SCHEDULE_QUANTUM runs `quantum` instructions of a core before moving to
+//   the next one
+// Instructions are decoded into InstructionBase objects and executed by
+// their execute() against a ProcessorState that holds the shared memory and
+// the registers of the core being stepped, so they behave exactly as in
+// Emulator::run().
+//
+// run_threaded() runs every core on its own host thread instead, with memory
+// as atomic bytes, for throughput experiments. Each byte access is atomic
+// and nothing more: the interleaving is whatever the host does, so results
+// that depend on it are not reproducible.
+//
+// The cores execute every step, endless loops are not detected. switches()
+// and instructions() count the scheduling work of run(), for measuring what
+// interleaving costs per emulated instruction (see BM_MultiCore in bench.cpp).
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "emulator.h"
+#include <array>
+#include <bitset>
+#include <memory>
+#include <vector>
+
+/**
+ * How run() interleaves the cores
+ */
+enum SchedulePolicy {
+  SCHEDULE_ROUND_ROBIN,
+  SCHEDULE_QUANTUM,
+};
+
+class MultiCoreEmulator {
+  public:
+    /**
+     * Creates the cores, all starting from the same machine
+     *
+     * Every core gets the acc, pc and breakpoints of the image, with 0 cycles,
+     * and the memory of the image becomes the shared memory.
+     *
+     * @param image The initial state, e.g. loaded with Emulator::load_state()
+     * @param num_cores How many cores, at least 1
+     */
+    MultiCoreEmulator(const Emulator& image, int num_cores);
+
+    /**
+     * Choose how run() interleaves the cores (round robin by default)
+     *
+     * @param policy The policy
+     * @param quantum The instructions per turn with SCHEDULE_QUANTUM, at least 1
+     * @return 1 for success, 0 if the quantum is out of range
+     */
+    int set_schedule(SchedulePolicy policy, int quantum = 1);
+
+    /**
+     * Run every core for up to the given number of steps, interleaved by the schedule
+     *
+     * Like Emulator::run(), the whole machine stops as soon as a core fails
+     * (odd PC, invalid opcode) or reaches one of its breakpoints; stopped_core()
+     * tells which. Calling run() again carries on with the schedule from the
+     * next core, so runs whose steps are multiples of the quantum add up to
+     * the same as one longer run.
+     *
+     * @param steps The maximum number of cycles each core executes
+     * @return RUN_STOPPED if every core ran all steps or a core reached a breakpoint, RUN_ERROR if a core failed
+     */
+    int run(int steps);
+
+    /**
+     * Run every core on its own thread for up to the given number of steps
+     *
+     * Each core stops by itself on an error or at one of its breakpoints,
+     * the others carry on.
+     *
+     * @param steps The maximum number of cycles each core executes
+     * @return the number of cores that stopped normally
+     */
+    int run_threaded(int steps);
+
+    /**
+     * The core that ended the last run() early, -1 if every core ran all its steps
+     */
+    int stopped_core() const;
+
+    /**
+     * Whether a core failed in the last run() or run_threaded()
+     */
+    int failed(int core) const;
+
+    // ----------> Cores
+
+    int cores() const;
+    data_t read_acc(int core) const;
+    addr_t read_pc(int core) const;
+    int cycles(int core) const;
+
+    /**
+     * Set the registers of a core, e.g. to start the cores in different places
+     *
+     * @return 1 for success, 0 if the core or a value are out of range
+     */
+    int set_registers(int core, data_t acc, addr_t pc);
+
+    /**
+     * Add / remove a breakpoint of one core
+     *
+     * @return 1 for success, 0 if the core or the address are out of range, or it already is / isn't a breakpoint
+     */
+    int insert_breakpoint(int core, addr_t address);
+    int delete_breakpoint(int core, addr_t address);
+
+    /**
+     * Read a byte of the shared memory
+     */
+    byte_t read_mem(addr_t address) const;
+
+    // ----------> Scheduling statistics
+
+    /**
+     * How many times run() switched from one core to another
+     */
+    uint64_t switches() const;
+
+    /**
+     * How many instructions run() executed over all cores
+     */
+    uint64_t instructions() const;
+
+  private:
+    struct Core {
+      data_t acc = 0;
+      addr_t pc = 0;
+      int cycles = 0;
+      int failed = 0;
+      std::bitset<MEMORY_SIZE> breakpoints;
+    };
+
+    /**
+     * Execute one instruction of a core against the shared memory
+     *
+     * @return 1 for success, 0 on an error
+     */
+    int step(Core& core);
+
+    std::vector<Core> core_states;
+
+    // The shared memory, and the registers of the core being stepped
+    ProcessorState memory;
+
+    // One lazily decoded instruction per instruction slot, shared by the
+    // cores and dropped when a store writes into the slot
+    std::array<InstructionHandle, MAX_INSTRUCTIONS> decoded;
+
+    SchedulePolicy policy{SCHEDULE_ROUND_ROBIN};
+    int quantum{1};
+
+    // Where the schedule goes on, and who ran last
+    int next_core{0};
+    int last_core{-1};
+    int stopped{-1};
+
+    uint64_t num_switches{0};
+    uint64_t num_instructions{0};
+};
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <cstring>
+#include "names.h"
+
+// ============= NameArena ==============
+
+NameArena::NameArena(const NameArena& other) {
+  *this = other;
+}
+
+NameArena& NameArena::operator=(const NameArena& other) {
+  if (this == &other)
+    return *this;
+
+  // The views of other point into its own chunks
+  clear();
+  for (std::string_view name : other.views)
+    intern(name);
+  return *this;
+}
+
+char* NameArena::allocate(size_t size) {
+  while (current_chunk < chunks.size()) {
+    Chunk& chunk = chunks.at(current_chunk);
+    if (chunk.size - chunk_used >= size) {
+      char* storage = chunk.data.get() + chunk_used;
+      chunk_used += size;
+      return storage;
+    }
+    ++current_chunk;
+    chunk_used = 0;
+  }
+
+  const size_t chunk_size = std::max(size, CHUNK_SIZE);
+  chunks.push_back({std::make_unique<char[]>(chunk_size), chunk_size});
+  current_chunk = chunks.size() - 1;
+  chunk_used = size;
+  return chunks.back().data.get();
+}
+
+int NameArena::intern(std::string_view name) {
+  const int found = find(name);
+  if (found >= 0)
+    return found;
+
+  char* storage = allocate(name.size());
+  memcpy(storage, name.data(), name.size());
+
+  const std::string_view stored(storage, name.size());
+  views.push_back(stored);
+  ids.emplace(stored, views.size() - 1);
+  return views.size() - 1;
+}
+
+int NameArena::find(std::string_view name) const {
+  auto found = ids.find(name);
+  if (found == ids.end())
+    return -1;
+  return found->second;
+}
+
+std::string_view NameArena::name(int id) const {
+  return views.at(id);
+}
+
+int NameArena::size() const {
+  return views.size();
+}
+
+void NameArena::clear() {
+  views.clear();
+  ids.clear();
+  current_chunk = 0;
+  chunk_used = 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: names.h
+//
+// Interned names, for looking breakpoints up by name without building a
+// std::string for every call.
+//
+// A NameArena gives every distinct name a small id, in the order the names
+// were first interned. The characters are stored back to back in large
+// chunks, so interning a name costs no allocation of its own most of the
+// time, and looking one up takes a std::string_view, which any string-like
+// argument converts to for free. Names are never removed one by one: an id
+// stays valid, and keeps its name, until the arena is cleared.
+// -----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class NameArena {
+  public:
+    NameArena() = default;
+
+    /**
+     * Copies intern the same names in the same order, so the ids are the same
+     */
+    NameArena(const NameArena& other);
+    NameArena& operator=(const NameArena& other);
+
+    // The chunks move with their characters, so the views stay valid
+    NameArena(NameArena&& other) noexcept = default;
+    NameArena& operator=(NameArena&& other) noexcept = default;
+    ~NameArena() = default;
+
+    /**
+     * The id of a name, interning it if it's new
+     *
+     * @param name The name
+     * @return its id, from 0 to size() - 1
+     */
+    int intern(std::string_view name);
+
+    /**
+     * The id of a name
+     *
+     * @return its id, -1 if it was never interned
+     */
+    int find(std::string_view name) const;
+
+    /**
+     * The name with an id
+     *
+     * @param id An id returned by intern()
+     * @return a view into the arena, valid until the arena is cleared or destroyed
+     */
+    std::string_view name(int id) const;
+
+    /**
+     * The number of interned names
+     */
+    int size() const;
+
+    /**
+     * Forget all names. The chunks are kept for the next names
+     */
+    void clear();
+
+  private:
+    // Names longer than this get a chunk of their own
+    static constexpr size_t CHUNK_SIZE = 4096;
+
+    struct Chunk {
+      std::unique_ptr<char[]> data;
+      size_t size;
+    };
+
+    /**
+     * Room for `size` characters in the chunks, allocating a chunk if they are full
+     */
+    char* allocate(size_t size);
+
+    // The chunks before current_chunk are full, and chunk_used characters of it are taken
+    std::vector<Chunk> chunks;
+    size_t current_chunk{0};
+    size_t chunk_used{0};
+
+    // views.at(id) points into the chunks, and so do the keys of ids
+    std::vector<std::string_view> views;
+    std::unordered_map<std::string_view, int> ids;
+};
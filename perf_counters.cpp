@@ -0,0 +1,198 @@
+#include "perf_counters.h"
+#include "emulator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// ============= Helpers ==============
+
+namespace {
+
+#ifdef __linux__
+
+/**
+ * Open one event counting the calling thread in user space, stopped
+ *
+ * @return the file descriptor, or -1 if the host can't count it
+ */
+int open_event(uint32_t type, uint64_t config) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+uint64_t cache_miss(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+#endif
+
+}
+
+const char* host_event_name(HostEvent event) {
+  static const char* names[NUM_HOST_EVENTS] = {"cycles", "instructions", "branch_misses", "l1d_misses", "l1i_misses"};
+  return names[event];
+}
+
+// ============= HostCounters ==============
+
+HostCounters::HostCounters() {
+  fds.fill(-1);
+#ifdef __linux__
+  fds.at(HOST_CYCLES) = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  fds.at(HOST_INSTRUCTIONS) = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  fds.at(HOST_BRANCH_MISSES) = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+  fds.at(HOST_L1D_MISSES) = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+  fds.at(HOST_L1I_MISSES) = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1I));
+#endif
+}
+
+HostCounters::~HostCounters() {
+#ifdef __linux__
+  for (int fd : fds)
+    if (fd >= 0)
+      ::close(fd);
+#endif
+}
+
+int HostCounters::available(HostEvent event) const {
+  return fds.at(event) >= 0;
+}
+
+int HostCounters::any_available() const {
+  for (int fd : fds)
+    if (fd >= 0)
+      return 1;
+  return 0;
+}
+
+int HostCounters::start() {
+  values.fill(0);
+  if (!any_available())
+    return 0;
+
+#ifdef __linux__
+  for (int fd : fds) {
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+  return 1;
+}
+
+int HostCounters::stop() {
+  if (!any_available())
+    return 0;
+
+#ifdef __linux__
+  for (int fd : fds)
+    if (fd >= 0)
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+  for (int event = 0; event < NUM_HOST_EVENTS; ++event) {
+    if (fds.at(event) < 0)
+      continue;
+
+    // The count, the time enabled and the time it was actually counting
+    uint64_t read_values[3] = {0, 0, 0};
+    if (read(fds.at(event), read_values, sizeof(read_values)) != sizeof(read_values))
+      continue;
+    if (read_values[2] > 0 && read_values[2] < read_values[1])
+      values.at(event) = static_cast<uint64_t>(static_cast<double>(read_values[0]) * read_values[1] / read_values[2]);
+    else
+      values.at(event) = read_values[0];
+  }
+#endif
+  return 1;
+}
+
+uint64_t HostCounters::value(HostEvent event) const {
+  return values.at(event);
+}
+
+// ============= RunMeasurement ==============
+
+double RunMeasurement::per_instruction(HostEvent event) const {
+  if (!host_available.at(event) || cycles <= 0)
+    return -1;
+  return static_cast<double>(host.at(event)) / cycles;
+}
+
+double RunMeasurement::mips() const {
+  if (nanoseconds == 0)
+    return 0;
+  return cycles * 1e3 / nanoseconds;
+}
+
+std::string RunMeasurement::json() const {
+  // One line, fixed keys, so that scripts can pick it apart without a JSON library
+  std::string out = "{\"status\": " + std::to_string(status) + ", \"cycles\": " + std::to_string(cycles) +
+                    ", \"nanoseconds\": " + std::to_string(nanoseconds);
+
+  char number[32];
+  snprintf(number, sizeof(number), "%.3f", mips());
+  out += ", \"mips\": " + std::string(number) + ", \"host\": {";
+  for (int event = 0; event < NUM_HOST_EVENTS; ++event) {
+    out += (event > 0) ? ", \"" : "\"";
+    out += host_event_name(static_cast<HostEvent>(event));
+    out += "\": " + (host_available.at(event) ? std::to_string(host.at(event)) : std::string("null"));
+  }
+
+  const double cpi = per_instruction(HOST_CYCLES);
+  snprintf(number, sizeof(number), "%.3f", cpi);
+  out += "}, \"host_cycles_per_instruction\": " + ((cpi < 0) ? std::string("null") : std::string(number));
+
+  out += ", \"engine\": {\"decodes\": " + std::to_string(engine.decodes) +
+         ", \"allocations\": " + std::to_string(engine.allocations) +
+         ", \"breakpoint_checks\": " + std::to_string(engine.breakpoint_checks) +
+         ", \"cache_hits\": " + std::to_string(engine.cache_hits) + "}}";
+  return out;
+}
+
+// ============= measure_run ==============
+
+RunMeasurement measure_run(Emulator& emulator, int steps, HostCounters& counters, int (Emulator::*engine)(int)) {
+  if (engine == NULL)
+    engine = &Emulator::run;
+
+  RunMeasurement measurement;
+  const EngineCounters before = emulator.engine_counters();
+  const int cycles_before = emulator.cycles();
+
+  counters.start();
+  const auto start = std::chrono::steady_clock::now();
+  measurement.status = (emulator.*engine)(steps);
+  const auto end = std::chrono::steady_clock::now();
+  counters.stop();
+
+  measurement.cycles = emulator.cycles() - cycles_before;
+  measurement.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  for (int event = 0; event < NUM_HOST_EVENTS; ++event) {
+    measurement.host_available.at(event) = counters.available(static_cast<HostEvent>(event));
+    measurement.host.at(event) = counters.value(static_cast<HostEvent>(event));
+  }
+
+  const EngineCounters after = emulator.engine_counters();
+  measurement.engine.decodes = after.decodes - before.decodes;
+  measurement.engine.allocations = after.allocations - before.allocations;
+  measurement.engine.breakpoint_checks = after.breakpoint_checks - before.breakpoint_checks;
+  measurement.engine.cache_hits = after.cache_hits - before.cache_hits;
+  return measurement;
+}
@@ -0,0 +1,169 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: perf_counters.h
+//
+// Instrumentation for finding out where the host time of a run goes.
+//
+// HostCounters counts host hardware events with Linux perf_event_open():
+// cycles, instructions, branch misses and L1 data and instruction cache
+// misses, only in user space and only for the calling thread. Each event is
+// opened on its own, so a host that lacks one (e.g. most virtual machines
+// have no L1 instruction cache events, containers often have no hardware
+// events at all) still counts the others. Events that can't be opened are
+// reported as unavailable rather than as errors, and on other systems none
+// are available.
+//
+// EngineCounters are the emulator's own counts of what run() does besides
+// executing instructions: decodes, allocations of InstructionBase objects,
+// breakpoint checks and decode cache hits. They cost an increment each and
+// are always on.
+//
+// measure_run() wraps a run in both, with its wall clock time, and gives
+// derived figures such as the host cycles per emulated instruction. A
+// RunMeasurement can be written as JSON, and the bench target reports the
+// same figures as benchmark counters (see BM_Counters in bench.cpp).
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include <array>
+#include <cstdint>
+#include <string>
+
+class Emulator;
+
+/**
+ * The host events HostCounters can count
+ */
+enum HostEvent {
+  HOST_CYCLES,
+  HOST_INSTRUCTIONS,
+  HOST_BRANCH_MISSES,
+  HOST_L1D_MISSES,
+  HOST_L1I_MISSES,
+  NUM_HOST_EVENTS
+};
+
+/**
+ * The name of an event, as used in the JSON output: "cycles", "instructions", ...
+ */
+const char* host_event_name(HostEvent event);
+
+class HostCounters {
+  public:
+    /**
+     * Open every event for the calling thread. Events the host doesn't have are left unavailable
+     */
+    HostCounters();
+    ~HostCounters();
+
+    // The counters are file descriptors of the thread that opened them
+    HostCounters(const HostCounters&) = delete;
+    HostCounters& operator=(const HostCounters&) = delete;
+
+    /**
+     * Whether this event is being counted
+     */
+    int available(HostEvent event) const;
+
+    /**
+     * Whether any event is being counted
+     */
+    int any_available() const;
+
+    /**
+     * Zero and start the counters
+     *
+     * @return 1 for success, 0 if no event is available
+     */
+    int start();
+
+    /**
+     * Stop the counters and read them
+     *
+     * @return 1 for success, 0 if no event is available
+     */
+    int stop();
+
+    /**
+     * The count of an event between the last start() and stop(), 0 if it isn't available
+     *
+     * When the kernel had to share the hardware counters between more
+     * events than it has, the count is scaled up to the whole time measured.
+     */
+    uint64_t value(HostEvent event) const;
+
+  private:
+    std::array<int, NUM_HOST_EVENTS> fds;
+    std::array<uint64_t, NUM_HOST_EVENTS> values{};
+};
+
+/**
+ * What run() did besides executing instructions, counted since the emulator was created or reset_engine_counters()
+ */
+struct EngineCounters {
+  // Instructions decoded from memory, i.e. decode cache misses
+  uint64_t decodes = 0;
+
+  // InstructionBase objects allocated by those decodes. The 8-bit instructions are shared, so none
+  uint64_t allocations = 0;
+
+  // Breakpoint lookups after executed instructions
+  uint64_t breakpoint_checks = 0;
+
+  // Decode cache hits
+  uint64_t cache_hits = 0;
+};
+
+/**
+ * One run measured by measure_run()
+ */
+struct RunMeasurement {
+  // A RunStatus, what the engine returned
+  int status = 0;
+
+  // The emulated cycles of the run, counting those of skipped loops
+  int cycles = 0;
+
+  // The wall clock time of the run
+  uint64_t nanoseconds = 0;
+
+  // The host events during the run, and which of them were counted
+  std::array<uint64_t, NUM_HOST_EVENTS> host{};
+  std::array<int, NUM_HOST_EVENTS> host_available{};
+
+  // What the counters of the emulator counted during the run
+  EngineCounters engine;
+
+  /**
+   * Host events per emulated instruction, e.g. host cycles per instruction for HOST_CYCLES
+   *
+   * @return the ratio, or -1 if the event wasn't counted or no instruction was executed
+   */
+  double per_instruction(HostEvent event) const;
+
+  /**
+   * Millions of emulated instructions per second of wall clock time, 0 if the run took no time
+   */
+  double mips() const;
+
+  /**
+   * The measurement as a JSON object, with null for the events that weren't counted
+   */
+  std::string json() const;
+};
+
+/**
+ * Run an emulator with host and engine counters around the run
+ *
+ * The counters only measure the run itself. With loop detection on, the
+ * cycles of skipped loops are counted without being executed, so turn it
+ * off (see Emulator::set_loop_detection()) to measure what an instruction costs.
+ *
+ * @param emulator The emulator to run
+ * @param steps The maximum number of cycles to execute
+ * @param counters The host counters, which must have been opened by the calling thread
+ * @param engine The engine to measure, NULL for run()
+ * @return the measurement
+ */
+RunMeasurement measure_run(Emulator& emulator, int steps, HostCounters& counters, int (Emulator::*engine)(int) = NULL);
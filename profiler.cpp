@@ -0,0 +1,67 @@
+#include <charconv>
+#include <string>
+#include "disassembler.h"
+#include "profiler.h"
+
+// ============= Profiler ==============
+
+uint64_t Profiler::executions(addr_t pc) const {
+  return executed.at(pc & ARCH_BITMASK);
+}
+
+uint64_t Profiler::opcode_count(InstructionOpcode opcode) const {
+  return opcodes.at(opcode);
+}
+
+uint64_t Profiler::branches_taken(addr_t pc) const {
+  return taken.at(pc & ARCH_BITMASK);
+}
+
+uint64_t Profiler::branches_not_taken(addr_t pc) const {
+  return not_taken.at(pc & ARCH_BITMASK);
+}
+
+uint64_t Profiler::memory_reads(addr_t address) const {
+  return reads.at(address & ARCH_BITMASK);
+}
+
+uint64_t Profiler::memory_writes(addr_t address) const {
+  return writes.at(address & ARCH_BITMASK);
+}
+
+uint64_t Profiler::total() const {
+  uint64_t sum = 0;
+  for (uint64_t count : opcodes)
+    sum += count;
+  return sum;
+}
+
+void Profiler::reset() {
+  executed.fill(0);
+  opcodes.fill(0);
+  taken.fill(0);
+  not_taken.fill(0);
+  reads.fill(0);
+  writes.fill(0);
+}
+
+int Profiler::print_annotated(const Emulator& emulator, std::ostream& out) const {
+  // The whole listing is built here and written with a single write, without going through std::cout
+  std::string listing;
+  listing.reserve(MAX_INSTRUCTIONS * (DISASSEMBLY_LINE_MAX + 24));
+
+  // One line per instruction slot, in address order
+  for (addr_t offset = 0; offset < MEMORY_SIZE; offset += INSTRUCTION_SIZE) {
+    char line[24 + DISASSEMBLY_LINE_MAX];
+    char* end = std::to_chars(line, line + 24, executed.at(offset)).ptr;
+    *end++ = '\t';
+    *end++ = '|';
+    *end++ = ' ';
+    end = disassemble_line(end, offset, {emulator.read_mem(offset), emulator.read_mem(offset + 1)});
+    listing.append(line, end);
+  }
+
+  out.write(listing.data(), listing.size());
+  out.flush();
+  return !out.fail();
+}
@@ -0,0 +1,105 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: profiler.h
+//
+// An execution profiler for finding the hot spots of a program.
+//
+// Profiler is an observer for Emulator::run_with(), so profiling is chosen at
+// compile time: a profiled run is `emulator.run_with(steps, profiler)`, and
+// the other engines don't pay anything for it. A profiled run stops and fails
+// exactly where run() would, but endless loops are executed in full.
+//
+// For every executed instruction the profiler counts:
+// - the execution of its address
+// - its opcode
+// - for JNE, whether the branch is taken or not
+// - the memory byte it reads (ADD, AND, ORR, XOR, LDR) or writes (STR)
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "emulator.h"
+#include "instructions.h"
+#include <array>
+#include <iostream>
+
+class Profiler {
+  public:
+    static constexpr bool stops_at_breakpoints = true;
+
+    // Every step is counted, so loops are executed in full
+    static constexpr bool detects_loops = false;
+
+    /**
+     * The Emulator::run_with() hook, called right before each instruction executes
+     */
+    void before_step(Emulator& emulator, byte_t opcode, addr_t address) {
+      const addr_t pc = emulator.read_pc();
+      ++executed.at(pc);
+      ++opcodes.at(opcode);
+
+      switch (opcode) {
+        case STR:
+          ++writes.at(address);
+          break;
+        case JMP:
+          break;
+        case JNE:
+          ++(emulator.is_zero() ? not_taken : taken).at(pc);
+          break;
+        default:
+          ++reads.at(address);
+          break;
+      }
+    }
+
+    /**
+     * How many times the instruction at this address was executed
+     */
+    uint64_t executions(addr_t pc) const;
+
+    /**
+     * How many instructions with this opcode were executed
+     */
+    uint64_t opcode_count(InstructionOpcode opcode) const;
+
+    /**
+     * How many times the JNE at this address jumped to its target / fell through
+     */
+    uint64_t branches_taken(addr_t pc) const;
+    uint64_t branches_not_taken(addr_t pc) const;
+
+    /**
+     * How many times this memory byte was read by an instruction / written by a STR
+     */
+    uint64_t memory_reads(addr_t address) const;
+    uint64_t memory_writes(addr_t address) const;
+
+    /**
+     * The total number of instructions profiled
+     */
+    uint64_t total() const;
+
+    /**
+     * Forget all counts
+     */
+    void reset();
+
+    /**
+     * Prints the program like Emulator::print_program(), with every line
+     * prefixed by the number of times the instruction on it was executed
+     *
+     * @param emulator The emulator whose program to print
+     * @param out Where to print
+     * @return 1 for success, 0 otherwise
+     */
+    int print_annotated(const Emulator& emulator, std::ostream& out = std::cout) const;
+
+  private:
+    std::array<uint64_t, MEMORY_SIZE> executed{};
+    std::array<uint64_t, NUM_OPCODES> opcodes{};
+    std::array<uint64_t, MEMORY_SIZE> taken{};
+    std::array<uint64_t, MEMORY_SIZE> not_taken{};
+    std::array<uint64_t, MEMORY_SIZE> reads{};
+    std::array<uint64_t, MEMORY_SIZE> writes{};
+};
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "runner.h"
+
+// ============= Work queues ==============
+
+namespace {
+
+/**
+ * A queue of job indices owned by one worker
+ *
+ * Jobs are coarse (a file load and a whole run), so a mutex per queue costs
+ * nothing measurable and keeps stealing simple
+ */
+class WorkQueue {
+  public:
+    void push(int job) {
+      std::lock_guard<std::mutex> guard(lock);
+      jobs.push_back(job);
+    }
+
+    // The owner takes jobs in order from the front...
+    int pop() {
+      std::lock_guard<std::mutex> guard(lock);
+      if (jobs.empty())
+        return -1;
+      int job = jobs.front();
+      jobs.pop_front();
+      return job;
+    }
+
+    // ...and thieves take them from the back, away from the owner
+    int steal() {
+      std::lock_guard<std::mutex> guard(lock);
+      if (jobs.empty())
+        return -1;
+      int job = jobs.back();
+      jobs.pop_back();
+      return job;
+    }
+
+  private:
+    std::mutex lock;
+    std::deque<int> jobs;
+};
+
+JobResult run_job(Emulator& emulator, int (Emulator::*engine)(int), const EmulatorJob& job) {
+  JobResult result;
+
+  if (!emulator.load_state(job.state_file))
+    return result;
+
+  for (const std::pair<addr_t, std::string>& breakpoint : job.breakpoints)
+    if (!emulator.insert_breakpoint(breakpoint.first, breakpoint.second))
+      return result;
+
+  result.loaded = 1;
+  result.status = (emulator.*engine)(job.steps);
+  result.acc = emulator.read_acc();
+  result.pc = emulator.read_pc();
+  result.cycles = emulator.cycles();
+  return result;
+}
+
+}
+
+// ============= JobRunner ==============
+
+JobRunner::JobRunner(int num_threads, const Emulator& prototype, int (Emulator::*engine)(int))
+  : num_threads(num_threads), prototype(prototype), engine(engine) {
+  if (this->num_threads <= 0)
+    this->num_threads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+int JobRunner::threads() const {
+  return num_threads;
+}
+
+std::vector<JobResult> JobRunner::run(const std::vector<EmulatorJob>& jobs) const {
+  std::vector<JobResult> results(jobs.size());
+  std::deque<WorkQueue> queues(num_threads);
+
+  for (size_t job = 0; job < jobs.size(); ++job)
+    queues.at(job % num_threads).push(job);
+
+  auto worker = [&](int id) {
+    // Each worker gets its own copy of the prototype
+    Emulator emulator(prototype);
+
+    for (;;) {
+      int job = queues.at(id).pop();
+
+      // Out of work: go around the other queues looking for something to steal
+      for (int victim = 1; job < 0 && victim < num_threads; ++victim)
+        job = queues.at((id + victim) % num_threads).steal();
+
+      // Nobody has anything left. Jobs are only ever added before the workers
+      // start, so there's nothing more to wait for
+      if (job < 0)
+        return;
+
+      results.at(job) = run_job(emulator, engine, jobs.at(job));
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int id = 1; id < num_threads; ++id)
+    workers.emplace_back(worker, id);
+
+  // The calling thread is worker 0
+  worker(0);
+
+  // Joining also makes all the result slots visible to this thread
+  for (std::thread& thread : workers)
+    thread.join();
+
+  return results;
+}
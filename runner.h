@@ -0,0 +1,82 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: runner.h
+//
+// Runs many independent emulator jobs on all cores.
+//
+// Every worker thread owns a copy of a prototype Emulator and a queue of
+// jobs. Jobs are dealt round-robin to the queues up front. Workers take jobs
+// from the front of their own queue and, once it is empty, steal from the back
+// of the other queues, so a few long jobs don't leave the other cores idle.
+//
+// Results go straight into a preallocated buffer with one slot per job. Each
+// slot is written by exactly one worker, so the buffer needs no locking.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "emulator.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * One unit of work: load a state, add some breakpoints, and run it
+ */
+struct EmulatorJob {
+  std::string state_file;
+  int steps = 0;
+
+  /**
+   * Breakpoints added on top of the ones in the state file
+   */
+  std::vector<std::pair<addr_t, std::string>> breakpoints;
+};
+
+/**
+ * The outcome of an EmulatorJob
+ */
+struct JobResult {
+  /**
+   * Whether the state file was loaded and the breakpoints inserted successfully.
+   * The rest of the fields are meaningless if this is 0
+   */
+  int loaded = 0;
+
+  /**
+   * The return value of the run
+   */
+  int status = 0;
+
+  data_t acc = 0;
+  addr_t pc = 0;
+  int cycles = 0;
+};
+
+class JobRunner {
+  public:
+    /**
+     * @param num_threads How many workers to use, 0 means one per hardware thread
+     * @param prototype The emulator every worker starts from (copied with the copy constructor)
+     * @param engine The Emulator method used to run the jobs. Any of the engines with the run() contract works
+     */
+    explicit JobRunner(int num_threads = 0, const Emulator& prototype = Emulator(), int (Emulator::*engine)(int) = &Emulator::run_fast);
+
+    /**
+     * Run all jobs and wait for them to finish
+     *
+     * @param jobs The jobs to run
+     * @return One result per job, in the same order as the jobs
+     */
+    std::vector<JobResult> run(const std::vector<EmulatorJob>& jobs) const;
+
+    /**
+     * The number of worker threads
+     */
+    int threads() const;
+
+  private:
+    int num_threads;
+    Emulator prototype;
+    int (Emulator::*engine)(int);
+};
@@ -0,0 +1,257 @@
+#include "server.h"
+#include <cstring>
+
+// ============= ServerResponse ==============
+
+void ServerResponse::clear() {
+  owned.clear();
+  pieces_list.clear();
+}
+
+size_t ServerResponse::size() const {
+  size_t total = 0;
+  for (const Piece& piece : pieces_list)
+    total += piece.length;
+  return total;
+}
+
+std::vector<std::pair<const byte_t*, size_t>> ServerResponse::pieces() const {
+  std::vector<std::pair<const byte_t*, size_t>> result;
+  result.reserve(pieces_list.size());
+  for (const Piece& piece : pieces_list) {
+    const byte_t* data = (piece.view != NULL) ? piece.view : reinterpret_cast<const byte_t*>(owned.data()) + piece.offset;
+    result.emplace_back(data, piece.length);
+  }
+  return result;
+}
+
+std::string ServerResponse::flatten() const {
+  std::string result;
+  result.reserve(size());
+  for (const auto& [data, length] : pieces())
+    result.append(reinterpret_cast<const char*>(data), length);
+  return result;
+}
+
+size_t ServerResponse::viewed() const {
+  size_t total = 0;
+  for (const Piece& piece : pieces_list)
+    if (piece.view != NULL)
+      total += piece.length;
+  return total;
+}
+
+void ServerResponse::append(const void* data, size_t length) {
+  if (length == 0)
+    return;
+
+  // Consecutive copies are one piece
+  if (!pieces_list.empty() && pieces_list.back().view == NULL)
+    pieces_list.back().length += length;
+  else
+    pieces_list.push_back(Piece{NULL, owned.size(), length, 0});
+  owned.append(static_cast<const char*>(data), length);
+}
+
+void ServerResponse::append_view(const byte_t* data, size_t length, uint32_t session) {
+  pieces_list.push_back(Piece{data, 0, length, session});
+}
+
+void ServerResponse::copy_views(uint32_t session) {
+  for (Piece& piece : pieces_list) {
+    if (piece.view != NULL && piece.session == session) {
+      const size_t offset = owned.size();
+      owned.append(reinterpret_cast<const char*>(piece.view), piece.length);
+      piece.view = NULL;
+      piece.offset = offset;
+    }
+  }
+}
+
+// ============= EmulatorServer ==============
+
+int EmulatorServer::handle(const byte_t* batch, size_t size, ServerResponse& response) {
+  response.clear();
+
+  ServerBatchHeader header;
+  if (size < sizeof(header))
+    return 0;
+  memcpy(&header, batch, sizeof(header));
+  if (header.size != size - sizeof(header))
+    return 0;
+
+  // Check the framing of the whole batch before running any of it
+  size_t offset = sizeof(header);
+  for (uint32_t idx = 0; idx < header.count; ++idx) {
+    ServerCommandHeader command;
+    if (size - offset < sizeof(command))
+      return 0;
+    memcpy(&command, batch + offset, sizeof(command));
+    offset += sizeof(command);
+    if (size - offset < command.length)
+      return 0;
+    offset += command.length;
+  }
+  if (offset != size)
+    return 0;
+
+  // The size of the response is only known at the end
+  ServerBatchHeader reply{0, header.count};
+  response.append(&reply, sizeof(reply));
+
+  offset = sizeof(header);
+  for (uint32_t idx = 0; idx < header.count; ++idx) {
+    ServerCommandHeader command;
+    memcpy(&command, batch + offset, sizeof(command));
+    offset += sizeof(command);
+    execute(command, batch + offset, response);
+    offset += command.length;
+  }
+
+  reply.size = response.size() - sizeof(reply);
+  memcpy(response.owned.data(), &reply, sizeof(reply));
+  return 1;
+}
+
+void EmulatorServer::execute(const ServerCommandHeader& command, const byte_t* payload, ServerResponse& response) {
+  ServerResponseHeader header{};
+  header.op = command.op;
+  header.session = command.session;
+
+  auto fail = [&]() {
+    header.ok = 0;
+    header.length = 0;
+    response.append(&header, sizeof(header));
+  };
+  auto succeed = [&](const void* data, size_t length) {
+    header.ok = 1;
+    header.length = length;
+    response.append(&header, sizeof(header));
+    response.append(data, length);
+  };
+
+  if (command.reserved[0] != 0 || command.reserved[1] != 0 || command.reserved[2] != 0)
+    return fail();
+
+  auto found = session_map.find(command.session);
+  Session* session = (found != session_map.end()) ? found->second.get() : NULL;
+
+  // Reads leave the session as it is, everything else may change what earlier responses refer to
+  if (session != NULL && command.op != SERVER_READ_MEM && command.op != SERVER_READ_STATE && command.op != SERVER_SNAPSHOT)
+    response.copy_views(command.session);
+
+  switch (command.op) {
+    case SERVER_LOAD_TEXT:
+    case SERVER_LOAD_BINARY: {
+      // A failed load leaves a fresh session behind, the same as a failed load_state()
+      if (session == NULL)
+        session = session_map.emplace(command.session, std::make_unique<Session>()).first->second.get();
+      session->snapshots.clear();
+      const int loaded = (command.op == SERVER_LOAD_TEXT)
+                           ? session->emulator.load_state_text(reinterpret_cast<const char*>(payload), command.length)
+                           : session->emulator.load_binary_state_data(payload, command.length);
+      return loaded ? succeed(NULL, 0) : fail();
+    }
+
+    case SERVER_CLOSE:
+      if (session == NULL)
+        return fail();
+      session_map.erase(found);
+      return succeed(NULL, 0);
+
+    default:
+      break;
+  }
+
+  if (session == NULL)
+    return fail();
+  Emulator& emulator = session->emulator;
+
+  switch (command.op) {
+    case SERVER_INSERT_BREAKPOINT: {
+      if (command.length < 2)
+        return fail();
+      const std::string_view name(reinterpret_cast<const char*>(payload + 1), command.length - 1);
+      if (!Emulator::valid_breakpoint_name(name))
+        return fail();
+      return emulator.insert_breakpoint(payload[0], name) ? succeed(NULL, 0) : fail();
+    }
+
+    case SERVER_DELETE_BREAKPOINT:
+      if (command.length != 1)
+        return fail();
+      return emulator.delete_breakpoint(static_cast<addr_t>(payload[0])) ? succeed(NULL, 0) : fail();
+
+    case SERVER_RUN: {
+      int32_t steps;
+      if (command.length != sizeof(steps))
+        return fail();
+      memcpy(&steps, payload, sizeof(steps));
+      if (steps < 0)
+        return fail();
+
+      const int32_t result[2] = {emulator.run(steps), emulator.cycles()};
+      return succeed(result, sizeof(result));
+    }
+
+    case SERVER_READ_MEM: {
+      uint16_t count;
+      if (command.length != 1 + sizeof(count))
+        return fail();
+      memcpy(&count, payload + 1, sizeof(count));
+      if (payload[0] + count > MEMORY_SIZE)
+        return fail();
+
+      header.ok = 1;
+      header.length = count;
+      response.append(&header, sizeof(header));
+      response.append_view(emulator.processor_state().memory.data() + payload[0], count, command.session);
+      return;
+    }
+
+    case SERVER_READ_STATE: {
+      if (command.length != 0)
+        return fail();
+      const ProcessorState& state = emulator.processor_state();
+      const ServerStateView view{emulator.cycles(), static_cast<uint8_t>(state.acc), static_cast<uint8_t>(state.pc),
+                                 static_cast<uint16_t>(emulator.num_breakpoints())};
+
+      header.ok = 1;
+      header.length = sizeof(view) + MEMORY_SIZE;
+      response.append(&header, sizeof(header));
+      response.append(&view, sizeof(view));
+      response.append_view(state.memory.data(), MEMORY_SIZE, command.session);
+      return;
+    }
+
+    case SERVER_SNAPSHOT: {
+      if (command.length != 0)
+        return fail();
+      const uint32_t id = session->snapshots.size();
+      session->snapshots.push_back(emulator.snapshot());
+      return succeed(&id, sizeof(id));
+    }
+
+    case SERVER_RESTORE: {
+      uint32_t id;
+      if (command.length != sizeof(id))
+        return fail();
+      memcpy(&id, payload, sizeof(id));
+      if (id >= session->snapshots.size())
+        return fail();
+      return emulator.restore(session->snapshots.at(id)) ? succeed(NULL, 0) : fail();
+    }
+
+    default:
+      return fail();
+  }
+}
+
+const Emulator* EmulatorServer::session(uint32_t id) const {
+  auto found = session_map.find(id);
+  return (found != session_map.end()) ? &found->second->emulator : NULL;
+}
+
+int EmulatorServer::sessions() const {
+  return session_map.size();
+}
@@ -0,0 +1,209 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: server.h
+//
+// Resident emulator sessions driven by batches of binary commands, for
+// serving high request rates without going through state files.
+//
+// An EmulatorServer keeps one Emulator per session id in memory. A client
+// sends a batch of commands (load a state, set breakpoints, run, read
+// memory, take and restore snapshots...) and gets one response per command
+// back, in the same order. Commands are independent: one that fails gets a
+// failed response and the rest of the batch still runs. The
+// emulator-server executable speaks this protocol over stdin/stdout or a
+// Unix domain socket (see emulator-server.cpp).
+//
+// A batch is laid out as:
+//   1. a ServerBatchHeader (8 bytes)
+//   2. `count` commands, each a ServerCommandHeader (12 bytes) followed by
+//      `length` payload bytes
+// and a response batch the same way, with ServerResponseHeaders. Like binary
+// states, multi-byte fields are in the byte order of the host.
+//
+// Commands and their payloads (-> the response payload):
+//   SERVER_LOAD_TEXT      the contents of a text state file -> nothing
+//   SERVER_LOAD_BINARY    the contents of a binary state file -> nothing
+//   SERVER_INSERT_BREAKPOINT  1 byte address, then the name -> nothing
+//   SERVER_DELETE_BREAKPOINT  1 byte address -> nothing
+//   SERVER_RUN            int32 steps -> int32 RunStatus, int32 cycles so far
+//   SERVER_READ_MEM       1 byte address, uint16 count -> the memory bytes
+//   SERVER_READ_STATE     nothing -> a ServerStateView and all of memory
+//   SERVER_SNAPSHOT       nothing -> uint32 snapshot id
+//   SERVER_RESTORE        uint32 snapshot id -> nothing
+//   SERVER_CLOSE          nothing -> nothing
+// Loading creates the session if it doesn't exist; the other commands fail
+// on unknown sessions.
+//
+// Memory in responses is not copied: a ServerResponse refers to the
+// ProcessorState of the session (see Emulator::processor_state()) and the
+// bytes are gathered straight from it when the response is written. A
+// later command of the same batch that changes the session copies the
+// pending views first, so each response still shows the memory as it was
+// when its command ran.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "emulator.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct ServerBatchHeader {
+  // The bytes of the batch after this header
+  uint32_t size;
+
+  // The number of commands or responses in it
+  uint32_t count;
+};
+
+static_assert(sizeof(ServerBatchHeader) == 8, "ServerBatchHeader must have no padding");
+
+/**
+ * The commands of the protocol
+ */
+enum ServerOp {
+  SERVER_LOAD_TEXT = 1,
+  SERVER_LOAD_BINARY,
+  SERVER_INSERT_BREAKPOINT,
+  SERVER_DELETE_BREAKPOINT,
+  SERVER_RUN,
+  SERVER_READ_MEM,
+  SERVER_READ_STATE,
+  SERVER_SNAPSHOT,
+  SERVER_RESTORE,
+  SERVER_CLOSE,
+};
+
+struct ServerCommandHeader {
+  uint8_t op;
+
+  /**
+   * Must be zero
+   */
+  uint8_t reserved[3];
+  uint32_t session;
+
+  // The payload bytes after this header
+  uint32_t length;
+};
+
+static_assert(sizeof(ServerCommandHeader) == 12, "ServerCommandHeader must have no padding");
+
+struct ServerResponseHeader {
+  // The op of the command this answers
+  uint8_t op;
+
+  // 1 for success, 0 otherwise. Failed commands have no payload
+  uint8_t ok;
+  uint8_t reserved[2];
+  uint32_t session;
+  uint32_t length;
+};
+
+static_assert(sizeof(ServerResponseHeader) == 12, "ServerResponseHeader must have no padding");
+
+/**
+ * The registers part of a SERVER_READ_STATE response, the MEMORY_SIZE memory bytes follow it
+ */
+struct ServerStateView {
+  int32_t cycles;
+  uint8_t acc;
+  uint8_t pc;
+  uint16_t num_breakpoints;
+};
+
+static_assert(sizeof(ServerStateView) == 8, "ServerStateView must have no padding");
+
+/**
+ * A response batch, made of bytes it owns and views of session memory
+ */
+class ServerResponse {
+  public:
+    /**
+     * Forget the last batch
+     */
+    void clear();
+
+    /**
+     * The size of the whole batch, header included
+     */
+    size_t size() const;
+
+    /**
+     * The pieces of the batch in order, for gathering them with writev(). Valid until the server handles another batch
+     */
+    std::vector<std::pair<const byte_t*, size_t>> pieces() const;
+
+    /**
+     * The whole batch copied into one string
+     */
+    std::string flatten() const;
+
+    /**
+     * How many bytes are views rather than copies, for checking that reads aren't copied
+     */
+    size_t viewed() const;
+
+  private:
+    friend class EmulatorServer;
+
+    // A run of `owned` when `view` is NULL, a view of `length` bytes at `view` otherwise
+    struct Piece {
+      const byte_t* view;
+      size_t offset;
+      size_t length;
+      uint32_t session;
+    };
+
+    void append(const void* data, size_t length);
+    void append_view(const byte_t* data, size_t length, uint32_t session);
+
+    /**
+     * Turn the views of a session into copies, before the session changes
+     */
+    void copy_views(uint32_t session);
+
+    std::string owned;
+    std::vector<Piece> pieces_list;
+};
+
+class EmulatorServer {
+  public:
+    /**
+     * Handle one batch of commands
+     *
+     * @param batch The batch, header included
+     * @param size Its size in bytes
+     * @param response Where to put the responses, cleared first
+     * @return 1 for success, 0 if the batch is malformed (then nothing was executed)
+     */
+    int handle(const byte_t* batch, size_t size, ServerResponse& response);
+
+    /**
+     * The emulator of a session, NULL if there is no such session
+     */
+    const Emulator* session(uint32_t id) const;
+
+    /**
+     * The number of open sessions
+     */
+    int sessions() const;
+
+  private:
+    struct Session {
+      Emulator emulator;
+      std::vector<EmulatorSnapshot> snapshots;
+    };
+
+    /**
+     * Execute one command and append its response
+     */
+    void execute(const ServerCommandHeader& command, const byte_t* payload, ServerResponse& response);
+
+    std::unordered_map<uint32_t, std::unique_ptr<Session>> session_map;
+};
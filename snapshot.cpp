@@ -0,0 +1,114 @@
+#include <cstring>
+#include "emulator.h"
+#include "snapshot.h"
+
+// ============= EmulatorSnapshot ==============
+
+int EmulatorSnapshot::valid() const {
+  return breakpoints != NULL;
+}
+
+int EmulatorSnapshot::cycles() const {
+  return total_cycles;
+}
+
+data_t EmulatorSnapshot::read_acc() const {
+  return acc;
+}
+
+addr_t EmulatorSnapshot::read_pc() const {
+  return pc;
+}
+
+addr_t EmulatorSnapshot::read_mem(addr_t address) const {
+  address &= ARCH_BITMASK;
+  return pages.at(address / SNAPSHOT_PAGE_SIZE)->at(address % SNAPSHOT_PAGE_SIZE);
+}
+
+int EmulatorSnapshot::num_breakpoints() const {
+  return breakpoints->size();
+}
+
+int EmulatorSnapshot::shared_pages(const EmulatorSnapshot& other) const {
+  int shared = 0;
+  for (int page = 0; page < SNAPSHOT_PAGES; ++page)
+    shared += (pages.at(page) != NULL && pages.at(page) == other.pages.at(page));
+  return shared;
+}
+
+// ============= Emulator ==============
+
+EmulatorSnapshot Emulator::snapshot() {
+  // Pages that haven't been written since the last snapshot/restore are
+  // still identical to the ones we kept from it
+  for (int page = 0; page < SNAPSHOT_PAGES; ++page) {
+    if (!dirty_pages.test(page) && snapshot_pages.at(page) != NULL)
+      continue;
+
+    auto copy = std::make_shared<SnapshotPage>();
+    memcpy(copy->data(), &state.memory.at(page * SNAPSHOT_PAGE_SIZE), SNAPSHOT_PAGE_SIZE);
+    snapshot_pages.at(page) = std::move(copy);
+  }
+  dirty_pages.reset();
+
+  if (breakpoints_changed || snapshot_breakpoints == NULL) {
+    snapshot_breakpoints = std::make_shared<const std::vector<Breakpoint>>(breakpoints);
+    breakpoints_changed = false;
+  }
+
+  EmulatorSnapshot saved;
+  saved.total_cycles = total_cycles;
+  saved.acc = state.acc;
+  saved.pc = state.pc;
+  saved.memory_hash = state.memory_hash;
+  saved.pages = snapshot_pages;
+  saved.breakpoints = snapshot_breakpoints;
+  return saved;
+}
+
+int Emulator::restore(const EmulatorSnapshot& saved) {
+  if (!saved.valid())
+    return 0;
+
+  restore_processor(saved);
+
+  // Rebuilding the breakpoints also rebuilds their indexes
+  if (breakpoints_changed || snapshot_breakpoints != saved.breakpoints) {
+    clear_breakpoints();
+    for (const Breakpoint& breakpoint : *saved.breakpoints)
+      insert_breakpoint(breakpoint.get_address(), breakpoint.get_name());
+    snapshot_breakpoints = saved.breakpoints;
+    breakpoints_changed = false;
+  }
+
+  // The recorded history doesn't lead to this state
+  reset_journal();
+  return 1;
+}
+
+void Emulator::restore_processor(const EmulatorSnapshot& saved) {
+  for (int page = 0; page < SNAPSHOT_PAGES; ++page) {
+    // Same page as the one we have, and we haven't written to it
+    if (!dirty_pages.test(page) && snapshot_pages.at(page) == saved.pages.at(page))
+      continue;
+
+    // Only the bytes that differ can make decoded code stale, so restarting
+    // a program keeps the blocks of the code it didn't modify
+    const int base = page * SNAPSHOT_PAGE_SIZE;
+    for (int address = base; address < base + SNAPSHOT_PAGE_SIZE; ++address) {
+      if (state.memory.at(address) != saved.pages.at(page)->at(address - base)) {
+        state.memory.at(address) = saved.pages.at(page)->at(address - base);
+        invalidate_decoded(address);
+      }
+    }
+    for (int address = base; address < base + SNAPSHOT_PAGE_SIZE; address += DIRTY_LINE_SIZE)
+      state.mark_dirty(address);
+  }
+  snapshot_pages = saved.pages;
+  dirty_pages.reset();
+
+  total_cycles = saved.total_cycles;
+  state.acc = saved.acc;
+  state.pc = saved.pc;
+  state.memory_hash = saved.memory_hash;
+}
@@ -0,0 +1,75 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: snapshot.h
+//
+// Cheap, immutable snapshots of an Emulator for speculative execution and
+// rollback (Emulator::snapshot() and Emulator::restore()).
+//
+// Memory is split into pages of SNAPSHOT_PAGE_SIZE bytes. A snapshot holds a
+// shared pointer to an immutable copy of each page and to an immutable copy
+// of the breakpoints. The emulator remembers the pages of the last snapshot it
+// took or restored and which of its pages have been written since, so a new
+// snapshot only copies the dirty pages and shares the rest, and the
+// breakpoints are only copied when they have changed. Snapshots taken along a
+// deep search therefore share almost all of their storage.
+//
+// Snapshots are values: copying one only copies the shared pointers, and they
+// can outlive the emulator they were taken from.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include <array>
+#include <memory>
+#include <vector>
+
+class Breakpoint;
+
+/**
+ * The unit of sharing between snapshots
+ */
+constexpr int SNAPSHOT_PAGE_SIZE = 16;
+constexpr int SNAPSHOT_PAGES = MEMORY_SIZE / SNAPSHOT_PAGE_SIZE;
+
+typedef std::array<byte_t, SNAPSHOT_PAGE_SIZE> SnapshotPage;
+
+/**
+ * The saved state of an Emulator, as returned by Emulator::snapshot()
+ */
+class EmulatorSnapshot {
+  public:
+    /**
+     * An empty snapshot. Restoring it fails
+     */
+    EmulatorSnapshot() = default;
+
+    /**
+     * Whether this snapshot holds a state (1) or is empty (0)
+     */
+    int valid() const;
+
+    /**
+     * Getters for the saved state
+     */
+    int cycles() const;
+    data_t read_acc() const;
+    addr_t read_pc() const;
+    addr_t read_mem(addr_t address) const;
+    int num_breakpoints() const;
+
+    /**
+     * The number of memory pages this snapshot shares with another one instead of having its own copy
+     */
+    int shared_pages(const EmulatorSnapshot& other) const;
+
+  private:
+    friend class Emulator;
+
+    int total_cycles = 0;
+    data_t acc = 0;
+    addr_t pc = 0;
+    // ProcessorState::memory_hash of the saved memory, so restoring doesn't rehash
+    uint64_t memory_hash = 0;
+    std::array<std::shared_ptr<const SnapshotPage>, SNAPSHOT_PAGES> pages;
+    std::shared_ptr<const std::vector<Breakpoint>> breakpoints;
+};
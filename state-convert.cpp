@@ -0,0 +1,41 @@
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: state-convert.cpp
+//
+// Converts state files between the text format of load_state() and the binary
+// format of load_binary_state().
+//
+// Usage: state-convert <input> <output>
+//
+// The format of the input is detected from its first bytes and the output is
+// written in the other format.
+// -----------------------------------------------------------------------------
+
+#include "binary_state.h"
+#include "emulator.h"
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <input> <output>" << std::endl;
+    return 1;
+  }
+
+  const std::string input = argv[1];
+  const std::string output = argv[2];
+  const int from_binary = is_binary_state_file(input);
+
+  Emulator emulator;
+  if (!(from_binary ? emulator.load_binary_state(input) : emulator.load_state(input))) {
+    std::cerr << "Could not load " << (from_binary ? "binary" : "text") << " state file " << input << std::endl;
+    return 1;
+  }
+
+  if (!(from_binary ? emulator.save_state(output) : emulator.save_binary_state(output))) {
+    std::cerr << "Could not write " << (from_binary ? "text" : "binary") << " state file " << output << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,39 @@
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: trace-decode.cpp
+//
+// Prints a binary execution trace (see trace.h) as text, one line per cycle.
+//
+// Usage: trace-decode <trace> [output]
+//
+// Compressed and uncompressed traces are both accepted. Without an output
+// file, the text goes to stdout.
+// -----------------------------------------------------------------------------
+
+#include "trace.h"
+#include <fstream>
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv) {
+  if (argc != 2 && argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <trace> [output]" << std::endl;
+    return 1;
+  }
+
+  std::ofstream file;
+  if (argc == 3) {
+    file.open(argv[2]);
+    if (!file) {
+      std::cerr << "Could not create " << argv[2] << std::endl;
+      return 1;
+    }
+  }
+
+  if (!decode_trace(argv[1], argc == 3 ? file : std::cout)) {
+    std::cerr << "Could not decode trace file " << argv[1] << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
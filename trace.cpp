@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include "disassembler.h"
+#include "emulator.h"
+#include "trace.h"
+
+#ifdef EMULATOR_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// ============= TraceRing ==============
+
+TraceRing::TraceRing(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity)
+    size *= 2;
+  records.resize(size);
+  mask = size - 1;
+}
+
+size_t TraceRing::pop(TraceRecord* out, size_t max) {
+  const size_t head = read_index.load(std::memory_order_relaxed);
+  const size_t tail = write_index.load(std::memory_order_acquire);
+  const size_t count = std::min(max, tail - head);
+
+  for (size_t idx = 0; idx < count; ++idx)
+    out[idx] = records[(head + idx) & mask];
+
+  read_index.store(head + count, std::memory_order_release);
+  return count;
+}
+
+int TraceRing::empty() const {
+  return read_index.load(std::memory_order_acquire) == write_index.load(std::memory_order_acquire);
+}
+
+// ============= TraceWriter ==============
+
+namespace {
+
+// Records per write to the file (64 KiB)
+constexpr size_t TRACE_CHUNK = 8192;
+
+}
+
+TraceWriter::TraceWriter(size_t ring_capacity) : ring(ring_capacity) {
+
+}
+
+TraceWriter::~TraceWriter() {
+  close();
+}
+
+int TraceWriter::compression_available() {
+#ifdef EMULATOR_HAVE_ZLIB
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+int TraceWriter::open(const std::string& filename, int start_cycle, int compress) {
+  if (file != NULL || gzfile != NULL)
+    return 0;
+
+  if (compress) {
+#ifdef EMULATOR_HAVE_ZLIB
+    gzfile = gzopen(filename.c_str(), "wb6");
+    if (gzfile == NULL)
+      return 0;
+    gzbuffer(static_cast<gzFile>(gzfile), TRACE_CHUNK * sizeof(TraceRecord));
+#else
+    return 0;
+#endif
+  } else {
+    file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+      return 0;
+  }
+
+  TraceHeader header{};
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof(TraceRecord);
+  header.start_cycle = start_cycle;
+
+  last_cycle = start_cycle;
+  num_records = 0;
+  closing = false;
+  failed = !write(&header, sizeof(header));
+
+  writer = std::thread(&TraceWriter::drain, this);
+  return 1;
+}
+
+int TraceWriter::close() {
+  if (!writer.joinable())
+    return 0;
+
+  // The writer thread empties the ring before it stops
+  closing.store(true, std::memory_order_release);
+  writer.join();
+
+  int success = !failed;
+  if (file != NULL) {
+    success &= fclose(file) == 0;
+    file = NULL;
+  }
+#ifdef EMULATOR_HAVE_ZLIB
+  if (gzfile != NULL) {
+    success &= gzclose(static_cast<gzFile>(gzfile)) == Z_OK;
+    gzfile = NULL;
+  }
+#endif
+  return success;
+}
+
+uint64_t TraceWriter::records() const {
+  return num_records;
+}
+
+void TraceWriter::record(int cycle, addr_t pc, byte_t opcode, byte_t operand, data_t acc) {
+  // Cycles that were executed without the trace attached
+  int delta = cycle - last_cycle;
+  while (delta > UINT16_MAX) {
+    push({UINT16_MAX, 0, 0, 0, 0, TRACE_GAP, 0});
+    delta -= UINT16_MAX;
+  }
+
+  const byte_t flags = (opcode == STR) ? TRACE_WRITE : 0;
+  push({static_cast<uint16_t>(delta), static_cast<byte_t>(pc), opcode, operand, static_cast<byte_t>(acc), flags, 0});
+  last_cycle = cycle;
+}
+
+void TraceWriter::push(const TraceRecord& record) {
+  // A trace with holes is useless, so wait for the writer instead of dropping records
+  while (!ring.push(record))
+    std::this_thread::yield();
+  ++num_records;
+}
+
+void TraceWriter::drain() {
+  std::vector<TraceRecord> chunk(TRACE_CHUNK);
+  size_t used = 0;
+
+  for (;;) {
+    // Read `closing` first: if it is set, everything the emulator pushed is in the ring
+    const bool last = closing.load(std::memory_order_acquire);
+    const size_t popped = ring.pop(chunk.data() + used, chunk.size() - used);
+    used += popped;
+
+    if (used == chunk.size() || (last && popped == 0 && used > 0)) {
+      if (!write(chunk.data(), used * sizeof(TraceRecord)))
+        failed = true;
+      used = 0;
+    }
+
+    if (last && popped == 0 && used == 0)
+      return;
+    if (popped == 0)
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+int TraceWriter::write(const void* data, size_t size) {
+  if (file != NULL)
+    return fwrite(data, 1, size, file) == size;
+#ifdef EMULATOR_HAVE_ZLIB
+  if (gzfile != NULL)
+    return gzwrite(static_cast<gzFile>(gzfile), data, size) == static_cast<int>(size);
+#endif
+  return 0;
+}
+
+// ============= Reading traces ==============
+
+int read_trace(const std::string& filename, TraceHeader& header, std::vector<TraceRecord>& records) {
+  std::vector<char> bytes;
+  char buffer[1 << 16];
+
+  // gzread() also reads files that aren't compressed
+#ifdef EMULATOR_HAVE_ZLIB
+  gzFile file = gzopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return 0;
+  int size;
+  while ((size = gzread(file, buffer, sizeof(buffer))) > 0)
+    bytes.insert(bytes.end(), buffer, buffer + size);
+  const int success = size == 0;
+  gzclose(file);
+#else
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return 0;
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    bytes.insert(bytes.end(), buffer, buffer + size);
+  const int success = !ferror(file);
+  fclose(file);
+#endif
+
+  if (!success || bytes.size() < sizeof(TraceHeader))
+    return 0;
+
+  memcpy(&header, bytes.data(), sizeof(header));
+  if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION ||
+      header.record_size != sizeof(TraceRecord) || (bytes.size() - sizeof(header)) % sizeof(TraceRecord) != 0)
+    return 0;
+
+  records.resize((bytes.size() - sizeof(header)) / sizeof(TraceRecord));
+  memcpy(records.data(), bytes.data() + sizeof(header), records.size() * sizeof(TraceRecord));
+  return 1;
+}
+
+int decode_trace(const std::string& filename, std::ostream& out) {
+  TraceHeader header;
+  std::vector<TraceRecord> records;
+  if (!read_trace(filename, header, records))
+    return 0;
+
+  uint64_t cycle = header.start_cycle;
+  char line[DISASSEMBLY_LINE_MAX + 64];
+  for (const TraceRecord& record : records) {
+    cycle += record.cycle_delta;
+    if (record.flags & TRACE_GAP)
+      continue;
+
+    // "cycle\t" + the print_program() line, without its '\n'
+    char* end = std::to_chars(line, line + 24, cycle).ptr;
+    *end++ = '\t';
+    end = disassemble_line(end, record.pc, {record.opcode, record.operand}) - 1;
+
+    constexpr std::string_view acc = "\tACC = ";
+    end = std::copy(acc.begin(), acc.end(), end);
+    end = std::to_chars(end, end + 4, record.acc).ptr;
+
+    if (record.flags & TRACE_WRITE) {
+      *end++ = '\t';
+      *end++ = '[';
+      end = std::to_chars(end, end + 4, record.operand).ptr;
+      constexpr std::string_view arrow = "] <- ";
+      end = std::copy(arrow.begin(), arrow.end(), end);
+      end = std::to_chars(end, end + 4, record.acc).ptr;
+    }
+    *end++ = '\n';
+    out.write(line, end - line);
+  }
+
+  out.flush();
+  return !out.fail();
+}
+
+// ============= Emulator ==============
+
+namespace {
+
+/**
+ * Reports every instruction to the emulator's TraceSink after it executes
+ */
+struct TraceRecorder {
+  static constexpr bool stops_at_breakpoints = true;
+  static constexpr bool detects_loops = false;
+
+  TraceSink& sink;
+  addr_t pc{0};
+  byte_t opcode{0};
+  byte_t operand{0};
+
+  void before_step(Emulator& emulator, byte_t opcode, addr_t address) {
+    pc = emulator.read_pc();
+    this->opcode = opcode;
+    operand = address;
+  }
+
+  void after_step(Emulator& emulator) {
+    sink.record(emulator.cycles(), pc, opcode, operand, emulator.read_acc());
+  }
+};
+
+}
+
+void Emulator::set_trace(TraceSink* sink) {
+  trace = sink;
+}
+
+int Emulator::run_traced(int steps) {
+  TraceRecorder recorder{*trace};
+  return run_with(steps, recorder);
+}
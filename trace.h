@@ -0,0 +1,220 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: trace.h
+//
+// Binary execution traces, for offline analysis of long runs.
+//
+// While a TraceSink is attached to an Emulator (Emulator::set_trace()), every
+// executed instruction is reported to it. TraceWriter is the sink that saves
+// traces: it encodes every instruction into an 8-byte TraceRecord and pushes
+// it into a lock-free single-producer/single-consumer ring. A background
+// thread drains the ring into the file in large writes, optionally through
+// zlib. The emulator thread only blocks if the ring is full.
+//
+// The file is a TraceHeader followed by the records. Compressed traces are
+// gzip files of the same bytes. decode_trace() (and the trace-decode tool)
+// turns a trace back into text, one print_program()-style line per cycle.
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr char TRACE_MAGIC[4] = {'E', 'M', 'U', 'T'};
+constexpr uint8_t TRACE_VERSION = 1;
+
+// TraceRecord::flags
+constexpr uint8_t TRACE_WRITE = 1;  // The instruction wrote `acc` into memory at `operand`
+constexpr uint8_t TRACE_GAP = 2;    // No instruction, only cycles that passed untraced
+
+/**
+ * What one executed instruction did
+ */
+struct TraceRecord {
+  // Cycles since the previous record (since the start cycle for the first
+  // one). Gaps longer than 65535 cycles are split over TRACE_GAP records
+  uint16_t cycle_delta;
+  byte_t pc;
+  byte_t opcode;
+  byte_t operand;
+  // The accumulator after the instruction
+  byte_t acc;
+  byte_t flags;
+  byte_t reserved;
+};
+
+static_assert(sizeof(TraceRecord) == 8, "trace records are written as they are in memory");
+
+/**
+ * The first bytes of a trace file
+ */
+struct TraceHeader {
+  char magic[4];
+  uint8_t version;
+  uint8_t record_size;
+  uint8_t reserved[2];
+  // The cycle count of the emulator when the trace started
+  uint32_t start_cycle;
+};
+
+static_assert(sizeof(TraceHeader) == 12, "trace headers are written as they are in memory");
+
+/**
+ * Where an Emulator reports the instructions it executes
+ */
+class TraceSink {
+  public:
+    virtual ~TraceSink() = default;
+
+    /**
+     * Called after every traced instruction
+     *
+     * @param cycle The cycle count after the instruction
+     * @param pc The address of the instruction
+     * @param opcode The opcode
+     * @param operand The address in the instruction
+     * @param acc The accumulator after the instruction
+     */
+    virtual void record(int cycle, addr_t pc, byte_t opcode, byte_t operand, data_t acc) = 0;
+};
+
+/**
+ * A fixed-size lock-free ring of trace records, for one producer thread and
+ * one consumer thread
+ */
+class TraceRing {
+  public:
+    /**
+     * @param capacity The number of records, rounded up to a power of two
+     */
+    explicit TraceRing(size_t capacity);
+
+    /**
+     * Producer side: add a record
+     *
+     * @return 1 for success, 0 if the ring is full
+     */
+    int push(const TraceRecord& record) {
+      const size_t tail = write_index.load(std::memory_order_relaxed);
+      if (tail - cached_read_index == records.size()) {
+        cached_read_index = read_index.load(std::memory_order_acquire);
+        if (tail - cached_read_index == records.size())
+          return 0;
+      }
+      records[tail & mask] = record;
+      write_index.store(tail + 1, std::memory_order_release);
+      return 1;
+    }
+
+    /**
+     * Consumer side: take up to `max` records, oldest first
+     *
+     * @return the number of records copied into `out`
+     */
+    size_t pop(TraceRecord* out, size_t max);
+
+    /**
+     * Whether no records are waiting (exact only when the producer is idle)
+     */
+    int empty() const;
+
+  private:
+    std::vector<TraceRecord> records;
+    size_t mask;
+
+    // Each index is written by one side only, and they live on separate cache
+    // lines so the two threads don't keep stealing them from each other
+    alignas(64) std::atomic<size_t> write_index{0};
+    size_t cached_read_index{0};
+    alignas(64) std::atomic<size_t> read_index{0};
+};
+
+/**
+ * A TraceSink that saves the trace into a file from a background thread
+ */
+class TraceWriter : public TraceSink {
+  public:
+    /**
+     * @param ring_capacity The number of records the ring holds
+     */
+    explicit TraceWriter(size_t ring_capacity = 1 << 16);
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    /**
+     * Closes the file, if it's still open
+     */
+    ~TraceWriter() override;
+
+    /**
+     * Starts a new trace file and the thread that writes it
+     *
+     * @param filename The trace file
+     * @param start_cycle The cycle count of the emulator right now
+     * @param compress 1 to write a gzip-compressed trace
+     * @return 1 for success, 0 if the file can't be created, a trace is already open, or compression isn't available
+     */
+    int open(const std::string& filename, int start_cycle, int compress = 0);
+
+    /**
+     * Writes everything still in the ring and closes the file
+     *
+     * @return 1 if the whole trace was written successfully, 0 otherwise
+     */
+    int close();
+
+    /**
+     * The number of records written to the ring so far
+     */
+    uint64_t records() const;
+
+    void record(int cycle, addr_t pc, byte_t opcode, byte_t operand, data_t acc) override;
+
+    /**
+     * Whether compressed traces can be written (built with zlib)
+     */
+    static int compression_available();
+
+  private:
+    void push(const TraceRecord& record);
+    void drain();
+    int write(const void* data, size_t size);
+
+    TraceRing ring;
+    std::thread writer;
+    std::atomic<bool> closing{false};
+    std::atomic<bool> failed{false};
+
+    FILE* file{NULL};
+    void* gzfile{NULL};
+
+    int last_cycle{0};
+    uint64_t num_records{0};
+};
+
+/**
+ * Reads a trace file, compressed or not
+ *
+ * @param filename The trace file
+ * @param header Where to put the header
+ * @param records Where to put the records
+ * @return 1 for success, 0 if the file can't be read or isn't a trace
+ */
+int read_trace(const std::string& filename, TraceHeader& header, std::vector<TraceRecord>& records);
+
+/**
+ * Writes a trace as text, one line per traced cycle:
+ * `cycle` `pc:` `opcode` `operand` `:` `instruction` `ACC = acc`, plus `[operand] <- acc` for stores.
+ * The middle part is the same as the print_program() line for the instruction
+ *
+ * @param filename The trace file
+ * @param out Where to write the text
+ * @return 1 for success, 0 if the file can't be read or isn't a trace
+ */
+int decode_trace(const std::string& filename, std::ostream& out);
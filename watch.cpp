@@ -0,0 +1,103 @@
+#include "emulator.h"
+#include "watch.h"
+
+// ============= WatchList ==============
+
+namespace {
+
+constexpr int MEMORY_KINDS = WATCH_READ | WATCH_WRITE | WATCH_CHANGE | WATCH_VALUE;
+
+}
+
+int WatchList::insert(addr_t address, int kinds, data_t value) {
+  if (address < 0 || address >= MEMORY_SIZE || kinds <= 0 || (kinds & ~MEMORY_KINDS) != 0)
+    return 0;
+  if (value < 0 || value > ARCH_MAXVAL)
+    return 0;
+
+  addresses.set(address);
+  watch_kinds.at(address) = kinds;
+  watch_values.at(address) = value;
+  update_active();
+  return 1;
+}
+
+int WatchList::remove(addr_t address) {
+  if (address < 0 || address >= MEMORY_SIZE || !addresses.test(address))
+    return 0;
+
+  addresses.reset(address);
+  watch_kinds.at(address) = 0;
+  watch_values.at(address) = 0;
+  update_active();
+  return 1;
+}
+
+int WatchList::kinds(addr_t address) const {
+  if (address < 0 || address >= MEMORY_SIZE)
+    return 0;
+  return watch_kinds.at(address);
+}
+
+int WatchList::size() const {
+  return addresses.count();
+}
+
+int WatchList::insert_acc_condition(AccCondition condition, data_t value) {
+  if (value < 0 || value > ARCH_MAXVAL)
+    return 0;
+
+  std::bitset<ARCH_MAXVAL + 1> matching;
+  for (data_t acc = 0; acc <= ARCH_MAXVAL; ++acc) {
+    switch (condition) {
+      case ACC_EQUAL: matching[acc] = (acc == value); break;
+      case ACC_NOT_EQUAL: matching[acc] = (acc != value); break;
+      case ACC_LESS: matching[acc] = (acc < value); break;
+      case ACC_GREATER: matching[acc] = (acc > value); break;
+      default: return 0;
+    }
+  }
+
+  // e.g. ACC_LESS 0, which would never stop the run
+  if (matching.none())
+    return 0;
+
+  acc_values |= matching;
+  update_active();
+  return 1;
+}
+
+void WatchList::clear_acc_conditions() {
+  acc_values.reset();
+  update_active();
+}
+
+void WatchList::update_active() {
+  any_active = addresses.any() || acc_values.any();
+}
+
+// ============= Emulator ==============
+
+int Emulator::insert_watchpoint(addr_t address, int kinds, data_t value) {
+  return watches.insert(address, kinds, value);
+}
+
+int Emulator::delete_watchpoint(addr_t address) {
+  return watches.remove(address);
+}
+
+int Emulator::num_watchpoints() const {
+  return watches.size();
+}
+
+int Emulator::insert_acc_condition(AccCondition condition, data_t value) {
+  return watches.insert_acc_condition(condition, value);
+}
+
+void Emulator::clear_acc_conditions() {
+  watches.clear_acc_conditions();
+}
+
+const WatchHit& Emulator::watch_hit() const {
+  return last_watch_hit;
+}
@@ -0,0 +1,169 @@
+#pragma once
+// -----------------------------------------------------------------------------
+// Project: 8-bit accumulator-based emulator
+// File: watch.h
+//
+// Watchpoints on memory and conditions on the accumulator, checked by the
+// run loops themselves (Emulator::insert_watchpoint() and
+// Emulator::insert_acc_condition()).
+//
+// A watchpoint stops a run after an instruction that reads or writes a
+// watched byte. An acc condition stops it after an instruction that sets the
+// accumulator to a matching value. Both end the run with RUN_WATCH, with the
+// instruction executed and counted, the same way breakpoints stop after the
+// instruction that reaches them.
+//
+// The checks are cheap enough to do on every step:
+// - only ADD, AND, ORR, XOR, LDR and STR touch memory, and only at their
+//   operand, so the operand is looked up in a bitmap of the watched addresses
+// - only ADD, AND, ORR, XOR and LDR set the accumulator, and every condition
+//   is compiled into a bitmap of the matching acc values, so one lookup
+//   checks all of them
+// - without any watchpoint or condition the engines run their unwatched
+//   loop, so the checks cost nothing
+// -----------------------------------------------------------------------------
+
+#include "common.h"
+#include "instructions.h"
+#include <array>
+#include <bitset>
+
+/**
+ * What a watchpoint watches for, combined with |
+ */
+enum WatchKind {
+  // An ADD, AND, ORR, XOR or LDR reads the byte
+  WATCH_READ = 1,
+
+  // A STR writes the byte, whether its value changes or not
+  WATCH_WRITE = 2,
+
+  // A STR writes a different value into the byte
+  WATCH_CHANGE = 4,
+
+  // A STR leaves the watched value in the byte
+  WATCH_VALUE = 8,
+
+  // Not a watchpoint kind: what WatchHit::kinds holds when an acc condition stopped the run
+  WATCH_ACC = 16,
+};
+
+/**
+ * How an acc condition compares the accumulator with its value
+ */
+enum AccCondition {
+  ACC_EQUAL,
+  ACC_NOT_EQUAL,
+  ACC_LESS,
+  ACC_GREATER,
+};
+
+/**
+ * What stopped the last run that returned RUN_WATCH
+ */
+struct WatchHit {
+  // The WatchKinds that matched, 0 if no run stopped at a watchpoint yet
+  int kinds;
+
+  // The operand of the instruction (the watched address for memory watchpoints)
+  addr_t address;
+
+  // The address of the instruction
+  addr_t pc;
+};
+
+/**
+ * The watchpoints and acc conditions of an Emulator
+ */
+class WatchList {
+  public:
+    /**
+     * Watch a memory byte, replacing any watchpoint already on it
+     *
+     * @param address The address to watch
+     * @param kinds The WatchKinds to stop at (not WATCH_ACC)
+     * @param value The value for WATCH_VALUE
+     * @return 1 for success, 0 if the address, the kinds or the value are invalid
+     */
+    int insert(addr_t address, int kinds, data_t value);
+
+    /**
+     * Stop watching a memory byte
+     *
+     * @return 1 if a watchpoint was removed, 0 if there was none on the address
+     */
+    int remove(addr_t address);
+
+    /**
+     * The WatchKinds watched at an address, 0 if there is no watchpoint
+     */
+    int kinds(addr_t address) const;
+
+    /**
+     * The number of watched addresses
+     */
+    int size() const;
+
+    /**
+     * Add a condition on the accumulator. Conditions are combined with OR
+     *
+     * @param condition How to compare
+     * @param value What to compare the accumulator with
+     * @return 1 for success, 0 if the condition or value are invalid, or no acc value can match it
+     */
+    int insert_acc_condition(AccCondition condition, data_t value);
+
+    /**
+     * Remove all acc conditions
+     */
+    void clear_acc_conditions();
+
+    /**
+     * Whether there is any watchpoint or acc condition
+     */
+    int active() const {
+      return any_active;
+    }
+
+    /**
+     * Check an instruction that just executed
+     *
+     * @param opcode The opcode of the instruction
+     * @param address Its operand
+     * @param old The byte at `address` before it executed
+     * @param now The byte at `address` after it executed
+     * @param acc The accumulator after it executed
+     * @return the WatchKinds that matched, 0 if the run should go on
+     */
+    int check(byte_t opcode, addr_t address, byte_t old, byte_t now, data_t acc) const {
+      // JMP and JNE don't touch memory or the accumulator
+      if (opcode >= JMP)
+        return 0;
+
+      int hit = 0;
+      if (addresses.test(address)) {
+        const int watched = watch_kinds[address];
+        if (opcode != STR)
+          hit = watched & WATCH_READ;
+        else
+          hit = (watched & WATCH_WRITE) | ((old != now) ? (watched & WATCH_CHANGE) : 0) |
+                ((now == watch_values[address]) ? (watched & WATCH_VALUE) : 0);
+      }
+
+      if (opcode != STR && acc_values.test(acc))
+        hit |= WATCH_ACC;
+      return hit;
+    }
+
+  private:
+    void update_active();
+
+    std::bitset<MEMORY_SIZE> addresses;
+    std::array<uint8_t, MEMORY_SIZE> watch_kinds{};
+    std::array<byte_t, MEMORY_SIZE> watch_values{};
+
+    // acc_values.test(acc) is set if any condition matches acc
+    std::bitset<ARCH_MAXVAL + 1> acc_values;
+
+    int any_active{0};
+};